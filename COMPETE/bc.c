@@ -1,4 +1,8 @@
 #include "bc.h"
+#include <sys/resource.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 
 void *ALLOC(size_t size) {
@@ -10,15 +14,132 @@ void *ALLOC(size_t size) {
 
   return foo;
 }
-  
+
+
+static BOOL huge_pages = FALSE;
+static size_t mapped_table_bytes = 0;  // in the tables' own mappings, which the heap statistics don't see
+
+void enable_huge_pages() {
+  huge_pages = TRUE;
+}
+
+
+// the TABLE_ALIGNMENT bytes before each table of alloc_table() start with this
+typedef struct {
+  size_t mapping_length;  // of the table's own mapping, 0 for tables from the heap
+} table_header_struct;
+
+
+void *alloc_table(size_t size) {
+  size_t length, page = sysconf(_SC_PAGESIZE), slack = 0;
+  char *base, *aligned;
+  void *heap;
+
+  if (size + TABLE_ALIGNMENT < TABLE_MAP_THRESHOLD) {
+    if (posix_memalign(&heap, TABLE_ALIGNMENT, TABLE_ALIGNMENT + size) != 0) {
+      fprintf(stderr, "Error allocating memory.  Exiting.\n");
+      exit(1);
+    }
+    ((table_header_struct *)heap)->mapping_length = 0;
+    return (char *)heap + TABLE_ALIGNMENT;
+  }
+
+  // over-map by a huge page, and unmap what lies either side of the aligned part
+  if (huge_pages && size >= HUGE_PAGE_SIZE) page = slack = HUGE_PAGE_SIZE;
+  length = (TABLE_ALIGNMENT + size + page - 1) / page * page;
+  base = mmap(NULL, length + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Error allocating memory.  Exiting.\n");
+    exit(1);
+  }
+  aligned = base;
+  if (slack > 0) {
+    aligned = base + (HUGE_PAGE_SIZE - (size_t)base % HUGE_PAGE_SIZE) % HUGE_PAGE_SIZE;
+    if (aligned > base) munmap(base, aligned - base);
+    if (aligned + length < base + length + slack) munmap(aligned + length, base + length + slack - (aligned + length));
+#ifdef MADV_HUGEPAGE
+    madvise(aligned, length, MADV_HUGEPAGE);
+#endif
+  }
+
+  // the header only touches the table's first page
+  ((table_header_struct *)aligned)->mapping_length = length;
+  __sync_fetch_and_add(&mapped_table_bytes, length);
+  return aligned + TABLE_ALIGNMENT;
+}
+
+
+void free_table(void *table) {
+  table_header_struct *header;
+
+  if (!table) return;
+  header = (table_header_struct *)((char *)table - TABLE_ALIGNMENT);
+  if (header->mapping_length == 0) free(header);
+  else {
+    __sync_fetch_and_sub(&mapped_table_bytes, header->mapping_length);
+    munmap(header, header->mapping_length);
+  }
+}
+
+
+void *reserve_scratch_table(scratch_table_struct *scratch, size_t size) {
+  if (size > scratch->size) {
+    free_table(scratch->data);
+    scratch->data = alloc_table(size);
+    scratch->size = size;
+  }
+  return scratch->data;
+}
+
+
+void free_scratch_table(scratch_table_struct *scratch) {
+  free_table(scratch->data);
+  scratch->data = NULL;
+  scratch->size = 0;
+}
+
 // these functions will be helpful if I ever change how the matrices are constructed..
 // from and to are given in state number
+// edge lists are sorted by state, so this is a binary search
+edge_struct *find_edge(edge_struct *edges, int n_edges, int state) {
+  int lo = 0, hi = n_edges - 1;
+
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (edges[mid].state == state) return edges + mid;
+    if (edges[mid].state < state) lo = mid + 1;
+    else hi = mid - 1;
+  }
+
+  return NULL;
+}
+
 PROBABILITY fetch_transition_prob(model_def_struct *model_def, int from, int to) {
-  return model_def->transition_matrix[from * model_def->n_states + to];
+  edge_struct *edge;
+
+  if (model_def->transition_matrix) return model_def->transition_matrix[(unsigned long)from * model_def->n_states + to];
+
+  edge = find_edge(model_def->child_edges[from], model_def->n_children[from], to);
+  return edge ? edge->prob : 0.0;
 }
 
 void set_transition_prob(model_def_struct *model_def, int from, int to, PROBABILITY p) {
-  model_def->transition_matrix[from * model_def->n_states + to] = p;
+  edge_struct *edge = NULL;
+
+  if (model_def->transition_matrix) model_def->transition_matrix[(unsigned long)from * model_def->n_states + to] = p;
+
+  if (model_def->child_edges) {
+    if (edge = find_edge(model_def->child_edges[from], model_def->n_children[from], to)) {
+      edge->prob = p;
+      find_edge(model_def->parent_edges[to], model_def->n_parents[to], from)->prob = p;
+    } else if (p != 0.0) {
+      if (!model_def->transition_matrix) {
+        fprintf(stderr, "Cannot add transition %d -> %d once the model is finalized.\n", from, to);
+        exit(1);
+      }
+      model_def->edges_stale = TRUE;
+    }
+  }
 }
 
 // state is given in state number, chr is given in character number
@@ -27,88 +148,732 @@ PROBABILITY fetch_emission_prob(model_def_struct *model_def, int state, int chr)
   return model_def->emission_matrix[state * model_def->alphabet_length + chr];
 }
 
+char fetch_symbol(sequence_struct *sequence, long pos) {
+  if (sequence->seq) return sequence->seq[pos];
+
+  pos += sequence->packed_offset;
+  return (sequence->packed[pos >> 2] >> (2 * (pos & 3))) & 3;
+}
+
+void sequence_view(sequence_struct *sequence, long from, long len, sequence_struct *view) {
+  *view = *sequence;
+  if (view->seq) view->seq += from;
+  else view->packed_offset += from;
+  view->len = len;
+  view->mapping = NULL;  // still owned by sequence
+  view->view_offset += from;
+}
+
+static unsigned long scaling_ids = 0;
+
+static pthread_key_t scaling_cursor_key;
+static pthread_once_t scaling_cursor_once = PTHREAD_ONCE_INIT;
+
+static void free_thread_scaling_cursor(void *cursor) {
+  free_scaling_cursor(cursor);
+  free(cursor);
+}
+
+static void create_scaling_cursor_key(void) {
+  pthread_key_create(&scaling_cursor_key, free_thread_scaling_cursor);
+}
+
+const PROBABILITY *position_scaling(sequence_struct *sequence, long pos) {
+  scaling_cursor_struct *cursor;
+  long end;
+
+  if (!sequence->scaling) return NULL;
+
+  pos += sequence->view_offset;
+  if (pos < 0 || pos >= sequence->scaling->len) return NULL;
+
+  pthread_once(&scaling_cursor_once, create_scaling_cursor_key);
+  if (!(cursor = pthread_getspecific(scaling_cursor_key))) {
+    cursor = ALLOC(sizeof(scaling_cursor_struct));
+    init_scaling_cursor(cursor);
+    pthread_setspecific(scaling_cursor_key, cursor);
+  }
+  return seek_scaling_cursor(cursor, sequence->scaling, pos, &end);
+}
+
+void init_scaling_cursor(scaling_cursor_struct *cursor) {
+  memset(cursor, 0, sizeof(scaling_cursor_struct));
+}
+
+void free_scaling_cursor(scaling_cursor_struct *cursor) {
+  free(cursor->factors);
+  free(cursor->run);
+  free(cursor->run_begin);
+  init_scaling_cursor(cursor);
+}
+
+// run of a SCALING_RUNS column holding position x of the column, and in begin its first position
+static long long find_scaling_run(scaling_column_struct *column, long long x, long long *begin) {
+  long long lo = 0, hi = (column->n_values - 1) / SCALING_INDEX_STRIDE, r;
+
+  while (lo < hi) {
+    long long mid = (lo + hi + 1) / 2;
+    if (column->run_index[mid] <= x) lo = mid;
+    else hi = mid - 1;
+  }
+
+  r = lo * SCALING_INDEX_STRIDE;
+  *begin = column->run_index[lo];
+  while (r + 1 < column->n_values && *begin + column->lengths[r] <= x) *begin += column->lengths[r++];
+  return r;
+}
+
+const PROBABILITY *seek_scaling_cursor(scaling_cursor_struct *cursor, position_scaling_struct *scaling, long pos, long *end) {
+  long long x = pos + scaling->offset, to = scaling->offset + scaling->len, next = to, from = scaling->offset;
+  BOOL same = cursor->id == scaling->id;
+  int i, steps;
+
+  if (same && pos >= cursor->begin && pos < cursor->end) {
+    *end = cursor->end;
+    return cursor->unit ? NULL : cursor->factors;
+  }
+
+  if (!same) {
+    if (cursor->capacity < scaling->n_columns) {
+      cursor->capacity = scaling->n_columns;
+      free(cursor->factors);
+      free(cursor->run);
+      free(cursor->run_begin);
+      cursor->factors = ALLOC(sizeof(PROBABILITY) * cursor->capacity);
+      cursor->run = ALLOC(sizeof(long long) * cursor->capacity);
+      cursor->run_begin = ALLOC(sizeof(long long) * cursor->capacity);
+    }
+    cursor->id = scaling->id;
+  }
+
+  cursor->unit = TRUE;
+  for (i = 0; i < scaling->n_columns; i++) {
+    scaling_column_struct *column = scaling->columns[i];
+    float value;
+
+    if (column->encoding == SCALING_DENSE) {
+      value = column->values[x];
+      from = x;
+      next = x + 1;
+    } else {
+      long long r = cursor->run[i], begin = cursor->run_begin[i];
+      // a pass moves a run or two at a time; anything further is a search
+      for (steps = 0; same && steps < SCALING_INDEX_STRIDE && x >= begin + column->lengths[r] && r + 1 < column->n_values; steps++) begin += column->lengths[r++];
+      for (; same && steps < SCALING_INDEX_STRIDE && x < begin && r > 0; steps++) begin -= column->lengths[--r];
+      if (!same || x < begin || x >= begin + column->lengths[r]) r = find_scaling_run(column, x, &begin);
+      cursor->run[i] = r;
+      cursor->run_begin[i] = begin;
+      value = column->values[r];
+      if (begin > from) from = begin;
+      if (begin + column->lengths[r] < next) next = begin + column->lengths[r];
+    }
+
+    cursor->factors[i] = value;
+    if (value != 1.0) cursor->unit = FALSE;
+  }
+
+  cursor->begin = from - scaling->offset;
+  cursor->end = (next < to ? next : to) - scaling->offset;
+  *end = cursor->end;
+  return cursor->unit ? NULL : cursor->factors;
+}
+
+// fills in the run_index of a SCALING_RUNS column
+static void index_scaling_column(scaling_column_struct *column) {
+  long long r, begin = 0;
+
+  if (column->encoding != SCALING_RUNS) return;
+  column->run_index = ALLOC(sizeof(long long) * (column->n_values / SCALING_INDEX_STRIDE + 1));
+  column->run_index[0] = 0;
+  for (r = 0; r < column->n_values; r++) {
+    if (r % SCALING_INDEX_STRIDE == 0) column->run_index[r / SCALING_INDEX_STRIDE] = begin;
+    begin += column->lengths[r];
+  }
+}
+
+// TRUE when column has a factor other than 1 among positions from .. to - 1
+static BOOL scaling_column_scales(scaling_column_struct *column, long long from, long long to) {
+  long long r, begin, x;
+
+  if (column->encoding == SCALING_DENSE) {
+    for (x = from; x < to; x++) {
+      if (column->values[x] != 1.0f) return TRUE;
+    }
+    return FALSE;
+  }
+
+  for (r = find_scaling_run(column, from, &begin); r < column->n_values && begin < to; begin += column->lengths[r++]) {
+    if (column->values[r] != 1.0f) return TRUE;
+  }
+  return FALSE;
+}
+
+// a scaling of positions offset .. offset + len - 1 of columns, which store holds, keeping those with a factor other
+// than 1 there; NULL when there's none.  takes a reference to store when it returns one
+static position_scaling_struct *scaling_of_columns(scaling_store_struct *store, scaling_column_struct **columns, int *states, int n_columns, long offset, long len) {
+  position_scaling_struct *scaling;
+  BOOL *kept = ALLOC(sizeof(BOOL) * (n_columns > 0 ? n_columns : 1));
+  int i, n_kept = 0;
+
+  for (i = 0; i < n_columns; i++) {
+    if ((kept[i] = scaling_column_scales(columns[i], offset, offset + len))) n_kept++;
+  }
+  if (n_kept == 0) {
+    free(kept);
+    return NULL;
+  }
+
+  scaling = ALLOC(sizeof(position_scaling_struct));
+  scaling->n_columns = n_kept;
+  scaling->states = ALLOC(sizeof(int) * n_kept);
+  scaling->columns = ALLOC(sizeof(scaling_column_struct *) * n_kept);
+  for (n_kept = 0, i = 0; i < n_columns; i++) {
+    if (!kept[i]) continue;
+    scaling->states[n_kept] = states[i];
+    scaling->columns[n_kept++] = columns[i];
+  }
+  scaling->offset = offset;
+  scaling->len = len;
+  scaling->id = __sync_add_and_fetch(&scaling_ids, 1);
+  scaling->store = store;
+  __sync_add_and_fetch(&store->refs, 1);
+
+  free(kept);
+  return scaling;
+}
+
+static void release_scaling_store(scaling_store_struct *store) {
+  int i;
+
+  if (__sync_sub_and_fetch(&store->refs, 1) > 0) return;
+
+  for (i = 0; i < store->n_columns; i++) {
+    free(store->columns[i].run_index);
+    if (!store->mapping) {
+      free(store->columns[i].lengths);
+      free(store->columns[i].values);
+    }
+  }
+  if (store->mapping) munmap(store->mapping, store->mapping_length);
+  free(store->columns);
+  free(store);
+}
+
+scaling_builder_struct *begin_position_scaling(int n_columns, int *states, long len) {
+  scaling_builder_struct *builder = ALLOC(sizeof(scaling_builder_struct));
+  int i;
+
+  builder->n_columns = n_columns;
+  builder->states = states;
+  builder->len = len;
+  builder->pos = 0;
+  builder->columns = ALLOC(sizeof(scaling_column_struct) * (n_columns > 0 ? n_columns : 1));
+  builder->capacity = ALLOC(sizeof(long long) * (n_columns > 0 ? n_columns : 1));
+  memset(builder->columns, 0, sizeof(scaling_column_struct) * (n_columns > 0 ? n_columns : 1));
+  for (i = 0; i < n_columns; i++) {
+    builder->columns[i].encoding = SCALING_RUNS;
+    builder->capacity[i] = 0;
+  }
+  return builder;
+}
+
+// column i of builder takes value for positions builder->pos .. to - 1
+static void extend_scaling_column(scaling_builder_struct *builder, int i, float value, long to) {
+  scaling_column_struct *column = builder->columns + i;
+  long long r, x;
+
+  if (to <= builder->pos) return;
+
+  if (column->encoding == SCALING_DENSE) {
+    for (x = builder->pos; x < to; x++) column->values[x] = value;
+    return;
+  }
+
+  if (column->n_values > 0 && column->values[column->n_values - 1] == value) {
+    column->lengths[column->n_values - 1] += to - builder->pos;
+    return;
+  }
+
+  // a run takes a length and a factor, 12 bytes, against 4 for a position of a dense column
+  if (3 * (column->n_values + 1) > builder->len) {
+    float *values = ALLOC(sizeof(float) * (builder->len > 0 ? builder->len : 1));
+    for (x = 0, r = 0; r < column->n_values; r++) {
+      long long k;
+      for (k = 0; k < column->lengths[r]; k++) values[x++] = column->values[r];
+    }
+    free(column->lengths);
+    free(column->values);
+    column->encoding = SCALING_DENSE;
+    column->lengths = NULL;
+    column->values = values;
+    column->n_values = builder->len;
+    extend_scaling_column(builder, i, value, to);
+    return;
+  }
+
+  if (column->n_values == builder->capacity[i]) {
+    builder->capacity[i] = builder->capacity[i] ? 2 * builder->capacity[i] : 64;
+    column->lengths = realloc(column->lengths, sizeof(long long) * builder->capacity[i]);
+    column->values = realloc(column->values, sizeof(float) * builder->capacity[i]);
+    if (!column->lengths || !column->values) {
+      fprintf(stderr, "Error allocating memory.  Exiting.\n");
+      exit(1);
+    }
+  }
+  column->lengths[column->n_values] = to - builder->pos;
+  column->values[column->n_values++] = value;
+}
+
+void add_scaling_position(scaling_builder_struct *builder, long pos, const PROBABILITY *factors) {
+  int i;
+
+  if (pos >= builder->len) return;
+
+  // the positions skipped keep the factors before them, or 1 before any
+  for (i = 0; i < builder->n_columns; i++) {
+    scaling_column_struct *column = builder->columns + i;
+    float last = builder->pos == 0 ? 1.0f : column->encoding == SCALING_DENSE ? column->values[builder->pos - 1] : column->values[column->n_values - 1];
+    extend_scaling_column(builder, i, last, pos);
+  }
+  builder->pos = pos;
+
+  for (i = 0; i < builder->n_columns; i++) extend_scaling_column(builder, i, (float)factors[i], pos + 1);
+  builder->pos = pos + 1;
+}
+
+position_scaling_struct *finish_position_scaling(scaling_builder_struct *builder) {
+  scaling_store_struct *store = ALLOC(sizeof(scaling_store_struct));
+  scaling_column_struct **columns = ALLOC(sizeof(scaling_column_struct *) * (builder->n_columns > 0 ? builder->n_columns : 1));
+  position_scaling_struct *scaling;
+  int i;
+
+  for (i = 0; i < builder->n_columns; i++) {
+    scaling_column_struct *column = columns[i] = builder->columns + i;
+    float last = builder->pos == 0 ? 1.0f : column->encoding == SCALING_DENSE ? column->values[builder->pos - 1] : column->values[column->n_values - 1];
+    extend_scaling_column(builder, i, last, builder->len);
+  }
+
+  store->refs = 1;
+  store->n_columns = builder->n_columns;
+  store->columns = builder->columns;
+  store->mapping = NULL;
+  store->mapping_length = 0;
+  for (i = 0; i < store->n_columns; i++) index_scaling_column(store->columns + i);
+
+  // the scaling of it all holds the only reference the store needs
+  scaling = scaling_of_columns(store, columns, builder->states, builder->n_columns, 0, builder->len);
+  release_scaling_store(store);
+
+  free(columns);
+  free(builder->capacity);
+  free(builder);
+  return scaling;
+}
+
+position_scaling_struct *build_position_scaling(float **columns, int n_columns, int *states, long len) {
+  scaling_builder_struct *builder = begin_position_scaling(n_columns, states, len);
+  PROBABILITY *factors = ALLOC(sizeof(PROBABILITY) * (n_columns > 0 ? n_columns : 1));
+  long pos;
+  int i;
+
+  for (pos = 0; pos < len; pos++) {
+    for (i = 0; i < n_columns; i++) factors[i] = columns[i][pos];
+    add_scaling_position(builder, pos, factors);
+  }
+
+  free(factors);
+  return finish_position_scaling(builder);
+}
+
+static int cmp_longs(const void *a, const void *b) {
+  if (*(long *)a > *(long *)b) return 1;
+  else if (*(long *)a < *(long *)b) return -1;
+  else return 0;
+}
+
+
+fixed_state_masks_struct *build_fixed_state_masks(model_def_struct *model_def, long len) {
+  fixed_state_masks_struct *masks;
+  long *bounds, n_bounds = 0, b;
+  int i, j, k;
+
+  // an active set can only change where a fixed range begins or ends
+  bounds = ALLOC(sizeof(long) * (2 * model_def->n_fixed_states + 1));
+  bounds[n_bounds++] = 0;
+  for (i = 0; i < model_def->n_fixed_states; i++) {
+    fixed_states_struct *fixed = model_def->fixed_states + i;
+    if (fixed->position_from > 0 && fixed->position_from < len) bounds[n_bounds++] = fixed->position_from;
+    if (fixed->position_to + 1 > 0 && fixed->position_to + 1 < len) bounds[n_bounds++] = fixed->position_to + 1;
+  }
+  qsort(bounds, n_bounds, sizeof(long), cmp_longs);
+  for (j = 1, b = 1; b < n_bounds; b++) {
+    if (bounds[b] != bounds[j - 1]) bounds[j++] = bounds[b];
+  }
+  n_bounds = j;
+
+  masks = ALLOC(sizeof(fixed_state_masks_struct));
+  masks->n_runs = n_bounds;
+  masks->run_begin = bounds;
+  masks->masks = ALLOC(sizeof(state_mask_struct *) * n_bounds);
+  masks->mask_pool = ALLOC(sizeof(state_mask_struct) * n_bounds);
+
+  BOOL *allowed = ALLOC(sizeof(BOOL) * model_def->silent_states_begin);
+  BOOL *pinned = ALLOC(sizeof(BOOL) * model_def->silent_states_begin);
+  BOOL restricted = FALSE;
+  for (b = 0; b < n_bounds; b++) {
+    state_mask_struct *mask = masks->mask_pool + b;
+    BOOL active = FALSE;
+
+    // a run may only be in states every fixed range covering it allows
+    for (i = 0; i < model_def->n_fixed_states; i++) {
+      fixed_states_struct *fixed = model_def->fixed_states + i;
+      if (bounds[b] < fixed->position_from || bounds[b] > fixed->position_to) continue;
+      state_range_struct *range;
+      memset(pinned, FALSE, sizeof(BOOL) * model_def->silent_states_begin);
+      for (range = fixed->state_ranges; range; range = range->next_range) {
+        for (k = range->state_from; k <= range->state_to && k < model_def->silent_states_begin; k++) {
+          if (k >= 0) pinned[k] = TRUE;
+        }
+      }
+      for (k = 0; k < model_def->silent_states_begin; k++) allowed[k] = pinned[k] && (allowed[k] || !active);
+      active = TRUE;
+    }
+    if (!active) {
+      masks->masks[b] = NULL;
+      mask->n_ranges = 0;
+      mask->from = mask->to = NULL;
+      continue;
+    }
+    restricted = TRUE;
+
+    for (k = 0; k < model_def->silent_states_begin && !allowed[k]; k++);
+    if (k == model_def->silent_states_begin) {
+      fprintf(stderr, "Fixed states leave positions %ld-%ld in no state: the ranges covering them pin different states.\n",
+              bounds[b] + 1, b + 1 < n_bounds ? bounds[b + 1] : len);
+      exit(1);
+    }
+
+    // ... kept as sorted runs of allowed states, so clearing the rest is a few memsets
+    for (mask->n_ranges = 0, k = 0; k < model_def->silent_states_begin; k++) {
+      if (allowed[k] && (k == 0 || !allowed[k - 1])) mask->n_ranges++;
+    }
+    mask->from = ALLOC(sizeof(int) * (mask->n_ranges > 0 ? mask->n_ranges : 1));
+    mask->to = ALLOC(sizeof(int) * (mask->n_ranges > 0 ? mask->n_ranges : 1));
+    for (j = -1, k = 0; k < model_def->silent_states_begin; k++) {
+      if (!allowed[k]) continue;
+      if (k == 0 || !allowed[k - 1]) mask->from[++j] = k;
+      mask->to[j] = k;
+    }
+    masks->masks[b] = mask;
+  }
+  free(allowed);
+  free(pinned);
+
+  if (!restricted) {
+    free_fixed_state_masks(masks);
+    return NULL;
+  }
+  return masks;
+}
+
+void free_fixed_state_masks(fixed_state_masks_struct *masks) {
+  long b;
+
+  if (!masks) return;
+
+  for (b = 0; b < masks->n_runs; b++) {
+    free(masks->mask_pool[b].from);
+    free(masks->mask_pool[b].to);
+  }
+  free(masks->run_begin);
+  free(masks->masks);
+  free(masks->mask_pool);
+  free(masks);
+}
+
+void apply_fixed_state_mask(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *row, long pos) {
+  fixed_state_masks_struct *masks = sequence->fixed_masks;
+  state_mask_struct *mask;
+  long lo = 0, hi;
+  int i, cleared = 0;
+
+  if (!masks) return;
+
+  pos += sequence->view_offset;
+  hi = masks->n_runs - 1;
+  while (lo < hi) {
+    long mid = (lo + hi + 1) / 2;
+    if (masks->run_begin[mid] <= pos) lo = mid;
+    else hi = mid - 1;
+  }
+  if (!(mask = masks->masks[lo])) return;
+
+  for (i = 0; i < mask->n_ranges; i++) {
+    memset(row + cleared, 0, sizeof(PROBABILITY) * (mask->from[i] - cleared));
+    cleared = mask->to[i] + 1;
+  }
+  memset(row + cleared, 0, sizeof(PROBABILITY) * (model_def->silent_states_begin - cleared));
+}
+
+void free_position_scaling(position_scaling_struct *scaling) {
+  if (!scaling) return;
+
+  release_scaling_store(scaling->store);
+  free(scaling->states);
+  free(scaling->columns);
+  free(scaling);
+}
+
+position_scaling_struct *slice_position_scaling(position_scaling_struct *scaling, long from, long len) {
+  if (!scaling) return NULL;
+
+  return scaling_of_columns(scaling->store, scaling->columns, scaling->states, scaling->n_columns, scaling->offset + from, len);
+}
+
 void set_emission_prob(model_def_struct *model_def, int state, int chr, PROBABILITY p) {
   model_def->emission_matrix[state * model_def->alphabet_length + chr] = p;
 }
 
-void update_silent_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int row_index, BOOL forward) {
-  PROBABILITY *row = table + (unsigned long)model_def->n_states * (unsigned long)row_index;
+// forward rows of nucleosome positions 1 .. n_positions - 1 of the kernel block
+void update_nucleosome_block_forward(model_def_struct *model_def, PROBABILITY *prev_row, PROBABILITY *row, char chr) {
+  nucleosome_kernel_struct *kernel = model_def->nuc_kernel;
+  int q, i, d;
+
+  for (q = 1; q < kernel->n_positions; q++) {
+    const PROBABILITY *prev = prev_row + kernel->first_state + 16 * (q - 1);
+    const PROBABILITY *w = kernel->weights + 64 * q;
+    const PROBABILITY *em = kernel->emissions + 16 * (q * model_def->alphabet_length + chr);
+    PROBABILITY *out = row + kernel->first_state + 16 * q;
+    PROBABILITY sum[16];
+
+    for (d = 0; d < 16; d++) sum[d] = 0;
+    // lane 4j + k is fed by (q - 1, 4i + j) for every i
+    for (i = 0; i < 4; i++) {
+      for (d = 0; d < 16; d++) {
+        sum[d] += prev[4 * i + (d >> 2)] * w[16 * i + d];
+      }
+    }
+    for (d = 0; d < 16; d++) out[d] = em[d] * sum[d];
+  }
+}
+
+// backward rows of nucleosome positions 0 .. n_positions - 2 of the kernel block
+void update_nucleosome_block_backward(model_def_struct *model_def, PROBABILITY *next_row, PROBABILITY *row, char chr) {
+  nucleosome_kernel_struct *kernel = model_def->nuc_kernel;
+  int q, k, s;
+
+  for (q = 0; q < kernel->n_positions - 1; q++) {
+    const PROBABILITY *next = next_row + kernel->first_state + 16 * (q + 1);
+    const PROBABILITY *w = kernel->weights + 64 * (q + 1);
+    const PROBABILITY *em = kernel->emissions + 16 * ((q + 1) * model_def->alphabet_length + chr);
+    PROBABILITY *out = row + kernel->first_state + 16 * q;
+    PROBABILITY sum[16];
+
+    for (s = 0; s < 16; s++) sum[s] = 0;
+    // lane 4i + j goes to (q + 1, 4j + k) for every k
+    for (k = 0; k < 4; k++) {
+      for (s = 0; s < 16; s++) {
+        int c = 4 * (s & 3) + k;
+        sum[s] += next[c] * w[16 * (s >> 2) + c] * em[c];
+      }
+    }
+    for (s = 0; s < 16; s++) out[s] = sum[s];
+  }
+}
+
+// row[from .. to - 1] *= em[from .. to - 1]; both are contiguous, so this vectorises
+void scale_by_emissions(PROBABILITY *restrict row, const PROBABILITY *restrict em, int from, int to) {
+  int i;
+
+  for (i = from; i < to; i++) {
+    row[i] *= em[i];
+  }
+}
+
+void update_silent_row(model_def_struct *model_def, PROBABILITY *row, char chr, BOOL forward) {
   int i, j;
 
   if (forward) {
     for (i = model_def->silent_states_begin; i < model_def->n_states; i++) {
+      edge_struct *edges = model_def->parent_edges[i];
       PROBABILITY sum = 0;
       for (j = 0; j < model_def->first_silent_parent[i]; j++) {
-        int state = model_def->parents[i][j];
-        PROBABILITY transition_prob = fetch_transition_prob(model_def, state, i);
-        sum += row[state] * transition_prob;
+        sum += row[edges[j].state] * edges[j].prob;
       }
       row[i] = sum;
     }
 
     for (i = model_def->silent_states_begin + 1; i < model_def->n_states; i++) {
+      edge_struct *edges = model_def->parent_edges[i];
       PROBABILITY sum = 0;
       for (j = model_def->first_silent_parent[i]; j < model_def->n_parents[i]; j++) {
-        int state = model_def->parents[i][j];
-//        if (state >= i) break;  // I don't think this can happen, due to required ordering of silent states
-        PROBABILITY transition_prob = fetch_transition_prob(model_def, state, i);
-        sum += row[state] * transition_prob;
+//        if (edges[j].state >= i) break;  // I don't think this can happen, due to required ordering of silent states
+        sum += row[edges[j].state] * edges[j].prob;
       }
       row[i] += sum;
     }
 
   } else {
 
+    PROBABILITY *weights = model_def->child_emission_weights ? model_def->child_emission_weights + (unsigned long)model_def->n_edges * chr : NULL;
     for (i = model_def->silent_states_begin; i < model_def->n_states; i++) {
+      edge_struct *edges = model_def->child_edges[i];
       PROBABILITY sum = 0;
-      for (j = 0; j < model_def->first_silent_child[i]; j++) {
-        int state = model_def->children[i][j];
-        PROBABILITY transition_prob = fetch_transition_prob(model_def, i, state);
-        PROBABILITY emission_prob = fetch_emission_prob(model_def, state, sequence->seq[sequence->len - row_index - 1]);
-        sum += row[state] * transition_prob * emission_prob;
+      if (weights) {
+        PROBABILITY *w = weights + (edges - model_def->child_edge_pool);
+        for (j = 0; j < model_def->first_silent_child[i]; j++) {
+          sum += row[edges[j].state] * w[j];
+        }
+      } else {
+        for (j = 0; j < model_def->first_silent_child[i]; j++) {
+          int state = edges[j].state;
+          sum += row[state] * edges[j].prob * fetch_emission_prob(model_def, state, chr);
+        }
       }
       row[i] = sum;
     }
 
     for (i = model_def->n_states - 2; i > model_def->silent_states_begin - 1; i--) {
+      edge_struct *edges = model_def->child_edges[i];
       PROBABILITY sum = 0;
       for (j = model_def->first_silent_child[i]; j < model_def->n_children[i]; j++) {
-        int state = model_def->children[i][j];
-        PROBABILITY transition_prob = fetch_transition_prob(model_def, i, state);
-        sum += row[state] * transition_prob;
+        sum += row[edges[j].state] * edges[j].prob;
       }
       row[i] += sum;
     }
   }
 }
 
-void update_normal_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int row_index, BOOL forward) {
+void update_silent_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int row_index, BOOL forward) {
   PROBABILITY *row = table + (unsigned long)model_def->n_states * (unsigned long)row_index;
-  PROBABILITY *prev_row = table + (unsigned long)model_def->n_states * (unsigned long)(row_index - 1);
-  PROBABILITY *next_row = table + (unsigned long)model_def->n_states * (unsigned long)(row_index + 1);
+
+  // the backward table is stored in reverse, so its silent states see the emission at the row's own position
+  update_silent_row(model_def, row, forward ? 0 : fetch_symbol(sequence, sequence->len - row_index - 1), forward);
+}
+
+void update_normal_row(model_def_struct *model_def, PROBABILITY *prev_row, PROBABILITY *row, char chr, BOOL forward) {
   int i, j;
 
   if (forward) {
-    for (i = 0; i < model_def->silent_states_begin; i++) {
-      PROBABILITY sum = 0;
-      for (j = 0; j < model_def->n_parents[i]; j++) {
-        int state = model_def->parents[i][j];
-        PROBABILITY transition_prob = fetch_transition_prob(model_def, state, i);
-        sum += prev_row[state] * transition_prob;
+    // the nucleosome kernel covers every block position but the first, whose parents are the padding states
+    int skip_from = model_def->nuc_kernel ? model_def->nuc_kernel->first_state + 16 : model_def->silent_states_begin;
+    int skip_to = model_def->nuc_kernel ? model_def->nuc_kernel->first_state + 16 * model_def->nuc_kernel->n_positions : skip_from;
+
+    if (model_def->specialized) {
+      model_def->specialized->forward(prev_row, row, model_def->emission_by_chr + (unsigned long)model_def->emission_stride * chr, model_def->parent_edge_pool);
+    } else if (model_def->emission_by_chr) {
+      // gather the parent sums first, then scale them by this symbol's contiguous emission vector
+      PROBABILITY *em = model_def->emission_by_chr + (unsigned long)model_def->emission_stride * chr;
+      for (i = 0; i < model_def->silent_states_begin; i++) {
+        if (i == skip_from) i = skip_to;
+        if (i >= model_def->silent_states_begin) break;
+        edge_struct *edges = model_def->parent_edges[i];
+        PROBABILITY sum = 0;
+        for (j = 0; j < model_def->n_parents[i]; j++) {
+          sum += prev_row[edges[j].state] * edges[j].prob;
+        }
+        row[i] = sum;
+      }
+      scale_by_emissions(row, em, 0, skip_from < model_def->silent_states_begin ? skip_from : model_def->silent_states_begin);
+      if (skip_to < model_def->silent_states_begin) scale_by_emissions(row, em, skip_to, model_def->silent_states_begin);
+    } else {
+      for (i = 0; i < model_def->silent_states_begin; i++) {
+        if (i == skip_from) i = skip_to;
+        if (i >= model_def->silent_states_begin) break;
+        edge_struct *edges = model_def->parent_edges[i];
+        PROBABILITY sum = 0;
+        for (j = 0; j < model_def->n_parents[i]; j++) {
+          sum += prev_row[edges[j].state] * edges[j].prob;
+        }
+        row[i] = fetch_emission_prob(model_def, i, chr) * sum;
       }
-      row[i] = fetch_emission_prob(model_def, i, sequence->seq[row_index]) * sum;
     }
+    if (model_def->nuc_kernel) update_nucleosome_block_forward(model_def, prev_row, row, chr);
   } else {
-    for (i = 0; i < model_def->silent_states_begin; i++) {
-      PROBABILITY sum = 0;
-      for (j = 0; j < model_def->n_children[i]; j++) {
-        int state = model_def->children[i][j];
-        PROBABILITY transition_prob = fetch_transition_prob(model_def, i, state);
-        PROBABILITY emission_prob = fetch_emission_prob(model_def, state, sequence->seq[sequence->len - row_index]);
-        sum += prev_row[state] * transition_prob * emission_prob;
+    // ... and every block position but the last, whose children are the padding states
+    int skip_from = model_def->nuc_kernel ? model_def->nuc_kernel->first_state : model_def->silent_states_begin;
+    int skip_to = model_def->nuc_kernel ? model_def->nuc_kernel->first_state + 16 * (model_def->nuc_kernel->n_positions - 1) : skip_from;
+
+    if (model_def->specialized) {
+      model_def->specialized->backward(prev_row, row, model_def->child_emission_weights + (unsigned long)model_def->n_edges * chr);
+    } else if (model_def->child_emission_weights) {
+      // edge probability and child emission are premultiplied per symbol, in edge pool order
+      PROBABILITY *weights = model_def->child_emission_weights + (unsigned long)model_def->n_edges * chr;
+      for (i = 0; i < model_def->silent_states_begin; i++) {
+        if (i == skip_from) i = skip_to;
+        if (i >= model_def->silent_states_begin) break;
+        edge_struct *edges = model_def->child_edges[i];
+        PROBABILITY *w = weights + (edges - model_def->child_edge_pool);
+        PROBABILITY sum = 0;
+        for (j = 0; j < model_def->n_children[i]; j++) {
+          sum += prev_row[edges[j].state] * w[j];
+        }
+        row[i] = sum;
       }
-      row[i] = sum;
+    } else {
+      for (i = 0; i < model_def->silent_states_begin; i++) {
+        if (i == skip_from) i = skip_to;
+        if (i >= model_def->silent_states_begin) break;
+        edge_struct *edges = model_def->child_edges[i];
+        PROBABILITY sum = 0;
+        for (j = 0; j < model_def->n_children[i]; j++) {
+          int state = edges[j].state;
+          sum += prev_row[state] * edges[j].prob * fetch_emission_prob(model_def, state, chr);
+        }
+        row[i] = sum;
+      }
+    }
+    if (model_def->nuc_kernel) update_nucleosome_block_backward(model_def, prev_row, row, chr);
+  }
+}
+
+void update_normal_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int row_index, BOOL forward) {
+  PROBABILITY *row = table + (unsigned long)model_def->n_states * (unsigned long)row_index;
+  PROBABILITY *prev_row = table + (unsigned long)model_def->n_states * (unsigned long)(row_index - 1);
+
+  // backward rows are built from the next sequence position, so they need the emission there
+  update_normal_row(model_def, prev_row, row, forward ? fetch_symbol(sequence, row_index) : fetch_symbol(sequence, sequence->len - row_index), forward);
+}
+
+/* the row updates take every distributor transition at its model probability; this adds the difference a factor f
+   makes to each scaled one, (f - 1) times its contribution, rather than scaling a copy of the transitions.  an
+   element beginning at pos is entered from the distributor of row pos - 1 when its first state is normal, and from
+   the distributor of row pos, through its silent state, otherwise.  silent states of backward rows precede the
+   row's emission, so both kinds are entered at row pos there.  the distributor has no silent parents and the
+   silent states it enters no silent children, so neither silent loop needs to see the change.
+   forward rows call this twice: with prev_row, between the normal and silent updates, and with NULL after both.
+*/
+void scale_distributor_edges(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *prev_row, PROBABILITY *row, long pos, BOOL forward) {
+  int distributor = model_def->silent_states_begin;
+  const PROBABILITY *factors;
+  int i;
+
+  if (!sequence->scaling) return;
+  int *states = sequence->scaling->states;
+
+  if (forward && prev_row) {
+    if (!(factors = position_scaling(sequence, pos))) return;
+    char chr = fetch_symbol(sequence, pos);
+    for (i = 0; i < sequence->scaling->n_columns; i++) {
+      if (states[i] >= distributor) continue;
+      row[states[i]] += (factors[i] - 1.0) * prev_row[distributor] * fetch_transition_prob(model_def, distributor, states[i]) * fetch_emission_prob(model_def, states[i], chr);
     }
+  } else if (forward) {
+    if (pos + 1 >= sequence->len || !(factors = position_scaling(sequence, pos + 1))) return;
+    for (i = 0; i < sequence->scaling->n_columns; i++) {
+      if (states[i] < distributor) continue;
+      row[states[i]] += (factors[i] - 1.0) * row[distributor] * fetch_transition_prob(model_def, distributor, states[i]);
+    }
+  } else {
+    if (!(factors = position_scaling(sequence, pos))) return;
+    char chr = fetch_symbol(sequence, pos);
+    PROBABILITY sum = 0;
+    for (i = 0; i < sequence->scaling->n_columns; i++) {
+      PROBABILITY entered = row[states[i]] * fetch_transition_prob(model_def, distributor, states[i]);
+      if (states[i] < distributor) entered *= fetch_emission_prob(model_def, states[i], chr);
+      sum += (factors[i] - 1.0) * entered;
+    }
+    row[distributor] += sum;
   }
 }
 
@@ -176,260 +941,156 @@ void find_all_silent_parents(model_def_struct *model_def, BOOL *buffer, int stat
 }
 
 
-/* INPUTS:
-   model_def: struct containing definition of the model
-   sequence: struct containing sequence to train the model on
-   OUTPUTS:
-   table: forward table
-          this has to be filled out row-wise, because of paging issues.  hence, row index is sequence position and column index is state
-   s: array of s_i probability scaling factors
-*/
-void forward(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s) {
+// forward row as if the sequence began at pos; the real first row when pos is 0
+PROBABILITY forward_initial_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *row, long pos) {
+  int i;
 
   // initialize first row
   // normal states need to be handled specially
-  int i, j, k, l;
   for (i = 0; i < model_def->silent_states_begin; i++) {
-    table[i] = model_def->initial_probs[i] * fetch_emission_prob(model_def, i, sequence->seq[0]);
+    row[i] = model_def->initial_probs[i] * fetch_emission_prob(model_def, i, fetch_symbol(sequence, pos));
   }
+  apply_fixed_state_mask(model_def, sequence, row, pos);
 
-  // silent states can use the normal machinery
-  update_silent_states(model_def, sequence, table, 0, TRUE);
+  // silent states can use the normal machinery.  the initial probabilities cover elements already under way, and
+  // aren't scaled
+  update_silent_row(model_def, row, fetch_symbol(sequence, pos), TRUE);
+  scale_distributor_edges(model_def, sequence, NULL, row, pos, TRUE);
 
   // the first weight is just the sum of the first column (row, in this implementation).  calculate, and normalize.
-  s[0] = normalize_row(table, model_def->silent_states_begin, model_def->n_states);
-
-  // first row initialization complete
+  return normalize_row(row, model_def->silent_states_begin, model_def->n_states);
+}
 
 
-  // fill out the rest of the table now
-  for (i = 1; i < sequence->len; i++) {
-    #ifdef VERBOSE
-    if (i % 500 == 0) fprintf(stderr, "forward row %d\n", i);
-    #endif
-
-    // handle fixed state specifications entirely through parents and children lists
-    int *n_parents, *n_parents_fixed, *first_silent_parent, *first_silent_parent_fixed;
-    int **parents, **parents_fixed;
-    BOOL *parents_matrix;
-    BOOL handle_fixed_states = (model_def->n_fixed_states > 0) && model_def->fixed_state_positions[i];
-    if (handle_fixed_states) {
-      // there are fixed position ranges given that cover this position
-      n_parents = model_def->n_parents;
-      parents = model_def->parents;
-      first_silent_parent = model_def->first_silent_parent;
-      parents_matrix = ALLOC(sizeof(BOOL) * model_def->n_states * model_def->n_states);
-      memset(parents_matrix, FALSE, sizeof(BOOL) * model_def->n_states * model_def->n_states);
-
-      // build a new parents list to reflect the restrictions of the pinned positions
-      parents_fixed = ALLOC(sizeof(int*) * model_def->n_states);
-      n_parents_fixed = ALLOC(sizeof(int) * model_def->n_states);
-      first_silent_parent_fixed = ALLOC(sizeof(int) * model_def->n_states);
-      memset(parents_fixed, 0, sizeof(int*) * model_def->n_states);
-      memset(n_parents_fixed, 0, sizeof(int) * model_def->n_states);
-      memset(first_silent_parent_fixed, 0, sizeof(int) * model_def->n_states);
-
-      for (j = 0; j < model_def->n_fixed_states; j++) {
-        if ((i >= model_def->fixed_states[j].position_from) && (i <= model_def->fixed_states[j].position_to)) {
-          // position i is covered in range j
-          state_range_struct *state_range;
-          for (state_range = model_def->fixed_states[j].state_ranges; state_range; state_range = state_range->next_range) {
-            for (k = state_range->state_from; k <= state_range->state_to; k++) {
-              // walk through all the states in the range and build a new parents list that includes only things from this range
-              n_parents_fixed[k] = n_parents[k];
-              parents_fixed[k] = parents[k];
-              first_silent_parent_fixed[k] = model_def->first_silent_parent[k];
-            }
-          }
-
-          for (k = model_def->silent_states_begin; k < model_def->n_states; k++) {
-              n_parents_fixed[k] = n_parents[k];
-              parents_fixed[k] = parents[k];
-              first_silent_parent_fixed[k] = model_def->first_silent_parent[k];
-          }
-        }
-      }
-
-      model_def->n_parents = n_parents_fixed;
-      model_def->parents = parents_fixed;
-      model_def->first_silent_parent = first_silent_parent_fixed;
-    }
-
-    update_normal_states(model_def, sequence, table, i, TRUE);
-    update_silent_states(model_def, sequence, table, i, TRUE);
-    s[i] = normalize_row(table + (unsigned long)model_def->n_states * (unsigned long)i, model_def->silent_states_begin, model_def->n_states);
-
-    if (handle_fixed_states) {
-      model_def->n_parents = n_parents;
-      model_def->parents = parents;
-      model_def->first_silent_parent = first_silent_parent;
-      free(n_parents_fixed);
-      free(parents_fixed);
-      free(first_silent_parent_fixed);
-    }
-  }
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to train the model on
+   prev_row: forward row of position pos - 1 (unused when pos is 0)
+   pos: sequence position of the row to compute
+   OUTPUTS:
+   row: forward row of position pos, normalized
+   returns the s_pos probability scaling factor
+*/
+PROBABILITY forward_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *prev_row, PROBABILITY *row, long pos) {
+  PROFILE_ROW(PHASE_FORWARD);
+  if (pos == 0) return forward_initial_row(model_def, sequence, row, 0);
+
+  update_normal_row(model_def, prev_row, row, fetch_symbol(sequence, pos), TRUE);
+  scale_distributor_edges(model_def, sequence, prev_row, row, pos, TRUE);
+  // states a fixed range excludes are cleared before the silent states can pass them on
+  apply_fixed_state_mask(model_def, sequence, row, pos);
+  update_silent_row(model_def, row, fetch_symbol(sequence, pos), TRUE);
+  scale_distributor_edges(model_def, sequence, NULL, row, pos, TRUE);
+  return normalize_row(row, model_def->silent_states_begin, model_def->n_states);
 }
 
 
 /* INPUTS:
    model_def: struct containing definition of the model
    sequence: struct containing sequence to train the model on
-   s: array of s_i probability scaling factors
    OUTPUTS:
-   table: backward table
+   table: forward table
           this has to be filled out row-wise, because of paging issues.  hence, row index is sequence position and column index is state
-          this table is stored in reverse (i.e. row 0 contains the last column of the backwards table), also for paging reasons
+   s: array of s_i probability scaling factors
 */
-void backward(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *s, PROBABILITY *table) {
-
-  // initialize first row
-  // normal states need to be handled specially
-  int i, j, k, l;
-
-  s[sequence->len - 1] = model_def->silent_states_begin;
-  for (i = 0; i < model_def->silent_states_begin; i++) {
-    table[i] = 1.0 / s[sequence->len - 1];
-  }
-
-  // silent states can use the normal machinery
-  update_silent_states(model_def, sequence, table, 0, FALSE);
-
-  // first row initialization complete
+void forward(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s) {
+  profile_timer_struct timer;
+  long i;
 
+  profile_start(&timer);
+  s[0] = forward_row(model_def, sequence, NULL, table, 0);
 
   // fill out the rest of the table now
   for (i = 1; i < sequence->len; i++) {
-    #ifdef VERBOSE
-    if (i % 500 == 0) fprintf(stderr, "backward row %d\n", i);
-    #endif
-    int seq_pos = sequence->len - i - 1;
-
-    // handle fixed state specifications entirely through parents and children lists
-    int *n_children, *n_children_fixed, *first_silent_child, *first_silent_child_fixed;
-    int **children, **children_fixed;
-    BOOL *children_matrix;
-    BOOL handle_fixed_states = (model_def->n_fixed_states > 0) && (model_def->fixed_state_positions[seq_pos] || model_def->fixed_state_positions[seq_pos + 1]);
-    if (handle_fixed_states) {
-      // there are fixed position ranges given that cover this position
-      n_children = model_def->n_children;
-      children = model_def->children;
-      first_silent_child = model_def->first_silent_child;
-      children_matrix = ALLOC(sizeof(BOOL) * model_def->n_states * model_def->n_states);
-      memset(children_matrix, FALSE, sizeof(BOOL) * model_def->n_states * model_def->n_states);
-
-      // build a new children list to reflect the restrictions of the pinned positions
-      children_fixed = ALLOC(sizeof(int*) * model_def->n_states);
-      n_children_fixed = ALLOC(sizeof(int) * model_def->n_states);
-      first_silent_child_fixed = ALLOC(sizeof(int) * model_def->n_states);
-      memset(children_fixed, 0, sizeof(int*) * model_def->n_states);
-      memset(n_children_fixed, 0, sizeof(int) * model_def->n_states);
-      memset(first_silent_child_fixed, 0, sizeof(int) * model_def->n_states);
-
-      for (j = 0; j < model_def->n_fixed_states; j++) {
-        if ((seq_pos + 1 >= model_def->fixed_states[j].position_from) && (seq_pos + 1 <= model_def->fixed_states[j].position_to)) {
-          // position seq_pos + 1 is covered in range j
-          state_range_struct *state_range;
-          for (state_range = model_def->fixed_states[j].state_ranges; state_range; state_range = state_range->next_range) {
-            for (k = state_range->state_from; k <= state_range->state_to; k++) {
-              // walk through all the states in the range and build a new children list that includes only things from this range
-              for (l = 0; l < model_def->first_silent_parent[k]; l++) {
-                if (!children_matrix[model_def->parents[k][l] * model_def->n_states + k]) {
-                  children_matrix[model_def->parents[k][l] * model_def->n_states + k] = TRUE;
-                  n_children_fixed[model_def->parents[k][l]]++;
-                }
-              }
-            }
-          }
+    s[i] = forward_row(model_def, sequence, table + (unsigned long)model_def->n_states * (unsigned long)(i - 1), table + (unsigned long)model_def->n_states * (unsigned long)i, i);
+  }
+  profile_stop(&timer, PHASE_FORWARD);
+}
 
-          for (k = model_def->silent_states_begin; k < model_def->n_states; k++) {
-            // copy over the existing silent state dependencies
-            n_children_fixed[k] = n_children[k];
 
-            find_all_silent_parents(model_def, children_matrix, k, n_children_fixed);
+void forward_float(model_def_struct *model_def, sequence_struct *sequence, float *table, PROBABILITY *s) {
+  unsigned long n = model_def->n_states, j;
+  PROBABILITY *rows = ALLOC(sizeof(PROBABILITY) * n * 2);
+  profile_timer_struct timer;
+  long i;
 
-            for (l = 0; l < n_children[k]; l++) {
-              if (!children_matrix[k * model_def->n_states + model_def->children[k][l]]) {
-                children_matrix[k * model_def->n_states + model_def->children[k][l]] = TRUE;
-              }
-            }
-          }
-        }
+  // the recursion runs on two double rows; only the stored copy is rounded
+  profile_start(&timer);
+  for (i = 0; i < sequence->len; i++) {
+    PROBABILITY *row = rows + n * (i % 2);
+    s[i] = forward_row(model_def, sequence, i ? rows + n * ((i - 1) % 2) : NULL, row, i);
+    float *stored = table + n * (unsigned long)i;
+    for (j = 0; j < n; j++) stored[j] = row[j];
+  }
+  profile_stop(&timer, PHASE_FORWARD);
 
-        if ((seq_pos >= model_def->fixed_states[j].position_from) && (seq_pos <= model_def->fixed_states[j].position_to)) {
-          // if I'm at the position, I have to restrict the paths of the silent states
-          for (k = 0; k < model_def->silent_states_begin; k++) {
-            // copy over the existing normal state dependencies
-            n_children_fixed[k] = n_children[k];
+  free(rows);
+}
 
-            for (l = 0; l < n_children[k]; l++) {
-              if (!children_matrix[k * model_def->n_states + model_def->children[k][l]]) {
-                children_matrix[k * model_def->n_states + model_def->children[k][l]] = TRUE;
-              }
-            }
-          }
 
-          for (k = model_def->silent_states_begin; k < model_def->n_states; k++) {
-            n_children_fixed[k] = 0;
+// backward row as if the sequence ended at seq_pos; the real first backward row when seq_pos is the last position
+PROBABILITY backward_initial_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *row, long seq_pos) {
+  PROBABILITY s = model_def->silent_states_begin;
+  int i;
 
-            // reset the existing silent state dependencies
-            for (l = 0; l < n_children[k]; l++) {
-              if (children_matrix[k * model_def->n_states + model_def->children[k][l]]) {
-                children_matrix[k * model_def->n_states + model_def->children[k][l]] = FALSE;
-              }
-            }
-          }
+  // initialize first row
+  // normal states need to be handled specially
+  for (i = 0; i < model_def->silent_states_begin; i++) {
+    row[i] = 1.0 / s;
+  }
+  apply_fixed_state_mask(model_def, sequence, row, seq_pos);
 
-          state_range_struct *state_range;
-          for (state_range = model_def->fixed_states[j].state_ranges; state_range; state_range = state_range->next_range) {
-            for (k = state_range->state_from; k <= state_range->state_to; k++) {
-              // walk up the chain of silent states to figure out the children list
-              find_all_silent_parents(model_def, children_matrix, k, n_children_fixed);
-            }
-          }
+  // silent states can use the normal machinery
+  update_silent_row(model_def, row, fetch_symbol(sequence, seq_pos), FALSE);
+  scale_distributor_edges(model_def, sequence, NULL, row, seq_pos, FALSE);
+  return s;
+}
 
-        }
-      }
 
-      int counter = 0;
-      for (j = 0; j < model_def->n_states; j++) {
-        BOOL found_first_silent_child = FALSE;
-        children_fixed[j] = ALLOC(sizeof(int) * n_children_fixed[j]);
-        memset(children_fixed[j], 0, sizeof(int) * n_children_fixed[j]);
-        for (k = 0; k < model_def->n_states; k++) {
-          if (children_matrix[j * model_def->n_states + k]) {
-            if (!found_first_silent_child && (k >= model_def->silent_states_begin)) {
-              first_silent_child_fixed[j] = counter;
-              found_first_silent_child = TRUE;
-            }
-            children_fixed[j][counter] = k;
-            counter++;
-          }
-        }
-        if (!found_first_silent_child) {
-          first_silent_child_fixed[j] = counter;
-        }
-        counter = 0;
-      }
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to train the model on
+   next_row: backward row of position seq_pos + 1 (unused when seq_pos is the last position)
+   seq_pos: sequence position of the row to compute
+   OUTPUTS:
+   row: backward row of position seq_pos, normalized
+   returns the s_seq_pos probability scaling factor
+*/
+PROBABILITY backward_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *next_row, PROBABILITY *row, long seq_pos) {
+  PROFILE_ROW(PHASE_BACKWARD);
+  if (seq_pos == sequence->len - 1) return backward_initial_row(model_def, sequence, row, seq_pos);
+
+  update_normal_row(model_def, next_row, row, fetch_symbol(sequence, seq_pos + 1), FALSE);
+  // next_row was masked for seq_pos + 1 in turn, so paths through excluded states are already gone
+  apply_fixed_state_mask(model_def, sequence, row, seq_pos);
+  update_silent_row(model_def, row, fetch_symbol(sequence, seq_pos), FALSE);
+  scale_distributor_edges(model_def, sequence, NULL, row, seq_pos, FALSE);
+  return normalize_row(row, model_def->silent_states_begin, model_def->n_states);
+}
 
-      model_def->n_children = n_children_fixed;
-      model_def->children = children_fixed;
-      model_def->first_silent_child = first_silent_child_fixed;
-    }
 
-    update_normal_states(model_def, sequence, table, i, FALSE);
-    update_silent_states(model_def, sequence, table, i, FALSE);
-    s[seq_pos] = normalize_row(table + (unsigned long)model_def->n_states * (unsigned long)i, model_def->silent_states_begin, model_def->n_states);
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to train the model on
+   s: array of s_i probability scaling factors
+   OUTPUTS:
+   table: backward table
+          this has to be filled out row-wise, because of paging issues.  hence, row index is sequence position and column index is state
+          this table is stored in reverse (i.e. row 0 contains the last column of the backwards table), also for paging reasons
+*/
+void backward(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *s, PROBABILITY *table) {
+  profile_timer_struct timer;
+  long i;
+
+  profile_start(&timer);
+  s[sequence->len - 1] = backward_row(model_def, sequence, NULL, table, sequence->len - 1);
 
-    if (handle_fixed_states) {
-      model_def->n_children = n_children;
-      model_def->children = children;
-      model_def->first_silent_child = first_silent_child;
-      free(n_children_fixed);
-      free(children_fixed);
-      free(children_matrix);
-      free(first_silent_child_fixed);
-    }
+  // fill out the rest of the table now
+  for (i = 1; i < sequence->len; i++) {
+    long seq_pos = sequence->len - i - 1;
+    s[seq_pos] = backward_row(model_def, sequence, table + (unsigned long)model_def->n_states * (unsigned long)(i - 1), table + (unsigned long)model_def->n_states * (unsigned long)i, seq_pos);
   }
+  profile_stop(&timer, PHASE_BACKWARD);
 }
 
 
@@ -461,263 +1122,2067 @@ void calc_sr(PROBABILITY *sf, PROBABILITY *sb, int len, PROBABILITY *sr) {
 }
 
 
-void print_forward_table(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s, int n) {
-  int i, j;
-  PROBABILITY constant = 0;
+void calc_log_sr(PROBABILITY *sf, PROBABILITY *sb, long len, PROBABILITY *log_sr) {
+  long i;
 
-  for (i = 0; i < sequence->len; i++) {
-    constant += log(s[i]);
-    if (i > n && i < sequence->len - n - 1) {
-      fprintf(model_def->output, "%d\t", i);
-      for (j = 0; j < model_def->n_states; j++) {
-//        PROBABILITY p = log(fetch_forward_prob(model_def, sequence, table, i, j)) + constant;
-//        p = exp(p);
-        PROBABILITY p = fetch_forward_prob(model_def, sequence, table, i, j);
-        if (j < model_def->n_states - 1) {
-          fprintf(model_def->output, "%.14f\t", p);
-        } else {
-          fprintf(model_def->output, "%.14f\n", p);
-        }
+  log_sr[len - 1] = 0;
+  for (i = len - 1; i > 0; i--) {
+    log_sr[i - 1] = log_sr[i] + log(sb[i]) - log(sf[i]);
+  }
+}
+
+
+void sum_posterior_row(posterior_columns_struct *columns, PROBABILITY *f_row, PROBABILITY *b_row, PROBABILITY scale, PROBABILITY *out) {
+  int i, j;
+  state_range_struct *range;
+
+  PROFILE_ROW(PHASE_POSTERIOR);
+  for (i = 0; i < columns->n_columns; i++) {
+    PROBABILITY sum = 0;
+    for (range = columns->ranges[i]; range; range = range->next_range) {
+      PROBABILITY range_sum = 0;
+      for (j = range->state_from; j <= range->state_to; j++) {
+        range_sum += scale * f_row[j] * b_row[j];
       }
+      sum += range_sum;
     }
+    out[i] = sum;
   }
 }
 
 
-void print_backward_table(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s, int n) {
-  int i, j;
-  PROBABILITY constant = 0;
+int default_checkpoint_interval(long len) {
+  int interval = (int)ceil(sqrt((double)len));
+  return interval < 1 ? 1 : interval;
+}
 
-  for (i = sequence->len - 1; i >= 0; i--) {
-    constant += log(s[i]);
-    if (i > n && i < sequence->len - n - 1) {
-      fprintf(model_def->output, "%d\t", (int)(sequence->len - 1 - i));
-      for (j = 0; j < model_def->n_states; j++) {
-//        PROBABILITY p = log(fetch_backward_prob(model_def, sequence, table, i, j)) + constant;
-//        p = exp(p);
-        PROBABILITY p = fetch_backward_prob(model_def, sequence, table, i, j);
-        if (j < model_def->n_states - 1) {
-          fprintf(model_def->output, "%.14f\t", p);
-        } else {
-          fprintf(model_def->output, "%.14f\n", p);
-        }
-      }
+
+/* runs the backward recursion over positions seg_end - 1 down to seg_begin, reducing each backward row into the
+   posterior columns together with the forward row at the same position (f_rows holds the forward rows from
+   seg_begin on).  the backward rows themselves are thrown away, except for the one kept in stream for the next
+   call, which must cover the positions just before this segment.
+*/
+// backward_posterior_segment() over forward rows stored as double (f_rows) or, when f_rows is NULL, as float
+void backward_posterior_rows(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_rows, float *f_rows_float, long seg_begin, long seg_end, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior, backward_stream_struct *stream) {
+  unsigned long n = model_def->n_states, j;
+  PROBABILITY sb, scale, *tmp;
+  PROBABILITY *widened = f_rows ? NULL : ALLOC(sizeof(PROBABILITY) * n);  // a float row, widened for sum_posterior_row()
+  profile_timer_struct timer;
+  double t;
+  long i;
+
+  profile_start(&timer);
+  for (i = seg_end - 1; i >= seg_begin; i--) {
+    sb = backward_row(model_def, sequence, stream->b_next, stream->b_row, i);
+
+    // same recursion as calc_log_sr, run alongside the backward rows
+    if (i < sequence->len - 1) stream->log_sr = stream->log_sr + log(stream->sb_next) - log(sf[i + 1]);
+    scale = POSTERIOR_SCALE(sb, stream->log_sr);
+
+    if (profiling) t = profile_wall_clock();
+    if (widened) {
+      for (j = 0; j < n; j++) widened[j] = f_rows_float[n * (i - seg_begin) + j];
     }
+    sum_posterior_row(columns, widened ? widened : f_rows + n * (i - seg_begin), stream->b_row, scale, posterior + (unsigned long)columns->n_columns * i);
+    if (profiling) timer.nested += profile_wall_clock() - t;
+
+    tmp = stream->b_next;
+    stream->b_next = stream->b_row;
+    stream->b_row = tmp;
+    stream->sb_next = sb;
   }
+  profile_stop_nested(&timer, PHASE_BACKWARD, PHASE_POSTERIOR);
+  free(widened);
 }
 
 
-void print_posterior(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *b_table, PROBABILITY *s, int states_to_include, int n) {
-  int i, j;
+void backward_posterior_segment(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_rows, long seg_begin, long seg_end, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior, backward_stream_struct *stream) {
+  backward_posterior_rows(model_def, sequence, f_rows, NULL, seg_begin, seg_end, sf, columns, posterior, stream);
+}
 
-  for (i = 0; i < sequence->len; i++) {
-    if (i < n || i > sequence->len - n - 1) {
-      fprintf(model_def->output, "%d\t", i);
-      for (j = 0; j < states_to_include; j++) {
-        PROBABILITY p = log(s[i]) + log(fetch_forward_prob(model_def, sequence, f_table, i, j)) + log(fetch_backward_prob(model_def, sequence, b_table, i, j));
-        if (j < states_to_include - 1) {
-          fprintf(model_def->output, "%.14f\t", p);
-        } else {
-          fprintf(model_def->output, "%.14f\n", p);
-        }
-      }
+
+void init_backward_stream(model_def_struct *model_def, backward_stream_struct *stream) {
+  stream->b_next = ALLOC(sizeof(PROBABILITY) * model_def->n_states);
+  stream->b_row = ALLOC(sizeof(PROBABILITY) * model_def->n_states);
+  stream->sb_next = 0;
+  stream->log_sr = 0;
+}
+
+
+void free_backward_stream(backward_stream_struct *stream) {
+  free(stream->b_next);
+  free(stream->b_row);
+}
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   f_table: forward table, as filled out by forward()
+   sf: forward scaling factors, as filled out by forward()
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors, row index is sequence position
+
+   the backward table is never stored; each backward row is reduced into the posterior columns as soon as it is
+   produced, so backward memory is O(n_states) and no separate pass over the tables is needed.
+*/
+void fused_backward_posterior(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  backward_stream_struct stream;
+
+  init_backward_stream(model_def, &stream);
+  backward_posterior_segment(model_def, sequence, f_table, 0, sequence->len, sf, columns, posterior, &stream);
+  free_backward_stream(&stream);
+}
+
+
+void fused_backward_posterior_float(model_def_struct *model_def, sequence_struct *sequence, float *f_table, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  backward_stream_struct stream;
+
+  init_backward_stream(model_def, &stream);
+  backward_posterior_rows(model_def, sequence, NULL, f_table, 0, sequence->len, sf, columns, posterior, &stream);
+  free_backward_stream(&stream);
+}
+
+
+size_t forward_table_size(model_def_struct *model_def, long len) {
+  return (model_def->table_precision == TABLE_FLOAT ? sizeof(float) : sizeof(PROBABILITY)) * model_def->n_states * len;
+}
+
+
+void forward_fused_posterior(model_def_struct *model_def, sequence_struct *sequence, void *f_table, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  if (model_def->table_precision == TABLE_FLOAT) {
+    forward_float(model_def, sequence, (float *)f_table, sf);
+    fused_backward_posterior_float(model_def, sequence, (float *)f_table, sf, columns, posterior);
+  } else {
+    forward(model_def, sequence, (PROBABILITY *)f_table, sf);
+    fused_backward_posterior(model_def, sequence, (PROBABILITY *)f_table, sf, columns, posterior);
+  }
+}
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   interval: number of sequence positions between stored forward rows
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors, row index is sequence position
+
+   only every interval-th forward row is kept; while the backward sweep runs, each segment of forward rows is
+   recomputed from its checkpoint and handed to backward_posterior_segment, so neither full table is ever stored.
+   memory is O(n_states * (len / interval + interval)).
+*/
+void checkpointed_forward_backward(model_def_struct *model_def, sequence_struct *sequence, int interval, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  unsigned long n = model_def->n_states;
+  long n_checkpoints = (sequence->len + interval - 1) / interval;
+  long i, c;
+  PROBABILITY *checkpoints, *segment, *sf;
+  backward_stream_struct stream;
+  profile_timer_struct timer;
+
+  checkpoints = alloc_table(sizeof(PROBABILITY) * n * n_checkpoints);
+  segment = alloc_table(sizeof(PROBABILITY) * n * (interval > 1 ? interval : 2));  // the forward sweep alternates between two rows
+  sf = alloc_table(sizeof(PROBABILITY) * sequence->len);
+
+  // forward sweep, alternating between the first two segment rows and keeping every interval-th row
+  profile_start(&timer);
+  sf[0] = forward_row(model_def, sequence, NULL, segment, 0);
+  memcpy(checkpoints, segment, sizeof(PROBABILITY) * n);
+  for (i = 1; i < sequence->len; i++) {
+    PROBABILITY *prev_row = segment + n * ((i - 1) % 2);
+    PROBABILITY *row = segment + n * (i % 2);
+    sf[i] = forward_row(model_def, sequence, prev_row, row, i);
+    if (i % interval == 0) memcpy(checkpoints + n * (i / interval), row, sizeof(PROBABILITY) * n);
+  }
+  profile_stop(&timer, PHASE_FORWARD);
+
+  // backward sweep, one segment at a time from the end of the sequence
+  init_backward_stream(model_def, &stream);
+  for (c = n_checkpoints - 1; c >= 0; c--) {
+    long seg_begin = c * interval;
+    long seg_end = seg_begin + interval < sequence->len ? seg_begin + interval : sequence->len;
+
+    profile_start(&timer);
+    memcpy(segment, checkpoints + n * c, sizeof(PROBABILITY) * n);
+    for (i = seg_begin + 1; i < seg_end; i++) {
+      forward_row(model_def, sequence, segment + n * (i - 1 - seg_begin), segment + n * (i - seg_begin), i);
     }
+    profile_stop(&timer, PHASE_FORWARD);
+
+    backward_posterior_segment(model_def, sequence, segment, seg_begin, seg_end, sf, columns, posterior, &stream);
   }
+
+  free_backward_stream(&stream);
+  free_table(checkpoints);
+  free_table(segment);
+  free_table(sf);
 }
 
 
-void print_most_probable_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *b_table, PROBABILITY *s) {
-  int i, j, max_index;
-  PROBABILITY max_value;
+// TRUE when every entry of a is within PARALLEL_TOLERANCE of the matching entry of b, relative to a
+BOOL rows_agree(PROBABILITY *a, PROBABILITY *b, int n) {
+  int i;
 
-  for (i = 0; i < sequence->len; i++) {
-    fprintf(model_def->output, "%d\t", i);
-    max_value = log(s[i]) + log(fetch_forward_prob(model_def, sequence, f_table, i, 0)) + log(fetch_backward_prob(model_def, sequence, b_table, i, 0));
-    max_index = 0;
-    for (j = 1; j < model_def->n_states; j++) {
-      PROBABILITY p = log(s[i]) + log(fetch_forward_prob(model_def, sequence, f_table, i, j)) + log(fetch_backward_prob(model_def, sequence, b_table, i, j));
-      if (p > max_value) {
-        max_value = p;
-        max_index = j;
-      }
+  for (i = 0; i < n; i++) {
+    if (fabs(a[i] - b[i]) > PARALLEL_TOLERANCE * fabs(a[i])) return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+long boundary_state_checkpoints(boundary_state_struct *state) {
+  return (state->len + state->phase + state->interval - 1) / state->interval;
+}
+
+
+boundary_state_struct *alloc_boundary_state(model_def_struct *model_def, long len, int interval, long phase, int n_columns) {
+  boundary_state_struct *state = ALLOC(sizeof(boundary_state_struct));
+  long n_checkpoints;
+
+  state->len = len;
+  state->phase = phase;
+  state->n_states = model_def->n_states;
+  state->interval = interval;
+  state->n_columns = n_columns;
+  n_checkpoints = boundary_state_checkpoints(state);
+  state->fingerprint = 0;
+  state->sf = alloc_table(sizeof(PROBABILITY) * len);
+  state->sb = alloc_table(sizeof(PROBABILITY) * len);
+  state->f_rows = alloc_table(sizeof(PROBABILITY) * model_def->n_states * n_checkpoints);
+  state->b_rows = alloc_table(sizeof(PROBABILITY) * model_def->n_states * n_checkpoints);
+  state->posterior = alloc_table(sizeof(PROBABILITY) * n_columns * len);
+  state->scaling = NULL;
+  state->valid = FALSE;
+
+  return state;
+}
+
+
+void free_boundary_state(boundary_state_struct *state) {
+  free_table(state->sf);
+  free_table(state->sb);
+  free_table(state->f_rows);
+  free_table(state->b_rows);
+  free_table(state->posterior);
+  free_position_scaling(state->scaling);
+  free(state);
+}
+
+
+unsigned long fingerprint_bytes(unsigned long hash, const void *data, size_t size) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  size_t i;
+
+  // FNV-1a
+  for (i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211UL;
+  }
+  return hash;
+}
+
+
+unsigned long model_fingerprint(model_def_struct *model_def, posterior_columns_struct *columns) {
+  unsigned long hash = 14695981039346656037UL;
+  state_range_struct *range;
+  int i, e;
+
+  hash = fingerprint_bytes(hash, &model_def->n_states, sizeof(int));
+  hash = fingerprint_bytes(hash, model_def->initial_probs, sizeof(PROBABILITY) * model_def->silent_states_begin);
+  hash = fingerprint_bytes(hash, model_def->emission_matrix, sizeof(PROBABILITY) * model_def->alphabet_length * model_def->n_states);
+  for (e = 0; e < model_def->n_edges; e++) {
+    hash = fingerprint_bytes(hash, &model_def->parent_edge_pool[e].state, sizeof(int));
+    hash = fingerprint_bytes(hash, &model_def->parent_edge_pool[e].prob, sizeof(PROBABILITY));
+  }
+  for (i = 0; i < model_def->n_fixed_states; i++) {
+    hash = fingerprint_bytes(hash, &model_def->fixed_states[i].position_from, sizeof(int));
+    hash = fingerprint_bytes(hash, &model_def->fixed_states[i].position_to, sizeof(int));
+    for (range = model_def->fixed_states[i].state_ranges; range; range = range->next_range) {
+      hash = fingerprint_bytes(hash, &range->state_from, sizeof(int));
+      hash = fingerprint_bytes(hash, &range->state_to, sizeof(int));
     }
-    fprintf(model_def->output, "%d\n", max_index);
   }
+  for (i = 0; i < columns->n_columns; i++) {
+    for (range = columns->ranges[i]; range; range = range->next_range) {
+      hash = fingerprint_bytes(hash, &range->state_from, sizeof(int));
+      hash = fingerprint_bytes(hash, &range->state_to, sizeof(int));
+    }
+    hash = fingerprint_bytes(hash, "", 1);
+  }
+
+  return hash;
 }
 
 
-PROBABILITY A_kl(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, int n_seqs, int k, int l) {
-  int i, j;
-  PROBABILITY sum = 0;
-  PROBABILITY transition_prob = fetch_transition_prob(model_def, k, l);
+unsigned long run_fingerprint(model_def_struct *model_def, sequence_struct *sequence, posterior_columns_struct *columns) {
+  unsigned long hash = model_fingerprint(model_def, columns);
+  long pos;
 
-  for (j = 0; j < n_seqs; j++) {
-    for (i = 0; i < sequence[j]->len - 1; i++) {
-      PROBABILITY emission_prob = fetch_emission_prob(model_def, l, sequence[j]->seq[i + 1]);
-      PROBABILITY f_i = fetch_forward_prob(model_def, sequence[j], f_table[j], i, k);
-      PROBABILITY b_i = fetch_backward_prob(model_def, sequence[j], b_table[j], i + 1, l);
-      sum += f_i * transition_prob * emission_prob * b_i;
+  hash = fingerprint_bytes(hash, &sequence->len, sizeof(long));
+  for (pos = 0; pos < sequence->len; pos++) {
+    char chr = fetch_symbol(sequence, pos);
+    hash = fingerprint_bytes(hash, &chr, 1);
+  }
+
+  return hash;
+}
+
+
+static void write_state_section(FILE *f, const void *data, size_t size, char *filename) {
+  if (size > 0 && fwrite(data, size, 1, f) != 1) {
+    fprintf(stderr, "Error writing %s.  Exiting.\n", filename);
+    exit(1);
+  }
+}
+
+
+static void read_state_section(FILE *f, void *data, size_t size, char *filename) {
+  if (size > 0 && fread(data, size, 1, f) != 1) {
+    fprintf(stderr, "%s is truncated.\n", filename);
+    exit(1);
+  }
+}
+
+
+void fwrite_boundary_state(FILE *f, boundary_state_struct *state, char *filename) {
+  boundary_state_header_struct header;
+  long n_checkpoints = boundary_state_checkpoints(state);
+  position_scaling_struct *scaling = state->scaling;
+  scaling_cursor_struct cursor;
+  const PROBABILITY *factors;
+  PROBABILITY *ones;
+  long pos, end, n_runs = 0;
+  int i;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BOUNDARY_STATE_MAGIC, sizeof(header.magic));
+  header.version = BOUNDARY_STATE_VERSION;
+  header.n_states = state->n_states;
+  header.interval = state->interval;
+  header.n_columns = state->n_columns;
+  header.len = state->len;
+  header.fingerprint = state->fingerprint;
+  header.scaling_columns = scaling ? scaling->n_columns : 0;
+  header.phase = state->phase;
+  init_scaling_cursor(&cursor);
+  for (pos = 0; scaling && pos < scaling->len; pos = end, n_runs++) seek_scaling_cursor(&cursor, scaling, pos, &end);
+  header.scaling_runs = n_runs;
+
+  write_state_section(f, &header, sizeof(header), filename);
+  write_state_section(f, state->sf, sizeof(PROBABILITY) * state->len, filename);
+  write_state_section(f, state->sb, sizeof(PROBABILITY) * state->len, filename);
+  write_state_section(f, state->f_rows, sizeof(PROBABILITY) * state->n_states * n_checkpoints, filename);
+  write_state_section(f, state->b_rows, sizeof(PROBABILITY) * state->n_states * n_checkpoints, filename);
+  write_state_section(f, state->posterior, sizeof(PROBABILITY) * state->n_columns * state->len, filename);
+  if (scaling) {
+    ones = ALLOC(sizeof(PROBABILITY) * scaling->n_columns);
+    for (i = 0; i < scaling->n_columns; i++) ones[i] = 1.0;
+    write_state_section(f, scaling->states, sizeof(int) * scaling->n_columns, filename);
+    for (pos = 0; pos < scaling->len; pos = end) {
+      factors = seek_scaling_cursor(&cursor, scaling, pos, &end);
+      write_state_section(f, &pos, sizeof(long), filename);
+      write_state_section(f, factors ? factors : ones, sizeof(PROBABILITY) * scaling->n_columns, filename);
     }
+    free(ones);
+  }
+  free_scaling_cursor(&cursor);
+}
+
+
+void write_boundary_state(char *filename, boundary_state_struct *state) {
+  FILE *f;
+
+  if (!(f = fopen(filename, "w"))) {
+    fprintf(stderr, "Opening %s for writing failed.\n", filename);
+    exit(1);
+  }
+  fwrite_boundary_state(f, state, filename);
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Error writing %s.  Exiting.\n", filename);
+    exit(1);
   }
+}
+
+
+boundary_state_struct *fread_boundary_state(FILE *f, char *filename) {
+  boundary_state_header_struct header;
+  boundary_state_struct *state;
+  long n_checkpoints, r, run_begin;
+
+  read_state_section(f, &header, sizeof(header), filename);
+  if (memcmp(header.magic, BOUNDARY_STATE_MAGIC, sizeof(header.magic)) != 0 || header.version != BOUNDARY_STATE_VERSION) {
+    fprintf(stderr, "%s is not a version %d boundary state file.\n", filename, BOUNDARY_STATE_VERSION);
+    exit(1);
+  }
+
+  state = ALLOC(sizeof(boundary_state_struct));
+  state->len = header.len;
+  state->phase = header.phase;
+  state->n_states = header.n_states;
+  state->interval = header.interval;
+  state->n_columns = header.n_columns;
+  state->fingerprint = header.fingerprint;
+  n_checkpoints = boundary_state_checkpoints(state);
+  state->sf = alloc_table(sizeof(PROBABILITY) * state->len);
+  state->sb = alloc_table(sizeof(PROBABILITY) * state->len);
+  state->f_rows = alloc_table(sizeof(PROBABILITY) * state->n_states * n_checkpoints);
+  state->b_rows = alloc_table(sizeof(PROBABILITY) * state->n_states * n_checkpoints);
+  state->posterior = alloc_table(sizeof(PROBABILITY) * state->n_columns * state->len);
+  read_state_section(f, state->sf, sizeof(PROBABILITY) * state->len, filename);
+  read_state_section(f, state->sb, sizeof(PROBABILITY) * state->len, filename);
+  read_state_section(f, state->f_rows, sizeof(PROBABILITY) * state->n_states * n_checkpoints, filename);
+  read_state_section(f, state->b_rows, sizeof(PROBABILITY) * state->n_states * n_checkpoints, filename);
+  read_state_section(f, state->posterior, sizeof(PROBABILITY) * state->n_columns * state->len, filename);
+
+  state->scaling = NULL;
+  if (header.scaling_columns > 0) {
+    int *states = ALLOC(sizeof(int) * header.scaling_columns);
+    PROBABILITY *factors = ALLOC(sizeof(PROBABILITY) * header.scaling_columns);
+    scaling_builder_struct *builder = begin_position_scaling(header.scaling_columns, states, state->len);
+    read_state_section(f, states, sizeof(int) * header.scaling_columns, filename);
+    for (r = 0; r < header.scaling_runs; r++) {
+      read_state_section(f, &run_begin, sizeof(long), filename);
+      read_state_section(f, factors, sizeof(PROBABILITY) * header.scaling_columns, filename);
+      add_scaling_position(builder, run_begin, factors);
+    }
+    state->scaling = finish_position_scaling(builder);
+    free(states);
+    free(factors);
+  }
+
+  state->valid = TRUE;
+  return state;
+}
+
+
+boundary_state_struct *read_boundary_state(char *filename) {
+  boundary_state_struct *state;
+  FILE *f;
+
+  if (!(f = fopen(filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", filename);
+    exit(1);
+  }
+  state = fread_boundary_state(f, filename);
+  fclose(f);
+  return state;
+}
+
+
+// factor of state among factors of scaling (NULL when they're all 1), 1 when no column scales it
+static PROBABILITY scaling_factor_of(position_scaling_struct *scaling, const PROBABILITY *factors, int state) {
+  int i;
+
+  if (!factors) return 1.0;
+  for (i = 0; i < scaling->n_columns; i++) {
+    if (scaling->states[i] == state) return factors[i];
+  }
+  return 1.0;
+}
+
+
+static BOOL scaling_factors_differ(position_scaling_struct *a, const PROBABILITY *fa, position_scaling_struct *b, const PROBABILITY *fb) {
+  int i;
+
+  for (i = 0; a && i < a->n_columns; i++) {
+    if (scaling_factor_of(a, fa, a->states[i]) != (b ? scaling_factor_of(b, fb, a->states[i]) : 1.0)) return TRUE;
+  }
+  for (i = 0; b && i < b->n_columns; i++) {
+    if (scaling_factor_of(b, fb, b->states[i]) != (a ? scaling_factor_of(a, fa, b->states[i]) : 1.0)) return TRUE;
+  }
+  return FALSE;
+}
+
+
+BOOL scaling_difference_at(position_scaling_struct *a, long a_from, position_scaling_struct *b, long b_from, long len, long *first, long *last) {
+  scaling_cursor_struct ca, cb;
+  const PROBABILITY *fa = NULL, *fb = NULL;
+  long pos = 0, end;
+  BOOL differ = FALSE;
+
+  init_scaling_cursor(&ca);
+  init_scaling_cursor(&cb);
+
+  // walk both together; until either's factors may change, every factor is constant
+  while (pos < len) {
+    long next = len;
+    if (a) {
+      fa = seek_scaling_cursor(&ca, a, a_from + pos, &end);
+      if (end - a_from < next) next = end - a_from;
+    }
+    if (b) {
+      fb = seek_scaling_cursor(&cb, b, b_from + pos, &end);
+      if (end - b_from < next) next = end - b_from;
+    }
+
+    if (scaling_factors_differ(a, fa, b, fb)) {
+      if (!differ) *first = pos;
+      *last = next - 1;
+      differ = TRUE;
+    }
+
+    pos = next;
+  }
+
+  free_scaling_cursor(&ca);
+  free_scaling_cursor(&cb);
+  return differ;
+}
+
+
+BOOL scaling_difference(position_scaling_struct *a, position_scaling_struct *b, long len, long *first, long *last) {
+  return scaling_difference_at(a, 0, b, 0, len, first, last);
+}
+
+
+void refresh_forward_backward(model_def_struct *model_def, sequence_struct *sequence, boundary_state_struct *state, long first, long last, posterior_columns_struct *columns, long *from, long *to) {
+  unsigned long n = model_def->n_states;
+  long len = sequence->len, k = state->interval, phase = state->phase;
+  long p, p0, top, c;
+  PROBABILITY *rows, *prev, *row, *tmp, *segment, log_sr;
+  profile_timer_struct timer;
+  double t;
+
+  if (!state->valid) {
+    first = 0;
+    last = len - 1;
+  }
+  rows = ALLOC(sizeof(PROBABILITY) * n * 2);
+  segment = alloc_table(sizeof(PROBABILITY) * n * k);
+
+  // an element beginning at first is entered from the silent states of row first - 1
+  profile_start(&timer);
+  p0 = first > 0 ? first - 1 : 0;
+  prev = rows;
+  row = rows + n;
+  if (p0 > 0) {
+    // the rows before p0 are unchanged: rebuild row p0 - 1 from its checkpoint, or from row 0 before the first
+    c = (p0 - 1 + phase) / k;
+    if (c * k - phase < 0) forward_row(model_def, sequence, NULL, prev, 0);
+    else memcpy(prev, state->f_rows + n * c, sizeof(PROBABILITY) * n);
+    for (p = c * k - phase > 0 ? c * k - phase + 1 : 1; p < p0; p++) {
+      forward_row(model_def, sequence, prev, row, p);
+      tmp = prev;
+      prev = row;
+      row = tmp;
+    }
+  }
+  for (p = p0; p < len; p++) {
+    state->sf[p] = forward_row(model_def, sequence, p > 0 ? prev : NULL, row, p);
+    if ((p + phase) % k == 0) {
+      if (state->valid && p > last && rows_agree(row, state->f_rows + n * ((p + phase) / k), n)) break;
+      memcpy(state->f_rows + n * ((p + phase) / k), row, sizeof(PROBABILITY) * n);
+    }
+    tmp = prev;
+    prev = row;
+    row = tmp;
+  }
+  top = p < len ? p : len - 1;
+  profile_stop(&timer, PHASE_FORWARD);
+
+  // log_sr of top + 1, from the scale factors after it, which this run hasn't changed
+  for (log_sr = 0, p = len - 1; p > top + 1; p--) log_sr += log(state->sb[p]) - log(state->sf[p]);
+
+  // the backward row after top is also unchanged
+  profile_start(&timer);
+  prev = rows;
+  row = rows + n;
+  if (top < len - 1) {
+    c = (top + 1 + phase + k - 1) / k;
+    if (c * k - phase < len) {
+      memcpy(prev, state->b_rows + n * c, sizeof(PROBABILITY) * n);
+      p = c * k - phase - 1;
+    } else {
+      backward_row(model_def, sequence, NULL, prev, len - 1);
+      p = len - 2;
+    }
+    for (; p > top; p--) {
+      backward_row(model_def, sequence, prev, row, p);
+      tmp = prev;
+      prev = row;
+      row = tmp;
+    }
+  }
+  profile_stop(&timer, PHASE_BACKWARD);
+
+  // backward rows and posteriors, one forward segment at a time
+  for (c = (top + phase) / k, p = top; c >= 0 && p >= 0; c--) {
+    long seg_begin = c * k - phase > 0 ? c * k - phase : 0, i;
+
+    profile_start(&timer);
+    if (c * k - phase < 0) forward_row(model_def, sequence, NULL, segment, 0);
+    else memcpy(segment, state->f_rows + n * c, sizeof(PROBABILITY) * n);
+    for (i = seg_begin + 1; i <= p; i++) {
+      forward_row(model_def, sequence, segment + n * (i - 1 - seg_begin), segment + n * (i - seg_begin), i);
+    }
+    profile_stop(&timer, PHASE_FORWARD);
+
+    profile_start(&timer);
+    for (; p >= seg_begin; p--) {
+      PROBABILITY sb = backward_row(model_def, sequence, p < len - 1 ? prev : NULL, row, p);
+      if (p < len - 1) log_sr += log(state->sb[p + 1]) - log(state->sf[p + 1]);
+      state->sb[p] = sb;
+      if (profiling) t = profile_wall_clock();
+      sum_posterior_row(columns, segment + n * (p - seg_begin), row, POSTERIOR_SCALE(sb, log_sr), state->posterior + (unsigned long)columns->n_columns * p);
+      if (profiling) timer.nested += profile_wall_clock() - t;
+      tmp = prev;
+      prev = row;
+      row = tmp;
+      if ((p + phase) % k == 0) {
+        if (state->valid && p < first && rows_agree(prev, state->b_rows + n * ((p + phase) / k), n)) break;
+        memcpy(state->b_rows + n * ((p + phase) / k), prev, sizeof(PROBABILITY) * n);
+      }
+    }
+    profile_stop_nested(&timer, PHASE_BACKWARD, PHASE_POSTERIOR);
+    if (p >= seg_begin) break;
+  }
+
+  *from = p > 0 ? p : 0;
+  *to = top;
+  state->valid = TRUE;
+
+  free(rows);
+  free_table(segment);
+}
+
+/* fills one chunk of the forward (or reversed backward) table.  on the speculative pass every chunk but the one
+   at the start of the recursion starts PARALLEL_WARMUP positions early from an initial row, since the model
+   forgets where it started long before the chunk boundary.  on a repair pass the chunk is recomputed from the
+   true boundary row until its rows agree with the stored ones, after which the stored rows (and scaling factors)
+   are correct as well and are kept.
+*/
+void *sequence_chunk_thread(void *arg) {
+  sequence_chunk_struct *chunk = (sequence_chunk_struct *)arg;
+  model_def_struct *model_def = chunk->model_def;
+  sequence_struct *sequence = chunk->sequence;
+  unsigned long n = model_def->n_states;
+  PROBABILITY *prev, *row;
+  profile_timer_struct timer;
+  long p, first, last, step;
+
+  // positions are visited from first to last, in the direction of the recursion
+  first = chunk->forward ? chunk->from : chunk->to - 1;
+  last = chunk->forward ? chunk->to - 1 : chunk->from;
+  step = chunk->forward ? 1 : -1;
+  #define CHUNK_ROW(pos) (chunk->table + n * (unsigned long)(chunk->forward ? (pos) : sequence->len - (pos) - 1))
+
+  chunk->end_changed = TRUE;
+  profile_start(&timer);
+
+  if (chunk->speculative) {
+    if (chunk->forward && first == 0) {
+      chunk->s[0] = forward_initial_row(model_def, sequence, CHUNK_ROW(0), 0);
+    } else if (!chunk->forward && first == sequence->len - 1) {
+      chunk->s[first] = backward_initial_row(model_def, sequence, CHUNK_ROW(first), first);
+    } else {
+      long warm = first - step * PARALLEL_WARMUP;
+      if (warm < 0) warm = 0;
+      if (warm > sequence->len - 1) warm = sequence->len - 1;
+
+      prev = chunk->scratch;
+      row = chunk->scratch + n;
+      if (chunk->forward) forward_initial_row(model_def, sequence, prev, warm);
+      else backward_initial_row(model_def, sequence, prev, warm);
+      for (p = warm + step; p != first; p += step) {
+        if (chunk->forward) forward_row(model_def, sequence, prev, row, p);
+        else backward_row(model_def, sequence, prev, row, p);
+        PROBABILITY *tmp = prev;
+        prev = row;
+        row = tmp;
+      }
+      chunk->s[first] = chunk->forward ? forward_row(model_def, sequence, prev, CHUNK_ROW(first), first) : backward_row(model_def, sequence, prev, CHUNK_ROW(first), first);
+    }
+
+    for (p = first + step; p != last + step; p += step) {
+      chunk->s[p] = chunk->forward ? forward_row(model_def, sequence, CHUNK_ROW(p - step), CHUNK_ROW(p), p) : backward_row(model_def, sequence, CHUNK_ROW(p - step), CHUNK_ROW(p), p);
+    }
+    profile_stop(&timer, chunk->forward ? PHASE_FORWARD : PHASE_BACKWARD);
+    return NULL;
+  }
+
+  prev = chunk->boundary;
+  for (p = first; p != last + step; p += step) {
+    PROBABILITY s;
+    row = chunk->scratch + n * (prev == chunk->scratch);
+    s = chunk->forward ? forward_row(model_def, sequence, prev, row, p) : backward_row(model_def, sequence, prev, row, p);
+    // a row that agrees can still have been reached with a different scale (a fixed position resets the row whatever led to it)
+    chunk->s[p] = s;
+    if (rows_agree(row, CHUNK_ROW(p), n)) {
+      chunk->end_changed = FALSE;
+      break;
+    }
+    memcpy(CHUNK_ROW(p), row, sizeof(PROBABILITY) * n);
+    prev = row;
+  }
+
+  #undef CHUNK_ROW
+  profile_stop(&timer, chunk->forward ? PHASE_FORWARD : PHASE_BACKWARD);
+  return NULL;
+}
+
+
+void run_chunk_threads(sequence_chunk_struct *chunks, BOOL *active, int n_chunks) {
+  pthread_t *threads = ALLOC(sizeof(pthread_t) * n_chunks);
+  int c;
+
+  for (c = 0; c < n_chunks; c++) {
+    if (active[c]) pthread_create(threads + c, NULL, sequence_chunk_thread, chunks + c);
+  }
+  for (c = 0; c < n_chunks; c++) {
+    if (active[c]) pthread_join(threads[c], NULL);
+  }
+
+  free(threads);
+}
+
+
+/* fills a whole forward (or reversed backward) table with n_chunks threads.  after the speculative pass, each
+   chunk is repaired from the last row of its predecessor (in the direction of the recursion); a chunk only has
+   to be repaired again if that row changed while it was being repaired itself, so this usually takes a single
+   repair pass and never more than n_chunks.
+*/
+void parallel_table_fill(model_def_struct *model_def, sequence_struct *sequence, int n_chunks, BOOL forward, PROBABILITY *table, PROBABILITY *s) {
+  unsigned long n = model_def->n_states;
+  sequence_chunk_struct *chunks;
+  BOOL *active, *repaired, any;
+  int c;
+
+  chunks = ALLOC(sizeof(sequence_chunk_struct) * n_chunks);
+  active = ALLOC(sizeof(BOOL) * n_chunks);
+  repaired = ALLOC(sizeof(BOOL) * n_chunks);
+
+  for (c = 0; c < n_chunks; c++) {
+    chunks[c].model_def = model_def;
+    chunks[c].sequence = sequence;
+    chunks[c].table = table;
+    chunks[c].s = s;
+    chunks[c].from = sequence->len * c / n_chunks;
+    chunks[c].to = sequence->len * (c + 1) / n_chunks;
+    chunks[c].forward = forward;
+    chunks[c].speculative = TRUE;
+    chunks[c].scratch = ALLOC(sizeof(PROBABILITY) * n * 2);
+    chunks[c].boundary = ALLOC(sizeof(PROBABILITY) * n);
+    active[c] = TRUE;
+  }
+  run_chunk_threads(chunks, active, n_chunks);
+
+  // chunk order along the recursion: c for forward, n_chunks - 1 - c for backward
+  #define ALONG(i) (forward ? (i) : n_chunks - 1 - (i))
+  active[ALONG(0)] = FALSE;
+  for (c = 1; c < n_chunks; c++) active[ALONG(c)] = TRUE;
+
+  do {
+    for (c = 1; c < n_chunks; c++) {
+      sequence_chunk_struct *chunk = chunks + ALONG(c);
+      if (!active[ALONG(c)]) continue;
+      // snapshot the predecessor's last row, since the predecessor may be repaired at the same time
+      long boundary_pos = forward ? chunk->from - 1 : chunk->to;
+      memcpy(chunk->boundary, table + n * (unsigned long)(forward ? boundary_pos : sequence->len - boundary_pos - 1), sizeof(PROBABILITY) * n);
+      chunk->speculative = FALSE;
+    }
+    run_chunk_threads(chunks, active, n_chunks);
+
+    any = FALSE;
+    for (c = 0; c < n_chunks; c++) repaired[c] = active[c];
+    for (c = 1; c < n_chunks; c++) {
+      active[ALONG(c)] = repaired[ALONG(c - 1)] && chunks[ALONG(c - 1)].end_changed;
+      any |= active[ALONG(c)];
+    }
+  } while (any);
+  #undef ALONG
+
+  for (c = 0; c < n_chunks; c++) {
+    free(chunks[c].scratch);
+    free(chunks[c].boundary);
+  }
+  free(chunks);
+  free(active);
+  free(repaired);
+}
+
+
+typedef struct {
+  model_def_struct *model_def;
+  sequence_struct *sequence;
+  PROBABILITY *f_table, *b_table, *sb, *log_sr;
+  posterior_columns_struct *columns;
+  PROBABILITY *posterior;
+  long from, to;
+} posterior_chunk_struct;
+
+
+void *posterior_chunk_thread(void *arg) {
+  posterior_chunk_struct *chunk = (posterior_chunk_struct *)arg;
+  unsigned long n = chunk->model_def->n_states;
+  profile_timer_struct timer;
+  long i;
+
+  profile_start(&timer);
+  for (i = chunk->from; i < chunk->to; i++) {
+    // the backward table is stored in reverse
+    sum_posterior_row(chunk->columns, chunk->f_table + n * i, chunk->b_table + n * (chunk->sequence->len - i - 1), POSTERIOR_SCALE(chunk->sb[i], chunk->log_sr[i]), chunk->posterior + (unsigned long)chunk->columns->n_columns * i);
+  }
+  profile_stop(&timer, PHASE_POSTERIOR);
+
+  return NULL;
+}
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   n_threads: number of chunks the sequence is split into, each handled by its own thread
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors, row index is sequence position
+
+   returns the log likelihood of the sequence, from the forward scaling factors
+
+   exact parallel-in-sequence forward-backward; the result matches the serial engines to within
+   PARALLEL_TOLERANCE.  keeps both full tables.
+*/
+PROBABILITY parallel_forward_backward(model_def_struct *model_def, sequence_struct *sequence, int n_threads, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  unsigned long n = model_def->n_states;
+  PROBABILITY *f_table, *b_table, *sf, *sb, *log_sr, likelihood;
+  posterior_chunk_struct *chunks;
+  pthread_t *threads;
+  int c;
+
+  if (n_threads > sequence->len) n_threads = sequence->len;
+  if (n_threads < 1) n_threads = 1;
+
+  // the chunk threads are the first to write their rows of either table, so the pages are theirs
+  f_table = alloc_table(sizeof(PROBABILITY) * n * sequence->len);
+  b_table = alloc_table(sizeof(PROBABILITY) * n * sequence->len);
+  sf = alloc_table(sizeof(PROBABILITY) * sequence->len);
+  sb = alloc_table(sizeof(PROBABILITY) * sequence->len);
+  log_sr = alloc_table(sizeof(PROBABILITY) * sequence->len);
+
+  parallel_table_fill(model_def, sequence, n_threads, TRUE, f_table, sf);
+  parallel_table_fill(model_def, sequence, n_threads, FALSE, b_table, sb);
+  calc_log_sr(sf, sb, sequence->len, log_sr);
+
+  chunks = ALLOC(sizeof(posterior_chunk_struct) * n_threads);
+  threads = ALLOC(sizeof(pthread_t) * n_threads);
+  for (c = 0; c < n_threads; c++) {
+    chunks[c].model_def = model_def;
+    chunks[c].sequence = sequence;
+    chunks[c].f_table = f_table;
+    chunks[c].b_table = b_table;
+    chunks[c].sb = sb;
+    chunks[c].log_sr = log_sr;
+    chunks[c].columns = columns;
+    chunks[c].posterior = posterior;
+    chunks[c].from = sequence->len * c / n_threads;
+    chunks[c].to = sequence->len * (c + 1) / n_threads;
+    pthread_create(threads + c, NULL, posterior_chunk_thread, chunks + c);
+  }
+  for (c = 0; c < n_threads; c++) {
+    pthread_join(threads[c], NULL);
+  }
+  likelihood = log_likelihood(&sf, &sequence, 1);
+
+  free(chunks);
+  free(threads);
+  free_table(f_table);
+  free_table(b_table);
+  free_table(sf);
+  free_table(sb);
+  free_table(log_sr);
+  return likelihood;
+}
+
+
+// worker of windowed_forward_backward(): takes windows off the pool until none are left
+void *window_pool_thread(void *arg) {
+  window_pool_struct *pool = (window_pool_struct *)arg;
+  model_def_struct *model_def = pool->model_def;
+  int n_columns = pool->columns->n_columns;
+  long max_len = pool->window + 2 * pool->overlap;
+  PROBABILITY *f_table, *sf, *posterior;
+  sequence_struct sub;
+  long w;
+
+  if (max_len > pool->sequence->len) max_len = pool->sequence->len;
+  f_table = alloc_table(forward_table_size(model_def, max_len));
+  sf = alloc_table(sizeof(PROBABILITY) * max_len);
+  posterior = alloc_table(sizeof(PROBABILITY) * n_columns * max_len);
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    w = pool->next_window++;
+    pthread_mutex_unlock(&pool->lock);
+    if (w >= pool->n_windows) break;
+
+    long core_from = w * pool->window;
+    long core_to = core_from + pool->window < pool->sequence->len ? core_from + pool->window : pool->sequence->len;
+    long from = core_from - pool->overlap > 0 ? core_from - pool->overlap : 0;
+    long to = core_to + pool->overlap < pool->sequence->len ? core_to + pool->overlap : pool->sequence->len;
+
+    // the window is a view into the whole sequence
+    sequence_view(pool->sequence, from, to - from, &sub);
+    forward_fused_posterior(model_def, &sub, f_table, sf, pool->columns, posterior);
+
+    // each window owns its core rows of the output, so no locking is needed here
+    memcpy(pool->posterior + (unsigned long)n_columns * core_from, posterior + (unsigned long)n_columns * (core_from - from), sizeof(PROBABILITY) * n_columns * (core_to - core_from));
+  }
+
+  free_table(f_table);
+  free_table(sf);
+  free_table(posterior);
+  return NULL;
+}
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   window: number of positions in the core of each window
+   overlap: number of positions each window is extended by on either side, and then discarded
+   n_threads: number of worker threads windows are handed out to
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors, stitched from the window cores
+*/
+void windowed_forward_backward(model_def_struct *model_def, sequence_struct *sequence, long window, long overlap, int n_threads, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  window_pool_struct pool;
+  pthread_t *threads;
+  int t;
+
+  if (window < 1) window = 1;
+  if (overlap < 0) overlap = 0;
+
+  pool.model_def = model_def;
+  pool.sequence = sequence;
+  pool.columns = columns;
+  pool.posterior = posterior;
+  pool.window = window;
+  pool.overlap = overlap;
+  pool.n_windows = (sequence->len + window - 1) / window;
+  pool.next_window = 0;
+  pthread_mutex_init(&pool.lock, NULL);
+
+  if (n_threads > pool.n_windows) n_threads = pool.n_windows;
+  if (n_threads < 1) n_threads = 1;
+
+  threads = ALLOC(sizeof(pthread_t) * n_threads);
+  for (t = 0; t < n_threads; t++) {
+    pthread_create(threads + t, NULL, window_pool_thread, &pool);
+  }
+  for (t = 0; t < n_threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  pthread_mutex_destroy(&pool.lock);
+  free(threads);
+}
+
+
+void print_forward_table(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s, int n) {
+  int i, j;
+  PROBABILITY constant = 0;
+
+  for (i = 0; i < sequence->len; i++) {
+    constant += log(s[i]);
+    if (i > n && i < sequence->len - n - 1) {
+      fprintf(model_def->output, "%d\t", i);
+      for (j = 0; j < model_def->n_states; j++) {
+//        PROBABILITY p = log(fetch_forward_prob(model_def, sequence, table, i, j)) + constant;
+//        p = exp(p);
+        PROBABILITY p = fetch_forward_prob(model_def, sequence, table, i, j);
+        if (j < model_def->n_states - 1) {
+          fprintf(model_def->output, "%.14f\t", p);
+        } else {
+          fprintf(model_def->output, "%.14f\n", p);
+        }
+      }
+    }
+  }
+}
+
+
+void print_backward_table(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s, int n) {
+  int i, j;
+  PROBABILITY constant = 0;
+
+  for (i = sequence->len - 1; i >= 0; i--) {
+    constant += log(s[i]);
+    if (i > n && i < sequence->len - n - 1) {
+      fprintf(model_def->output, "%d\t", (int)(sequence->len - 1 - i));
+      for (j = 0; j < model_def->n_states; j++) {
+//        PROBABILITY p = log(fetch_backward_prob(model_def, sequence, table, i, j)) + constant;
+//        p = exp(p);
+        PROBABILITY p = fetch_backward_prob(model_def, sequence, table, i, j);
+        if (j < model_def->n_states - 1) {
+          fprintf(model_def->output, "%.14f\t", p);
+        } else {
+          fprintf(model_def->output, "%.14f\n", p);
+        }
+      }
+    }
+  }
+}
+
+
+void print_posterior(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *b_table, PROBABILITY *s, int states_to_include, int n) {
+  int i, j;
+
+  for (i = 0; i < sequence->len; i++) {
+    if (i < n || i > sequence->len - n - 1) {
+      fprintf(model_def->output, "%d\t", i);
+      for (j = 0; j < states_to_include; j++) {
+        PROBABILITY p = log(s[i]) + log(fetch_forward_prob(model_def, sequence, f_table, i, j)) + log(fetch_backward_prob(model_def, sequence, b_table, i, j));
+        if (j < states_to_include - 1) {
+          fprintf(model_def->output, "%.14f\t", p);
+        } else {
+          fprintf(model_def->output, "%.14f\n", p);
+        }
+      }
+    }
+  }
+}
+
+
+void print_most_probable_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *b_table, PROBABILITY *s) {
+  int i, j, max_index;
+  PROBABILITY max_value;
+
+  for (i = 0; i < sequence->len; i++) {
+    fprintf(model_def->output, "%d\t", i);
+    max_value = log(s[i]) + log(fetch_forward_prob(model_def, sequence, f_table, i, 0)) + log(fetch_backward_prob(model_def, sequence, b_table, i, 0));
+    max_index = 0;
+    for (j = 1; j < model_def->n_states; j++) {
+      PROBABILITY p = log(s[i]) + log(fetch_forward_prob(model_def, sequence, f_table, i, j)) + log(fetch_backward_prob(model_def, sequence, b_table, i, j));
+      if (p > max_value) {
+        max_value = p;
+        max_index = j;
+      }
+    }
+    fprintf(model_def->output, "%d\n", max_index);
+  }
+}
+
+
+PROBABILITY A_kl(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, int n_seqs, int k, int l) {
+  int i, j;
+  PROBABILITY sum = 0;
+  PROBABILITY transition_prob = fetch_transition_prob(model_def, k, l);
+
+  for (j = 0; j < n_seqs; j++) {
+    for (i = 0; i < sequence[j]->len - 1; i++) {
+      PROBABILITY emission_prob = fetch_emission_prob(model_def, l, fetch_symbol(sequence[j], i + 1));
+      PROBABILITY f_i = fetch_forward_prob(model_def, sequence[j], f_table[j], i, k);
+      PROBABILITY b_i = fetch_backward_prob(model_def, sequence[j], b_table[j], i + 1, l);
+      sum += f_i * transition_prob * emission_prob * b_i;
+    }
+  }
+
+  return sum;
+}
+
+
+PROBABILITY E_kb(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, PROBABILITY **s, int n_seqs, int k, char b) {
+  int i, j;
+  PROBABILITY sum = 0;
+
+  for (j = 0; j < n_seqs; j++) {
+    for (i = 0; i < sequence[j]->len - 1; i++) {
+      if (fetch_symbol(sequence[j], i) == b) {
+        PROBABILITY f_i = fetch_forward_prob(model_def, sequence[j], f_table[j], i, k);
+        PROBABILITY b_i = fetch_backward_prob(model_def, sequence[j], b_table[j], i, k);
+        sum += s[j][i] * f_i * b_i;
+      }
+    }
+  }
+
+  return sum;
+}
+
+
+void print_transition_matrix_as_dot(model_def_struct *model_def) {
+  int i, j;
+
+  fprintf(model_def->output, "digraph G {\n  node [shape = circle];\n");
+  for (i = 0; i < model_def->n_states; i++) {
+    fprintf(model_def->output, "  node_%d [label = \"%d\"];\n", i, i);
+  }
+
+  fprintf(model_def->output, "\n");
+
+  for (i = 0; i < model_def->n_states; i++) {
+    for (j = 0; j < model_def->n_states; j++) {
+      PROBABILITY p = fetch_transition_prob(model_def, i, j);
+      if (p > 0.0) fprintf(model_def->output, "  node_%d -> node_%d [label = \"%.5f\"];\n", i, j, p);
+    }
+  }
+
+  fprintf(model_def->output, "}\n");
+}
+
+
+void print_transition_matrix(model_def_struct *model_def) {
+  int i, j;
+
+  fprintf(model_def->output, "\n\t");
+  for (i = 0; i < model_def->n_states - 1; i++) {
+    fprintf(model_def->output, "%d\t", i);
+  }
+  fprintf(model_def->output, "%d\n", i);
+
+  for (i = 0; i < model_def->n_states; i++) {
+    fprintf(model_def->output, "%d\t", i);
+    for (j = 0; j < model_def->n_states; j++) {
+      fprintf(model_def->output, "%.5f", fetch_transition_prob(model_def, i, j));
+      if (j < model_def->n_states - 1) {
+        fprintf(model_def->output, "\t");
+      } else {
+        fprintf(model_def->output, "\n");
+      }
+    }
+  }
+}
+
+
+void print_emission_matrix(model_def_struct *model_def) {
+  int i, j;
+
+  fprintf(model_def->output, "\n\t");
+  for (i = 0; i < model_def->alphabet_length - 1; i++) {
+    fprintf(model_def->output, "%d\t", i);
+  }
+  fprintf(model_def->output, "%d\n", i);
+
+  for (i = 0; i < model_def->n_states; i++) {
+    fprintf(model_def->output, "%d\t", i);
+    for (j = 0; j < model_def->alphabet_length; j++) {
+      fprintf(model_def->output, "%.5f", fetch_emission_prob(model_def, i, j));
+      if (j < model_def->alphabet_length - 1) {
+        fprintf(model_def->output, "\t");
+      } else {
+        fprintf(model_def->output, "\n");
+      }
+    }
+  }
+}
+
+
+PROBABILITY log_likelihood(PROBABILITY **s, sequence_struct **sequence, int n_seqs) {
+  int i, j;
+  PROBABILITY sum = 0;
+
+  for (i = 0; i < n_seqs; i++) {
+    for (j = 0; j < sequence[i]->len; j++) {
+      sum += log(s[i][j]);
+    }
+  }
+
+  return sum;
+}
+
+
+// next task for worker: the longest left in its own deque, or else the shortest left in someone else's
+int take_sequence_task(task_pool_struct *pool, int worker) {
+  int i, task = -1;
+
+  for (i = 0; i < pool->n_workers && task < 0; i++) {
+    task_deque_struct *deque = pool->deques + (worker + i) % pool->n_workers;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->head < deque->tail) task = i == 0 ? deque->tasks[deque->head++] : deque->tasks[--deque->tail];
+    pthread_mutex_unlock(&deque->lock);
+  }
+
+  return task;
+}
+
+
+void *sequence_task_thread(void *arg) {
+  task_worker_struct *worker = (task_worker_struct *)arg;
+  int task;
+
+  // no tasks are added once the pool runs, so empty deques everywhere means we're done
+  while ((task = take_sequence_task(worker->pool, worker->worker)) >= 0) {
+    worker->pool->run(worker->pool->arg, task, worker->worker);
+  }
+
+  return NULL;
+}
+
+
+/* INPUTS:
+   cost: relative cost of each of the n_tasks tasks
+   n_workers: size of the pool
+   run: called as run(arg, task index, worker index) once for each task, from one of the workers
+   arg: passed through to run
+
+   the tasks are dealt out most expensive first (ties in index order), round-robin, into one deque per worker, so
+   each worker starts on the biggest of its own and idle workers steal the smallest from the others.
+*/
+void run_tasks(long *cost, int n_tasks, int n_workers, void (*run)(void *, int, int), void *arg) {
+  task_pool_struct pool;
+  task_worker_struct *workers;
+  pthread_t *threads;
+  int *order, i, j;
+
+  if (n_workers > n_tasks) n_workers = n_tasks;
+  if (n_workers < 1) n_workers = 1;
+
+  // insertion sort is plenty next to a forward-backward per task
+  order = ALLOC(sizeof(int) * (n_tasks > 0 ? n_tasks : 1));
+  for (i = 0; i < n_tasks; i++) {
+    for (j = i; j > 0 && cost[order[j - 1]] < cost[i]; j--) order[j] = order[j - 1];
+    order[j] = i;
+  }
+
+  pool.n_workers = n_workers;
+  pool.run = run;
+  pool.arg = arg;
+  pool.deques = ALLOC(sizeof(task_deque_struct) * n_workers);
+  for (i = 0; i < n_workers; i++) {
+    pool.deques[i].tasks = ALLOC(sizeof(int) * (n_tasks / n_workers + 1));
+    pool.deques[i].head = pool.deques[i].tail = 0;
+    pthread_mutex_init(&pool.deques[i].lock, NULL);
+  }
+  for (i = 0; i < n_tasks; i++) {
+    task_deque_struct *deque = pool.deques + i % n_workers;
+    deque->tasks[deque->tail++] = order[i];
+  }
+
+  workers = ALLOC(sizeof(task_worker_struct) * n_workers);
+  threads = ALLOC(sizeof(pthread_t) * n_workers);
+  for (i = 0; i < n_workers; i++) {
+    workers[i].pool = &pool;
+    workers[i].worker = i;
+    pthread_create(threads + i, NULL, sequence_task_thread, workers + i);
+  }
+  for (i = 0; i < n_workers; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  for (i = 0; i < n_workers; i++) {
+    free(pool.deques[i].tasks);
+    pthread_mutex_destroy(&pool.deques[i].lock);
+  }
+  free(pool.deques);
+  free(workers);
+  free(threads);
+  free(order);
+}
+
+
+// one task per sequence, longest first
+void run_sequence_tasks(sequence_struct **sequence, int n_seqs, int n_workers, void (*run)(void *, int, int), void *arg) {
+  long *cost = ALLOC(sizeof(long) * (n_seqs > 0 ? n_seqs : 1));
+  int i;
+
+  for (i = 0; i < n_seqs; i++) cost[i] = sequence[i]->len;
+  run_tasks(cost, n_seqs, n_workers, run, arg);
+  free(cost);
+}
+
+
+typedef struct {
+  model_def_struct *model_def;
+  sequence_struct **sequence;
+  PROBABILITY **f_table, **b_table, **sf, **sb;
+} fb_tables_task_struct;
+
+
+void fb_tables_task(void *arg, int i, int worker) {
+  fb_tables_task_struct *task = (fb_tables_task_struct *)arg;
+
+  forward(task->model_def, task->sequence[i], task->f_table[i], task->sf[i]);
+  backward(task->model_def, task->sequence[i], task->sb[i], task->b_table[i]);
+}
+
+
+void fb_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, PROBABILITY **sf, PROBABILITY **sb, int n_seqs) {
+  fb_tables_task_struct task;
+
+  task.model_def = model_def;
+  task.sequence = sequence;
+  task.f_table = f_table;
+  task.b_table = b_table;
+  task.sf = sf;
+  task.sb = sb;
+
+  run_sequence_tasks(sequence, n_seqs, find_num_cpus(), fb_tables_task, &task);
+}
+
+
+typedef struct {
+  model_def_struct *model_def;
+  sequence_struct **sequence;
+  int checkpoint_interval;
+  posterior_columns_struct *columns;
+  void (*done)(void *, int, PROBABILITY *);
+  void *done_arg;
+  pthread_mutex_t done_lock;
+  scratch_table_struct *scratch;  // three per worker: forward table, scale factors and posteriors
+} posterior_task_struct;
+
+
+void posterior_task(void *arg, int i, int worker) {
+  posterior_task_struct *task = (posterior_task_struct *)arg;
+  model_def_struct *model_def = task->model_def;
+  sequence_struct *sequence = task->sequence[i];
+  scratch_table_struct *scratch = task->scratch + 3 * worker;
+  PROBABILITY *posterior = reserve_scratch_table(scratch + 2, sizeof(PROBABILITY) * task->columns->n_columns * sequence->len);
+
+  if (task->checkpoint_interval != 0) {
+    int interval = task->checkpoint_interval > 0 ? task->checkpoint_interval : default_checkpoint_interval(sequence->len);
+    checkpointed_forward_backward(model_def, sequence, interval, task->columns, posterior);
+  } else {
+    void *f_table = reserve_scratch_table(scratch, forward_table_size(model_def, sequence->len));
+    PROBABILITY *sf = reserve_scratch_table(scratch + 1, sizeof(PROBABILITY) * sequence->len);
+    forward_fused_posterior(model_def, sequence, f_table, sf, task->columns, posterior);
+  }
+
+  pthread_mutex_lock(&task->done_lock);
+  task->done(task->done_arg, i, posterior);
+  pthread_mutex_unlock(&task->done_lock);
+}
+
+
+void posterior_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, int checkpoint_interval, posterior_columns_struct *columns, void (*done)(void *, int, PROBABILITY *), void *done_arg) {
+  posterior_task_struct task;
+  int i;
+
+  task.model_def = model_def;
+  task.sequence = sequence;
+  task.checkpoint_interval = checkpoint_interval;
+  task.columns = columns;
+  task.done = done;
+  task.done_arg = done_arg;
+  pthread_mutex_init(&task.done_lock, NULL);
+  // each worker's tables grow to the longest sequence it runs, and are reused for the others
+  if (n_threads < 1) n_threads = 1;
+  task.scratch = ALLOC(sizeof(scratch_table_struct) * 3 * n_threads);
+  memset(task.scratch, 0, sizeof(scratch_table_struct) * 3 * n_threads);
+
+  run_sequence_tasks(sequence, n_seqs, n_threads, posterior_task, &task);
+
+  for (i = 0; i < 3 * n_threads; i++) free_scratch_table(task.scratch + i);
+  free(task.scratch);
+  pthread_mutex_destroy(&task.done_lock);
+}
+
+
+size_t model_memory(model_def_struct *model_def) {
+  size_t n = model_def->n_states, n_edges = model_def->n_edges > 0 ? model_def->n_edges : 1, a = model_def->alphabet_length;
+  size_t bytes;
+
+  // per-state pointers into the edge lists, which a compiled model builds too
+  bytes = 4 * sizeof(void *) * n;
+  if (model_def->mapping) {
+    bytes += model_def->mapping_length;
+  } else {
+    bytes += sizeof(PROBABILITY) * (model_def->silent_states_begin + a * n);  // initial_probs, emission_matrix
+    bytes += 4 * sizeof(int) * n + 2 * sizeof(int) * n_edges + 2 * sizeof(edge_struct) * n_edges + a + 1;
+  }
+
+  // finalize_model()'s per-symbol tables, and the nucleosome kernel
+  bytes += sizeof(PROBABILITY) * a * (size_t)(model_def->emission_stride > 0 ? model_def->emission_stride : n);
+  bytes += sizeof(PROBABILITY) * a * n_edges;
+  if (model_def->nuc_kernel) bytes += sizeof(PROBABILITY) * (64 + 16 * a) * model_def->nuc_kernel->n_positions;
+
+  return bytes;
+}
+
+
+size_t sequence_memory(sequence_struct *sequence) {
+  // a packed store's bases are mapped from the file, four to a byte
+  return sizeof(sequence_struct) + (sequence->seq ? sequence->len : (sequence->len + 3) / 4);
+}
+
+
+size_t scaling_memory(position_scaling_struct *scaling) {
+  size_t bytes;
+  long long first, last, begin;
+  int i;
+
+  if (!scaling) return 0;
+  bytes = sizeof(position_scaling_struct) + (sizeof(int) + sizeof(scaling_column_struct *)) * scaling->n_columns;
+  // the factors of the positions the scaling covers, whether mapped or built in memory
+  for (i = 0; i < scaling->n_columns; i++) {
+    scaling_column_struct *column = scaling->columns[i];
+    if (column->encoding == SCALING_DENSE) {
+      bytes += sizeof(float) * scaling->len;
+    } else if (scaling->len > 0) {
+      first = find_scaling_run(column, scaling->offset, &begin);
+      last = find_scaling_run(column, scaling->offset + scaling->len - 1, &begin);
+      bytes += (sizeof(long long) + sizeof(float)) * (last - first + 1) + sizeof(long long) * ((last - first) / SCALING_INDEX_STRIDE + 1);
+    }
+  }
+  return bytes;
+}
+
+
+// bytes of one sequence of length len run on the full or checkpointed engine: forward rows, scale factors and the
+// backward stream
+static size_t sequence_table_memory(model_def_struct *model_def, long len, int engine, int interval) {
+  size_t n = model_def->n_states;
+
+  if (engine == ENGINE_CHECKPOINTED) {
+    if (interval <= 0) interval = default_checkpoint_interval(len);
+    return sizeof(PROBABILITY) * n * ((len + interval - 1) / interval + (interval > 1 ? interval : 2)) + sizeof(PROBABILITY) * (len + 2 * n);
+  }
+  return forward_table_size(model_def, len) + sizeof(PROBABILITY) * (len + 2 * n);
+}
+
+
+void estimate_memory(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_columns, memory_plan_struct *plan) {
+  size_t n = model_def->n_states;
+  int i;
+
+  plan->model = model_memory(model_def);
+  plan->model_build = model_def->mapping ? 0 : sizeof(PROBABILITY) * n * n;
+  plan->sequences = sizeof(sequence_struct *) * n_seqs;
+  plan->scaling = 0;
+  for (i = 0; i < n_seqs; i++) {
+    plan->sequences += sequence_memory(sequence[i]);
+    plan->scaling += scaling_memory(sequence[i]->scaling);
+  }
+  plan->tables = plan->output = 0;
+
+  if (n_seqs > 1) {
+    // the worst case has the n_threads longest sequences running at once, each with its own table and posterior
+    long *lens = ALLOC(sizeof(long) * n_seqs);
+    for (i = 0; i < n_seqs; i++) lens[i] = sequence[i]->len;
+    qsort(lens, n_seqs, sizeof(long), cmp_longs);
+    for (i = n_seqs - 1; i >= 0 && i >= n_seqs - plan->n_threads; i--) {
+      plan->tables += sequence_table_memory(model_def, lens[i], plan->engine, plan->checkpoint_interval);
+      plan->output += sizeof(PROBABILITY) * n_columns * lens[i];
+    }
+    free(lens);
+    return;
+  }
+
+  long len = sequence[0]->len;
+  plan->output = sizeof(PROBABILITY) * n_columns * len;
+  if (plan->engine == ENGINE_PARALLEL) {
+    // both whole tables and their scale factors, plus each chunk's scratch and boundary rows
+    plan->tables = 2 * sizeof(PROBABILITY) * n * len + 3 * sizeof(PROBABILITY) * len + 3 * sizeof(PROBABILITY) * n * plan->n_threads;
+  } else if (plan->engine == ENGINE_WINDOWED) {
+    long window = plan->window > 0 ? plan->window : 1;
+    long n_windows = (len + window - 1) / window;
+    long max_len = window + 2 * (plan->overlap > 0 ? plan->overlap : 0);
+    int n_threads = plan->n_threads < n_windows ? plan->n_threads : n_windows;
+    if (max_len > len) max_len = len;
+    if (n_threads < 1) n_threads = 1;
+    plan->tables = n_threads * sequence_table_memory(model_def, max_len, ENGINE_FULL, 0);
+    plan->output += n_threads * sizeof(PROBABILITY) * n_columns * max_len;
+  } else {
+    plan->tables = sequence_table_memory(model_def, len, plan->engine, plan->checkpoint_interval);
+  }
+}
+
+
+size_t plan_total(memory_plan_struct *plan) {
+  size_t run = plan->tables + plan->output;
+  return plan->model + plan->sequences + plan->scaling + plan->reserved + (plan->model_build > run ? plan->model_build : run);
+}
+
+
+// estimates candidate, and makes it the plan if it fits and is faster than the plan so far.  cost is the run time
+// relative to one whole-table thread
+static BOOL consider_engine(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_columns, size_t limit, memory_plan_struct *candidate, double cost, memory_plan_struct *plan, double *best_cost) {
+  estimate_memory(model_def, sequence, n_seqs, n_columns, candidate);
+  if (plan_total(candidate) > limit || cost >= *best_cost) return FALSE;
+  *plan = *candidate;
+  *best_cost = cost;
+  return TRUE;
+}
+
+
+BOOL plan_memory(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_columns, int max_threads, long overlap, size_t limit, memory_plan_struct *plan) {
+  memory_plan_struct candidate;
+  double best_cost = HUGE_VAL;
+  BOOL doubles = model_def->table_precision == TABLE_DOUBLE;  // the checkpointed and parallel engines only keep doubles
+  int t;
+
+  if (max_threads < 1) max_threads = 1;
+  if (n_seqs > 1 && max_threads > n_seqs) max_threads = n_seqs;
+  memset(&candidate, 0, sizeof(memory_plan_struct));
+  candidate.reserved = plan->reserved;
+  candidate.overlap = overlap;
+
+  // recomputing every forward segment makes the checkpointed engine about half again as slow.  a batch runs either
+  // on each of its threads, a single sequence on one, or split between threads by parallel_forward_backward()
+  for (t = n_seqs > 1 ? max_threads : 1; t >= 1; t--) {
+    candidate.n_threads = t;
+    candidate.engine = ENGINE_FULL;
+    consider_engine(model_def, sequence, n_seqs, n_columns, limit, &candidate, 1.0 / t, plan, &best_cost);
+    if (doubles) {
+      candidate.engine = ENGINE_CHECKPOINTED;
+      consider_engine(model_def, sequence, n_seqs, n_columns, limit, &candidate, 1.5 / t, plan, &best_cost);
+    }
+  }
+  if (n_seqs == 1 && doubles) {
+    candidate.engine = ENGINE_PARALLEL;
+    for (t = max_threads; t > 1; t--) {
+      candidate.n_threads = t;
+      consider_engine(model_def, sequence, n_seqs, n_columns, limit, &candidate, 1.0 / t, plan, &best_cost);
+    }
+  }
+  if (best_cost < HUGE_VAL) return TRUE;
+
+  if (n_seqs == 1) {
+    // windows only approximate the whole sequence, so they're the last resort: each as long as fits beside the
+    // output, with at least one core position
+    long len = sequence[0]->len;
+    size_t n = model_def->n_states;
+    size_t per_position = forward_table_size(model_def, 1) + sizeof(PROBABILITY) * (1 + n_columns);
+    size_t output = sizeof(PROBABILITY) * n_columns * len;
+    size_t fixed;
+
+    candidate.engine = ENGINE_WINDOWED;
+    candidate.n_threads = 1;
+    candidate.window = 1;
+    estimate_memory(model_def, sequence, n_seqs, n_columns, &candidate);
+    fixed = candidate.model + candidate.sequences + candidate.scaling + candidate.reserved;
+    for (t = max_threads; t >= 1; t--) {
+      if (fixed + output + t * 2 * sizeof(PROBABILITY) * n >= limit) continue;
+      long max_len = ((limit - fixed - output) / t - 2 * sizeof(PROBABILITY) * n) / per_position;
+      long window = max_len - 2 * overlap;
+      long share = (len + t - 1) / t;
+      if (window > share) window = share;
+      if (window < 1) continue;
+      candidate.n_threads = t;
+      candidate.window = window;
+      consider_engine(model_def, sequence, n_seqs, n_columns, limit, &candidate, (double)(window + 2 * overlap) / window / t, plan, &best_cost);
+    }
+    if (best_cost < HUGE_VAL) return TRUE;
+  }
+
+  // nothing fits: report the exact engine needing the least
+  candidate.engine = doubles ? ENGINE_CHECKPOINTED : ENGINE_FULL;
+  candidate.n_threads = 1;
+  candidate.window = 0;
+  estimate_memory(model_def, sequence, n_seqs, n_columns, &candidate);
+  *plan = candidate;
+  return FALSE;
+}
+
+// a --mem-limit: bytes, or K, M, G or T of 1024-based units.  0 if it isn't one
+size_t parse_byte_count(char *str) {
+  char *end;
+  double count = strtod(str, &end);
+  double unit = 1;
+
+  switch (toupper(*end)) {
+    case 'T': unit *= 1024;
+      /* fallthrough */
+    case 'G': unit *= 1024;
+      /* fallthrough */
+    case 'M': unit *= 1024;
+      /* fallthrough */
+    case 'K': unit *= 1024;
+      end++;
+      if (toupper(*end) == 'B') end++;
+      break;
+    case 'B':
+      end++;
+      break;
+  }
+  if (end == str || *end != '\0' || count <= 0) return 0;
+  return (size_t)(count * unit);
+}
+
+
+void distributor_edge_scale(model_def_struct *model_def, sequence_struct *sequence, long pos, PROBABILITY *edge_scale) {
+  const PROBABILITY *normal_factors, *silent_factors = NULL;
+  int c;
+
+  if (!sequence->scaling) return;
+
+  // the factors position_scaling() returns only last until its next call
+  normal_factors = position_scaling(sequence, pos);
+  for (c = 0; c < sequence->scaling->n_columns; c++) {
+    int state = sequence->scaling->states[c];
+    if (state < model_def->silent_states_begin) edge_scale[state] = normal_factors ? normal_factors[c] : 1.0;
+  }
+  if (pos + 1 < sequence->len) silent_factors = position_scaling(sequence, pos + 1);
+  for (c = 0; c < sequence->scaling->n_columns; c++) {
+    int state = sequence->scaling->states[c];
+    if (state >= model_def->silent_states_begin) edge_scale[state] = silent_factors ? silent_factors[c] : 1.0;
+  }
+}
+
+
+expected_counts_struct *alloc_expected_counts(model_def_struct *model_def) {
+  expected_counts_struct *counts = ALLOC(sizeof(expected_counts_struct));
+
+  counts->transitions = ALLOC(sizeof(PROBABILITY) * (model_def->n_edges > 0 ? model_def->n_edges : 1));
+  counts->emissions = ALLOC(sizeof(PROBABILITY) * model_def->silent_states_begin * model_def->alphabet_length);
+  clear_expected_counts(model_def, counts);
+
+  return counts;
+}
+
+
+void clear_expected_counts(model_def_struct *model_def, expected_counts_struct *counts) {
+  memset(counts->transitions, 0, sizeof(PROBABILITY) * model_def->n_edges);
+  memset(counts->emissions, 0, sizeof(PROBABILITY) * model_def->silent_states_begin * model_def->alphabet_length);
+  counts->log_likelihood = 0;
+}
+
+
+void free_expected_counts(expected_counts_struct *counts) {
+  free(counts->transitions);
+  free(counts->emissions);
+  free(counts);
+}
+
+
+/* the E step for one sequence, in the same sweep as fused_backward_posterior: each backward row is reduced as soon
+   as it is produced, together with the stored forward rows at its own position and the one before.  with f and b
+   the normalized rows, sr = exp(log_sr) and scale = sb * sr as in the posterior,
+     an edge k -> l into a normal state of row i carries f[i - 1][k] * a_kl * e_l(x_i) * b[i][l] * scale / sf[i]
+     an edge k -> l into a silent state of row i carries f[i][k] * a_kl * b[i + 1][l] * sr,
+   since backward silent states precede their row's emission.  a_kl is the edge as scaled at that position, and rows
+   are already masked where positions are fixed.
+*/
+void accumulate_expected_counts(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *sf, PROBABILITY *edge_scale, expected_counts_struct *counts) {
+  unsigned long n = model_def->n_states;
+  int distributor = model_def->silent_states_begin;
+  backward_stream_struct stream;
+  PROBABILITY sb, sr, scale, *tmp;
+  profile_timer_struct timer;
+  long i;
+  int j, l;
+
+  forward(model_def, sequence, f_table, sf);
+  init_backward_stream(model_def, &stream);
+
+  // the counts are gathered as the backward rows are computed, and are charged to the backward pass
+  profile_start(&timer);
+  for (i = sequence->len - 1; i >= 0; i--) {
+    PROBABILITY *f_row = f_table + n * i, *b_row;
+    char chr = fetch_symbol(sequence, i);
+
+    sb = backward_row(model_def, sequence, stream.b_next, stream.b_row, i);
+    if (i < sequence->len - 1) stream.log_sr = stream.log_sr + log(stream.sb_next) - log(sf[i + 1]);
+    sr = exp(stream.log_sr);
+    scale = POSTERIOR_SCALE(sb, stream.log_sr);
+    b_row = stream.b_row;
+    distributor_edge_scale(model_def, sequence, i, edge_scale);
+
+    for (l = 0; l < distributor; l++) {
+      counts->emissions[l * model_def->alphabet_length + chr] += scale * f_row[l] * b_row[l];
+    }
+
+    if (i > 0) {
+      PROBABILITY *prev = f_row - n;
+      for (l = 0; l < distributor; l++) {
+        if (b_row[l] == 0) continue;
+        edge_struct *edges = model_def->parent_edges[l];
+        PROBABILITY *c = counts->transitions + (edges - model_def->parent_edge_pool);
+        PROBABILITY w = fetch_emission_prob(model_def, l, chr) * b_row[l] * exp(log(sb) + stream.log_sr - log(sf[i]));
+        for (j = 0; j < model_def->n_parents[l]; j++) {
+          PROBABILITY p = edges[j].prob;
+          if (edges[j].state == distributor) p *= edge_scale[l];
+          c[j] += prev[edges[j].state] * p * w;
+        }
+      }
+    }
+
+    // after the last emission there is nothing left to enter
+    if (i < sequence->len - 1) {
+      for (l = distributor; l < model_def->n_states; l++) {
+        if (stream.b_next[l] == 0) continue;
+        edge_struct *edges = model_def->parent_edges[l];
+        PROBABILITY *c = counts->transitions + (edges - model_def->parent_edge_pool);
+        PROBABILITY w = stream.b_next[l] * sr;
+        for (j = 0; j < model_def->n_parents[l]; j++) {
+          PROBABILITY p = edges[j].prob;
+          if (edges[j].state == distributor) p *= edge_scale[l];
+          c[j] += f_row[edges[j].state] * p * w;
+        }
+      }
+    }
+
+    tmp = stream.b_next;
+    stream.b_next = stream.b_row;
+    stream.b_row = tmp;
+    stream.sb_next = sb;
+  }
+
+  profile_stop(&timer, PHASE_BACKWARD);
+
+  for (i = 0; i < sequence->len; i++) counts->log_likelihood += log(sf[i]);
+
+  free_backward_stream(&stream);
+}
+
+
+typedef struct {
+  model_def_struct *model_def;
+  sequence_struct **sequence;
+  expected_counts_struct **worker_counts;
+  scratch_table_struct *scratch;  // two per worker: forward table and scale factors
+} counts_task_struct;
+
+
+void counts_task(void *arg, int i, int worker) {
+  counts_task_struct *task = (counts_task_struct *)arg;
+  model_def_struct *model_def = task->model_def;
+  sequence_struct *sequence = task->sequence[i];
+  PROBABILITY *f_table = reserve_scratch_table(task->scratch + 2 * worker, sizeof(PROBABILITY) * model_def->n_states * sequence->len);
+  PROBABILITY *sf = reserve_scratch_table(task->scratch + 2 * worker + 1, sizeof(PROBABILITY) * sequence->len);
+  PROBABILITY *edge_scale = ALLOC(sizeof(PROBABILITY) * model_def->n_states);
+  int j;
 
-  return sum;
-}
+  for (j = 0; j < model_def->n_states; j++) edge_scale[j] = 1.0;
+  accumulate_expected_counts(model_def, sequence, f_table, sf, edge_scale, task->worker_counts[worker]);
 
+  free(edge_scale);
+}
 
-PROBABILITY E_kb(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, PROBABILITY **s, int n_seqs, int k, char b) {
-  int i, j;
-  PROBABILITY sum = 0;
 
-  for (j = 0; j < n_seqs; j++) {
-    for (i = 0; i < sequence[j]->len - 1; i++) {
-      if (sequence[j]->seq[i] == b) {
-        PROBABILITY f_i = fetch_forward_prob(model_def, sequence[j], f_table[j], i, k);
-        PROBABILITY b_i = fetch_backward_prob(model_def, sequence[j], b_table[j], i, k);
-        sum += s[j][i] * f_i * b_i;
-      }
-    }
+void expected_counts_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, expected_counts_struct *counts) {
+  counts_task_struct task;
+  int w, k;
+
+  if (n_threads < 1) n_threads = 1;
+  task.model_def = model_def;
+  task.sequence = sequence;
+  task.worker_counts = ALLOC(sizeof(expected_counts_struct *) * n_threads);
+  for (w = 0; w < n_threads; w++) task.worker_counts[w] = alloc_expected_counts(model_def);
+  task.scratch = ALLOC(sizeof(scratch_table_struct) * 2 * n_threads);
+  memset(task.scratch, 0, sizeof(scratch_table_struct) * 2 * n_threads);
+
+  run_sequence_tasks(sequence, n_seqs, n_threads, counts_task, &task);
+
+  // each worker's counts are its own until here, so the sweep needs no locking
+  clear_expected_counts(model_def, counts);
+  for (w = 0; w < n_threads; w++) {
+    for (k = 0; k < model_def->n_edges; k++) counts->transitions[k] += task.worker_counts[w]->transitions[k];
+    for (k = 0; k < model_def->silent_states_begin * model_def->alphabet_length; k++) counts->emissions[k] += task.worker_counts[w]->emissions[k];
+    counts->log_likelihood += task.worker_counts[w]->log_likelihood;
+    free_expected_counts(task.worker_counts[w]);
+    free_scratch_table(task.scratch + 2 * w);
+    free_scratch_table(task.scratch + 2 * w + 1);
   }
-
-  return sum;
+  free(task.worker_counts);
+  free(task.scratch);
 }
 
 
-void print_transition_matrix_as_dot(model_def_struct *model_def) {
-  int i, j;
+void maximize_expected_counts(model_def_struct *model_def, expected_counts_struct *counts) {
+  PROBABILITY *out_count = ALLOC(sizeof(PROBABILITY) * model_def->n_states);
+  PROBABILITY *out_total = ALLOC(sizeof(PROBABILITY) * model_def->n_states);
+  int i, j, b;
 
-  fprintf(model_def->output, "digraph G {\n  node [shape = circle];\n");
+  memset(out_count, 0, sizeof(PROBABILITY) * model_def->n_states);
+  memset(out_total, 0, sizeof(PROBABILITY) * model_def->n_states);
   for (i = 0; i < model_def->n_states; i++) {
-    fprintf(model_def->output, "  node_%d [label = \"%d\"];\n", i, i);
+    edge_struct *edges = model_def->parent_edges[i];
+    PROBABILITY *c = counts->transitions + (edges - model_def->parent_edge_pool);
+    for (j = 0; j < model_def->n_parents[i]; j++) {
+      out_count[edges[j].state] += c[j];
+      out_total[edges[j].state] += edges[j].prob;
+    }
   }
 
-  fprintf(model_def->output, "\n");
-
+  /* a state's outgoing weights keep their total, 1 unless a temperature was applied.  the distributor's are the
+     concentrations, which weigh paths rather than normalize them: moving weight to whichever element is shortest
+     would always raise the likelihood, so they are left alone
+  */
   for (i = 0; i < model_def->n_states; i++) {
-    for (j = 0; j < model_def->n_states; j++) {
-      PROBABILITY p = fetch_transition_prob(model_def, i, j);
-      if (p > 0.0) fprintf(model_def->output, "  node_%d -> node_%d [label = \"%.5f\"];\n", i, j, p);
+    edge_struct *edges = model_def->parent_edges[i];
+    PROBABILITY *c = counts->transitions + (edges - model_def->parent_edge_pool);
+    for (j = 0; j < model_def->n_parents[i]; j++) {
+      int parent = edges[j].state;
+      if (parent == model_def->silent_states_begin) continue;
+      if (out_count[parent] > 0) set_transition_prob(model_def, parent, i, out_total[parent] * c[j] / out_count[parent]);
     }
   }
 
-  fprintf(model_def->output, "}\n");
+  for (i = 0; i < model_def->silent_states_begin; i++) {
+    PROBABILITY *e = counts->emissions + i * model_def->alphabet_length;
+    PROBABILITY sum = 0;
+    for (b = 0; b < model_def->alphabet_length; b++) sum += e[b];
+    if (sum <= 0) continue;
+    for (b = 0; b < model_def->alphabet_length; b++) set_emission_prob(model_def, i, b, e[b] / sum);
+  }
+
+  free(out_count);
+  free(out_total);
 }
 
 
-void print_transition_matrix(model_def_struct *model_def) {
-  int i, j;
+int baum_welch(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, PROBABILITY delta, int max_iterations, tie_func tie_counts, a0k_func update_a0k, void (*done)(void *, int, double), void *done_arg) {
+  expected_counts_struct *counts = alloc_expected_counts(model_def);
+  double previous = -INFINITY;
+  int iteration;
 
-  fprintf(model_def->output, "\n\t");
-  for (i = 0; i < model_def->n_states - 1; i++) {
-    fprintf(model_def->output, "%d\t", i);
-  }
-  fprintf(model_def->output, "%d\n", i);
+  for (iteration = 0; iteration < max_iterations; iteration++) {
+    expected_counts_on_all_seqs(model_def, sequence, n_seqs, n_threads, counts);
+    if (done) done(done_arg, iteration, counts->log_likelihood);
+    if (counts->log_likelihood - previous < delta) break;
+    previous = counts->log_likelihood;
 
-  for (i = 0; i < model_def->n_states; i++) {
-    fprintf(model_def->output, "%d\t", i);
-    for (j = 0; j < model_def->n_states; j++) {
-      fprintf(model_def->output, "%.5f", fetch_transition_prob(model_def, i, j));
-      if (j < model_def->n_states - 1) {
-        fprintf(model_def->output, "\t");
-      } else {
-        fprintf(model_def->output, "\n");
-      }
-    }
+    if (tie_counts) tie_counts(model_def, counts);
+    maximize_expected_counts(model_def, counts);
+    if (update_a0k) update_a0k(model_def);
+    refresh_nucleosome_kernel(model_def);
+    refresh_emission_tables(model_def);
   }
+
+  free_expected_counts(counts);
+  return iteration;
 }
 
+// TRUE when filename starts with COMPILED_MODEL_MAGIC
+BOOL is_compiled_model(char *filename) {
+  char magic[sizeof(((compiled_model_header_struct *)0)->magic)];
+  FILE *f = fopen(filename, "r");
+  BOOL compiled;
 
-void print_emission_matrix(model_def_struct *model_def) {
-  int i, j;
+  if (!f) return FALSE;
+  compiled = fread(magic, sizeof(magic), 1, f) == 1 && memcmp(magic, COMPILED_MODEL_MAGIC, sizeof(magic)) == 0;
+  fclose(f);
+  return compiled;
+}
 
-  fprintf(model_def->output, "\n\t");
-  for (i = 0; i < model_def->alphabet_length - 1; i++) {
-    fprintf(model_def->output, "%d\t", i);
-  }
-  fprintf(model_def->output, "%d\n", i);
 
-  for (i = 0; i < model_def->n_states; i++) {
-    fprintf(model_def->output, "%d\t", i);
-    for (j = 0; j < model_def->alphabet_length; j++) {
-      fprintf(model_def->output, "%.5f", fetch_emission_prob(model_def, i, j));
-      if (j < model_def->alphabet_length - 1) {
-        fprintf(model_def->output, "\t");
-      } else {
-        fprintf(model_def->output, "\n");
-      }
-    }
-  }
+// bytes each section of a compiled model with these counts holds, before padding
+static void compiled_section_sizes(compiled_model_header_struct *header, size_t *size) {
+  size_t n_states = header->n_states, n_edges = header->n_edges;
+
+  size[COMPILED_ALPHABET] = header->alphabet_length;
+  size[COMPILED_INITIAL_PROBS] = sizeof(PROBABILITY) * header->silent_states_begin;
+  size[COMPILED_EMISSION_MATRIX] = sizeof(PROBABILITY) * header->alphabet_length * n_states;
+  size[COMPILED_N_PARENTS] = sizeof(int) * n_states;
+  size[COMPILED_FIRST_SILENT_PARENT] = sizeof(int) * n_states;
+  size[COMPILED_PARENTS] = sizeof(int) * n_edges;
+  size[COMPILED_N_CHILDREN] = sizeof(int) * n_states;
+  size[COMPILED_FIRST_SILENT_CHILD] = sizeof(int) * n_states;
+  size[COMPILED_CHILDREN] = sizeof(int) * n_edges;
+  size[COMPILED_PARENT_EDGE_POOL] = sizeof(edge_struct) * n_edges;
+  size[COMPILED_CHILD_EDGE_POOL] = sizeof(edge_struct) * n_edges;
 }
 
 
-PROBABILITY log_likelihood(PROBABILITY **s, sequence_struct **sequence, int n_seqs) {
-  int i, j;
-  PROBABILITY sum = 0;
+// points model_def's arrays into a privately mapped compiled model.  the state lists are already built, and
+// there is no dense transition matrix, so the model starts out finalized
+model_def_struct *load_compiled_model(char *filename) {
+  model_def_struct *model_def;
+  compiled_model_header_struct *header;
+  size_t size[COMPILED_N_SECTIONS];
+  struct stat sb;
+  char *base;
+  int fd, i;
+  long total_parents = 0, total_children = 0;
+
+  if ((fd = open(filename, O_RDONLY)) < 0 || fstat(fd, &sb) != 0) {
+    fprintf(stderr, "Failed to open compiled model '%s'.\n", filename);
+    exit(1);
+  }
+  if (sb.st_size < sizeof(compiled_model_header_struct)) {
+    fprintf(stderr, "Compiled model '%s' is truncated.\n", filename);
+    exit(1);
+  }
 
-  for (i = 0; i < n_seqs; i++) {
-    for (j = 0; j < sequence[i]->len; j++) {
-      sum += log(s[i][j]);
+  base = mmap(NULL, sb.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Failed to map compiled model '%s'.\n", filename);
+    exit(1);
+  }
+
+  header = (compiled_model_header_struct *)base;
+  if (header->version != COMPILED_MODEL_VERSION || header->probability_size != sizeof(PROBABILITY) || header->edge_size != sizeof(edge_struct)) {
+    fprintf(stderr, "Compiled model '%s' was written by an incompatible version of compete; compile it again.\n", filename);
+    exit(1);
+  }
+  if (header->n_states < 0 || header->silent_states_begin < 0 || header->silent_states_begin > header->n_states || header->alphabet_length < 0 || header->n_edges < 0) {
+    fprintf(stderr, "Compiled model '%s' is corrupt: %d states, %d of them normal, %d symbols and %d edges.\n", filename, header->n_states, header->silent_states_begin, header->alphabet_length, header->n_edges);
+    exit(1);
+  }
+  // every section has to lie whole inside the file, aligned for what it holds
+  compiled_section_sizes(header, size);
+  for (i = 0; i < COMPILED_N_SECTIONS; i++) {
+    if (header->offsets[i] < sizeof(compiled_model_header_struct) || header->offsets[i] % COMPILED_MODEL_ALIGNMENT != 0 || header->offsets[i] > sb.st_size || size[i] > sb.st_size - header->offsets[i]) {
+      fprintf(stderr, "Compiled model '%s' is truncated or corrupt: section %d at offset %lu takes %lu bytes, past the end of the %ld byte file.\n", filename, i, header->offsets[i], (unsigned long)size[i], (long)sb.st_size);
+      exit(1);
     }
   }
 
-  return sum;
+  model_def = ALLOC(sizeof(model_def_struct));
+  memset(model_def, 0, sizeof(model_def_struct));
+  model_def->mapping = base;
+  model_def->mapping_length = sb.st_size;
+  model_def->n_states = header->n_states;
+  model_def->silent_states_begin = header->silent_states_begin;
+  model_def->alphabet_length = header->alphabet_length;
+  model_def->case_sensitive = header->case_sensitive;
+  model_def->n_edges = header->n_edges;
+  model_def->transition_matrix = NULL;
+  model_def->edges_stale = FALSE;
+  model_def->table_precision = TABLE_DOUBLE;
+
+  model_def->alphabet = base + header->offsets[COMPILED_ALPHABET];
+  model_def->initial_probs = (PROBABILITY *)(base + header->offsets[COMPILED_INITIAL_PROBS]);
+  model_def->emission_matrix = (PROBABILITY *)(base + header->offsets[COMPILED_EMISSION_MATRIX]);
+  model_def->n_parents = (int *)(base + header->offsets[COMPILED_N_PARENTS]);
+  model_def->first_silent_parent = (int *)(base + header->offsets[COMPILED_FIRST_SILENT_PARENT]);
+  model_def->n_children = (int *)(base + header->offsets[COMPILED_N_CHILDREN]);
+  model_def->first_silent_child = (int *)(base + header->offsets[COMPILED_FIRST_SILENT_CHILD]);
+  model_def->parent_edge_pool = (edge_struct *)(base + header->offsets[COMPILED_PARENT_EDGE_POOL]);
+  model_def->child_edge_pool = (edge_struct *)(base + header->offsets[COMPILED_CHILD_EDGE_POOL]);
+
+  // only the per-state pointers into the flat lists have to be built
+  model_def->parents = ALLOC(sizeof(int *) * model_def->n_states);
+  model_def->children = ALLOC(sizeof(int *) * model_def->n_states);
+  model_def->parent_edges = ALLOC(sizeof(edge_struct *) * model_def->n_states);
+  model_def->child_edges = ALLOC(sizeof(edge_struct *) * model_def->n_states);
+  for (i = 0; i < model_def->n_states; i++) {
+    if (model_def->n_parents[i] < 0 || model_def->n_children[i] < 0) break;
+    model_def->parents[i] = (int *)(base + header->offsets[COMPILED_PARENTS]) + total_parents;
+    model_def->parent_edges[i] = model_def->parent_edge_pool + total_parents;
+    total_parents += model_def->n_parents[i];
+    model_def->children[i] = (int *)(base + header->offsets[COMPILED_CHILDREN]) + total_children;
+    model_def->child_edges[i] = model_def->child_edge_pool + total_children;
+    total_children += model_def->n_children[i];
+  }
+  if (i < model_def->n_states || total_parents != model_def->n_edges || total_children != model_def->n_edges) {
+    fprintf(stderr, "Compiled model '%s' is corrupt: its states' parent and child counts don't add up to its %d edges.\n", filename, model_def->n_edges);
+    exit(1);
+  }
+  for (i = 0; i < model_def->n_edges; i++) {
+    if (model_def->parent_edge_pool[i].state < 0 || model_def->parent_edge_pool[i].state >= model_def->n_states || model_def->child_edge_pool[i].state < 0 || model_def->child_edge_pool[i].state >= model_def->n_states) {
+      fprintf(stderr, "Compiled model '%s' is corrupt: edge %d leads to a state it doesn't have.\n", filename, i);
+      exit(1);
+    }
+  }
+
+  return model_def;
 }
 
 
-void *forward_thread_wrapper(void *arg) {
-  thread_wrapper_struct *tw = (thread_wrapper_struct *)arg;
-  forward(tw->model_def, tw->sequence, tw->table, tw->s);
+// bytes a section of size bytes takes up, padded so the next one starts aligned
+unsigned long compiled_section_size(size_t size) {
+  return (size + COMPILED_MODEL_ALIGNMENT - 1) / COMPILED_MODEL_ALIGNMENT * COMPILED_MODEL_ALIGNMENT;
 }
 
 
-void *backward_thread_wrapper(void *arg) {
-  thread_wrapper_struct *tw = (thread_wrapper_struct *)arg;
-  backward(tw->model_def, tw->sequence, tw->s, tw->table);
-}
+void write_compiled_model(model_def_struct *model_def, char *filename) {
+  static const char padding[COMPILED_MODEL_ALIGNMENT] = {0};
+  compiled_model_header_struct header;
+  void *data[COMPILED_N_SECTIONS];
+  size_t size[COMPILED_N_SECTIONS];
+  int *parents, *children;
+  unsigned long offset;
+  long total_parents = 0, total_children = 0;
+  FILE *f;
+  int i;
 
+  if (!model_def->parent_edges || model_def->edges_stale) {
+    fprintf(stderr, "The model's edge lists are out of date; it cannot be compiled.\n");
+    exit(1);
+  }
 
-void fb_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, PROBABILITY **sf, PROBABILITY **sb, int n_seqs) {
-  int i, n_cpu;
-  pthread_t *fpth, *bpth;
-  thread_wrapper_struct *ftw, *btw;
+  // the per-state lists are stored back to back, in the same order as the edge pools
+  parents = ALLOC(sizeof(int) * (model_def->n_edges > 0 ? model_def->n_edges : 1));
+  children = ALLOC(sizeof(int) * (model_def->n_edges > 0 ? model_def->n_edges : 1));
+  for (i = 0; i < model_def->n_states; i++) {
+    memcpy(parents + total_parents, model_def->parents[i], sizeof(int) * model_def->n_parents[i]);
+    total_parents += model_def->n_parents[i];
+    memcpy(children + total_children, model_def->children[i], sizeof(int) * model_def->n_children[i]);
+    total_children += model_def->n_children[i];
+  }
 
-  n_cpu = find_num_cpus();
+  data[COMPILED_ALPHABET] = model_def->alphabet;
+  data[COMPILED_INITIAL_PROBS] = model_def->initial_probs;
+  data[COMPILED_EMISSION_MATRIX] = model_def->emission_matrix;
+  data[COMPILED_N_PARENTS] = model_def->n_parents;
+  data[COMPILED_FIRST_SILENT_PARENT] = model_def->first_silent_parent;
+  data[COMPILED_PARENTS] = parents;
+  data[COMPILED_N_CHILDREN] = model_def->n_children;
+  data[COMPILED_FIRST_SILENT_CHILD] = model_def->first_silent_child;
+  data[COMPILED_CHILDREN] = children;
+  data[COMPILED_PARENT_EDGE_POOL] = model_def->parent_edge_pool;
+  data[COMPILED_CHILD_EDGE_POOL] = model_def->child_edge_pool;
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, COMPILED_MODEL_MAGIC, sizeof(header.magic));
+  header.version = COMPILED_MODEL_VERSION;
+  header.probability_size = sizeof(PROBABILITY);
+  header.edge_size = sizeof(edge_struct);
+  header.n_states = model_def->n_states;
+  header.silent_states_begin = model_def->silent_states_begin;
+  header.alphabet_length = model_def->alphabet_length;
+  header.case_sensitive = model_def->case_sensitive;
+  header.n_edges = model_def->n_edges;
+  compiled_section_sizes(&header, size);
+  offset = compiled_section_size(sizeof(header));
+  for (i = 0; i < COMPILED_N_SECTIONS; i++) {
+    header.offsets[i] = offset;
+    offset += compiled_section_size(size[i]);
+  }
 
-  if (n_cpu < 2) {
-    for (i = 0; i < n_seqs; i++) {
-      forward(model_def, sequence[i], f_table[i], sf[i]);
-      backward(model_def, sequence[i], sb[i], b_table[i]);
+  if (!(f = fopen(filename, "w"))) {
+    fprintf(stderr, "Opening %s for writing failed.\n", filename);
+    exit(1);
+  }
+  for (i = -1; i < COMPILED_N_SECTIONS; i++) {
+    void *section = i < 0 ? (void *)&header : data[i];
+    size_t section_size = i < 0 ? sizeof(header) : size[i];
+    size_t pad = compiled_section_size(section_size) - section_size;
+    if ((section_size > 0 && fwrite(section, section_size, 1, f) != 1) || (pad > 0 && fwrite(padding, pad, 1, f) != 1)) {
+      fprintf(stderr, "Error writing %s.  Exiting.\n", filename);
+      exit(1);
     }
-  } else {
-    fpth = ALLOC(sizeof(pthread_t) * n_seqs);
-    bpth = ALLOC(sizeof(pthread_t) * n_seqs);
-    ftw = ALLOC(sizeof(thread_wrapper_struct) * n_seqs);
-    btw = ALLOC(sizeof(thread_wrapper_struct) * n_seqs);
+  }
+  fclose(f);
 
-    for (i = 0; i < n_seqs; i++) {
-      ftw[i].model_def = model_def;
-      ftw[i].sequence = sequence[i];
-      ftw[i].table = f_table[i];
-      ftw[i].s = sf[i];
+  free(parents);
+  free(children);
+}
 
-      btw[i].model_def = model_def;
-      btw[i].sequence = sequence[i];
-      btw[i].table = b_table[i];
-      btw[i].s = sb[i];
 
-      pthread_create(bpth + i, NULL, backward_thread_wrapper, btw + i);
-      pthread_create(fpth + i, NULL, forward_thread_wrapper, ftw + i);
-    }
+void free_model(model_def_struct *model_def) {
+  int i;
 
-    for (i = 0; i < n_seqs; i++) {
-      pthread_join(bpth[i], NULL);
-      pthread_join(fpth[i], NULL);
+  free_nucleosome_kernel(model_def);
+  free_specialized_kernel(model_def);
+  free_emission_tables(model_def);
+  free(model_def->transition_matrix);
+  if (model_def->n_fixed_states > 0) {
+    for (i = 0; i < model_def->n_fixed_states; i++) {
+      state_range_struct *range = model_def->fixed_states[i].state_ranges, *next;
+      for (; range; range = next) {
+        next = range->next_range;
+        free(range);
+      }
     }
+    free(model_def->fixed_states);
+  }
 
-    free(fpth);
-    free(bpth);
-    free(ftw);
-    free(btw);
+  if (model_def->mapping) {
+    // everything but the per-state pointers lives in the mapping
+    free(model_def->parents);
+    free(model_def->children);
+    free(model_def->parent_edges);
+    free(model_def->child_edges);
+    munmap(model_def->mapping, model_def->mapping_length);
+  } else {
+    free(model_def->initial_probs);
+    free(model_def->emission_matrix);
+    free(model_def->alphabet);
+    free_parents_and_children(model_def);
+    free(model_def->n_parents);
+    free(model_def->n_children);
+    free(model_def->first_silent_parent);
+    free(model_def->first_silent_child);
+    free(model_def->parents);
+    free(model_def->children);
   }
+
+  free(model_def);
 }
 
 
@@ -725,8 +3190,18 @@ model_def_struct *initialize_model(char *filename, fixed_states_struct *fixed_st
   model_def_struct *model_def;
   struct config_t cfg;
   config_setting_t *list;
+  profile_timer_struct timer;
   int i, j;
 
+  profile_start(&timer);
+  if (is_compiled_model(filename)) {
+    model_def = load_compiled_model(filename);
+    model_def->fixed_states = n_fixed_states > 0 ? fixed_states : NULL;
+    model_def->n_fixed_states = n_fixed_states > 0 ? n_fixed_states : 0;
+    profile_stop(&timer, PHASE_PARSE);
+    return model_def;
+  }
+
   config_init(&cfg);
   if (!config_read_file(&cfg, filename)) {
     fprintf(stderr, "Failed to load config file '%s'.\n", filename);
@@ -735,6 +3210,15 @@ model_def_struct *initialize_model(char *filename, fixed_states_struct *fixed_st
 
   model_def = ALLOC(sizeof(model_def_struct));
   model_def->n_fixed_states = 0;  // workaround of set_transition_prob looking for n_fixed_states to be set
+  model_def->parent_edges = model_def->child_edges = NULL;  // set_transition_prob only writes the dense matrix until the edge lists exist
+  model_def->nuc_kernel = NULL;
+  model_def->specialized = NULL;
+  model_def->emission_by_chr = NULL;
+  model_def->child_emission_weights = NULL;
+  model_def->edges_stale = FALSE;
+  model_def->table_precision = TABLE_DOUBLE;
+  model_def->mapping = NULL;
+  model_def->case_sensitive = FALSE;  // not read from the config; written into compiled models
   
   model_def->n_states = config_lookup_int(&cfg, "model.n_states");
 //  fprintf(stderr, "n_states: %d\n", model_def->n_states);
@@ -796,9 +3280,10 @@ model_def_struct *initialize_model(char *filename, fixed_states_struct *fixed_st
   model_def->children = ALLOC(sizeof(int*) * model_def->n_states);
   model_def->n_children = ALLOC(sizeof(int) * model_def->n_states);
   model_def->first_silent_child = ALLOC(sizeof(int) * model_def->n_states);
-  find_parents_and_children(model_def);
-
   config_destroy(&cfg);
+  profile_stop(&timer, PHASE_PARSE);
+
+  find_parents_and_children(model_def);
   return model_def;
 }
 
@@ -806,8 +3291,11 @@ model_def_struct *initialize_model(char *filename, fixed_states_struct *fixed_st
 void find_parents_and_children(model_def_struct *model_def) {
   int *parents, *children;
   int n_parents, n_children, first_silent_parent, first_silent_child;
+  int total_parents = 0, total_children = 0;
+  profile_timer_struct timer;
   int i, j;
 
+  profile_start(&timer);
   parents = ALLOC(sizeof(int) * model_def->n_states);
   children = ALLOC(sizeof(int) * model_def->n_states);
 
@@ -816,55 +3304,391 @@ void find_parents_and_children(model_def_struct *model_def) {
     memset(children, 0, sizeof(int) * model_def->n_states);
     n_parents = n_children = 0;
 
-    for (j = 0; j < model_def->silent_states_begin; j++) {
-      if (fetch_transition_prob(model_def, j, i) != 0.0) {
-        parents[n_parents] = j;
-        n_parents++;
-      }
-      if (fetch_transition_prob(model_def, i, j) != 0.0) {
-        children[n_children] = j;
-        n_children++;
-      }
-    }
+    for (j = 0; j < model_def->silent_states_begin; j++) {
+      if (fetch_transition_prob(model_def, j, i) != 0.0) {
+        parents[n_parents] = j;
+        n_parents++;
+      }
+      if (fetch_transition_prob(model_def, i, j) != 0.0) {
+        children[n_children] = j;
+        n_children++;
+      }
+    }
+
+    first_silent_parent = n_parents;
+    first_silent_child = n_children;
+
+    for (j = model_def->silent_states_begin; j < model_def->n_states; j++) {
+      if (fetch_transition_prob(model_def, j, i) != 0.0) {
+        parents[n_parents] = j;
+        n_parents++;
+      }
+      if (fetch_transition_prob(model_def, i, j) != 0.0) {
+        children[n_children] = j;
+        n_children++;
+      }
+    }
+
+    model_def->parents[i] = ALLOC(sizeof(int) * n_parents);
+    memcpy(model_def->parents[i], parents, sizeof(int) * n_parents);
+    model_def->n_parents[i] = n_parents;
+    model_def->first_silent_parent[i] = first_silent_parent;
+
+    model_def->children[i] = ALLOC(sizeof(int) * n_children);
+    memcpy(model_def->children[i], children, sizeof(int) * n_children);
+    model_def->n_children[i] = n_children;
+    model_def->first_silent_child[i] = first_silent_child;
+
+    total_parents += n_parents;
+    total_children += n_children;
+  }
+
+  // lay the edges out contiguously, so the forward and backward loops stream through them
+  model_def->n_edges = total_parents;
+  model_def->parent_edge_pool = ALLOC(sizeof(edge_struct) * (total_parents > 0 ? total_parents : 1));
+  model_def->child_edge_pool = ALLOC(sizeof(edge_struct) * (total_children > 0 ? total_children : 1));
+  model_def->parent_edges = ALLOC(sizeof(edge_struct *) * model_def->n_states);
+  model_def->child_edges = ALLOC(sizeof(edge_struct *) * model_def->n_states);
+
+  total_parents = total_children = 0;
+  for (i = 0; i < model_def->n_states; i++) {
+    model_def->parent_edges[i] = model_def->parent_edge_pool + total_parents;
+    for (j = 0; j < model_def->n_parents[i]; j++) {
+      model_def->parent_edges[i][j].state = model_def->parents[i][j];
+      model_def->parent_edges[i][j].prob = fetch_transition_prob(model_def, model_def->parents[i][j], i);
+    }
+    total_parents += model_def->n_parents[i];
+
+    model_def->child_edges[i] = model_def->child_edge_pool + total_children;
+    for (j = 0; j < model_def->n_children[i]; j++) {
+      model_def->child_edges[i][j].state = model_def->children[i][j];
+      model_def->child_edges[i][j].prob = fetch_transition_prob(model_def, i, model_def->children[i][j]);
+    }
+    total_children += model_def->n_children[i];
+  }
+  model_def->edges_stale = FALSE;
+
+  free(parents);
+  free(children);
+  profile_stop(&timer, PHASE_EDGES);
+}
+
+
+void free_parents_and_children(model_def_struct *model_def) {
+  int i;
+
+  for (i = 0; i < model_def->n_states; i++) {
+    free(model_def->parents[i]);
+    free(model_def->children[i]);
+  }
+  free(model_def->parent_edges);
+  free(model_def->child_edges);
+  free(model_def->parent_edge_pool);
+  free(model_def->child_edge_pool);
+  model_def->parent_edges = model_def->child_edges = NULL;
+  model_def->parent_edge_pool = model_def->child_edge_pool = NULL;
+}
+
+
+BOOL enable_nucleosome_kernel(model_def_struct *model_def, int first_state, int n_positions) {
+  int q, d, i;
+
+  if (n_positions < 2 || first_state + 16 * n_positions > model_def->silent_states_begin) return FALSE;
+
+  for (q = 1; q < n_positions; q++) {
+    for (d = 0; d < 16; d++) {
+      int state = first_state + 16 * q + d;
+      if (model_def->n_parents[state] != 4 || model_def->first_silent_parent[state] != 4) return FALSE;
+      for (i = 0; i < 4; i++) {
+        int parent = first_state + 16 * (q - 1) + 4 * i + (d >> 2);
+        if (model_def->parent_edges[state][i].state != parent) return FALSE;
+      }
+    }
+    for (d = 0; d < 16; d++) {
+      int state = first_state + 16 * (q - 1) + d;
+      if (model_def->n_children[state] != 4 || model_def->first_silent_child[state] != 4) return FALSE;
+      for (i = 0; i < 4; i++) {
+        if (model_def->child_edges[state][i].state != first_state + 16 * q + 4 * (d & 3) + i) return FALSE;
+      }
+    }
+  }
+
+  free_nucleosome_kernel(model_def);
+  model_def->nuc_kernel = ALLOC(sizeof(nucleosome_kernel_struct));
+  model_def->nuc_kernel->first_state = first_state;
+  model_def->nuc_kernel->n_positions = n_positions;
+  model_def->nuc_kernel->weights = ALLOC(sizeof(PROBABILITY) * 64 * n_positions);
+  model_def->nuc_kernel->emissions = ALLOC(sizeof(PROBABILITY) * 16 * model_def->alphabet_length * n_positions);
+  refresh_nucleosome_kernel(model_def);
+
+  return TRUE;
+}
+
+
+void refresh_nucleosome_kernel(model_def_struct *model_def) {
+  nucleosome_kernel_struct *kernel = model_def->nuc_kernel;
+  int q, d, i, c;
+
+  if (!kernel) return;
+
+  memset(kernel->weights, 0, sizeof(PROBABILITY) * 64 * kernel->n_positions);
+  for (q = 1; q < kernel->n_positions; q++) {
+    for (d = 0; d < 16; d++) {
+      edge_struct *edges = model_def->parent_edges[kernel->first_state + 16 * q + d];
+      for (i = 0; i < 4; i++) {
+        kernel->weights[64 * q + 16 * i + d] = edges[i].prob;
+      }
+    }
+  }
+
+  for (q = 0; q < kernel->n_positions; q++) {
+    for (c = 0; c < model_def->alphabet_length; c++) {
+      for (d = 0; d < 16; d++) {
+        kernel->emissions[16 * (q * model_def->alphabet_length + c) + d] = fetch_emission_prob(model_def, kernel->first_state + 16 * q + d, c);
+      }
+    }
+  }
+}
+
+
+void free_nucleosome_kernel(model_def_struct *model_def) {
+  if (!model_def->nuc_kernel) return;
+
+  free(model_def->nuc_kernel->weights);
+  free(model_def->nuc_kernel->emissions);
+  free(model_def->nuc_kernel);
+  model_def->nuc_kernel = NULL;
+}
+
+
+void refresh_emission_tables(model_def_struct *model_def) {
+  int c, i, j, per_row = EMISSION_ALIGNMENT / sizeof(PROBABILITY);
+
+  free_emission_tables(model_def);
+
+  // round each symbol's row up so the next one starts aligned as well
+  model_def->emission_stride = (model_def->n_states + per_row - 1) / per_row * per_row;
+  if (posix_memalign((void **)&model_def->emission_by_chr, EMISSION_ALIGNMENT, sizeof(PROBABILITY) * model_def->emission_stride * model_def->alphabet_length) != 0) {
+    fprintf(stderr, "Error allocating memory.  Exiting.\n");
+    exit(1);
+  }
+  memset(model_def->emission_by_chr, 0, sizeof(PROBABILITY) * model_def->emission_stride * model_def->alphabet_length);
+  for (c = 0; c < model_def->alphabet_length; c++) {
+    for (i = 0; i < model_def->silent_states_begin; i++) {
+      model_def->emission_by_chr[c * model_def->emission_stride + i] = fetch_emission_prob(model_def, i, c);
+    }
+  }
+
+  model_def->child_emission_weights = ALLOC(sizeof(PROBABILITY) * (unsigned long)model_def->alphabet_length * (model_def->n_edges > 0 ? model_def->n_edges : 1));
+  for (c = 0; c < model_def->alphabet_length; c++) {
+    PROBABILITY *weights = model_def->child_emission_weights + (unsigned long)model_def->n_edges * c;
+    for (i = 0; i < model_def->n_states; i++) {
+      edge_struct *edges = model_def->child_edges[i];
+      PROBABILITY *w = weights + (edges - model_def->child_edge_pool);
+      for (j = 0; j < model_def->n_children[i]; j++) {
+        w[j] = edges[j].prob;
+        if (edges[j].state < model_def->silent_states_begin) w[j] *= fetch_emission_prob(model_def, edges[j].state, c);
+      }
+    }
+  }
+}
+
+
+void free_emission_tables(model_def_struct *model_def) {
+  free(model_def->emission_by_chr);
+  free(model_def->child_emission_weights);
+  model_def->emission_by_chr = NULL;
+  model_def->child_emission_weights = NULL;
+}
+
+
+void finalize_model(model_def_struct *model_def) {
+  if (model_def->transition_matrix) {
+    if (model_def->edges_stale) {
+      free_parents_and_children(model_def);
+      find_parents_and_children(model_def);
+    }
+
+    free(model_def->transition_matrix);
+    model_def->transition_matrix = NULL;
+  }
+
+  refresh_nucleosome_kernel(model_def);
+  refresh_emission_tables(model_def);
+}
+
+
+model_def_struct *clone_model(model_def_struct *model_def) {
+  model_def_struct *clone;
+  int i;
+
+  if (model_def->transition_matrix) {
+    fprintf(stderr, "Only finalized models can be cloned.\n");
+    exit(1);
+  }
+
+  clone = ALLOC(sizeof(model_def_struct));
+  *clone = *model_def;
+
+  clone->initial_probs = ALLOC(sizeof(PROBABILITY) * model_def->silent_states_begin);
+  clone->emission_matrix = ALLOC(sizeof(PROBABILITY) * model_def->alphabet_length * model_def->n_states);
+  clone->parent_edge_pool = ALLOC(sizeof(edge_struct) * (model_def->n_edges > 0 ? model_def->n_edges : 1));
+  clone->child_edge_pool = ALLOC(sizeof(edge_struct) * (model_def->n_edges > 0 ? model_def->n_edges : 1));
+  clone->parent_edges = ALLOC(sizeof(edge_struct *) * model_def->n_states);
+  clone->child_edges = ALLOC(sizeof(edge_struct *) * model_def->n_states);
+  for (i = 0; i < model_def->n_states; i++) {
+    clone->parent_edges[i] = clone->parent_edge_pool + (model_def->parent_edges[i] - model_def->parent_edge_pool);
+    clone->child_edges[i] = clone->child_edge_pool + (model_def->child_edges[i] - model_def->child_edge_pool);
+  }
+  restore_model_probabilities(clone, model_def);
+
+  // the derived tables are the clone's own, too
+  clone->nuc_kernel = NULL;
+  clone->emission_by_chr = NULL;
+  clone->child_emission_weights = NULL;
+  if (model_def->nuc_kernel) enable_nucleosome_kernel(clone, model_def->nuc_kernel->first_state, model_def->nuc_kernel->n_positions);
+  refresh_emission_tables(clone);
+
+  return clone;
+}
+
+
+void restore_model_probabilities(model_def_struct *model_def, model_def_struct *source) {
+  memcpy(model_def->initial_probs, source->initial_probs, sizeof(PROBABILITY) * source->silent_states_begin);
+  memcpy(model_def->emission_matrix, source->emission_matrix, sizeof(PROBABILITY) * source->alphabet_length * source->n_states);
+  memcpy(model_def->parent_edge_pool, source->parent_edge_pool, sizeof(edge_struct) * source->n_edges);
+  memcpy(model_def->child_edge_pool, source->child_edge_pool, sizeof(edge_struct) * source->n_edges);
+}
+
+
+void free_model_clone(model_def_struct *clone) {
+  free_nucleosome_kernel(clone);
+  free_emission_tables(clone);
+  free(clone->initial_probs);
+  free(clone->emission_matrix);
+  free(clone->parent_edge_pool);
+  free(clone->child_edge_pool);
+  free(clone->parent_edges);
+  free(clone->child_edges);
+  free(clone);
+}
+
+
+/* maps record name of the packed sequence store store_filename into sequence, positions begin_read .. end_read
+   (from 1, inclusive; end_read < 0 for the rest of the record).  returns 1 once mapped, 0 if store_filename isn't a
+   store, and -1, having said why, if the store has no such record or positions.
+*/
+int map_stored_sequence(char *store_filename, char *name, long begin_read, long end_read, sequence_struct *sequence) {
+  sequence_store_header_struct header;
+  sequence_store_record_struct *records;
+  struct stat sb;
+  char *base;
+  int fd, i;
+
+  if ((fd = open(store_filename, O_RDONLY)) < 0) return 0;
+  if (read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(header.magic, SEQUENCE_STORE_MAGIC, sizeof(header.magic)) != 0) {
+    close(fd);
+    return 0;
+  }
+  if (header.version != SEQUENCE_STORE_VERSION) {
+    fprintf(stderr, "Sequence store %s was written by an incompatible version of compete; pack it again.\n", store_filename);
+    close(fd);
+    return -1;
+  }
+
+  fstat(fd, &sb);
+  base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Failed to map sequence store %s.\n", store_filename);
+    exit(1);
+  }
+
+  records = (sequence_store_record_struct *)(base + sizeof(header));
+  for (i = 0; i < header.n_records; i++) {
+    if (strncmp(records[i].name, name, SEQUENCE_STORE_NAME_LENGTH) == 0) break;
+  }
+  if (i == header.n_records) {
+    fprintf(stderr, "No sequence %s in %s.\n", name, store_filename);
+    munmap(base, sb.st_size);
+    return -1;
+  }
+  if (end_read < 0) end_read = records[i].len;
+  if (begin_read < 1 || end_read > records[i].len || end_read < begin_read) {
+    fprintf(stderr, "Positions %ld to %ld are outside %s:%s, which is %lld long.\n", begin_read, end_read, store_filename, name, records[i].len);
+    munmap(base, sb.st_size);
+    return -1;
+  }
 
-    first_silent_parent = n_parents;
-    first_silent_child = n_children;
+  sequence->seq = NULL;
+  sequence->len = end_read - begin_read + 1;
+  sequence->packed = (unsigned char *)base + header.data_offset;
+  sequence->packed_offset = records[i].offset + begin_read - 1;
+  sequence->mapping = base;
+  sequence->mapping_length = sb.st_size;
+  return 1;
+}
 
-    for (j = model_def->silent_states_begin; j < model_def->n_states; j++) {
-      if (fetch_transition_prob(model_def, j, i) != 0.0) {
-        parents[n_parents] = j;
-        n_parents++;
-      }
-      if (fetch_transition_prob(model_def, i, j) != 0.0) {
-        children[n_children] = j;
-        n_children++;
-      }
-    }
 
-    model_def->parents[i] = ALLOC(sizeof(int) * n_parents);
-    memcpy(model_def->parents[i], parents, sizeof(int) * n_parents);
-    model_def->n_parents[i] = n_parents;
-    model_def->first_silent_parent[i] = first_silent_parent;
+BOOL read_sequence_region(char *name, long begin_read, long end_read, sequence_struct *sequence) {
+  char *record;
+  struct stat sb;
+  FILE *f;
+
+  sequence->seq = NULL;
+  sequence->len = 0;
+  sequence->packed = NULL;
+  sequence->packed_offset = 0;
+  sequence->mapping = NULL;
+  sequence->scaling = NULL;
+  sequence->view_offset = 0;
+  sequence->fixed_masks = NULL;
+
+  // store:name picks a record of a packed sequence store
+  if (record = strrchr(name, ':')) {
+    int mapped;
+    *record = '\0';
+    mapped = map_stored_sequence(name, record + 1, begin_read, end_read, sequence);
+    *record = ':';
+    if (mapped != 0) return mapped > 0;
+  }
 
-    model_def->children[i] = ALLOC(sizeof(int) * n_children);
-    memcpy(model_def->children[i], children, sizeof(int) * n_children);
-    model_def->n_children[i] = n_children;
-    model_def->first_silent_child[i] = first_silent_child;
+  if (stat(name, &sb) != 0 || !(f = fopen(name, "r"))) {
+    fprintf(stderr, "Error reading %s.\n", name);
+    return FALSE;
+  }
+  if (end_read < 0) end_read = sb.st_size;
+  if (begin_read < 1 || end_read > sb.st_size || end_read < begin_read) {
+    fprintf(stderr, "Positions %ld to %ld are outside %s, which is %ld long.\n", begin_read, end_read, name, (long)sb.st_size);
+    fclose(f);
+    return FALSE;
   }
 
-  free(parents);
-  free(children);
+  sequence->len = end_read - begin_read + 1;
+  sequence->seq = ALLOC(sizeof(char) * sequence->len);
+  fseek(f, begin_read - 1, SEEK_SET);
+  if (fread(sequence->seq, sequence->len, 1, f) != 1) {
+    fprintf(stderr, "Error reading %s.\n", name);
+    fclose(f);
+    free(sequence->seq);
+    sequence->seq = NULL;
+    return FALSE;
+  }
+  fclose(f);
+  return TRUE;
 }
 
 
 int read_sequence(char *filename, sequence_struct ***sequence_ptr) {
   sequence_struct **sequence;
-  FILE *f, *f_index;
-  int result, i, j, n_seqs = 0, begin_read, end_read;
-  char **names, str[256];
-  int max_filename_length = 256;
+  FILE *f_index;
+  int i, n_seqs = 0, begin_read, end_read;
+  char str[256];
 
-  f_index = fopen(filename, "r");
+  if (!(f_index = fopen(filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", filename);
+    exit(1);
+  }
   // this is ugly, but I don't know how else to count the darn things
   while (fscanf(f_index, "%s %d %d\n", str, &begin_read, &end_read) > 0) {
 //    fprintf(stderr, "file %d: \"%s\"\n", n_seqs, str);
@@ -877,35 +3701,175 @@ int read_sequence(char *filename, sequence_struct ***sequence_ptr) {
   i = 0;
   while (fscanf(f_index, "%s %d %d\n", str, &begin_read, &end_read) > 0) {
     sequence[i] = ALLOC(sizeof(sequence_struct));
+    if (!read_sequence_region(str, begin_read, end_read, sequence[i])) {
+      fprintf(stderr, "Exiting.\n");
+      exit(1);
+    }
+    i++;
+  }
+
+  fclose(f_index);
+
+  *sequence_ptr = sequence;
+  return n_seqs;
+}
 
 
-    if (end_read < 0) {
-      struct stat sb;
-      result = stat(str, &sb);
-      if (result != 0) {
-        fprintf(stderr, "Error reading %s.  Exiting.\n", str);
-        exit;
-      }
+int read_sequence_regions(char *filename, sequence_region_struct **regions_ptr) {
+  sequence_region_struct *regions = NULL, region;
+  int n_regions = 0;
+  FILE *f_index;
+
+  if (!(f_index = fopen(filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", filename);
+    exit(1);
+  }
+  while (fscanf(f_index, "%255s %ld %ld\n", region.name, &region.begin, &region.end) > 0) {
+    regions = realloc(regions, sizeof(sequence_region_struct) * (n_regions + 1));
+    regions[n_regions++] = region;
+  }
+  fclose(f_index);
+
+  *regions_ptr = regions;
+  return n_regions;
+}
+
+
+void free_sequence(sequence_struct *sequence) {
+  if (sequence->mapping) munmap(sequence->mapping, sequence->mapping_length);
+  free_position_scaling(sequence->scaling);
+  free_fixed_state_masks(sequence->fixed_masks);
+  free(sequence->seq);
+  free(sequence);
+}
 
-      end_read = sb.st_size;
+
+// growing store being packed by write_sequence_store()
+typedef struct {
+  unsigned char *packed;
+  long long n_bases, capacity;  // capacity in bases
+  sequence_store_record_struct *records;
+  int n_records;
+} sequence_store_builder_struct;
+
+
+void start_store_record(sequence_store_builder_struct *store, char *name) {
+  sequence_store_record_struct *record;
+
+  // every record starts on a byte
+  store->n_bases = (store->n_bases + 3) / 4 * 4;
+  store->records = realloc(store->records, sizeof(sequence_store_record_struct) * (store->n_records + 1));
+  record = store->records + store->n_records++;
+  memset(record->name, 0, SEQUENCE_STORE_NAME_LENGTH);
+  strncpy(record->name, name, SEQUENCE_STORE_NAME_LENGTH - 1);
+  record->offset = store->n_bases;
+  record->len = 0;
+}
+
+
+void append_store_base(sequence_store_builder_struct *store, int chr) {
+  if (store->n_bases == store->capacity) {
+    store->capacity = store->capacity ? 2 * store->capacity : 1 << 20;
+    store->packed = realloc(store->packed, store->capacity / 4);
+    if (!store->packed) {
+      fprintf(stderr, "Error allocating memory.  Exiting.\n");
+      exit(1);
     }
+  }
 
-    sequence[i]->len = end_read - begin_read + 1;
-    sequence[i]->seq = ALLOC(sizeof(char) * sequence[i]->len);
+  if ((store->n_bases & 3) == 0) store->packed[store->n_bases >> 2] = 0;
+  store->packed[store->n_bases >> 2] |= chr << (2 * (store->n_bases & 3));
+  store->n_bases++;
+  store->records[store->n_records - 1].len++;
+}
 
-    f = fopen(str, "r");
-    fseek(f, begin_read - 1, SEEK_SET);
-    result = fread(sequence[i]->seq, sequence[i]->len, 1, f);
-//    fprintf(stderr, "%d objects of size %d read from %s.\n", result, sequence[i]->len, str);
-    fclose(f);
 
-    i++;
+void write_sequence_store(char *filename, char **inputs, int n_inputs) {
+  static const char padding[SEQUENCE_STORE_ALIGNMENT] = {0};
+  sequence_store_builder_struct store;
+  sequence_store_header_struct header;
+  char name[SEQUENCE_STORE_NAME_LENGTH];
+  long long index_size;
+  FILE *f, *out;
+  int c, i;
+
+  memset(&store, 0, sizeof(store));
+
+  for (i = 0; i < n_inputs; i++) {
+    if (!(f = fopen(inputs[i], "r"))) {
+      fprintf(stderr, "Opening %s for reading failed.\n", inputs[i]);
+      exit(1);
+    }
+
+    c = getc(f);
+    if (c == '>') {
+      // FASTA: one record per > line, named by its first word
+      while (c == '>') {
+        int n = 0;
+        while ((c = getc(f)) != EOF && c != '\n' && c != ' ' && c != '\t') {
+          if (n < SEQUENCE_STORE_NAME_LENGTH - 1) name[n++] = c;
+        }
+        name[n] = '\0';
+        while (c != EOF && c != '\n') c = getc(f);
+        start_store_record(&store, name);
+
+        while ((c = getc(f)) != EOF && c != '>') {
+          switch (c) {
+            case 'A': case 'a': append_store_base(&store, 0); break;
+            case 'C': case 'c': append_store_base(&store, 1); break;
+            case 'G': case 'g': append_store_base(&store, 2); break;
+            case 'T': case 't': append_store_base(&store, 3); break;
+            case '\n': case '\r': case ' ': case '\t': break;
+            default:
+              // dropping it would shift every position after it
+              fprintf(stderr, "%s: record %s has '%c' at position %lld; a packed store only holds A, C, G and T.\n", inputs[i], name, c, store.records[store.n_records - 1].len + 1);
+              exit(1);
+          }
+        }
+      }
+    } else {
+      // character numbers, as written by convert_seq.rb: the record is named after the file
+      char *base = strrchr(inputs[i], '/') ? strrchr(inputs[i], '/') + 1 : inputs[i];
+      strncpy(name, base, SEQUENCE_STORE_NAME_LENGTH - 1);
+      name[SEQUENCE_STORE_NAME_LENGTH - 1] = '\0';
+      if (strchr(name, '.')) *strchr(name, '.') = '\0';
+      start_store_record(&store, name);
+
+      for (; c != EOF; c = getc(f)) {
+        if (c < 0 || c >= 4) {
+          fprintf(stderr, "%s: byte %d at position %lld is not a character number of ACGT.\n", inputs[i], c, store.records[store.n_records - 1].len + 1);
+          exit(1);
+        }
+        append_store_base(&store, c);
+      }
+    }
+
+    fclose(f);
   }
 
-  fclose(f_index);
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SEQUENCE_STORE_MAGIC, sizeof(header.magic));
+  header.version = SEQUENCE_STORE_VERSION;
+  header.n_records = store.n_records;
+  index_size = sizeof(header) + sizeof(sequence_store_record_struct) * store.n_records;
+  // page aligned, so each record's bases are mapped independently of the index
+  header.data_offset = (index_size + SEQUENCE_STORE_ALIGNMENT - 1) / SEQUENCE_STORE_ALIGNMENT * SEQUENCE_STORE_ALIGNMENT;
 
-  *sequence_ptr = sequence;
-  return n_seqs;
+  if (!(out = fopen(filename, "w"))) {
+    fprintf(stderr, "Opening %s for writing failed.\n", filename);
+    exit(1);
+  }
+  if (fwrite(&header, sizeof(header), 1, out) != 1
+      || (store.n_records > 0 && fwrite(store.records, sizeof(sequence_store_record_struct) * store.n_records, 1, out) != 1)
+      || (header.data_offset > index_size && fwrite(padding, header.data_offset - index_size, 1, out) != 1)
+      || (store.n_bases > 0 && fwrite(store.packed, (store.n_bases + 3) / 4, 1, out) != 1)) {
+    fprintf(stderr, "Error writing %s.  Exiting.\n", filename);
+    exit(1);
+  }
+  fclose(out);
+
+  free(store.packed);
+  free(store.records);
 }
 
 
@@ -968,143 +3932,634 @@ int find_num_cpus() {
 }
 
 
-static int cmp_sortable_pairs(const void *a, const void *b) {
-  if (((sortable_pair *)a)->value > ((sortable_pair *)b)->value) return 1;
-  else if (((sortable_pair *)a)->value < ((sortable_pair *)b)->value) return -1;
-  else return 0;
+BOOL profiling = FALSE;
+
+static pthread_mutex_t profile_lock = PTHREAD_MUTEX_INITIALIZER;
+static thread_profile_struct *profile_threads = NULL, **profile_threads_end = &profile_threads;
+static __thread thread_profile_struct *profile_of_thread = NULL;
+static struct timespec profile_began;
+static size_t peak_allocated = 0; // under profile_lock
+
+static const char *phase_names[N_PHASES] = {"parse", "edges", "scaling", "temperature", "forward", "backward", "posterior", "viterbi", "output"};
+
+
+void enable_profiling() {
+  profiling = TRUE;
+  clock_gettime(CLOCK_MONOTONIC, &profile_began);
+  thread_profile();
 }
 
 
-void update_silent_states_viterbi(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int row_index, sortable_pair *pairs, int *ptr) {
-  PROBABILITY *row = table + (unsigned long)model_def->n_states * (unsigned long)row_index;
-  int *argmax = ptr + (unsigned long)model_def->n_states * (unsigned long)row_index;
-  int i, j, n_pairs;
+thread_profile_struct *thread_profile() {
+  if (!profile_of_thread) {
+    thread_profile_struct *profile = ALLOC(sizeof(thread_profile_struct));
+    memset(profile, 0, sizeof(thread_profile_struct));
+    pthread_mutex_lock(&profile_lock);
+    *profile_threads_end = profile;
+    profile_threads_end = &profile->next;
+    pthread_mutex_unlock(&profile_lock);
+    profile_of_thread = profile;
+  }
 
-  for (i = model_def->silent_states_begin; i < model_def->n_states; i++) {
-    n_pairs = model_def->first_silent_parent[i];
-    for (j = 0; j < n_pairs; j++) {
-      int state = model_def->parents[i][j];
-      PROBABILITY transition_prob = fetch_transition_prob(model_def, state, i);
-      pairs[j].index = state;
-      pairs[j].value = row[state] * transition_prob;
+  return profile_of_thread;
+}
+
+
+static double seconds_between(struct timespec *from, struct timespec *to) {
+  return (to->tv_sec - from->tv_sec) + 1e-9 * (to->tv_nsec - from->tv_nsec);
+}
+
+
+// bytes the heap has handed out and not yet had back, where the C library can tell, and those of mapped tables
+static size_t allocated_bytes() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd + mapped_table_bytes;
+#else
+  return mapped_table_bytes;
+#endif
+}
+
+
+double profile_wall_clock() {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + 1e-9 * now.tv_nsec;
+}
+
+
+void profile_start(profile_timer_struct *timer) {
+  if (!profiling) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &timer->wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &timer->cpu);
+  timer->nested = 0;
+}
+
+
+void profile_stop(profile_timer_struct *timer, int phase) {
+  profile_stop_nested(timer, phase, phase);
+}
+
+
+void profile_stop_nested(profile_timer_struct *timer, int phase, int nested_phase) {
+  thread_profile_struct *profile;
+  struct timespec wall, cpu;
+  double wall_s, cpu_s, nested_cpu;
+  size_t allocated;
+
+  if (!profiling) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &wall);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+  wall_s = seconds_between(&timer->wall, &wall);
+  cpu_s = seconds_between(&timer->cpu, &cpu);
+
+  // the nested phase ran on this thread, between rows of this one, so its CPU time is taken to be its wall time
+  profile = thread_profile();
+  nested_cpu = timer->nested < cpu_s ? timer->nested : cpu_s;
+  profile->wall[phase] += wall_s - timer->nested;
+  profile->cpu[phase] += cpu_s - nested_cpu;
+  profile->calls[phase]++;
+  if (timer->nested > 0) {
+    profile->wall[nested_phase] += timer->nested;
+    profile->cpu[nested_phase] += nested_cpu;
+    profile->calls[nested_phase]++;
+  }
+
+  // whatever a phase keeps is still allocated as it ends
+  allocated = allocated_bytes();
+  pthread_mutex_lock(&profile_lock);
+  if (allocated > peak_allocated) peak_allocated = allocated;
+  pthread_mutex_unlock(&profile_lock);
+}
+
+
+void profile_totals(double *wall, double *cpu, long *calls, long *rows) {
+  thread_profile_struct *profile;
+  int i;
+
+  memset(wall, 0, sizeof(double) * N_PHASES);
+  memset(cpu, 0, sizeof(double) * N_PHASES);
+  memset(calls, 0, sizeof(long) * N_PHASES);
+  memset(rows, 0, sizeof(long) * N_PHASES);
+  pthread_mutex_lock(&profile_lock);
+  for (profile = profile_threads; profile; profile = profile->next) {
+    for (i = 0; i < N_PHASES; i++) {
+      wall[i] += profile->wall[i];
+      cpu[i] += profile->cpu[i];
+      calls[i] += profile->calls[i];
+      rows[i] += profile->rows[i];
+    }
+  }
+  pthread_mutex_unlock(&profile_lock);
+}
+
+
+void write_profile(FILE *f, model_def_struct *model_def, long n_positions, double log_likelihood) {
+  thread_profile_struct *profile, *next;
+  double wall[N_PHASES], cpu[N_PHASES];
+  long calls[N_PHASES], rows[N_PHASES];
+  struct timespec now;
+  struct rusage usage;
+  long peak_rss;
+  int i, t;
+
+  if (!profiling) return;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  getrusage(RUSAGE_SELF, &usage);
+  #ifdef __APPLE__
+  peak_rss = usage.ru_maxrss;         // bytes
+  #else
+  peak_rss = usage.ru_maxrss * 1024L; // kilobytes
+  #endif
+
+  profile_totals(wall, cpu, calls, rows);
+
+  fprintf(f, "{\"wall_s\":%.6f,\"user_s\":%.6f,\"sys_s\":%.6f", seconds_between(&profile_began, &now), usage.ru_utime.tv_sec + 1e-6 * usage.ru_utime.tv_usec, usage.ru_stime.tv_sec + 1e-6 * usage.ru_stime.tv_usec);
+  fprintf(f, ",\"peak_rss_bytes\":%ld,\"peak_allocated_bytes\":%lu", peak_rss, (unsigned long)peak_allocated);
+  fprintf(f, ",\"states\":%d,\"edges\":%d,\"positions\":%ld", model_def->n_states, model_def->n_edges, n_positions);
+  // every row of a recursion visits every edge of the model
+  fprintf(f, ",\"edges_visited\":%.0f", (double)(rows[PHASE_FORWARD] + rows[PHASE_BACKWARD] + rows[PHASE_VITERBI]) * model_def->n_edges);
+  if (!isnan(log_likelihood)) fprintf(f, ",\"log_likelihood\":%.17g", log_likelihood);
+
+  fprintf(f, ",\"phases\":{");
+  for (i = 0; i < N_PHASES; i++) {
+    fprintf(f, "%s\"%s\":{\"wall_s\":%.6f,\"cpu_s\":%.6f,\"calls\":%ld,\"rows\":%ld}", i ? "," : "", phase_names[i], wall[i], cpu[i], calls[i], rows[i]);
+  }
+
+  // threads that ran rows of a recursion, with the time they spent in the recursions and posterior summation
+  fprintf(f, "},\"threads\":[");
+  for (profile = profile_threads, t = 0; profile; profile = profile->next) {
+    long thread_rows = profile->rows[PHASE_FORWARD] + profile->rows[PHASE_BACKWARD] + profile->rows[PHASE_VITERBI];
+    double busy = profile->wall[PHASE_FORWARD] + profile->wall[PHASE_BACKWARD] + profile->wall[PHASE_POSTERIOR] + profile->wall[PHASE_VITERBI];
+    if (thread_rows == 0) continue;
+    fprintf(f, "%s{\"rows\":%ld,\"busy_s\":%.6f,\"rows_per_s\":%.1f}", t++ ? "," : "", thread_rows, busy, busy > 0 ? thread_rows / busy : 0.0);
+  }
+  fprintf(f, "]}\n");
+  fflush(f);
+
+  for (profile = profile_threads; profile; profile = next) {
+    next = profile->next;
+    free(profile);
+  }
+  profile_threads = NULL;
+  profile_threads_end = &profile_threads;
+  profile_of_thread = NULL;
+  profiling = FALSE;
+}
+
+
+// backpointers are indices into the state's parent edge list, one byte wide unless some state has more than 256 parents
+#define GET_BACKPOINTER(bp, wide, k) ((wide) ? ((unsigned short *)(bp))[k] : ((unsigned char *)(bp))[k])
+#define SET_BACKPOINTER(bp, wide, k, j) do { if (wide) ((unsigned short *)(bp))[k] = (j); else ((unsigned char *)(bp))[k] = (j); } while (0)
+
+/* max-product counterpart of forward_row: row[i] is the probability of the best path ending in state i at pos,
+   over the sum of the normal states.  the distributor's scaled transitions and the fixed state masks apply as they
+   do in the forward recursion.  when bp isn't NULL, it gets the parent edge each state's best path came through.
+   returns the row's scale.
+*/
+PROBABILITY viterbi_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *prev_row, PROBABILITY *row, long pos, PROBABILITY *edge_scale, void *bp, BOOL wide) {
+  int distributor = model_def->silent_states_begin;
+  char chr = fetch_symbol(sequence, pos);
+  int i, j;
+
+  PROFILE_ROW(PHASE_VITERBI);
+  distributor_edge_scale(model_def, sequence, pos, edge_scale);
+
+  for (i = 0; i < distributor; i++) {
+    if (pos == 0) {
+      row[i] = model_def->initial_probs[i] * fetch_emission_prob(model_def, i, chr);
+      continue;
+    }
+    edge_struct *edges = model_def->parent_edges[i];
+    PROBABILITY best = 0;
+    int arg = 0;
+    for (j = 0; j < model_def->n_parents[i]; j++) {
+      PROBABILITY v = prev_row[edges[j].state] * edges[j].prob;
+      if (edges[j].state == distributor) v *= edge_scale[i];
+      if (v > best) {
+        best = v;
+        arg = j;
+      }
+    }
+    row[i] = fetch_emission_prob(model_def, i, chr) * best;
+    if (bp) SET_BACKPOINTER(bp, wide, i, arg);
+  }
+  apply_fixed_state_mask(model_def, sequence, row, pos);
+
+  // silent parents precede their children, so one ascending pass sees every parent final
+  for (i = distributor; i < model_def->n_states; i++) {
+    edge_struct *edges = model_def->parent_edges[i];
+    PROBABILITY best = 0;
+    int arg = 0;
+    for (j = 0; j < model_def->n_parents[i]; j++) {
+      PROBABILITY v = row[edges[j].state] * edges[j].prob;
+      if (edges[j].state == distributor) v *= edge_scale[i];
+      if (v > best) {
+        best = v;
+        arg = j;
+      }
+    }
+    row[i] = best;
+    if (bp) SET_BACKPOINTER(bp, wide, i, arg);
+  }
+
+  return normalize_row(row, distributor, model_def->n_states);
+}
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   interval: number of sequence positions between stored rows, or 0 for the default
+   OUTPUTS:
+   path: the sequence->len normal states of the most probable path
+   returns its log probability
+
+   only every interval-th row is stored.  the traceback then recomputes one segment at a time from its checkpoint,
+   keeping the backpointers of that segment alone, so memory is O(n_states * (len / interval + interval)) and the
+   backpointers take one or two bytes each.
+*/
+double viterbi(model_def_struct *model_def, sequence_struct *sequence, int interval, int *path) {
+  unsigned long n = model_def->n_states;
+  long len = sequence->len, n_segments, seg, pos;
+  PROBABILITY *checkpoints, *rows, *edge_scale, *prev, *row, *tmp;
+  void *bp;
+  BOOL wide = FALSE;
+  size_t width;
+  double log_p = 0;
+  profile_timer_struct timer;
+  int i, state;
+
+  for (i = 0; i < model_def->n_states; i++) {
+    if (model_def->n_parents[i] > 65536) {
+      fprintf(stderr, "State %d has %d parents, more than Viterbi backpointers can address.\n", i, model_def->n_parents[i]);
+      exit(1);
     }
+    if (model_def->n_parents[i] > 256) wide = TRUE;
+  }
+  width = wide ? sizeof(unsigned short) : sizeof(unsigned char);
+
+  if (interval <= 0) interval = default_checkpoint_interval(len);
+  n_segments = (len + interval - 1) / interval;
+
+  // checkpoint seg holds the row just before segment seg, at position seg * interval - 1
+  checkpoints = alloc_table(sizeof(PROBABILITY) * n * n_segments);
+  rows = ALLOC(sizeof(PROBABILITY) * n * 2);
+  edge_scale = ALLOC(sizeof(PROBABILITY) * n);
+  for (i = 0; i < model_def->n_states; i++) edge_scale[i] = 1.0;
+  bp = alloc_table(width * n * interval);
+
+  profile_start(&timer);
+  prev = rows;
+  row = rows + n;
+  for (pos = 0; pos < len; pos++) {
+    log_p += log(viterbi_row(model_def, sequence, prev, row, pos, edge_scale, NULL, wide));
+    if ((pos + 1) % interval == 0 && pos + 1 < len) memcpy(checkpoints + n * ((pos + 1) / interval), row, sizeof(PROBABILITY) * n);
+    tmp = prev;
+    prev = row;
+    row = tmp;
+  }
 
-    qsort(pairs, n_pairs, sizeof(sortable_pair), cmp_sortable_pairs);
-    row[i] = pairs[n_pairs-1].value;
-    argmax[i] = pairs[n_pairs-1].index;
+  // the path ends in the best normal state of the last row
+  for (state = 0, i = 1; i < model_def->silent_states_begin; i++) {
+    if (prev[i] > prev[state]) state = i;
   }
+  log_p += log(prev[state]);
 
-  for (i = model_def->silent_states_begin + 1; i < model_def->n_states; i++) {
-    n_pairs = model_def->n_parents[i] - model_def->first_silent_parent[i];
-    for (j = model_def->first_silent_parent[i]; j < model_def->n_parents[i]; j++) {
-      int state = model_def->parents[i][j];
-      PROBABILITY transition_prob = fetch_transition_prob(model_def, state, i);
-      pairs[j].index = state;
-      pairs[j].value = row[state] * transition_prob;
+  for (seg = n_segments - 1; seg >= 0; seg--) {
+    long from = seg * interval, to = from + interval < len ? from + interval : len;
+
+    prev = seg > 0 ? checkpoints + n * seg : NULL;
+    for (pos = from; pos < to; pos++) {
+      row = rows + n * ((pos - from) % 2);
+      viterbi_row(model_def, sequence, prev, row, pos, edge_scale, (char *)bp + width * n * (pos - from), wide);
+      prev = row;
     }
 
-    if (n_pairs > 0) {
-      qsort(pairs, n_pairs, sizeof(sortable_pair), cmp_sortable_pairs);
-      if (pairs[n_pairs-1].value > row[i]) {
-        row[i] = pairs[n_pairs-1].value;
-        argmax[i] = pairs[n_pairs-1].index;
+    // state may be a silent one of row to - 1, reached from the segment after this
+    for (pos = to - 1; pos >= from; pos--) {
+      void *ptr = (char *)bp + width * n * (pos - from);
+      while (state >= model_def->silent_states_begin) {
+        state = model_def->parent_edges[state][GET_BACKPOINTER(ptr, wide, state)].state;
       }
+      path[pos] = state;
+      if (pos > 0) state = model_def->parent_edges[state][GET_BACKPOINTER(ptr, wide, state)].state;
     }
   }
+  profile_stop(&timer, PHASE_VITERBI);
+
+  free_table(checkpoints);
+  free(rows);
+  free(edge_scale);
+  free_table(bp);
+
+  return log_p;
 }
 
 
-void update_normal_states_viterbi(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int row_index, sortable_pair *pairs, int *ptr) {
-  PROBABILITY *row = table + (unsigned long)model_def->n_states * (unsigned long)row_index;
-  PROBABILITY *prev_row = table + (unsigned long)model_def->n_states * (unsigned long)(row_index - 1);
-  int *argmax = ptr + (unsigned long)model_def->n_states * (unsigned long)row_index;
-  int i, j, n_pairs;
 
-  for (i = 0; i < model_def->silent_states_begin; i++) {
-    n_pairs = model_def->n_parents[i];
-    for (j = 0; j < n_pairs; j++) {
-      int state = model_def->parents[i][j];
-      PROBABILITY transition_prob = fetch_transition_prob(model_def, state, i);
-      pairs[j].index = state;
-      pairs[j].value = prev_row[state] * transition_prob;
+// parses the n factors of one scaling table line; returns FALSE unless there are exactly n.  factors are kept
+// to float precision, as the columnar format stores them
+BOOL parse_scaling_line(char *line, int n, PROBABILITY *factors) {
+  char *end;
+  int i;
+
+  for (i = 0; i < n; i++) {
+    factors[i] = (float)strtod(line, &end);
+    if (end == line) return FALSE;
+    line = end;
+  }
+  while (isspace((unsigned char)*line)) line++;
+
+  return *line == '\0';
+}
+
+BOOL blank_line(char *line) {
+  while (isspace((unsigned char)*line)) line++;
+  return *line == '\0';
+}
+
+
+// the columnar scaling file mapped at base, its columns read in place.  the scaling returned owns the mapping, and
+// unmaps it when it and every slice of it are freed
+position_scaling_struct *read_scaling_file(char *filename, char *base, size_t size, int n_columns, int *states, long len) {
+  scaling_file_header_struct *header = (scaling_file_header_struct *)base;
+  scaling_store_struct *store;
+  scaling_column_struct **columns;
+  position_scaling_struct *scaling;
+  size_t offset = sizeof(scaling_file_header_struct);
+  int i;
+
+  if (size < sizeof(scaling_file_header_struct) || header->version != SCALING_FILE_VERSION) {
+    fprintf(stderr, "Scaling file %s was written by an incompatible version of compete; convert it again.\n", filename);
+    exit(1);
+  }
+  if (header->n_columns != n_columns || header->len != len) {
+    fprintf(stderr, "%s has %d columns of %lld positions, but the model and the sequences of seq_file need %d of %ld.\n", filename, header->n_columns, header->len, n_columns, len);
+    exit(1);
+  }
+
+  store = ALLOC(sizeof(scaling_store_struct));
+  store->refs = 1;
+  store->n_columns = n_columns;
+  store->columns = ALLOC(sizeof(scaling_column_struct) * (n_columns > 0 ? n_columns : 1));
+  store->mapping = base;
+  store->mapping_length = size;
+  columns = ALLOC(sizeof(scaling_column_struct *) * (n_columns > 0 ? n_columns : 1));
+  for (i = 0; i < n_columns; i++) {
+    scaling_column_header_struct *column_header;
+    scaling_column_struct *column = columns[i] = store->columns + i;
+
+    if (offset + sizeof(scaling_column_header_struct) > size) break;
+    column_header = (scaling_column_header_struct *)(base + offset);
+    if (column_header->n_values < 0 || column_header->n_values > len || (column_header->encoding == SCALING_DENSE && column_header->n_values != len)) break;
+    if (column_header->encoding != SCALING_DENSE && column_header->encoding != SCALING_RUNS) break;
+    offset += scaling_column_size(column_header);
+    if (offset > size) break;
+
+    column->encoding = column_header->encoding;
+    column->n_values = column_header->n_values;
+    column->run_index = NULL;
+    if (column->encoding == SCALING_RUNS) {
+      long long j, covered = 0;
+      column->lengths = SCALING_RUN_LENGTHS(column_header);
+      column->values = SCALING_RUN_VALUES(column_header);
+      for (j = 0; j < column->n_values && column->lengths[j] > 0; j++) covered += column->lengths[j];
+      if (j < column->n_values || covered != len) break;
+      index_scaling_column(column);
+    } else {
+      column->lengths = NULL;
+      column->values = SCALING_DENSE_VALUES(column_header);
     }
+  }
+  if (i < n_columns) {
+    fprintf(stderr, "Scaling file %s is truncated or corrupt.\n", filename);
+    exit(1);
+  }
+
+  scaling = scaling_of_columns(store, columns, states, n_columns, 0, len);
+  release_scaling_store(store);
+  free(columns);
+  return scaling;
+}
+
+
+position_scaling_struct *read_position_scaling(char *filename, int n_columns, int *states, long len) {
+  PROBABILITY *factors;
+  char magic[8], *line = NULL;
+  size_t capacity = 0;
+  long pos = 0, line_number = 1;
+  FILE *in;
+
+  if (!(in = fopen(filename, "r"))) {
+    fprintf(stderr, "Can't open %s\n", filename);
+    exit(1);
+  }
+
+  if (fread(magic, sizeof(magic), 1, in) == 1 && memcmp(magic, SCALING_FILE_MAGIC, sizeof(magic)) == 0) {
+    struct stat sb;
+
+    fstat(fileno(in), &sb);
+    char *base = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fileno(in), 0);
+    fclose(in);
+    if (base == MAP_FAILED) {
+      fprintf(stderr, "Failed to map scaling file %s.\n", filename);
+      exit(1);
+    }
+    return read_scaling_file(filename, base, sb.st_size, n_columns, states, len);
+  }
+  rewind(in);
+
+  // the header line names the columns
+  if (getline(&line, &capacity, in) < 0) {
+    fprintf(stderr, "%s is empty.\n", filename);
+    exit(1);
+  }
+
+  factors = ALLOC(sizeof(PROBABILITY) * (n_columns > 0 ? n_columns : 1));
+  scaling_builder_struct *builder = begin_position_scaling(n_columns, states, len);
+  while (getline(&line, &capacity, in) >= 0) {
+    line_number++;
+    if (blank_line(line)) continue;
+    if (pos == len) {
+      fprintf(stderr, "hit line %ld in file %s, but the sequences of seq_file are %ld positions long\n", line_number, filename, len);
+      exit(1);
+    }
+    if (!parse_scaling_line(line, n_columns, factors)) {
+      fprintf(stderr, "line %ld of %s should have %d fields\n", line_number, filename, n_columns);
+      exit(1);
+    }
+    add_scaling_position(builder, pos++, factors);
+  }
 
-    qsort(pairs, n_pairs, sizeof(sortable_pair), cmp_sortable_pairs);
-    row[i] = fetch_emission_prob(model_def, i, sequence->seq[row_index]) * pairs[n_pairs-1].value;
-    argmax[i] = pairs[n_pairs-1].index;
+  if (pos != len) {
+    fprintf(stderr, "file %s only has %ld lines, but the sequences of seq_file are %ld positions long\n", filename, pos, len);
+    exit(1);
   }
+
+  fclose(in);
+  free(line);
+  free(factors);
+  return finish_position_scaling(builder);
 }
 
-void viterbi(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int *path, PROBABILITY *s) {
-  int i, j;
-  sortable_pair *pairs;
-  int *ptr;
+void read_sequence_scalings(char *filename, int n_columns, int *states, long *lens, int n_seqs, position_scaling_struct **scalings) {
+  position_scaling_struct *scaling;
+  long total = 0, from = 0;
+  int i;
 
-  pairs = ALLOC(sizeof(sortable_pair) * model_def->n_states);
-  ptr = ALLOC(sizeof(int) * model_def->n_states * sequence->len);
+  for (i = 0; i < n_seqs; i++) total += lens[i];
+  scaling = read_position_scaling(filename, n_columns, states, total);
 
-  // initialize first row
-  // normal states need to be handled specially
-  for (i = 0; i < model_def->silent_states_begin; i++) {
-    table[i] = model_def->initial_probs[i] * fetch_emission_prob(model_def, i, sequence->seq[0]);
-    ptr[i] = model_def->n_states;  // special value to indicate no previous state
+  for (i = 0; i < n_seqs; i++) {
+    scalings[i] = slice_position_scaling(scaling, from, lens[i]);
+    from += lens[i];
   }
+  free_position_scaling(scaling);
+}
 
-  // silent states can use the normal machinery
-  update_silent_states_viterbi(model_def, sequence, table, 0, pairs, ptr);
 
-  // the first weight is just the sum of the first column (row, in this implementation).  calculate, and normalize.
-  s[0] = normalize_row(table, model_def->silent_states_begin, model_def->n_states);
+// one column of the scaling table being converted, as runs
+typedef struct {
+  long long *lengths;
+  float *values;
+  long long n_runs, capacity;
+} scaling_column_runs_struct;
 
-  // first row initialization complete
 
+void write_scaling_file(char *tsv_filename, char *filename) {
+  static const char padding[8] = {0};
+  scaling_column_runs_struct *columns = NULL;
+  scaling_file_header_struct header;
+  PROBABILITY *factors = NULL;
+  char *line = NULL, *c, *end;
+  size_t capacity = 0;
+  long line_number = 1;
+  int n_columns = -1, i;
+  FILE *in, *out;
 
-  // fill out the rest of the table now
-  for (i = 1; i < sequence->len; i++) {
-    #ifdef VERBOSE
-    if (i % 500 == 0) fprintf(stderr, "viterbi row %d\n", i);
-    #endif
-    update_normal_states_viterbi(model_def, sequence, table, i, pairs, ptr);
-    update_silent_states_viterbi(model_def, sequence, table, i, pairs, ptr);
-    s[i] = normalize_row(table + (unsigned long)model_def->n_states * (unsigned long)i, model_def->silent_states_begin, model_def->n_states);
+  if (!(in = fopen(tsv_filename, "r"))) {
+    fprintf(stderr, "Can't open %s\n", tsv_filename);
+    exit(1);
+  }
+  if (getline(&line, &capacity, in) < 0) {
+    fprintf(stderr, "%s is empty.\n", tsv_filename);
+    exit(1);
   }
 
-  PROBABILITY *row = table + (unsigned long)model_def->n_states * (unsigned long)(sequence->len-1);
-  int state;
-  for (i = 0; i < model_def->n_states; i++) {
-    pairs[i].index = i;
-    pairs[i].value = row[i];
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SCALING_FILE_MAGIC, sizeof(header.magic));
+  header.version = SCALING_FILE_VERSION;
+
+  while (getline(&line, &capacity, in) >= 0) {
+    line_number++;
+    if (blank_line(line)) continue;
+
+    if (n_columns < 0) {
+      // the first line of factors sets the number of columns
+      for (n_columns = 0, c = line; strtod(c, &end), end != c; c = end) n_columns++;
+      columns = ALLOC(sizeof(scaling_column_runs_struct) * (n_columns > 0 ? n_columns : 1));
+      memset(columns, 0, sizeof(scaling_column_runs_struct) * (n_columns > 0 ? n_columns : 1));
+      factors = ALLOC(sizeof(PROBABILITY) * (n_columns > 0 ? n_columns : 1));
+    }
+    if (!parse_scaling_line(line, n_columns, factors)) {
+      fprintf(stderr, "line %ld of %s should have %d fields\n", line_number, tsv_filename, n_columns);
+      exit(1);
+    }
+
+    for (i = 0; i < n_columns; i++) {
+      scaling_column_runs_struct *column = columns + i;
+      float value = factors[i];
+      if (column->n_runs > 0 && column->values[column->n_runs - 1] == value) {
+        column->lengths[column->n_runs - 1]++;
+        continue;
+      }
+      if (column->n_runs == column->capacity) {
+        column->capacity = column->capacity ? 2 * column->capacity : 1024;
+        column->lengths = realloc(column->lengths, sizeof(long long) * column->capacity);
+        column->values = realloc(column->values, sizeof(float) * column->capacity);
+        if (!column->lengths || !column->values) {
+          fprintf(stderr, "Error allocating memory.  Exiting.\n");
+          exit(1);
+        }
+      }
+      column->lengths[column->n_runs] = 1;
+      column->values[column->n_runs++] = value;
+    }
+    header.len++;
   }
-  qsort(pairs, model_def->n_states, sizeof(sortable_pair), cmp_sortable_pairs);
-  state = pairs[model_def->n_states-1].index;
+  fclose(in);
 
-  for (i = sequence->len - 1; i >= 0; i--) {
-    int *argmax = ptr + (unsigned long)model_def->n_states * (unsigned long)(i);
-    while (state >= model_def->silent_states_begin) { // backtrack through silent states
-      state = argmax[state];
+  header.n_columns = n_columns > 0 ? n_columns : 0;
+  if (!(out = fopen(filename, "w"))) {
+    fprintf(stderr, "Opening %s for writing failed.\n", filename);
+    exit(1);
+  }
+
+  BOOL failed = fwrite(&header, sizeof(header), 1, out) != 1;
+  for (i = 0; i < header.n_columns; i++) {
+    scaling_column_runs_struct *column = columns + i;
+    scaling_column_header_struct column_header;
+    long long j, k;
+
+    // runs unless a column changes so often that plain floats are smaller
+    memset(&column_header, 0, sizeof(column_header));
+    if (column->n_runs * (sizeof(long long) + sizeof(float)) < header.len * sizeof(float)) {
+      column_header.encoding = SCALING_RUNS;
+      column_header.n_values = column->n_runs;
+      failed |= fwrite(&column_header, sizeof(column_header), 1, out) != 1;
+      failed |= fwrite(column->lengths, sizeof(long long), column->n_runs, out) != column->n_runs;
+      failed |= fwrite(column->values, sizeof(float), column->n_runs, out) != column->n_runs;
+    } else {
+      column_header.encoding = SCALING_DENSE;
+      column_header.n_values = header.len;
+      failed |= fwrite(&column_header, sizeof(column_header), 1, out) != 1;
+      for (j = 0; j < column->n_runs; j++) {
+        for (k = 0; k < column->lengths[j]; k++) failed |= fwrite(column->values + j, sizeof(float), 1, out) != 1;
+      }
     }
-    path[i] = state;
-    state = argmax[state];
+    unsigned long written = scaling_column_size(&column_header) - sizeof(column_header);
+    unsigned long data = column_header.encoding == SCALING_RUNS ? column->n_runs * (sizeof(long long) + sizeof(float)) : header.len * sizeof(float);
+    if (written > data) failed |= fwrite(padding, written - data, 1, out) != 1;
+
+    free(column->lengths);
+    free(column->values);
+  }
+  if (failed) {
+    fprintf(stderr, "Error writing %s.  Exiting.\n", filename);
+    exit(1);
   }
 
-  free(pairs);
-  free(ptr);
+  fclose(out);
+  free(columns);
+  free(factors);
+  free(line);
 }
 
 
+unsigned long scaling_column_size(scaling_column_header_struct *column) {
+  unsigned long size = column->encoding == SCALING_RUNS ? column->n_values * (sizeof(long long) + sizeof(float)) : column->n_values * sizeof(float);
+
+  // every column header is 8-byte aligned
+  return sizeof(scaling_column_header_struct) + (size + 7) / 8 * 8;
+}
+
 
 void load_seq_pos_conc_scaler(char* file_name, float** seq_pos_conc_scaler,
                               int sequence_length, int n_motifs, BOOL nuc_present)
 {
     // the file that specifies the position specific conc scaler should be a csv
     // file, delimited by \t. The first line of the file should be header.
-    // The first column should be nucleosome, and the rest should be TFs
+    // The first columns should be TFs, in model order, and the last nucleosome
     FILE *in;
     //char tmp[1024];
     char tmp[4096];
 
     int line_count = 0;
-    int field_parsed = 0;
 
     in = fopen(file_name, "r");
 
@@ -1115,7 +4570,11 @@ void load_seq_pos_conc_scaler(char* file_name, float** seq_pos_conc_scaler,
     }
 
     // ignore the header line
-    char* ptr = fgets(tmp, sizeof(tmp),in);
+    if(!fgets(tmp, sizeof(tmp),in))
+    {
+        fprintf(stderr, "%s is empty, expected a header line\n", file_name);
+        exit(1);
+    }
     line_count++;
 
     // how many filed do I expect on each line
@@ -1134,15 +4593,7 @@ void load_seq_pos_conc_scaler(char* file_name, float** seq_pos_conc_scaler,
             exit(1);
         }
 
-        field_parsed = parse_one_line(tmp, seq_pos_conc_scaler, line_count - 1,
-                                      total_filed);
-
-        // filed in each line should equal to the number of TFs plus nucleosome
-        //if(field_parsed != total_filed) {
-        //  fprintf(stderr, "line %d only have %d field, there should be %d\n",
-        //          line_count, field_parsed, n_motifs + 1);
-        //  exit(1);
-        //}
+        parse_one_line(tmp, seq_pos_conc_scaler, line_count - 1, total_filed);
 
         line_count++;
     }
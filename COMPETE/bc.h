@@ -1,6 +1,10 @@
+#ifndef BC_H
+#define BC_H
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -8,6 +12,8 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <sys/sysctl.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 
 #define BOOL char
 #define TRUE 1
@@ -15,9 +21,82 @@
 
 #define PROBABILITY double
 
-#define VERBOSE
+// compete -P phases, each timed on its own.  the row phases run on every worker thread; a thread's posterior
+// summation is taken out of the backward pass it is fused with
+#define PHASE_PARSE 0        // reading the model file, or mapping a compiled one
+#define PHASE_EDGES 1        // find_parents_and_children()
+#define PHASE_SCALING 2      // loading the position specific scaling factors
+#define PHASE_TEMPERATURE 3  // applying concentrations and temperature to the model
+#define PHASE_FORWARD 4
+#define PHASE_BACKWARD 5
+#define PHASE_POSTERIOR 6
+#define PHASE_VITERBI 7
+#define PHASE_OUTPUT 8
+#define N_PHASES 9
+
+// parallel_forward_backward(): relative agreement at which a repaired row is taken to match the stored one,
+// and how far ahead of its chunk a speculative start begins
+#define PARALLEL_TOLERANCE 1e-12
+#define PARALLEL_WARMUP 1000
+
+// engines a compete run can be planned onto (plan_memory())
+#define ENGINE_FULL 0          // a whole forward table: forward_fused_posterior(), or one per posterior_on_all_seqs() task
+#define ENGINE_CHECKPOINTED 1
+#define ENGINE_PARALLEL 2
+#define ENGINE_WINDOWED 3
+
+// default number of positions each window of windowed_forward_backward() is extended by on either side
+#define DEFAULT_WINDOW_OVERLAP 5000
+
+// baum_welch() stopping rule of compete --train: at most this many E steps, or a log likelihood gain below this
+#define DEFAULT_TRAIN_ITERATIONS 20
+#define DEFAULT_TRAIN_TOLERANCE 1e-3
+
+// alignment of each symbol's row of the per-symbol emission table, wide enough for AVX-512
+#define EMISSION_ALIGNMENT 64
+
+// forward table storage.  TABLE_FLOAT rows are computed in double and only stored as float, halving the table
+#define TABLE_DOUBLE 0
+#define TABLE_FLOAT 1
+
+// compiled models (write_compiled_model()) start with this, and are refused unless the version matches
+#define COMPILED_MODEL_MAGIC "COMPETEm"
+#define COMPILED_MODEL_VERSION 1
+// every section of a compiled model starts on a multiple of this
+#define COMPILED_MODEL_ALIGNMENT 64
 
 void *ALLOC(size_t size);
+
+// DP tables, checkpoint rows and scale arrays (alloc_table()) start on a multiple of this, like the emission rows
+#define TABLE_ALIGNMENT 64
+// tables of at least this many bytes get a mapping of their own, whose pages nothing has touched yet
+#define TABLE_MAP_THRESHOLD (1UL << 20)
+// transparent huge page size, which enable_huge_pages() aligns the mappings of tables at least this large to
+#define HUGE_PAGE_SIZE (2UL << 20)
+
+/* memory for a DP table, checkpoint rows, scale array or other buffer the row loops stream through, TABLE_ALIGNMENT
+   aligned.  large ones are mapped on their own rather than carved from the heap, so their pages are only
+   faulted in by the first write: under Linux's first-touch policy each page lands on the NUMA node of the thread
+   that fills it, and the engines have each chunk of a table filled by the worker that owns it, or allocate it on
+   that worker.  after enable_huge_pages() (compete --huge-pages) the mappings of tables over HUGE_PAGE_SIZE are
+   huge-page aligned and advised (madvise(MADV_HUGEPAGE)) for transparent huge pages.  freed with free_table()
+*/
+void *alloc_table(size_t size);
+
+void free_table(void *table);
+
+void enable_huge_pages();
+
+// a table a worker keeps from task to task (sequence, window or iteration), grown to the largest it was asked for
+typedef struct {
+  void *data;
+  size_t size;
+} scratch_table_struct;
+
+// scratch->data, grown to at least size bytes; its contents are not kept
+void *reserve_scratch_table(scratch_table_struct *scratch, size_t size);
+
+void free_scratch_table(scratch_table_struct *scratch);
   
 
 // states and characters (emissions) are always considered to be numbered starting at 0
@@ -29,17 +108,42 @@ typedef struct s_r_s {
 } state_range_struct;
 
 typedef struct {
-  int position_from; // which positions along the input sequence this corresponds to
+  int position_from; // which positions along the input sequence this corresponds to, from 0 and inclusive
   int position_to;
   state_range_struct *state_ranges;
 } fixed_states_struct;
 
+typedef struct {
+  int state; // the state at the other end of the edge
+  PROBABILITY prob; // transition probability along the edge
+} edge_struct;
+
+// nucleosome body: n_positions consecutive blocks of 16 dinucleotide states starting at first_state.  state
+// (q, 4i + j) emits base j and moves to (q + 1, 4j + k), so each block is fed by the previous one through a
+// dense 16-lane transfer instead of being walked edge by edge.
+typedef struct {
+  int first_state;
+  int n_positions;
+  PROBABILITY *weights;   // [n_positions][4][16]: weights[q][i][4j + k] is the transition (q - 1, 4i + j) -> (q, 4j + k)
+  PROBABILITY *emissions; // [n_positions][alphabet_length][16]: emission of each block state, by character
+} nucleosome_kernel_struct;
+
+// update_normal_row()'s loops generated and compiled for one model topology (specialize_model()).  forward takes
+// the row's emissions (emission_by_chr) and the parent edge pool, backward the symbol's child_emission_weights
+typedef struct {
+  void *handle;            // of the dlopen()ed kernel
+  unsigned long topology;  // model_topology_hash() it was generated for
+  void (*forward)(const PROBABILITY *prev_row, PROBABILITY *row, const PROBABILITY *em, const edge_struct *edges);
+  void (*backward)(const PROBABILITY *next_row, PROBABILITY *row, const PROBABILITY *weights);
+} specialized_kernel_struct;
+
 typedef struct {
   char **state_names; // n_states long array of pointers to strings containing state names
   int n_states;
   PROBABILITY *initial_probs;  // silent_states_begin array of probabilities of beginning in each non-silent state
   PROBABILITY *transition_matrix;  // n_states by n_states array of transition probabilities
                                    // consider row index to be "from" state, column index to be "to" state
+                                   // only exists while the model is being built; finalize_model() frees it
 //  PROBABILITY *transition_matrix_b;  // split this out to allow "fixed" states along a sequence (i.e. enforcement of a certain state at a certain position)
   PROBABILITY *emission_matrix;  // alphabet_length by n_states array of emission probabilities
                                  // consider row index to be state, column index to be alphabet index
@@ -59,29 +163,350 @@ typedef struct {
   int *n_children;
   int *first_silent_child;
 
+  // the same lists in compressed sparse form, each edge's probability stored next to the state at its other end.
+  // parent_edges[i][j] is the edge parents[i][j] -> i, child_edges[i][j] is the edge i -> children[i][j].
+  edge_struct **parent_edges;
+  edge_struct **child_edges;
+  edge_struct *parent_edge_pool; // contiguous storage behind parent_edges, in state order
+  edge_struct *child_edge_pool; // contiguous storage behind child_edges, in state order
+  int n_edges;
+  BOOL edges_stale; // a transition was added to the dense matrix after the edge lists were built
+
+  // per-symbol tables built by finalize_model().  emission_by_chr[c * emission_stride + i] is the emission of
+  // symbol c by state i, each symbol's row aligned to EMISSION_ALIGNMENT bytes; child_emission_weights[c * n_edges + e]
+  // is child_edge_pool[e].prob times the child's emission of c (or just the probability, for silent children).
+  PROBABILITY *emission_by_chr;
+  int emission_stride;
+  PROBABILITY *child_emission_weights;
+
+  nucleosome_kernel_struct *nuc_kernel; // NULL unless enable_nucleosome_kernel() recognised the nucleosome block
+  specialized_kernel_struct *specialized; // NULL unless specialize_model() compiled one; clones share it
+
+  int table_precision; // TABLE_DOUBLE or TABLE_FLOAT: how forward_fused_posterior() stores the forward table
+
   FILE *output;
 
+  // a compiled model is mmap()ed privately, and the arrays above point into the mapping: pages are shared between
+  // runs until a run changes their probabilities.  NULL for models read from a config file.
+  void *mapping;
+  size_t mapping_length;
+
   fixed_states_struct *fixed_states; // list of postions -> states restrictions for fixing input sequence positions to be in certain states
   int n_fixed_states; // how many fixed position -> state mappings we've got
   BOOL *fixed_state_positions; // vector indicating which positions have state restrictions
 } model_def_struct;
 
 
+/* position-specific concentration scaling of the distributor's transitions, from local_conc_scale_file.  the factor
+   of a column at position p multiplies the transition into its element for elements that begin at p, so the model's
+   transitions themselves are never copied.  each column is kept as a columnar scaling file lays it out, in float:
+   mapped in place from such a file, or built from the tab delimited table into the same layout.  positions offset ..
+   offset + len - 1 of the columns are the scaling's 0 .. len - 1, so slices of one file share its columns.
+*/
+typedef struct {
+  int encoding;              // SCALING_DENSE or SCALING_RUNS
+  long long n_values;
+  long long *lengths;        // SCALING_RUNS: the length of each run
+  float *values;             // the factor of each position, or of each run
+  long long *run_index;      // SCALING_RUNS: first position of runs 0, SCALING_INDEX_STRIDE, 2 * SCALING_INDEX_STRIDE ...
+} scaling_column_struct;
+
+// every SCALING_INDEX_STRIDE-th run of a SCALING_RUNS column has its first position indexed
+#define SCALING_INDEX_STRIDE 16
+
+// the columns of a scaling and their storage, shared by every slice of it
+typedef struct {
+  int refs;
+  int n_columns;
+  scaling_column_struct *columns;
+  void *mapping;             // the columnar file the columns point into; NULL when they're built in memory
+  size_t mapping_length;
+} scaling_store_struct;
+
+typedef struct {
+  int n_columns;                    // columns that aren't 1 everywhere; the others are dropped
+  int *states;                      // distributor child each column scales
+  scaling_column_struct **columns;  // into store
+  long offset, len;
+  unsigned long id;                 // tells the scalings a scaling_cursor_struct has seen apart
+  scaling_store_struct *store;
+} position_scaling_struct;
+
+// where a scan of a scaling is, so that positions near the last one are found without a search
+typedef struct {
+  unsigned long id;          // of the scaling the cursor is on, 0 for none
+  long begin, end;           // positions the factors hold for
+  BOOL unit;                 // every factor is 1
+  int capacity;
+  PROBABILITY *factors;
+  long long *run, *run_begin; // per SCALING_RUNS column, the run at begin and its first position in the column
+} scaling_cursor_struct;
+
+
+/* what a run leaves behind for a later one that only changes the scaling factors (refresh_forward_backward()): the
+   scale factors of every position, the forward and backward rows of every interval-th one, and the posteriors.
+   fingerprint covers the model, its parameters, fixed states, output columns and the sequence, and scaling is the
+   scaling the rows were computed with.  the checkpoints are the positions p with (p + phase) % interval == 0, so
+   states of overlapping regions of one chromosome can share them (result caches, run_with_result_cache()).
+*/
+typedef struct {
+  long len, phase;
+  int n_states, interval, n_columns;
+  unsigned long fingerprint;
+  PROBABILITY *sf, *sb;          // len of each
+  PROBABILITY *f_rows, *b_rows;  // rows of positions -phase, interval - phase, 2 * interval - phase ... (the first
+                                 // unused unless phase is 0)
+  PROBABILITY *posterior;        // len by n_columns
+  position_scaling_struct *scaling;
+  BOOL valid;                    // FALSE until a run has filled it in
+} boundary_state_struct;
+
+// boundary state files hold a boundary_state_header_struct, then sf, sb, f_rows, b_rows and posterior, then the
+// scaling: its states (int), and for each run its first position (long) and its factors (double, 1 where NULL)
+#define BOUNDARY_STATE_MAGIC "COMPETEb"
+#define BOUNDARY_STATE_VERSION 1
+
+typedef struct {
+  char magic[8];
+  int version;
+  int n_states;
+  int interval;
+  int n_columns;
+  long long len;
+  unsigned long long fingerprint;
+  int scaling_columns;
+  int phase;               // 0 in files written before states had one
+  long long scaling_runs;
+} boundary_state_header_struct;
+
+
+// expected counts of a training sweep
+typedef struct {
+  PROBABILITY *transitions;  // per edge, in parent_edge_pool order
+  PROBABILITY *emissions;    // silent_states_begin by alphabet_length
+  double log_likelihood;
+} expected_counts_struct;
+
+
+// normal states a fixed position may be in: from[i] .. to[i], ascending and disjoint
+typedef struct {
+  int n_ranges;
+  int *from, *to;
+} state_mask_struct;
+
+/* the fixed_states of a model, precompiled for one sequence: one mask per run of positions covered by the same set
+   of fixed ranges, NULL for runs no range covers.  the row kernels clear the states a run's mask excludes.
+*/
+typedef struct {
+  long n_runs;
+  long *run_begin;            // first position of each run, ascending from 0
+  state_mask_struct **masks;
+  state_mask_struct *mask_pool;
+} fixed_state_masks_struct;
+
+
+// incremental construction of a position_scaling_struct, one position at a time in ascending order.  each column is
+// run-length encoded until that takes more room than one float per position
+typedef struct {
+  int n_columns;
+  int *states;
+  long len, pos;                   // positions expected, and the first not filled in yet
+  scaling_column_struct *columns;
+  long long *capacity;             // of each SCALING_RUNS column's runs
+} scaling_builder_struct;
+
+
+// columnar scaling files (write_scaling_file()) start with a scaling_file_header_struct, followed by n_columns
+// columns, each a scaling_column_header_struct and its data padded to 8 bytes: for SCALING_RUNS, n_values run
+// lengths (long long) then n_values float factors; for SCALING_DENSE, one float factor per position
+#define SCALING_FILE_MAGIC "COMPETEf"
+#define SCALING_FILE_VERSION 1
+
+enum { SCALING_DENSE, SCALING_RUNS };
+
+typedef struct {
+  char magic[8];
+  int version;
+  int n_columns;
+  long long len;
+} scaling_file_header_struct;
+
+typedef struct {
+  int encoding;
+  int reserved;
+  long long n_values;
+} scaling_column_header_struct;
+
+#define SCALING_RUN_LENGTHS(column) ((long long *)((column) + 1))
+#define SCALING_RUN_VALUES(column) ((float *)(SCALING_RUN_LENGTHS(column) + (column)->n_values))
+#define SCALING_DENSE_VALUES(column) ((float *)((column) + 1))
+
+
 typedef struct {
   char *seq; // array of output characters, represented by their index in alphabet in ASCII characters (i.e. letter 0 is chr(0))
+             // NULL for sequences in a packed sequence store; use fetch_symbol() rather than reading this directly
   long len;
+  unsigned char *packed; // packed store bases, four to a byte with the first in the low bits
+  long packed_offset;    // index among the packed bases of the sequence's position 0
+  void *mapping;         // the store mapping this sequence owns, if any
+  size_t mapping_length;
+  position_scaling_struct *scaling; // NULL when unscaled
+  fixed_state_masks_struct *fixed_masks; // NULL when no position is fixed
+  long view_offset;      // position of the sequence's position 0 in the sequence scaling and fixed_masks describe
 } sequence_struct;
 
 
+// packed sequence stores (write_sequence_store()) start with a sequence_store_header_struct, followed by n_records
+// sequence_store_record_struct, followed at data_offset by the 2-bit packed bases of every record
+#define SEQUENCE_STORE_MAGIC "COMPETEs"
+#define SEQUENCE_STORE_VERSION 1
+#define SEQUENCE_STORE_NAME_LENGTH 64
+#define SEQUENCE_STORE_ALIGNMENT 4096
+
+typedef struct {
+  char magic[8];
+  int version;
+  int n_records;
+  long long data_offset; // from the start of the file
+} sequence_store_header_struct;
+
+typedef struct {
+  char name[SEQUENCE_STORE_NAME_LENGTH];  // FASTA record name, or input file name without directory and extension
+  long long offset;  // of the record's first base among the packed bases, always a multiple of 4
+  long long len;
+} sequence_store_record_struct;
+
+
+// sections of a compiled model file, in file order
+enum {
+  COMPILED_ALPHABET,
+  COMPILED_INITIAL_PROBS,
+  COMPILED_EMISSION_MATRIX,
+  COMPILED_N_PARENTS,
+  COMPILED_FIRST_SILENT_PARENT,
+  COMPILED_PARENTS,          // every state's parents list, one after another
+  COMPILED_N_CHILDREN,
+  COMPILED_FIRST_SILENT_CHILD,
+  COMPILED_CHILDREN,
+  COMPILED_PARENT_EDGE_POOL,
+  COMPILED_CHILD_EDGE_POOL,
+  COMPILED_N_SECTIONS
+};
+
+
+typedef struct {
+  char magic[8];
+  int version;
+  int probability_size;  // sizeof(PROBABILITY) and sizeof(edge_struct) of the build that wrote the file
+  int edge_size;
+  int n_states;
+  int silent_states_begin;
+  int alphabet_length;
+  int case_sensitive;
+  int n_edges;
+  unsigned long offsets[COMPILED_N_SECTIONS];  // from the start of the file
+} compiled_model_header_struct;
+
+
+// a line of the seq_filenames file
+typedef struct {
+  char name[256];
+  long begin, end;
+} sequence_region_struct;
+
+
 typedef void(*a0k_func)(model_def_struct *);
 
+// pools the expected counts of parameters a model ties together, before baum_welch()'s M step normalizes them
+typedef void(*tie_func)(model_def_struct *, expected_counts_struct *);
+
+
+typedef struct {
+  int n_columns;
+  char **names; // n_columns column labels, for output headers
+  state_range_struct **ranges; // per column list of state ranges whose posteriors are summed into that column
+} posterior_columns_struct;
+
+
+// state carried between consecutive backward_posterior_segment calls
+typedef struct {
+  PROBABILITY *b_next; // backward row of the position after the next one to compute
+  PROBABILITY *b_row;  // scratch row for the next backward row
+  PROBABILITY sb_next; // scaling factor of b_next
+  PROBABILITY log_sr;  // running sum of log(sb / sf) ratios, as in calc_log_sr
+} backward_stream_struct;
+
+
+// one worker's share of a run_sequence_tasks() pool: sequence indices, taken from the head by the owner and from
+// the tail by thieves
+typedef struct {
+  int *tasks;
+  int head, tail;
+  pthread_mutex_t lock;
+} task_deque_struct;
+
+
+typedef struct {
+  task_deque_struct *deques;
+  int n_workers;
+  void (*run)(void *arg, int seq_index, int worker);
+  void *arg;
+} task_pool_struct;
+
+
+typedef struct {
+  task_pool_struct *pool;
+  int worker;
+} task_worker_struct;
+
 
+// one chunk of a table filled by parallel_table_fill()
 typedef struct {
   model_def_struct *model_def;
   sequence_struct *sequence;
-  PROBABILITY *table;
-  PROBABILITY *s;
-} thread_wrapper_struct;
+  PROBABILITY *table; // forward table, or backward table (stored in reverse)
+  PROBABILITY *s;     // scaling factors by sequence position
+  long from, to;      // sequence positions [from, to) covered by the chunk
+  BOOL forward;
+  BOOL speculative;   // first pass, started without a boundary row
+  PROBABILITY *boundary; // on repair passes, the row just before the chunk along the recursion
+  PROBABILITY *scratch;  // two rows
+  BOOL end_changed;   // the repair pass rewrote the chunk's last row along the recursion
+} sequence_chunk_struct;
+
+
+// shared state of the windowed_forward_backward() thread pool
+typedef struct {
+  model_def_struct *model_def;
+  sequence_struct *sequence;
+  posterior_columns_struct *columns;
+  PROBABILITY *posterior;
+  long window, overlap;
+  long n_windows;
+  long next_window;      // next window to hand out, under lock
+  pthread_mutex_t lock;
+} window_pool_struct;
+
+
+// one thread's -P counters.  each thread gets its own on first use, so the row kernels count without locking
+typedef struct t_p_s {
+  double wall[N_PHASES], cpu[N_PHASES]; // seconds spent in each phase
+  long calls[N_PHASES];
+  long rows[N_PHASES];                  // rows computed (or, for PHASE_POSTERIOR, summed) in each phase
+  struct t_p_s *next;                   // every thread's counters, in the order they were first used
+} thread_profile_struct;
+
+
+typedef struct {
+  struct timespec wall, cpu;
+  double nested; // wall seconds of a phase run inside this one, to be charged to it instead; see profile_stop_nested()
+} profile_timer_struct;
+
+
+// set by enable_profiling(); everything below does nothing while it's FALSE
+extern BOOL profiling;
+
+#define PROFILE_ROW(phase) do { if (profiling) thread_profile()->rows[phase]++; } while (0)
 
 
 // these functions will be helpful if I ever change how the matrices are constructed..
@@ -104,8 +529,93 @@ void set_transition_prob_b(model_def_struct *model_def, int from, int to, PROBAB
 // state is given in state number, chr is given in character number
 PROBABILITY fetch_emission_prob(model_def_struct *model_def, int state, int chr);
 
+// character number at position pos of sequence, wherever it is stored
+char fetch_symbol(sequence_struct *sequence, long pos);
+
+// view is set to positions from .. from + len - 1 of sequence, sharing its storage
+void sequence_view(sequence_struct *sequence, long from, long len, sequence_struct *view);
+
+/* factors (one per scaling column) for elements that begin at position pos of sequence, or NULL when they're all 1.
+   each thread keeps a scaling_cursor_struct, so a pass through the positions in either direction finds them without
+   searching.  the factors stay valid until the thread's next call.
+*/
+const PROBABILITY *position_scaling(sequence_struct *sequence, long pos);
+
+void init_scaling_cursor(scaling_cursor_struct *cursor);
+
+void free_scaling_cursor(scaling_cursor_struct *cursor);
+
+/* factors of scaling at pos, or NULL when they're all 1; end is set to the first position past pos at which some
+   factor may change (at most scaling->len).  they stay valid until cursor is moved again
+*/
+const PROBABILITY *seek_scaling_cursor(scaling_cursor_struct *cursor, position_scaling_struct *scaling, long pos, long *end);
+
+/* INPUTS:
+   columns: n_columns factors for each of positions 0 .. len - 1, as read by load_seq_pos_conc_scaler()
+   states: the distributor child each column scales
+   returns the scaling, or NULL when every factor is 1
+*/
+position_scaling_struct *build_position_scaling(float **columns, int n_columns, int *states, long len);
+
+void free_position_scaling(position_scaling_struct *scaling);
+
+// positions from .. from + len - 1 of scaling, renumbered from 0 and sharing its columns; NULL when every factor
+// there is 1
+position_scaling_struct *slice_position_scaling(position_scaling_struct *scaling, long from, long len);
+
+// model_def->fixed_states compiled for a sequence of len positions; NULL when none of them falls inside it
+fixed_state_masks_struct *build_fixed_state_masks(model_def_struct *model_def, long len);
+
+void free_fixed_state_masks(fixed_state_masks_struct *masks);
+
+// clears the normal states of row that a fixed range excludes at position pos of sequence
+void apply_fixed_state_mask(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *row, long pos);
+
+// a builder for len positions
+scaling_builder_struct *begin_position_scaling(int n_columns, int *states, long len);
+
+// factors for position pos, which must follow the last one added; positions skipped keep the last one's factors
+void add_scaling_position(scaling_builder_struct *builder, long pos, const PROBABILITY *factors);
+
+// frees builder; returns NULL when every factor was 1
+position_scaling_struct *finish_position_scaling(scaling_builder_struct *builder);
+
+/* reads local_conc_scale_file, either a columnar file written by write_scaling_file() or the tab delimited table
+   (see load_seq_pos_conc_scaler()).  a columnar file is mapped and its columns read in place; the table is parsed
+   line by line into columns of the same layout, so it takes about as much memory as the columnar file would.
+   INPUTS:
+   n_columns: columns expected, the motifs in model order then the nucleosome
+   states: the distributor child each column scales
+   len: positions expected
+*/
+position_scaling_struct *read_position_scaling(char *filename, int n_columns, int *states, long len);
+
+/* read_position_scaling() for the n_seqs sequences of seq_file: the file is one block of factors per sequence, in
+   seq_file order, so it has lens[0] + ... + lens[n_seqs - 1] positions.  a file that doesn't cover every sequence
+   exactly is refused, as for one sequence.  scalings[i] is set to sequence i's block, renumbered from 0
+*/
+void read_sequence_scalings(char *filename, int n_columns, int *states, long *lens, int n_seqs, position_scaling_struct **scalings);
+
+// converts a tab delimited scaling table to the columnar format, each column run-length encoded unless that's larger
+void write_scaling_file(char *tsv_filename, char *filename);
+
+unsigned long scaling_column_size(scaling_column_header_struct *column);
+
+// the distributor's transitions out of row (and, forward, into its normal children from prev_row), scaled for pos
+void scale_distributor_edges(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *prev_row, PROBABILITY *row, long pos, BOOL forward);
+
 void set_emission_prob(model_def_struct *model_def, int state, int chr, PROBABILITY p);
 
+// row-pointer variants: chr is the observed character used for emissions (unused for forward silent states)
+void update_silent_row(model_def_struct *model_def, PROBABILITY *row, char chr, BOOL forward);
+
+void update_normal_row(model_def_struct *model_def, PROBABILITY *prev_row, PROBABILITY *row, char chr, BOOL forward);
+
+// the nucleosome kernel's share of update_normal_row(): every block position but the first (forward) or last (backward)
+void update_nucleosome_block_forward(model_def_struct *model_def, PROBABILITY *prev_row, PROBABILITY *row, char chr);
+
+void update_nucleosome_block_backward(model_def_struct *model_def, PROBABILITY *next_row, PROBABILITY *row, char chr);
+
 void update_silent_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, int row_index, BOOL forward);
 
 
@@ -123,6 +633,25 @@ PROBABILITY normalize_row(PROBABILITY *row, int n_states, int total_states);
 */
 void forward(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s);
 
+// forward() into a table of floats, for TABLE_FLOAT; every row is still computed in double
+void forward_float(model_def_struct *model_def, sequence_struct *sequence, float *table, PROBABILITY *s);
+
+
+// first forward row, computed as if the sequence began at pos
+PROBABILITY forward_initial_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *row, long pos);
+
+
+// first backward row, computed as if the sequence ended at seq_pos
+PROBABILITY backward_initial_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *row, long seq_pos);
+
+
+// compute a single normalized forward row from the previous one, returning its scaling factor
+PROBABILITY forward_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *prev_row, PROBABILITY *row, long pos);
+
+
+// compute a single normalized backward row from the next one, returning its scaling factor
+PROBABILITY backward_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *next_row, PROBABILITY *row, long seq_pos);
+
 
 /* INPUTS:
    model_def: struct containing definition of the model
@@ -142,6 +671,213 @@ PROBABILITY posterior_decoding(model_def_struct *model_def, sequence_struct *seq
 void calc_sr(PROBABILITY *sf, PROBABILITY *sb, int len, PROBABILITY *sr);
 
 
+// calc_sr in log space: log_sr[i] = log(sr[i]), which doesn't underflow or overflow on long sequences
+void calc_log_sr(PROBABILITY *sf, PROBABILITY *sb, long len, PROBABILITY *log_sr);
+
+// the posterior scale sb * sr of a row, the product taken in log space so that it can't overflow or underflow where sr would
+#define POSTERIOR_SCALE(sb, log_sr) exp(log(sb) + (log_sr))
+
+
+// out[c] = sum over column c's state ranges of scale * f_row[state] * b_row[state]; scale is sb * sr for the row
+void sum_posterior_row(posterior_columns_struct *columns, PROBABILITY *f_row, PROBABILITY *b_row, PROBABILITY scale, PROBABILITY *out);
+
+
+void init_backward_stream(model_def_struct *model_def, backward_stream_struct *stream);
+
+void free_backward_stream(backward_stream_struct *stream);
+
+
+// backward recursion over [seg_begin, seg_end), reducing each row into posterior with the forward rows in f_rows
+void backward_posterior_segment(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_rows, long seg_begin, long seg_end, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior, backward_stream_struct *stream);
+
+// backward_posterior_segment() over f_rows or, when f_rows is NULL, the float rows of f_rows_float
+void backward_posterior_rows(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_rows, float *f_rows_float, long seg_begin, long seg_end, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior, backward_stream_struct *stream);
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   f_table: forward table, as filled out by forward()
+   sf: forward scaling factors, as filled out by forward()
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors
+
+   backward pass fused with the posterior summation; the backward table is never stored
+*/
+void fused_backward_posterior(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior);
+
+// fused_backward_posterior() with a table filled out by forward_float()
+void fused_backward_posterior_float(model_def_struct *model_def, sequence_struct *sequence, float *f_table, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior);
+
+
+// bytes of a forward table of len rows, stored at model_def->table_precision
+size_t forward_table_size(model_def_struct *model_def, long len);
+
+
+// forward() and fused_backward_posterior(), or their float counterparts, per model_def->table_precision.  f_table
+// holds forward_table_size() bytes
+void forward_fused_posterior(model_def_struct *model_def, sequence_struct *sequence, void *f_table, PROBABILITY *sf, posterior_columns_struct *columns, PROBABILITY *posterior);
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   n_threads: number of chunks the sequence is split into, each handled by its own thread
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors
+
+   returns the log likelihood of the sequence
+
+   exact parallel-in-sequence forward-backward, matching the serial result within PARALLEL_TOLERANCE
+*/
+PROBABILITY parallel_forward_backward(model_def_struct *model_def, sequence_struct *sequence, int n_threads, posterior_columns_struct *columns, PROBABILITY *posterior);
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   window: number of positions in the core of each window
+   overlap: number of positions each window is extended by on either side, and then discarded
+   n_threads: number of worker threads windows are handed out to
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors, stitched from the window cores
+
+   each window is run as its own sequence, so memory per worker is bounded by window + 2 * overlap rows.
+   the result approaches the whole-sequence one as the overlap grows.
+*/
+void windowed_forward_backward(model_def_struct *model_def, sequence_struct *sequence, long window, long overlap, int n_threads, posterior_columns_struct *columns, PROBABILITY *posterior);
+
+
+// hash of everything a specialized kernel is generated from: the states, each one's edges, the nucleosome kernel and, on
+// x86, the host CPU -march=native builds for
+unsigned long model_topology_hash(model_def_struct *model_def);
+
+/* generates the normal row loops of model_def, which is finalized and has its nucleosome kernel enabled, compiles
+   them with $CC (or cc) into the kernel cache ($COMPETE_KERNEL_CACHE, or compete/ under $XDG_CACHE_HOME or ~/.cache)
+   unless a kernel of the same topology is there already, and loads them for update_normal_row() to run.  returns
+   FALSE, having said why, when the kernel can't be built; the generic loops run then.
+*/
+BOOL specialize_model(model_def_struct *model_def);
+
+// the C source specialize_model() compiles
+void write_specialized_kernel(FILE *f, model_def_struct *model_def, unsigned long topology);
+
+void free_specialized_kernel(model_def_struct *model_def);
+
+
+// the motif chains duration_forward_backward() collapses: their first states and lengths, when starts and lens aren't
+// NULL.  returns how many there are
+int find_duration_chains(model_def_struct *model_def, int *starts, int *lens);
+
+/* INPUTS:
+   model_def: struct containing definition of the model, finalized
+   sequence: struct containing sequence to run the model on, without fixed states
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors
+   returns FALSE, saying why on stderr, when the sequence scales a state inside a motif chain
+
+   forward-backward over the states outside motif chains, each chain a single transition scored by the PWM
+   likelihood of the window it covers (duration.c).  the forward rows kept hold only those states and the silent ones.
+*/
+BOOL duration_forward_backward(model_def_struct *model_def, sequence_struct *sequence, posterior_columns_struct *columns, PROBABILITY *posterior);
+
+// duration_forward_backward() on each of the n_seqs sequences, n_threads at a time, calling done(done_arg, index,
+// posterior) for each, one at a time.  returns FALSE once a sequence is refused, skipping those not yet started
+BOOL duration_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, posterior_columns_struct *columns, void (*done)(void *, int, PROBABILITY *), void *done_arg);
+
+
+// checkpoint spacing that balances stored and recomputed forward rows, about sqrt(len)
+int default_checkpoint_interval(long len);
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   interval: number of sequence positions between stored forward rows
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   posterior: sequence->len by columns->n_columns table of summed posteriors
+
+   forward-backward in O(n_states * (len / interval + interval)) memory, recomputing forward segments from checkpoints
+*/
+void checkpointed_forward_backward(model_def_struct *model_def, sequence_struct *sequence, int interval, posterior_columns_struct *columns, PROBABILITY *posterior);
+
+
+boundary_state_struct *alloc_boundary_state(model_def_struct *model_def, long len, int interval, long phase, int n_columns);
+
+// number of checkpoint rows in each of f_rows and b_rows
+long boundary_state_checkpoints(boundary_state_struct *state);
+
+void free_boundary_state(boundary_state_struct *state);
+
+// FNV-1a of size bytes of data, carrying on from hash (14695981039346656037UL for the first)
+unsigned long fingerprint_bytes(unsigned long hash, const void *data, size_t size);
+
+// hash of the model, its parameters, fixed states and output columns: run_fingerprint() but for the sequence
+unsigned long model_fingerprint(model_def_struct *model_def, posterior_columns_struct *columns);
+
+// hash of everything but the scaling that a boundary state depends on
+unsigned long run_fingerprint(model_def_struct *model_def, sequence_struct *sequence, posterior_columns_struct *columns);
+
+void write_boundary_state(char *filename, boundary_state_struct *state);
+
+// write_boundary_state() to f, already open; filename is for messages
+void fwrite_boundary_state(FILE *f, boundary_state_struct *state, char *filename);
+
+// a boundary state as written by write_boundary_state(), valid
+boundary_state_struct *read_boundary_state(char *filename);
+
+// read_boundary_state() from f, already open; filename is for messages
+boundary_state_struct *fread_boundary_state(FILE *f, char *filename);
+
+// first and last positions at which some factor differs between scalings a and b (either may be NULL, for none);
+// FALSE when they agree everywhere in 0 .. len - 1
+BOOL scaling_difference(position_scaling_struct *a, position_scaling_struct *b, long len, long *first, long *last);
+
+// scaling_difference() between positions a_from ... of a and b_from ... of b; first and last count from a_from
+BOOL scaling_difference_at(position_scaling_struct *a, long a_from, position_scaling_struct *b, long b_from, long len, long *first, long *last);
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   state: from an earlier run of the same model and sequence, or invalid (then everything is computed)
+   first, last: positions whose scaling factors changed since state was computed.  ignored unless state is valid
+   columns: which states' posteriors are summed into each output column
+   OUTPUTS:
+   state: brought up to date with sequence->scaling, its posteriors included
+   *from, *to: the positions whose posteriors were recomputed
+
+   forward rows are recomputed from the row before first, until a stored row past last agrees with the new one
+   (to PARALLEL_TOLERANCE); backward rows, and the posteriors with them, from that position down, until a stored
+   row before first agrees.  rows past either point are the stored ones, so the work is bounded by how far a change
+   of the factors carries rather than by the sequence length.  memory is that of checkpointed_forward_backward().
+*/
+void refresh_forward_backward(model_def_struct *model_def, sequence_struct *sequence, boundary_state_struct *state, long first, long last, posterior_columns_struct *columns, long *from, long *to);
+
+
+// max-product row of pos from prev_row (unused when pos is 0); bp, if not NULL, receives each state's parent edge index
+PROBABILITY viterbi_row(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *prev_row, PROBABILITY *row, long pos, PROBABILITY *edge_scale, void *bp, BOOL wide);
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to run the model on
+   interval: number of sequence positions between stored rows, or 0 for the default (about sqrt(len))
+   OUTPUTS:
+   path: sequence->len normal states of the most probable path through the model
+   returns the log probability of that path
+
+   rows are stored at checkpoints, and each segment's one or two byte backpointers are recomputed for the traceback,
+   so memory is O(n_states * (len / interval + interval)).
+*/
+double viterbi(model_def_struct *model_def, sequence_struct *sequence, int interval, int *path);
+
+
 void print_forward_table(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *table, PROBABILITY *s, int n);
 
 
@@ -168,15 +904,92 @@ void print_transition_matrix(model_def_struct *model_def);
 PROBABILITY log_likelihood(PROBABILITY **s, sequence_struct **sequence, int n_seqs);
 
 
-void baum_welch(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, PROBABILITY **s, int n_seqs, PROBABILITY delta, a0k_func update_a0k);
+/* INPUTS:
+   model_def: struct containing definition of the model, finalized
+   sequence: the n_seqs training sequences, n_threads of them run at once
+   delta: smallest log likelihood gain worth another iteration
+   max_iterations: the most E steps to run
+   tie_counts: called on each E step's counts before the M step, so tied parameters come out equal, or NULL
+   update_a0k: called after each M step to tie the initial probabilities to the new transitions, or NULL
+   done: called as done(done_arg, iteration, log likelihood) after each E step, or NULL
+   OUTPUTS:
+   model_def: reestimated in place
+   returns the number of M steps taken
+*/
+int baum_welch(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, PROBABILITY delta, int max_iterations, tie_func tie_counts, a0k_func update_a0k, void (*done)(void *, int, double), void *done_arg);
 
 
 model_def_struct *initialize_model(char *filename, fixed_states_struct* fixed_states, int n_fixed_states);
 
 void find_parents_and_children(model_def_struct *model_def);
 
+void free_parents_and_children(model_def_struct *model_def);
+
+// check that the n_positions * 16 states from first_state form a dinucleotide nucleosome block, and if so handle
+// them with the dedicated kernel from now on.  returns FALSE, leaving the generic loops in charge, otherwise.
+BOOL enable_nucleosome_kernel(model_def_struct *model_def, int first_state, int n_positions);
+
+// copy the current block transitions and emissions into the kernel; finalize_model() does this for you
+void refresh_nucleosome_kernel(model_def_struct *model_def);
+
+void free_nucleosome_kernel(model_def_struct *model_def);
+
+// rebuild the per-symbol emission tables from the current emissions and edges; finalize_model() does this for you
+void refresh_emission_tables(model_def_struct *model_def);
+
+void free_emission_tables(model_def_struct *model_def);
+
+// call once all transitions are set: rebuilds the edge lists if needed, frees the dense transition matrix and
+// builds the per-symbol emission tables.
+// afterwards transitions can still be changed with set_transition_prob, but only along existing edges.
+void finalize_model(model_def_struct *model_def);
+
+// write model_def, as parsed (before finalize_model()), to filename in the compiled format initialize_model() maps
+void write_compiled_model(model_def_struct *model_def, char *filename);
+
+// frees model_def and everything it owns, whether read from a config file or mapped from a compiled one
+void free_model(model_def_struct *model_def);
+
+// copy of a finalized model that shares its topology (state and edge lists, fixed states, output) but has its own
+// probabilities and derived tables, so it can be reparameterised and run alongside the original
+model_def_struct *clone_model(model_def_struct *model_def);
+
+// copy initial, emission and transition probabilities from source, a clone of model_def or the other way round.
+// the nucleosome kernel and emission tables need refreshing afterwards
+void restore_model_probabilities(model_def_struct *model_def, model_def_struct *source);
+
+void free_model_clone(model_def_struct *clone);
+
+/* reads the seq_filenames file: one "filename begin end" line per sequence, positions counted from 1 and inclusive,
+   end -1 for the rest of the file.  filename is either a file of character numbers (as written by convert_seq.rb),
+   or store:name for record name of a packed sequence store, which is mapped rather than read.
+*/
 int read_sequence(char *filename, sequence_struct ***sequence_ptr);
 
+// one such region into sequence, which is filled in from scratch; FALSE, having said why, if it can't be read
+BOOL read_sequence_region(char *name, long begin_read, long end_read, sequence_struct *sequence);
+
+// the lines of the seq_filenames file as they are, one per sequence read_sequence() reads
+int read_sequence_regions(char *filename, sequence_region_struct **regions_ptr);
+
+void free_sequence(sequence_struct *sequence);
+
+/* reads local_conc_scale_file, a tab delimited table with a header line and one line per sequence position: the
+   factor of each motif, in model order, then the nucleosome's when nuc_present.  seq_pos_conc_scaler[column][position]
+*/
+void load_seq_pos_conc_scaler(char* file_name, float** seq_pos_conc_scaler, int sequence_length, int n_motifs, BOOL nuc_present);
+
+int parse_one_line(char* line, float** matrix, int row, int total_fields);
+
+/* INPUTS:
+   inputs: n_inputs FASTA files (alphabet ACGT in any case; each > line starts a record) or files of character
+           numbers, as in chr/, which become one record named after the file
+   OUTPUTS:
+   filename: packed sequence store holding every record.  as in convert_seq.rb, characters outside the alphabet
+             are dropped.
+*/
+void write_sequence_store(char *filename, char **inputs, int n_inputs);
+
 
 void print_initial_probs(model_def_struct *model_def);
 
@@ -188,8 +1001,137 @@ BOOL anything_to_update(model_def_struct *model_def);
 
 int find_num_cpus();
 
+// starts the -P clock of the whole run and the counters of the calling thread
+void enable_profiling();
 
+// the calling thread's counters
+thread_profile_struct *thread_profile();
+
+void profile_start(profile_timer_struct *timer);
+
+// charges the wall and CPU time since profile_start(timer) to phase on the calling thread
+void profile_stop(profile_timer_struct *timer, int phase);
+
+// wall clock in seconds, for timing a nested phase into timer->nested
+double profile_wall_clock();
+
+// profile_stop(), but with timer->nested seconds charged to nested_phase instead of phase.  for phases fused
+// row by row, where taking the CPU clock around every row would cost more than the row
+void profile_stop_nested(profile_timer_struct *timer, int phase, int nested_phase);
+
+// wall and CPU time, calls and rows of each phase counted since enable_profiling(), summed over threads
+void profile_totals(double *wall, double *cpu, long *calls, long *rows);
+
+/* writes everything counted since enable_profiling() as one line of JSON, and frees the counters:
+   the run's wall, user and system time, peak RSS and the peak of allocated bytes (sampled as each phase ends),
+   per phase wall and CPU time, calls and rows (wall and CPU summed over threads), model edges visited by the
+   recursions, each thread's rows per second over the time it spent in them, and log_likelihood unless it's NAN
+*/
+void write_profile(FILE *f, model_def_struct *model_def, long n_positions, double log_likelihood);
+
+/* INPUTS:
+   cost: relative cost of each of the n_tasks tasks; the most expensive are started first
+   n_workers: size of the pool
+   run: called as run(arg, task index, worker index) once for each task, from one of the workers
+   arg: passed through to run
+*/
+void run_tasks(long *cost, int n_tasks, int n_workers, void (*run)(void *, int, int), void *arg);
+
+// run_tasks() with one task per sequence, costed by length
+void run_sequence_tasks(sequence_struct **sequence, int n_seqs, int n_workers, void (*run)(void *, int, int), void *arg);
+
+// full forward and backward tables for every sequence, on a pool of one worker per CPU
+void fb_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, PROBABILITY **f_table, PROBABILITY **b_table, PROBABILITY **sf, PROBABILITY **sb, int n_seqs);
+
+// sets edge_scale[state] to the factor each scaled element's distributor transition takes at pos: pos's for normal
+// first states, entered from row pos - 1, and pos + 1's for silent ones, entered within row pos
+void distributor_edge_scale(model_def_struct *model_def, sequence_struct *sequence, long pos, PROBABILITY *edge_scale);
+
+
+expected_counts_struct *alloc_expected_counts(model_def_struct *model_def);
+
+void clear_expected_counts(model_def_struct *model_def, expected_counts_struct *counts);
+
+void free_expected_counts(expected_counts_struct *counts);
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: struct containing sequence to train the model on
+   f_table: room for sequence->len forward rows, sf for as many scaling factors
+   edge_scale: n_states of scratch, all 1 but for the scaled states
+   OUTPUTS:
+   counts: the sequence's expected transition and emission counts and log likelihood are added in
+
+   one forward pass, then one backward sweep that reduces each row as it is produced; the backward table is never
+   stored, and each edge is visited once per position.
+*/
+void accumulate_expected_counts(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *sf, PROBABILITY *edge_scale, expected_counts_struct *counts);
+
+// expected counts over all n_seqs sequences, n_threads at a time, each worker into its own counts until the reduction
+void expected_counts_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, expected_counts_struct *counts);
+
+// M step: every edge but the distributor's (the concentrations) gets its share of its parent's expected outgoing
+// count, scaled to the parent's current total weight, and every normal state's emissions their expected frequencies.
+// states never visited keep their values.  each parameter is normalized on its own, so a tie_func pools tied ones first
+void maximize_expected_counts(model_def_struct *model_def, expected_counts_struct *counts);
+
+
+/* INPUTS:
+   model_def: struct containing definition of the model
+   sequence: the n_seqs sequences to run the model on
+   n_threads: size of the worker pool
+   checkpoint_interval: if nonzero, run each sequence checkpointed with this interval, or the default one if negative
+   columns: which states' posteriors are summed into each output column
+   done: called as done(done_arg, sequence index, posterior) as each sequence finishes, one call at a time.
+         posterior is sequence->len by columns->n_columns, and only valid until done returns: the worker reuses it
+*/
+void posterior_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, int checkpoint_interval, posterior_columns_struct *columns, void (*done)(void *, int, PROBABILITY *), void *done_arg);
+
+
+/* compete --mem-limit / --dry-run.  an engine with its settings, and the bytes it's estimated to need: sizes come
+   from n_states, n_edges and the sequence lengths, the same expressions the engines ALLOC with.  the model build's
+   dense transition matrix is freed before any table is allocated, so only the larger of the two counts at once.
+*/
 typedef struct {
-  int index;
-  PROBABILITY value;
-} sortable_pair;
+  int engine;               // ENGINE_*
+  int n_threads;
+  int checkpoint_interval;  // ENGINE_CHECKPOINTED: 0 for each sequence's default_checkpoint_interval()
+  long window, overlap;     // ENGINE_WINDOWED
+  size_t model;             // the finalized model, its per-symbol tables and nucleosome kernel
+  size_t model_build;       // dense transition matrix of a model read from a config file
+  size_t sequences;
+  size_t scaling;
+  size_t tables;            // forward and backward rows and scale factors of every worker at once
+  size_t output;            // posterior tables
+  size_t reserved;          // set by the caller: needed whatever the engine, such as the output buffer
+} memory_plan_struct;
+
+size_t model_memory(model_def_struct *model_def);
+
+size_t sequence_memory(sequence_struct *sequence);
+
+size_t scaling_memory(position_scaling_struct *scaling);
+
+// fills in the byte counts of plan's engine, threads, interval, window and overlap
+void estimate_memory(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_columns, memory_plan_struct *plan);
+
+// peak bytes of an estimated plan
+size_t plan_total(memory_plan_struct *plan);
+
+/* INPUTS:
+   model_def: finalized model; its table_precision rules out the engines without a float table
+   sequence: the n_seqs sequences to run
+   n_columns: output columns
+   max_threads: most worker threads to use
+   overlap: window overlap, should windowed execution be the only engine that fits
+   limit: bytes the run has to fit in
+   OUTPUTS:
+   plan: the fastest engine that fits, exact ones first, estimated; plan->reserved is kept.  if nothing fits,
+         FALSE, and plan is the exact engine needing the least memory
+*/
+BOOL plan_memory(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_columns, int max_threads, long overlap, size_t limit, memory_plan_struct *plan);
+
+// a --mem-limit: bytes, or K, M, G or T of 1024-based units.  0 if it isn't one
+size_t parse_byte_count(char *str);
+
+#endif
@@ -0,0 +1,602 @@
+#include "bc.h"
+#include "output.h"
+#include <time.h>
+#include <libgen.h>
+#include <getopt.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+extern char *optarg;
+extern int optind;
+
+// benchmark driver: builds synthetic models with the topology construct_model_from_motifs.rb writes, and runs
+// random sequences through each engine as compete's main() does, one tab-delimited line per case and engine.
+// every run is a child process of its own, so that its peak RSS is that of the whole run.
+
+// defaults of -m, -l, -x and -e
+#define BENCH_MOTIFS "0,10,50,200"
+#define BENCH_LENGTHS "1k,10k,100k,1M"
+#define BENCH_NUCLEOSOME "0,1"
+#define BENCH_ENGINES "full,checkpointed,parallel,windowed"
+
+// -w's default; -o's is compete's
+#define BENCH_WINDOW 10000
+
+// shortest and longest synthetic motif, as found among the PBM motifs
+#define BENCH_MIN_MOTIF_LEN 8
+#define BENCH_MAX_MOTIF_LEN 20
+
+// nucleosome body as in construct_nucleosome_model.rb, with in_vitro_nucleosome_dinucleotide_probs.txt's length
+#define BENCH_NUC_POSITIONS 127
+#define BENCH_NUC_PADDING ((147 - BENCH_NUC_POSITIONS) / 2 + 5)
+
+// the engines -e names, each the one compete runs a single sequence with given that option
+#define BENCH_FULL 0          // none: forward_fused_posterior() over a whole forward table
+#define BENCH_CHECKPOINTED 1  // -c
+#define BENCH_PARALLEL 2      // -p
+#define BENCH_WINDOWED 3      // -w
+#define BENCH_FLOAT 4         // --precision float
+#define BENCH_DURATION 5      // --duration
+#define N_BENCH_ENGINES 6
+
+static const char *bench_engine_names[N_BENCH_ENGINES] = {"full", "checkpointed", "parallel", "windowed", "float", "duration"};
+
+static const PROBABILITY background[4] = {0.308512, 0.191488, 0.191488, 0.308512};
+
+
+typedef struct {
+  int n_motifs;
+  BOOL nucleosome;
+  long len;
+} bench_case_struct;
+
+
+// how each engine is run, as compete's options of the same name set it
+typedef struct {
+  int output_format;
+  BOOL specialize;
+  int n_threads;            // -p and -w
+  int checkpoint_interval;  // -k, 0 for default_checkpoint_interval()
+  long window, overlap;     // -w and -o
+  size_t mem_limit;         // runs plan_total() expects to need more of are skipped
+} bench_options_struct;
+
+
+typedef struct {
+  int n_states, n_edges;
+  double load, run, output; // seconds
+  double forward, backward, posterior; // seconds in each phase of the engine, as -P counts them, summed over threads
+  size_t planned;           // bytes, as estimate_memory() has it; 0 for the engines it doesn't know
+  double bound;             // posterior sum of every column but background, which only changes between engines by
+                            // rounding, or -w's approximation
+  BOOL skipped;
+} bench_result_struct;
+
+
+// xorshift64*, so that a seed gives the same models and sequences everywhere
+static unsigned long long bench_rng_state;
+
+static double bench_uniform() {
+  bench_rng_state ^= bench_rng_state >> 12;
+  bench_rng_state ^= bench_rng_state << 25;
+  bench_rng_state ^= bench_rng_state >> 27;
+  return (double)((bench_rng_state * 2685821657736338717ULL) >> 11) / 9007199254740992.0;
+}
+
+
+static int bench_symbol(const PROBABILITY *p) {
+  double u = bench_uniform();
+  int c;
+
+  for (c = 0; c < 3; c++) {
+    if (u < p[c]) return c;
+    u -= p[c];
+  }
+  return 3;
+}
+
+
+// a random distribution over the four bases, none of them below 5% before normalizing
+static void random_distribution(PROBABILITY *p) {
+  PROBABILITY sum = 0;
+  int c;
+
+  for (c = 0; c < 4; c++) sum += (p[c] = 0.05 + bench_uniform());
+  for (c = 0; c < 4; c++) p[c] /= sum;
+}
+
+
+static double seconds_since(struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) + 1e-9 * (now.tv_nsec - start->tv_nsec);
+}
+
+
+/* writes a libconfig model file of n_motifs random motifs and optionally a nucleosome, laid out as
+   construct_model_from_motifs.rb lays them out: unbound as state 0, both strands of each motif, the nucleosome
+   (padding, branched background state, dinucleotide blocks, padding), then the distributor and one silent state
+   per motif.  the distributor's transitions are those of unit concentrations, normalized.  motif_starts and
+   motif_lens get each motif's first state and length, nuc_start the nucleosome's first state.
+*/
+static void write_synthetic_model(FILE *f, int n_motifs, BOOL nucleosome, int *motif_starts, int *motif_lens, int *nuc_start) {
+  int n_emitting = 1, n_states, distributor, index, i, j, k, q, m;
+  PROBABILITY p[4], total;
+  PROBABILITY **pwm = ALLOC(sizeof(PROBABILITY *) * (n_motifs > 0 ? n_motifs : 1));
+
+  for (m = 0; m < n_motifs; m++) {
+    motif_lens[m] = BENCH_MIN_MOTIF_LEN + (int)(bench_uniform() * (BENCH_MAX_MOTIF_LEN - BENCH_MIN_MOTIF_LEN + 1));
+    motif_starts[m] = n_emitting;
+    n_emitting += 2 * motif_lens[m];
+    pwm[m] = ALLOC(sizeof(PROBABILITY) * 4 * motif_lens[m]);
+    for (i = 0; i < motif_lens[m]; i++) random_distribution(pwm[m] + 4 * i);
+  }
+  *nuc_start = n_emitting;
+  if (nucleosome) n_emitting += (BENCH_NUC_PADDING - 1) + 4 + 16 * BENCH_NUC_POSITIONS + BENCH_NUC_PADDING;
+  distributor = n_emitting;
+  n_states = n_emitting + 1 + n_motifs;
+
+  fprintf(f, "model = {\n");
+  fprintf(f, "  n_states = %d;\n  silent_states_begin = %d;\n  alphabet_length = 4;\n  alphabet = \"ACGT\";\n", n_states, distributor);
+
+  fprintf(f, "  initial_probs = (\n");
+  for (i = 0; i < n_emitting; i++) fprintf(f, "    (%d, %.17e)%s\n", i, 1.0 / n_emitting, i < n_emitting - 1 ? "," : "");
+  fprintf(f, "  );\n");
+
+  fprintf(f, "  transition_matrix = (\n");
+  fprintf(f, "    (0, %d, 1.0)", distributor);
+  for (m = 0; m < n_motifs; m++) {
+    for (j = 0; j < 2; j++) {
+      index = motif_starts[m] + j * motif_lens[m];
+      for (i = 0; i < motif_lens[m] - 1; i++) fprintf(f, ",\n    (%d, %d, 1.0)", index + i, index + i + 1);
+      fprintf(f, ",\n    (%d, %d, 1.0)", index + motif_lens[m] - 1, distributor);
+    }
+  }
+
+  if (nucleosome) {
+    index = *nuc_start;
+    for (i = 0; i < BENCH_NUC_PADDING - 2; i++, index++) fprintf(f, ",\n    (%d, %d, 1.0)", index, index + 1);
+    // the branched background state, then the first dinucleotide block
+    for (i = 0; i < 4; i++) fprintf(f, ",\n    (%d, %d, %.17e)", index, index + 1 + i, background[i]);
+    index++;
+    for (i = 0; i < 4; i++) {
+      random_distribution(p);
+      for (j = 0; j < 4; j++) fprintf(f, ",\n    (%d, %d, %.17e)", index + i, index + 4 * (1 + i) + j, p[j]);
+    }
+    index += 4;
+    for (q = 1; q < BENCH_NUC_POSITIONS; q++, index += 16) {
+      for (i = 0; i < 16; i++) {
+        random_distribution(p);
+        for (k = 0; k < 4; k++) fprintf(f, ",\n    (%d, %d, %.17e)", index + i, index + 16 + 4 * (i & 3) + k, p[k]);
+      }
+    }
+    for (i = 0; i < 16; i++) fprintf(f, ",\n    (%d, %d, 1.0)", index + i, index + 16);
+    index += 16;
+    for (i = 0; i < BENCH_NUC_PADDING - 1; i++, index++) fprintf(f, ",\n    (%d, %d, 1.0)", index, index + 1);
+    fprintf(f, ",\n    (%d, %d, 1.0)", index, distributor);
+  }
+
+  total = 1.0 + 0.01 * n_motifs + (nucleosome ? 1.0 : 0);
+  fprintf(f, ",\n    (%d, 0, %.17e)", distributor, 1.0 / total);
+  if (nucleosome) fprintf(f, ",\n    (%d, %d, %.17e)", distributor, *nuc_start, 1.0 / total);
+  for (m = 0; m < n_motifs; m++) {
+    fprintf(f, ",\n    (%d, %d, %.17e)", distributor, distributor + 1 + m, 0.01 / total);
+    fprintf(f, ",\n    (%d, %d, 0.5),\n    (%d, %d, 0.5)", distributor + 1 + m, motif_starts[m], distributor + 1 + m, motif_starts[m] + motif_lens[m]);
+  }
+  fprintf(f, "\n  );\n");
+
+  fprintf(f, "  emission_matrix = (\n");
+  for (i = 0; i < 4; i++) fprintf(f, "    (0, %d, %.17e)%s\n", i, background[i], i < 3 || n_motifs > 0 || nucleosome ? "," : "");
+  for (m = 0; m < n_motifs; m++) {
+    for (i = 0; i < motif_lens[m]; i++) {
+      for (j = 0; j < 4; j++) fprintf(f, "    (%d, %d, %.17e),\n", motif_starts[m] + i, j, pwm[m][4 * i + j]);
+    }
+    // the reverse strand emits the complement, from the motif's last position back
+    for (i = 0; i < motif_lens[m]; i++) {
+      for (j = 0; j < 4; j++) {
+        BOOL last = m == n_motifs - 1 && !nucleosome && i == motif_lens[m] - 1 && j == 3;
+        fprintf(f, "    (%d, %d, %.17e)%s\n", motif_starts[m] + motif_lens[m] + i, j, pwm[m][4 * (motif_lens[m] - 1 - i) + 3 - j], last ? "" : ",");
+      }
+    }
+    free(pwm[m]);
+  }
+  if (nucleosome) {
+    index = *nuc_start;
+    for (i = 0; i < BENCH_NUC_PADDING - 1; i++, index++) {
+      for (j = 0; j < 4; j++) fprintf(f, "    (%d, %d, %.17e),\n", index, j, background[j]);
+    }
+    // branched background and dinucleotide states each emit the second base of their pair
+    for (i = 0; i < 4 + 16 * BENCH_NUC_POSITIONS; i++, index++) fprintf(f, "    (%d, %d, 1.0),\n", index, i < 4 ? i : i & 3);
+    for (i = 0; i < BENCH_NUC_PADDING; i++, index++) {
+      for (j = 0; j < 4; j++) fprintf(f, "    (%d, %d, %.17e)%s\n", index, j, background[j], i == BENCH_NUC_PADDING - 1 && j == 3 ? "" : ",");
+    }
+  }
+  fprintf(f, "  );\n};\n");
+
+  free(pwm);
+}
+
+
+static state_range_struct *add_range(state_range_struct *next, int from, int to) {
+  state_range_struct *range = ALLOC(sizeof(state_range_struct));
+
+  range->state_from = from;
+  range->state_to = to;
+  range->next_range = next;
+  return range;
+}
+
+
+// the columns compete writes by default: unbound, each motif's two strands, and the nucleosome's padding and body
+static posterior_columns_struct *bench_columns(int n_motifs, int *motif_starts, int *motif_lens, BOOL nucleosome, int nuc_start, int nuc_len) {
+  posterior_columns_struct *columns = ALLOC(sizeof(posterior_columns_struct));
+  char name[64];
+  int c = 0, m;
+
+  columns->n_columns = 1 + n_motifs + (nucleosome ? 2 : 0);
+  columns->names = ALLOC(sizeof(char *) * columns->n_columns);
+  columns->ranges = ALLOC(sizeof(state_range_struct *) * columns->n_columns);
+
+  columns->names[c] = strdup("background");
+  columns->ranges[c++] = add_range(NULL, 0, 0);
+  for (m = 0; m < n_motifs; m++, c++) {
+    sprintf(name, "motif_%d", m);
+    columns->names[c] = strdup(name);
+    columns->ranges[c] = add_range(add_range(NULL, motif_starts[m] + motif_lens[m], motif_starts[m] + 2 * motif_lens[m] - 1), motif_starts[m], motif_starts[m] + motif_lens[m] - 1);
+  }
+  if (nucleosome) {
+    columns->names[c] = strdup("nuc_padding");
+    columns->ranges[c++] = add_range(add_range(NULL, nuc_start + nuc_len - 5, nuc_start + nuc_len - 1), nuc_start, nuc_start + 4);
+    columns->names[c] = strdup("nucleosome");
+    columns->ranges[c++] = add_range(NULL, nuc_start + 5, nuc_start + nuc_len - 6);
+  }
+
+  return columns;
+}
+
+
+static void free_bench_columns(posterior_columns_struct *columns) {
+  state_range_struct *range, *next;
+  int c;
+
+  for (c = 0; c < columns->n_columns; c++) {
+    free(columns->names[c]);
+    for (range = columns->ranges[c]; range; range = next) {
+      next = range->next_range;
+      free(range);
+    }
+  }
+  free(columns->names);
+  free(columns->ranges);
+  free(columns);
+}
+
+
+static sequence_struct *random_sequence(long len) {
+  sequence_struct *sequence = ALLOC(sizeof(sequence_struct));
+  long i;
+
+  memset(sequence, 0, sizeof(sequence_struct));
+  sequence->len = len;
+  sequence->seq = ALLOC(len);
+  for (i = 0; i < len; i++) sequence->seq[i] = bench_symbol(background);
+
+  return sequence;
+}
+
+
+/* runs one case on engine, timing model load (parsing the generated model file, finalize_model(), the nucleosome
+   kernel and, with specialize, generating and compiling the specialized kernel unless it's cached), the engine
+   from allocating its tables to the last posterior row, and writing the posteriors to /dev/null in output_format.
+   the engine's forward, backward and posterior summation phases are taken from the -P counters.
+*/
+static void run_case(bench_case_struct *bench_case, int engine, bench_options_struct *options, bench_result_struct *result) {
+  int n_motifs = bench_case->n_motifs, nuc_start, nuc_len, interval;
+  int *motif_starts = ALLOC(sizeof(int) * (n_motifs > 0 ? n_motifs : 1));
+  int *motif_lens = ALLOC(sizeof(int) * (n_motifs > 0 ? n_motifs : 1));
+  char model_filename[] = "/tmp/compete_bench_XXXXXX";
+  struct timespec start;
+  memory_plan_struct plan;
+  model_def_struct *model_def;
+  sequence_struct *sequence;
+  posterior_columns_struct *columns;
+  PROBABILITY *posterior;
+  long i, len = bench_case->len;
+  int fd;
+  FILE *f;
+
+  if ((fd = mkstemp(model_filename)) < 0 || !(f = fdopen(fd, "w"))) {
+    fprintf(stderr, "Creating %s failed.\n", model_filename);
+    exit(1);
+  }
+  write_synthetic_model(f, n_motifs, bench_case->nucleosome, motif_starts, motif_lens, &nuc_start);
+  fclose(f);
+  sequence = random_sequence(len);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  model_def = initialize_model(model_filename, NULL, 0);
+  finalize_model(model_def);
+  nuc_len = model_def->silent_states_begin - nuc_start;
+  if (bench_case->nucleosome && !enable_nucleosome_kernel(model_def, nuc_start + BENCH_NUC_PADDING + 3, BENCH_NUC_POSITIONS)) {
+    fprintf(stderr, "The synthetic nucleosome doesn't fit the nucleosome kernel.\n");
+    exit(1);
+  }
+  if (options->specialize && !specialize_model(model_def)) exit(1);
+  result->load = seconds_since(&start);
+  unlink(model_filename);
+
+  result->n_states = model_def->n_states;
+  result->n_edges = model_def->n_edges;
+  model_def->table_precision = engine == BENCH_FLOAT ? TABLE_FLOAT : TABLE_DOUBLE;
+  columns = bench_columns(n_motifs, motif_starts, motif_lens, bench_case->nucleosome, nuc_start, nuc_len);
+  interval = options->checkpoint_interval > 0 ? options->checkpoint_interval : default_checkpoint_interval(len);
+
+  // the duration engine keeps tables of its own, which estimate_memory() doesn't know
+  memset(&plan, 0, sizeof(plan));
+  plan.engine = engine == BENCH_CHECKPOINTED ? ENGINE_CHECKPOINTED : engine == BENCH_PARALLEL ? ENGINE_PARALLEL : engine == BENCH_WINDOWED ? ENGINE_WINDOWED : ENGINE_FULL;
+  plan.n_threads = engine == BENCH_PARALLEL || engine == BENCH_WINDOWED ? options->n_threads : 1;
+  plan.checkpoint_interval = interval;
+  plan.window = options->window;
+  plan.overlap = options->overlap;
+  estimate_memory(model_def, &sequence, 1, columns->n_columns, &plan);
+  result->planned = engine == BENCH_DURATION ? 0 : plan_total(&plan);
+  result->skipped = result->planned > options->mem_limit;
+
+  result->run = result->output = result->bound = 0;
+  result->forward = result->backward = result->posterior = 0;
+  if (!result->skipped) {
+    double wall[N_PHASES], cpu[N_PHASES];
+    long calls[N_PHASES], rows[N_PHASES];
+
+    enable_profiling();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    posterior = ALLOC(sizeof(PROBABILITY) * columns->n_columns * len);
+    if (engine == BENCH_FULL || engine == BENCH_FLOAT) {
+      void *f_table = alloc_table(forward_table_size(model_def, len));
+      PROBABILITY *sf = alloc_table(sizeof(PROBABILITY) * len);
+      forward_fused_posterior(model_def, sequence, f_table, sf, columns, posterior);
+      free_table(f_table);
+      free_table(sf);
+    } else if (engine == BENCH_CHECKPOINTED) {
+      checkpointed_forward_backward(model_def, sequence, interval, columns, posterior);
+    } else if (engine == BENCH_PARALLEL) {
+      parallel_forward_backward(model_def, sequence, options->n_threads, columns, posterior);
+    } else if (engine == BENCH_WINDOWED) {
+      windowed_forward_backward(model_def, sequence, options->window, options->overlap, options->n_threads, columns, posterior);
+    } else if (!duration_forward_backward(model_def, sequence, columns, posterior)) {
+      exit(1);
+    }
+    result->run = seconds_since(&start);
+    profile_totals(wall, cpu, calls, rows);
+    result->forward = wall[PHASE_FORWARD];
+    result->backward = wall[PHASE_BACKWARD];
+    result->posterior = wall[PHASE_POSTERIOR];
+
+    for (i = 0; i < (long)columns->n_columns * len; i++) {
+      if (i % columns->n_columns != 0) result->bound += posterior[i];
+    }
+
+    if (!(f = fopen("/dev/null", "w"))) {
+      fprintf(stderr, "Opening /dev/null for writing failed.\n");
+      exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    posterior_writer_struct *writer = open_posterior_writer(f, options->output_format, DEFAULT_COMPACT_PRECISION, DEFAULT_SPARSE_THRESHOLD);
+    write_posterior_block(writer, NULL, columns, posterior, len);
+    close_posterior_writer(writer);
+    result->output = seconds_since(&start);
+    fclose(f);
+    free(posterior);
+  }
+
+  free_bench_columns(columns);
+  free_sequence(sequence);
+  free_model(model_def);
+  free(motif_starts);
+  free(motif_lens);
+}
+
+
+// comma delimited list of counts, each optionally followed by k (thousand) or M (million)
+static int parse_count_list(char *str, long **values_ptr) {
+  long *values = ALLOC(sizeof(long) * (strlen(str) + 1));
+  char *token, *end;
+  int n = 0;
+
+  for (token = strtok(str, ","); token; token = strtok(NULL, ",")) {
+    values[n] = strtol(token, &end, 10);
+    if (*end == 'k') {
+      values[n] *= 1000;
+      end++;
+    } else if (*end == 'M') {
+      values[n] *= 1000000;
+      end++;
+    }
+    if (end == token || *end || values[n] < 0) {
+      fprintf(stderr, "Can't make sense of \"%s\" as a count.\n", token);
+      exit(1);
+    }
+    n++;
+  }
+
+  *values_ptr = values;
+  return n;
+}
+
+
+// comma delimited list of engine names, as bench_engine_names has them
+static int parse_engine_list(char *str, int **engines_ptr) {
+  int *engines = ALLOC(sizeof(int) * (strlen(str) + 1));
+  char *token;
+  int n = 0, e;
+
+  for (token = strtok(str, ","); token; token = strtok(NULL, ",")) {
+    for (e = 0; e < N_BENCH_ENGINES && strcmp(token, bench_engine_names[e]) != 0; e++);
+    if (e == N_BENCH_ENGINES) {
+      fprintf(stderr, "There is no engine \"%s\".\n", token);
+      exit(1);
+    }
+    engines[n++] = e;
+  }
+
+  *engines_ptr = engines;
+  return n;
+}
+
+
+void print_usage(char **argv) {
+  fprintf(stderr, "usage: %s [options]\n", basename(argv[0]));
+  fprintf(stderr, "  -m  motif counts (comma delimited, default %s)\n", BENCH_MOTIFS);
+  fprintf(stderr, "  -l  sequence lengths (comma delimited, k and M suffixes allowed, default %s)\n", BENCH_LENGTHS);
+  fprintf(stderr, "  -x  nucleosome: 0 without, 1 with (comma delimited, default %s)\n", BENCH_NUCLEOSOME);
+  fprintf(stderr, "  -e  engines (comma delimited, default %s): full, or the engine compete runs with -c (checkpointed),\n", BENCH_ENGINES);
+  fprintf(stderr, "      -p (parallel), -w (windowed), --precision float (float) or --duration (duration)\n");
+  fprintf(stderr, "  -k  checkpoint interval of checkpointed (default as compete's)\n");
+  fprintf(stderr, "  -p  threads of parallel and windowed (default the number of CPUs)\n");
+  fprintf(stderr, "  -w  window of windowed (default %d)\n", BENCH_WINDOW);
+  fprintf(stderr, "  -o  overlap of windowed (default %d)\n", DEFAULT_WINDOW_OVERLAP);
+  fprintf(stderr, "  -M  skip runs estimated to need more memory than this, as --mem-limit (default the machine's)\n");
+  fprintf(stderr, "  -O  output_format timed by the output phase, as for compete (default text)\n");
+  fprintf(stderr, "  -s  seed (int, default 1) of the synthetic models and sequences\n");
+  fprintf(stderr, "  -j  run each model's specialized kernel (compete --specialize)\n");
+  fprintf(stderr, "\nwrites one tab-delimited line per case and engine: times in seconds (of load, the engine, its forward, backward\n");
+  fprintf(stderr, "and posterior summation phases summed over its threads, and output), bases per second and ns per model edge and\n");
+  fprintf(stderr, "position of the engine, the memory estimate_memory() plans for and the peak RSS of the whole run in kB, and the\n");
+  fprintf(stderr, "expected number of positions bound by a motif or the nucleosome\n");
+}
+
+
+int main(int argc, char **argv) {
+  char motifs_str[256] = BENCH_MOTIFS, lengths_str[256] = BENCH_LENGTHS, nucleosome_str[256] = BENCH_NUCLEOSOME, engines_str[256] = BENCH_ENGINES;
+  int output_precision = DEFAULT_COMPACT_PRECISION;
+  PROBABILITY output_threshold = DEFAULT_SPARSE_THRESHOLD;
+  unsigned long long seed = 1;
+  long *motifs, *lengths, *nucleosome;
+  int *engines, n_motif_counts, n_lengths, n_nucleosome, n_engines, a, b, c, e, opt;
+  bench_options_struct options;
+
+  options.output_format = OUTPUT_TEXT;
+  options.specialize = FALSE;
+  options.n_threads = find_num_cpus();
+  options.checkpoint_interval = 0;
+  options.window = BENCH_WINDOW;
+  options.overlap = DEFAULT_WINDOW_OVERLAP;
+  options.mem_limit = (size_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+
+  while ((opt = getopt(argc, argv, "m:l:x:e:k:p:w:o:M:O:s:jh")) > 0) {
+    switch (opt) {
+      case 'm':
+        snprintf(motifs_str, sizeof(motifs_str), "%s", optarg);
+        break;
+      case 'l':
+        snprintf(lengths_str, sizeof(lengths_str), "%s", optarg);
+        break;
+      case 'x':
+        snprintf(nucleosome_str, sizeof(nucleosome_str), "%s", optarg);
+        break;
+      case 'e':
+        snprintf(engines_str, sizeof(engines_str), "%s", optarg);
+        break;
+      case 'k':
+        options.checkpoint_interval = atoi(optarg);
+        break;
+      case 'p':
+        options.n_threads = atoi(optarg);
+        break;
+      case 'w':
+        options.window = atol(optarg);
+        break;
+      case 'o':
+        options.overlap = atol(optarg);
+        break;
+      case 'M':
+        if ((options.mem_limit = parse_byte_count(optarg)) == 0) {
+          fprintf(stderr, "Can't make sense of \"%s\" as a number of bytes.\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'O':
+        if (!parse_output_format(optarg, &options.output_format, &output_precision, &output_threshold)) {
+          fprintf(stderr, "Can't make sense of output format \"%s\".\n", optarg);
+          exit(1);
+        }
+        break;
+      case 's':
+        seed = strtoull(optarg, NULL, 10);
+        break;
+      case 'j':
+        options.specialize = TRUE;
+        break;
+      default:
+        print_usage(argv);
+        exit(opt == 'h' ? 0 : 1);
+    }
+  }
+  if (options.n_threads < 1 || options.window < 1 || options.overlap < 0) {
+    fprintf(stderr, "-p and -w have to be positive, and -o can't be negative.\n");
+    exit(1);
+  }
+
+  n_motif_counts = parse_count_list(motifs_str, &motifs);
+  n_lengths = parse_count_list(lengths_str, &lengths);
+  n_nucleosome = parse_count_list(nucleosome_str, &nucleosome);
+  n_engines = parse_engine_list(engines_str, &engines);
+
+  printf("motifs\tnucleosome\tlength\tengine\tstates\tedges\tload_s\trun_s\tforward_s\tbackward_s\tposterior_s\toutput_s\tbases_per_s\tns_per_edge\tplanned_kb\tpeak_rss_kb\tbound\n");
+  fflush(stdout);
+
+  for (a = 0; a < n_nucleosome; a++) {
+    for (b = 0; b < n_motif_counts; b++) {
+      for (c = 0; c < n_lengths; c++) {
+        for (e = 0; e < n_engines; e++) {
+          bench_case_struct bench_case;
+          bench_result_struct r;
+          struct rusage usage;
+          int status, fds[2];
+          pid_t pid;
+
+          bench_case.n_motifs = motifs[b];
+          bench_case.nucleosome = nucleosome[a] != 0;
+          bench_case.len = lengths[c];
+          if (bench_case.len < 1) continue;
+
+          if (pipe(fds) < 0 || (pid = fork()) < 0) {
+            fprintf(stderr, "fork() failed.\n");
+            exit(1);
+          }
+          if (pid == 0) {
+            close(fds[0]);
+            // the same case always gets the same model and sequence, whatever engine runs it
+            bench_rng_state = (seed * 1000003ULL + bench_case.n_motifs) * 1000003ULL + bench_case.nucleosome + 0x9E3779B97F4A7C15ULL;
+            run_case(&bench_case, engines[e], &options, &r);
+            if (write(fds[1], &r, sizeof(r)) != sizeof(r)) _exit(1);
+            _exit(0);
+          }
+          close(fds[1]);
+
+          // the result comes back through the pipe, and the peak RSS of the whole run from the child's usage
+          BOOL done = read(fds[0], &r, sizeof(r)) == sizeof(r);
+          close(fds[0]);
+          if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 || !done) {
+            fprintf(stderr, "Case of %d motifs, %s nucleosome, length %ld failed on %s.\n", bench_case.n_motifs, bench_case.nucleosome ? "with" : "without", bench_case.len, bench_engine_names[engines[e]]);
+            continue;
+          }
+          if (r.skipped) {
+            fprintf(stderr, "Skipped %d motifs, %s nucleosome, length %ld on %s, planned at %zu kB.\n", bench_case.n_motifs, bench_case.nucleosome ? "with" : "without", bench_case.len, bench_engine_names[engines[e]], r.planned / 1024);
+            continue;
+          }
+          printf("%d\t%d\t%ld\t%s\t%d\t%d\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\t%.6f\t%.0f\t%.3f\t%zu\t%ld\t%.10g\n", bench_case.n_motifs, bench_case.nucleosome, bench_case.len, bench_engine_names[engines[e]], r.n_states, r.n_edges, r.load, r.run, r.forward, r.backward, r.posterior, r.output, r.run > 0 ? bench_case.len / r.run : 0, 1e9 * r.run / ((double)bench_case.len * r.n_edges), r.planned / 1024, usage.ru_maxrss, r.bound);
+          fflush(stdout);
+        }
+      }
+    }
+  }
+
+  free(motifs);
+  free(lengths);
+  free(nucleosome);
+  free(engines);
+
+  return 0;
+}
@@ -0,0 +1,266 @@
+#include "cache.h"
+#include <dirent.h>
+#include <limits.h>
+
+
+// an entry in the cache directory, and how many positions it shares with the region being run
+typedef struct {
+  char *filename;
+  long begin, len, overlap;
+} cache_candidate_struct;
+
+
+BOOL read_first_region(char *seq_filename, char *name, long *begin) {
+  char str[256], path[PATH_MAX];
+  long begin_read, end_read;
+  FILE *f;
+
+  if (!(f = fopen(seq_filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", seq_filename);
+    return FALSE;
+  }
+  if (fscanf(f, "%255s %ld %ld\n", str, &begin_read, &end_read) != 3) {
+    fprintf(stderr, "%s has no region on its first line.\n", seq_filename);
+    fclose(f);
+    return FALSE;
+  }
+  fclose(f);
+
+  // store:record names aren't files, and are kept as given
+  if (!strchr(str, ':') && realpath(str, path)) strcpy(name, path);
+  else strcpy(name, str);
+  *begin = begin_read;
+  return TRUE;
+}
+
+
+static int compare_candidates(const void *a, const void *b) {
+  const cache_candidate_struct *x = (const cache_candidate_struct *)a, *y = (const cache_candidate_struct *)b;
+
+  if (x->overlap != y->overlap) return x->overlap > y->overlap ? -1 : 1;
+  return x->len < y->len ? -1 : x->len > y->len;
+}
+
+
+// the entries of model_key and region_key in cache_dir that overlap begin ... begin + len - 1, most shared first
+static int find_cache_candidates(char *cache_dir, unsigned long model_key, unsigned long region_key, long begin, long len, cache_candidate_struct **candidates_ptr) {
+  cache_candidate_struct *candidates = NULL;
+  unsigned long entry_model, entry_region;
+  long entry_begin, entry_len, from, to;
+  int n = 0, consumed;
+  struct dirent *d;
+  DIR *dir;
+
+  if (!(dir = opendir(cache_dir))) {
+    *candidates_ptr = NULL;
+    return 0;
+  }
+  while ((d = readdir(dir))) {
+    consumed = 0;
+    if (sscanf(d->d_name, "%16lx_%16lx_%ld_%ld.result%n", &entry_model, &entry_region, &entry_begin, &entry_len, &consumed) != 4 || consumed == 0 || d->d_name[consumed] != '\0') continue;
+    if (entry_model != model_key || entry_region != region_key) continue;
+
+    from = entry_begin > begin ? entry_begin : begin;
+    to = entry_begin + entry_len < begin + len ? entry_begin + entry_len : begin + len;
+    if (to <= from) continue;
+
+    candidates = realloc(candidates, sizeof(cache_candidate_struct) * (n + 1));
+    candidates[n].filename = ALLOC(strlen(cache_dir) + strlen(d->d_name) + 2);
+    sprintf(candidates[n].filename, "%s/%s", cache_dir, d->d_name);
+    candidates[n].begin = entry_begin;
+    candidates[n].len = entry_len;
+    candidates[n].overlap = to - from;
+    n++;
+  }
+  closedir(dir);
+
+  if (n > 1) qsort(candidates, n, sizeof(cache_candidate_struct), compare_candidates);
+  *candidates_ptr = candidates;
+  return n;
+}
+
+
+/* the boundary state of candidate if it can stand in for sequence where the two overlap: the same model and
+   columns, the same bases there and checkpoints at least two intervals apart in it.  NULL otherwise
+*/
+static boundary_state_struct *read_cache_entry(cache_candidate_struct *candidate, model_def_struct *model_def, sequence_struct *sequence, long begin, unsigned long model_key, unsigned long region_key, int n_columns) {
+  result_cache_header_struct header;
+  boundary_state_struct *state;
+  long shift = candidate->begin - begin, from, to, p;
+  char *symbols;
+  FILE *f;
+
+  if (!(f = fopen(candidate->filename, "r"))) return NULL;
+  if (fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic)) != 0 || header.version != RESULT_CACHE_VERSION || header.model_key != model_key || header.region_key != region_key || header.begin != candidate->begin || header.len != candidate->len) {
+    fprintf(stderr, "%s is not a version %d cache entry of this model; ignored.\n", candidate->filename, RESULT_CACHE_VERSION);
+    fclose(f);
+    return NULL;
+  }
+
+  // the positions both have, in the sequence's own
+  from = shift > 0 ? shift : 0;
+  to = shift + candidate->len < sequence->len ? shift + candidate->len : sequence->len;
+  symbols = ALLOC(candidate->len);
+  if (fread(symbols, candidate->len, 1, f) != 1) {
+    fprintf(stderr, "%s is truncated; ignored.\n", candidate->filename);
+    free(symbols);
+    fclose(f);
+    return NULL;
+  }
+  for (p = from; p < to && symbols[p - shift] == fetch_symbol(sequence, p); p++);
+  free(symbols);
+  if (p < to) {
+    fprintf(stderr, "%s has other bases than the sequence; ignored.\n", candidate->filename);
+    fclose(f);
+    return NULL;
+  }
+
+  state = fread_boundary_state(f, candidate->filename);
+  fclose(f);
+  if (state->len != candidate->len || state->n_states != model_def->n_states || state->n_columns != n_columns || state->phase != (candidate->begin - 1) % state->interval || to - from < 2 * state->interval) {
+    free_boundary_state(state);
+    return NULL;
+  }
+  return state;
+}
+
+
+// entry's scale factors, checkpoint rows and posteriors at the positions it shares with state, entry_begin - begin on
+static void copy_cache_entry(boundary_state_struct *entry, long entry_shift, boundary_state_struct *state, long from, long to) {
+  unsigned long n = state->n_states;
+  long k = state->interval, c, p;
+
+  memcpy(state->sf + from, entry->sf + from - entry_shift, sizeof(PROBABILITY) * (to - from));
+  memcpy(state->sb + from, entry->sb + from - entry_shift, sizeof(PROBABILITY) * (to - from));
+  memcpy(state->posterior + (unsigned long)state->n_columns * from, entry->posterior + (unsigned long)state->n_columns * (from - entry_shift), sizeof(PROBABILITY) * state->n_columns * (to - from));
+
+  // both phases are those of the chromosome, so a checkpoint of one is one of the other
+  for (c = (from + state->phase + k - 1) / k; (p = c * k - state->phase) < to; c++) {
+    long e = (p - entry_shift + entry->phase) / k;
+    memcpy(state->f_rows + n * c, entry->f_rows + n * e, sizeof(PROBABILITY) * n);
+    memcpy(state->b_rows + n * c, entry->b_rows + n * e, sizeof(PROBABILITY) * n);
+  }
+}
+
+
+static void refresh_range(model_def_struct *model_def, sequence_struct *sequence, boundary_state_struct *state, long first, long last, posterior_columns_struct *columns, char *why) {
+  long from, to;
+
+  refresh_forward_backward(model_def, sequence, state, first, last, columns, &from, &to);
+  fprintf(stderr, "%s at positions %ld to %ld; posteriors of %ld to %ld recomputed.\n", why, first + 1, last + 1, from + 1, to + 1);
+}
+
+
+static void write_cache_entry(char *cache_dir, sequence_struct *sequence, long begin, unsigned long model_key, unsigned long region_key, boundary_state_struct *state) {
+  result_cache_header_struct header;
+  char *filename = ALLOC(strlen(cache_dir) + 128), *temporary = ALLOC(strlen(cache_dir) + 160), *symbols;
+  long p;
+  FILE *f;
+
+  sprintf(filename, "%s/%016lx_%016lx_%ld_%ld.result", cache_dir, model_key, region_key, begin, sequence->len);
+  sprintf(temporary, "%s.%d.tmp", filename, (int)getpid());
+  if (!(f = fopen(temporary, "w"))) {
+    fprintf(stderr, "Opening %s for writing failed; the run is not cached.\n", temporary);
+    free(filename);
+    free(temporary);
+    return;
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, RESULT_CACHE_MAGIC, sizeof(header.magic));
+  header.version = RESULT_CACHE_VERSION;
+  header.model_key = model_key;
+  header.region_key = region_key;
+  header.begin = begin;
+  header.len = sequence->len;
+  symbols = ALLOC(sequence->len);
+  for (p = 0; p < sequence->len; p++) symbols[p] = fetch_symbol(sequence, p);
+  fwrite(&header, sizeof(header), 1, f);
+  fwrite(symbols, sequence->len, 1, f);
+  free(symbols);
+
+  // the state records the scaling it now matches, which the sequence still owns
+  free_position_scaling(state->scaling);
+  state->scaling = sequence->scaling;
+  fwrite_boundary_state(f, state, temporary);
+  state->scaling = NULL;
+
+  // written under a name of this process's own and renamed, so concurrent runs never read half an entry
+  if (fclose(f) != 0 || rename(temporary, filename) != 0) {
+    fprintf(stderr, "Error writing %s; the run is not cached.\n", filename);
+    unlink(temporary);
+  }
+  free(filename);
+  free(temporary);
+}
+
+
+void run_with_result_cache(model_def_struct *model_def, sequence_struct *sequence, char *name, long begin, posterior_columns_struct *columns, posterior_writer_struct *writer, int checkpoint_interval, char *cache_dir) {
+  unsigned long model_key = model_fingerprint(model_def, columns);
+  unsigned long region_key = fingerprint_bytes(14695981039346656037UL, name, strlen(name));
+  long len = sequence->len, k, shift = 0, from = 0, to = 0, first, last, left_last = -1;
+  cache_candidate_struct *candidates, *used = NULL;
+  boundary_state_struct *state = NULL, *entry = NULL;
+  BOOL changed = TRUE, merged = FALSE;
+  int n_candidates, i;
+
+  mkdir(cache_dir, 0755);
+  n_candidates = find_cache_candidates(cache_dir, model_key, region_key, begin, len, &candidates);
+  for (i = 0; i < n_candidates && !entry; i++) {
+    if ((entry = read_cache_entry(candidates + i, model_def, sequence, begin, model_key, region_key, columns->n_columns))) used = candidates + i;
+  }
+
+  if (entry && used->begin == begin && used->len == len) {
+    // the very region: as --resume, recomputing only what changed scaling factors reach
+    fprintf(stderr, "Serving positions 1 to %ld from %s.\n", len, used->filename);
+    state = entry;
+    entry = NULL;
+    if ((changed = scaling_difference(state->scaling, sequence->scaling, len, &first, &last))) refresh_range(model_def, sequence, state, first, last, columns, "Scaling factors changed");
+  } else if (entry) {
+    k = entry->interval;
+    shift = used->begin - begin;
+    from = shift > 0 ? shift : 0;
+    to = shift + used->len < len ? shift + used->len : len;
+    fprintf(stderr, "Reusing positions %ld to %ld from %s.\n", from + 1, to, used->filename);
+
+    state = alloc_boundary_state(model_def, len, k, (begin - 1) % k, columns->n_columns);
+    state->fingerprint = run_fingerprint(model_def, sequence, columns);
+    copy_cache_entry(entry, shift, state, from, to);
+    state->valid = TRUE;
+
+    /* each refresh leaves everything right of where it stops as the new run has it, so the changes are taken from
+       the right: the right flank (or the entry's own right end, where the backward rows start over), changed
+       scaling factors in between, then the left flank (or the entry's left end)
+    */
+    if (to < len) refresh_range(model_def, sequence, state, to, len - 1, columns, "New positions");
+    else if (shift + used->len > len) refresh_range(model_def, sequence, state, len - 1, len - 1, columns, "Region ends");
+    if (from > 0) left_last = from - 1;
+    else if (shift < 0) left_last = 0;
+    if (scaling_difference_at(entry->scaling, from - shift, sequence->scaling, from, to - from, &first, &last)) {
+      // a change too close to the left end has no checkpoint of the entry before it, and is run with the flank
+      if (left_last >= 0 && first <= k + 1) {
+        left_last = from + last;
+        merged = TRUE;
+      }
+      else refresh_range(model_def, sequence, state, from + first, from + last, columns, "Scaling factors changed");
+    }
+    if (left_last >= 0) refresh_range(model_def, sequence, state, 0, left_last, columns, merged ? "Left end and changed scaling factors" : (from > 0 ? "New positions" : "Region begins"));
+    free_boundary_state(entry);
+  } else {
+    k = checkpoint_interval > 0 ? checkpoint_interval : default_checkpoint_interval(len);
+    state = alloc_boundary_state(model_def, len, k, (begin - 1) % k, columns->n_columns);
+    state->fingerprint = run_fingerprint(model_def, sequence, columns);
+    refresh_forward_backward(model_def, sequence, state, 0, len - 1, columns, &from, &to);
+  }
+  write_posterior_block(writer, NULL, columns, state->posterior, len);
+
+  if (changed) {
+    write_cache_entry(cache_dir, sequence, begin, model_key, region_key, state);
+    // an entry within the region has nothing the new one doesn't
+    if (used && used->begin >= begin && used->begin + used->len <= begin + len && (used->begin != begin || used->len != len)) unlink(used->filename);
+  }
+
+  for (i = 0; i < n_candidates; i++) free(candidates[i].filename);
+  free(candidates);
+  free_boundary_state(state);
+}
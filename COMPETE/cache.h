@@ -0,0 +1,52 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "bc.h"
+#include "output.h"
+
+/* result cache (compete --cache dir): every run leaves its region's boundary state in dir, as --save-state would,
+   under a name made of the model key (model_fingerprint(): the model, its -n/-m/-u/-t parameters and the output
+   columns), a hash of the region's sequence file and the region's first position and length.  a later run of the
+   same model over a region of the same file looks for the entry that overlaps it most:
+
+   - an entry for the very region is served as it is, or refreshed as --resume would if the scaling changed
+   - an entry overlapping it lends its scale factors, checkpoint rows and posteriors at the positions the two share,
+     and only the new flanks are run.  refresh_forward_backward() then recomputes forward rows from the left flank
+     and backward rows from the right one until they agree with the entry's (to PARALLEL_TOLERANCE), which is as
+     far as the change of the region's ends carries
+
+   checkpoints sit at the same chromosome positions in every entry of a file (boundary_state_struct.phase), so
+   overlapping entries share them.  bases, and the scaling factors where the regions overlap, are compared before
+   anything is reused.
+*/
+
+#define RESULT_CACHE_MAGIC "COMPETEr"
+#define RESULT_CACHE_VERSION 1
+
+
+// entries are this header, the len symbols of the region and its boundary state as fwrite_boundary_state() has it
+typedef struct {
+  char magic[8];
+  int version;
+  int pad;
+  unsigned long long model_key, region_key;
+  long long begin, len;
+} result_cache_header_struct;
+
+
+// first region of seq_filename: its name made absolute (into name, PATH_MAX long) and its first position
+BOOL read_first_region(char *seq_filename, char *name, long *begin);
+
+/* INPUTS:
+   model_def: finalized model, with its parameters applied
+   sequence: the region of name that begins at position begin (1-based), with its scaling
+   columns: which states' posteriors are summed into each output column
+   checkpoint_interval: of new entries, default_checkpoint_interval() if not positive; reused entries keep theirs
+   cache_dir: where entries are kept, created if need be
+   OUTPUTS:
+   the posteriors of sequence, through writer, and an entry for the region in cache_dir.  an entry that lies
+   within the region is replaced by it
+*/
+void run_with_result_cache(model_def_struct *model_def, sequence_struct *sequence, char *name, long begin, posterior_columns_struct *columns, posterior_writer_struct *writer, int checkpoint_interval, char *cache_dir);
+
+#endif
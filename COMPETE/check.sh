@@ -0,0 +1,304 @@
+#!/bin/sh
+# regression check of the engines and file formats (make check): runs the bundled example model over a stretch of
+# chr/IV.txt with position specific scaling, and compares what each engine, store, output format and resumed,
+# sharded or served run writes with the default engine's output.  exits 1 if any comparison fails.
+
+COMPETE=${COMPETE:-./compete}
+MODEL=examples/foo_model.cfg
+PARAMETERS="-n 35 -m 0.01,0.02"
+
+# exact engines agree to rounding; --duration sums in another order, and --precision float keeps 7 digits
+EXACT=1e-12
+DURATION=1e-10
+FLOAT=1e-5
+# bc.h's PARALLEL_TOLERANCE, relative to the serial engine's value
+PARALLEL=1e-12
+
+if [ ! -x "$COMPETE" ]; then
+  echo "$COMPETE not found; run make first" >&2
+  exit 1
+fi
+
+dir=$(mktemp -d "${TMPDIR:-/tmp}/compete_check.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT
+# --specialize compiles its kernels here, not into the user's cache
+export COMPETE_KERNEL_CACHE="$dir/kernels"
+failed=0
+checks=0
+
+# the regions run, and scaling factors that change at every position
+printf 'chr/IV.txt 740741 742740\n' > "$dir/a.seq"
+printf 'chr/IV.txt 750001 751500\n' > "$dir/b.seq"
+cat "$dir/a.seq" "$dir/b.seq" > "$dir/ab.seq"
+printf 'chr/IV.txt 741741 743740\n' > "$dir/overlap.seq"
+printf 'chr/IV.txt 700001 712000\n' > "$dir/long.seq"
+scaling() {
+  awk -v n=$1 -v shift=$2 -v edit=$3 'BEGIN {
+    print "FKH2\tmotif\tnucleosome"
+    for (i = shift; i < shift + n; i++) {
+      f = 1 + 0.3 * sin(i / 101)
+      if (edit && i >= 900 && i < 1000) f *= 2
+      printf "%.4f\t%.4f\t%.4f\n", 1 + 0.5 * sin(i / 37), 1 + 0.4 * cos(i / 53), f
+    }
+  }'
+}
+scaling 2000 0 0 > "$dir/a.tsv"
+scaling 2000 0 1 > "$dir/edited.tsv"
+scaling 1500 9260 0 > "$dir/b.tsv"
+scaling 2000 1000 0 > "$dir/overlap.tsv"
+scaling 12000 0 0 > "$dir/long.tsv"
+(cat "$dir/a.tsv"; tail -n +2 "$dir/b.tsv") > "$dir/ab.tsv"
+
+# compare name expected actual tolerance: lines that aren't numbers have to be the same, and numbers within tolerance
+compare() {
+  checks=$((checks + 1))
+  if result=$(awk -v tol=$4 '
+      FNR == NR { expected[FNR] = $0; n = FNR; next }
+      {
+        if (FNR > n) { print "line " FNR " is extra"; exit 1 }
+        if ($1 !~ /^[-0-9.]/ || expected[FNR] !~ /^[-0-9.]/) {
+          if ($0 != expected[FNR]) { print "line " FNR " is \"" $0 "\", expected \"" expected[FNR] "\""; exit 1 }
+          next
+        }
+        split(expected[FNR], e)
+        for (i = 1; i <= NF; i++) {
+          d = $i - e[i]
+          if (d < 0) d = -d
+          if (d > max) max = d
+        }
+        if (NF != length(e)) { print "line " FNR " has " NF " fields, expected " length(e); exit 1 }
+      }
+      END {
+        if (FNR < n) { print "only " FNR " of " n " lines"; exit 1 }
+        if (max > tol) { print "differs by " max; exit 1 }
+      }' "$2" "$3" 2>&1) && [ -s "$3" ]; then
+    echo "ok      $1"
+  else
+    echo "FAIL    $1: ${result:-no output}"
+    failed=$((failed + 1))
+  fi
+}
+
+# identical name expected actual: the files have to be the same, byte for byte
+identical() {
+  checks=$((checks + 1))
+  if [ -s "$3" ] && cmp -s "$2" "$3"; then
+    echo "ok      $1"
+  else
+    echo "FAIL    $1: $([ -s "$3" ] && echo differs || echo no output)"
+    failed=$((failed + 1))
+  fi
+}
+
+# the block of seq_filenames line $2 in a batch output, whose blocks come in the order they finish
+block() {
+  awk -v line="# seq_filenames line $2," 'index($0, line) == 1 { on = 1; next } /^#/ { on = 0 } on' "$1"
+}
+
+# the log likelihood -P reported for the run that wrote $1, alone on a line in $1.ll
+likelihood() {
+  sed -n 's/.*"log_likelihood":\([^,}]*\).*/\1/p' "$dir/$1.err" > "$dir/$1.ll"
+}
+
+# the float32 rows of -O binary file $1 as text, under the header line of text output $2
+binary_rows() {
+  header=$(head -n 1 "$2")
+  n_columns=$(printf '%s\n' "$header" | awk -F '\t' '{ print NF }')
+  names=$(printf '%s\n' "$header" | awk -F '\t' '{ n = 0; for (i = 1; i <= NF; i++) n += length($i) + 1; print n }')
+  label=$(od -An -tu4 -j 24 -N 4 "$1" | tr -d ' ')
+  printf '%s\n' "$header"
+  # magic, version, column count, row count and label length, the label and names, padded to 4 bytes
+  od -An -v -tf4 -j $(( (28 + label + names + 3) / 4 * 4 )) "$1" | awk -v n=$n_columns '{
+    for (i = 1; i <= NF; i++) {
+      line = line (k ? "\t" : "") $i
+      if (++k == n) { print line; line = ""; k = 0 }
+    }
+  }'
+}
+
+run() {
+  out=$1
+  shift
+  $COMPETE $PARAMETERS "$@" > "$dir/$out" 2> "$dir/$out.err" || { cat "$dir/$out.err" >&2; : > "$dir/$out"; }
+}
+
+run default.txt $MODEL "$dir/a.seq" "$dir/a.tsv"
+run edited.txt $MODEL "$dir/a.seq" "$dir/edited.tsv"
+run b.txt $MODEL "$dir/b.seq" "$dir/b.tsv"
+run overlap.txt $MODEL "$dir/overlap.seq" "$dir/overlap.tsv"
+
+# engines
+run c.txt -c $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "-c" "$dir/default.txt" "$dir/c.txt" $EXACT
+run k.txt -c -k 100 $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "-c -k 100" "$dir/default.txt" "$dir/k.txt" $EXACT
+# 3000 position chunks, so every chunk but the first starts speculatively, PARALLEL_WARMUP positions early, and is
+# repaired from its true boundary row
+run long.txt -P $MODEL "$dir/long.seq" "$dir/long.tsv"
+run long_p.txt -P -p 4 $MODEL "$dir/long.seq" "$dir/long.tsv"
+compare "-p 4" "$dir/long.txt" "$dir/long_p.txt" $PARALLEL
+likelihood long.txt
+likelihood long_p.txt
+tolerance=$(awk -v tol=$PARALLEL '{ print tol * ($1 < 0 ? -$1 : $1) }' "$dir/long.txt.ll")
+compare "-p 4, log likelihood" "$dir/long.txt.ll" "$dir/long_p.txt.ll" ${tolerance:-0}
+# windows whose overlap reaches across the whole region give the exact posteriors
+run w.txt -w 500 -o 2000 -p 2 $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "-w 500 -o 2000" "$dir/default.txt" "$dir/w.txt" $EXACT
+run duration.txt --duration $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "--duration" "$dir/default.txt" "$dir/duration.txt" $DURATION
+run float.txt --precision float $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "--precision float" "$dir/default.txt" "$dir/float.txt" $FLOAT
+# the generated kernels run the generic loops' sums in the same order
+run specialize.txt --specialize $MODEL "$dir/a.seq" "$dir/a.tsv"
+identical "--specialize" "$dir/default.txt" "$dir/specialize.txt"
+run huge.txt --huge-pages $MODEL "$dir/a.seq" "$dir/a.tsv"
+identical "--huge-pages" "$dir/default.txt" "$dir/huge.txt"
+
+# fixed states, with the speculative -p chunks of the -p 4 check above
+FIXED="-f 100-200:0,5000-5005:1"
+run fixed.txt $FIXED $MODEL "$dir/long.seq" "$dir/long.tsv"
+run fixed_p.txt $FIXED -p 4 $MODEL "$dir/long.seq" "$dir/long.tsv"
+compare "-f -p 4" "$dir/fixed.txt" "$dir/fixed_p.txt" $PARALLEL
+
+# the most probable path, from whole and checkpointed tables
+run viterbi.txt -V $MODEL "$dir/a.seq" "$dir/a.tsv"
+run viterbi_k.txt -V -k 100 $MODEL "$dir/a.seq" "$dir/a.tsv"
+identical "-V -k 100" "$dir/viterbi.txt" "$dir/viterbi_k.txt"
+
+# a sweep of the command line's own parameters, whose block is the plain run's after its comment
+printf 'n\tm\n35\t0.01,0.02\n' > "$dir/sweep.tsv"
+run sweep.txt -S "$dir/sweep.tsv" $MODEL "$dir/a.seq" "$dir/a.tsv"
+grep -v '^#' "$dir/sweep.txt" > "$dir/sweep_block.txt"
+identical "-S, one set" "$dir/default.txt" "$dir/sweep_block.txt"
+
+# a batch, each sequence with its own block of the scaling file
+run ab.txt $MODEL "$dir/ab.seq" "$dir/ab.tsv"
+block "$dir/ab.txt" 1 > "$dir/ab1.txt"
+block "$dir/ab.txt" 2 > "$dir/ab2.txt"
+compare "batch, first sequence" "$dir/default.txt" "$dir/ab1.txt" $EXACT
+compare "batch, second sequence" "$dir/b.txt" "$dir/ab2.txt" $EXACT
+run ab_duration.txt --duration -p 2 $MODEL "$dir/ab.seq" "$dir/ab.tsv"
+block "$dir/ab_duration.txt" 1 > "$dir/ab_duration1.txt"
+block "$dir/ab_duration.txt" 2 > "$dir/ab_duration2.txt"
+compare "--duration -p 2, first sequence" "$dir/default.txt" "$dir/ab_duration1.txt" $DURATION
+compare "--duration -p 2, second sequence" "$dir/b.txt" "$dir/ab_duration2.txt" $DURATION
+
+# stores
+$COMPETE --compile-model "$dir/model.bin" $MODEL
+run bin.txt "$dir/model.bin" "$dir/a.seq" "$dir/a.tsv"
+compare "--compile-model" "$dir/default.txt" "$dir/bin.txt" $EXACT
+$COMPETE --pack-sequence "$dir/genome.pack" chr/IV.txt
+printf '%s:IV 740741 742740\n' "$dir/genome.pack" > "$dir/packed.seq"
+run pack.txt $MODEL "$dir/packed.seq" "$dir/a.tsv"
+compare "--pack-sequence" "$dir/default.txt" "$dir/pack.txt" $EXACT
+$COMPETE --pack-scaling "$dir/a.bin" "$dir/a.tsv"
+run scaling.txt $MODEL "$dir/a.seq" "$dir/a.bin"
+compare "--pack-scaling" "$dir/default.txt" "$dir/scaling.txt" $EXACT
+
+# output formats, read back: compact has the text format's 20 places, sparse the default threshold, binary float32
+run compact.txt -O compact:20 $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "-O compact:20" "$dir/default.txt" "$dir/compact.txt" 0
+run sparse.txt -O sparse $MODEL "$dir/a.seq" "$dir/a.tsv"
+awk 'NR > 1 { for (i = 2; i <= NF; i++) if ($i > 0.01) print NR - 2 "\t" i "\t" $i }' "$dir/default.txt" > "$dir/sparse_expected.txt"
+awk 'FNR == NR { if (FNR == 1) for (i = 1; i <= NF; i++) column[$i] = i; next }
+  /^#/ || $1 == "position" { next }
+  { print $1 "\t" column[$2] "\t" $3 }' "$dir/default.txt" "$dir/sparse.txt" > "$dir/sparse_read.txt"
+compare "-O sparse" "$dir/sparse_expected.txt" "$dir/sparse_read.txt" 5e-7
+run binary.out -O binary $MODEL "$dir/a.seq" "$dir/a.tsv"
+binary_rows "$dir/binary.out" "$dir/default.txt" > "$dir/binary.txt"
+compare "-O binary" "$dir/default.txt" "$dir/binary.txt" $FLOAT
+
+# several outputs of one pass: the occupancy group is the default table, each motif's strands add up to -s's
+# start probabilities, and each interval's counts are their sums over it (BED starts count from 0)
+run starts.txt -s $MODEL "$dir/a.seq" "$dir/a.tsv"
+printf 'IV\t740800\t741000\tfirst\nIV\t742500\t743000\tclipped\n' > "$dir/intervals.bed"
+run outputs.txt --outputs occupancy,starts="$dir/strands.txt" --counts "$dir/intervals.bed"="$dir/counts.tsv" $MODEL "$dir/a.seq" "$dir/a.tsv"
+identical "--outputs occupancy" "$dir/default.txt" "$dir/outputs.txt"
+awk 'FNR == NR { if (FNR > 1) for (i = 1; i <= NF; i++) s[FNR, i] = $i; next }
+  FNR == 1 { print "background\tmotif_0\tmotif_1"; next }
+  { printf "%s\t%.17g\t%.17g\n", s[FNR, 1], $1 + $2, $3 + $4 }' "$dir/starts.txt" "$dir/strands.txt" > "$dir/strands_summed.txt"
+cut -f 1-3 "$dir/starts.txt" > "$dir/starts_motifs.txt"
+compare "--outputs starts" "$dir/starts_motifs.txt" "$dir/strands_summed.txt" $EXACT
+awk -v first=740741 'FNR == NR { if (FNR == 1) for (i = 1; i <= NF; i++) name[i] = $i; else for (i = 2; i <= NF; i++) s[FNR - 2, i] = $i; n_columns = NF; n = FNR - 1; next }
+  {
+    # clipped to the region, as --counts writes them
+    end = $3 < first + n - 1 ? $3 : first + n - 1
+    line = $2 "\t" end
+    for (i = 2; i <= n_columns; i++) {
+      if (name[i] == "nuc_padding") continue
+      sum = 0
+      for (p = $2 - first + 1; p <= end - first; p++) if (p >= 0 && p < n) sum += s[p, i]
+      line = line "\t" sprintf("%.17g", sum)
+    }
+    print line
+  }' "$dir/starts.txt" "$dir/intervals.bed" > "$dir/counts_expected.txt"
+cut -f 2,3,5- "$dir/counts.tsv" | tail -n +2 > "$dir/counts_read.txt"
+compare "--counts" "$dir/counts_expected.txt" "$dir/counts_read.txt" 1e-8
+
+# boundary states: resuming with edited factors gives the edited run's posteriors
+run saved.txt --save-state "$dir/state.bin" $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "--save-state" "$dir/default.txt" "$dir/saved.txt" $EXACT
+run resumed.txt --resume "$dir/state.bin" $MODEL "$dir/a.seq" "$dir/edited.tsv"
+compare "--resume" "$dir/edited.txt" "$dir/resumed.txt" 1e-9
+
+# the cache: a cold run, the same region served from its entry, and an overlapping one run from the flanks
+mkdir "$dir/cache"
+run cold.txt --cache "$dir/cache" $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "--cache, new entry" "$dir/default.txt" "$dir/cold.txt" $EXACT
+run warm.txt --cache "$dir/cache" $MODEL "$dir/a.seq" "$dir/a.tsv"
+compare "--cache, same region" "$dir/default.txt" "$dir/warm.txt" $EXACT
+run flanks.txt --cache "$dir/cache" $MODEL "$dir/overlap.seq" "$dir/overlap.tsv"
+compare "--cache, overlapping region" "$dir/overlap.txt" "$dir/flanks.txt" 1e-9
+
+# shards of both sequences, stitched back together; as for -w, the overlap reaches across each region
+mkdir "$dir/parts"
+$COMPETE $PARAMETERS --plan-shards "$dir/manifest.tsv" -w 1000 -o 1000 $MODEL "$dir/ab.seq" "$dir/ab.tsv" 2> "$dir/plan.err" || cat "$dir/plan.err" >&2
+$COMPETE --run-shard all "$dir/manifest.tsv" "$dir/parts"
+$COMPETE --merge-shards "$dir/manifest.tsv" "$dir/parts" "$dir/merged.txt"
+block "$dir/merged.txt" 1 > "$dir/merged1.txt"
+block "$dir/merged.txt" 2 > "$dir/merged2.txt"
+compare "shards, first sequence" "$dir/default.txt" "$dir/merged1.txt" $EXACT
+compare "shards, second sequence" "$dir/b.txt" "$dir/merged2.txt" $EXACT
+
+# training: every iteration's log likelihood is at least the last one's, to rounding
+run train.txt --train "$dir/trained.bin" --iterations 5 --tolerance 0 $MODEL "$dir/ab.seq" "$dir/ab.tsv"
+checks=$((checks + 1))
+if result=$(awk 'NR > 1 {
+      if (n && $2 < last - 1e-9 * (last < 0 ? -last : last)) { print "iteration " $1 " fell to " $2 " from " last; exit 1 }
+      last = $2; n++
+    }
+    END { if (n < 2) { print "only " n + 0 " iterations"; exit 1 } }' "$dir/train.txt"); then
+  echo "ok      --train, log likelihood"
+else
+  echo "FAIL    --train, log likelihood: $result"
+  failed=$((failed + 1))
+fi
+
+# a region served by competed, which has no scaling factors, against a run with all of them 1
+if command -v perl > /dev/null; then
+  awk 'BEGIN { print "FKH2\tmotif\tnucleosome"; for (i = 0; i < 2000; i++) print "1\t1\t1" }' > "$dir/unscaled.tsv"
+  run unscaled.txt $MODEL "$dir/a.seq" "$dir/unscaled.tsv"
+  ${COMPETED:-./competed} $PARAMETERS -p 2 $MODEL "$dir/competed.sock" 2> "$dir/competed.err" &
+  server=$!
+  tries=0
+  while [ ! -S "$dir/competed.sock" ] && [ $tries -lt 50 ]; do sleep 0.1; tries=$((tries + 1)); done
+  perl -MIO::Socket::UNIX -e '
+    my $socket = IO::Socket::UNIX->new(Peer => $ARGV[0]) or die "connect: $!\n";
+    print $socket "$ARGV[1]\n";
+    my $answer = <$socket>;
+    $answer =~ /^ok (\d+)/ or die "competed: $answer";
+    my $left = $1;
+    while ($left > 0) {
+      my $n = read($socket, my $bytes, $left) or die "answer cut short\n";
+      print $bytes;
+      $left -= $n;
+    }' "$dir/competed.sock" "chr/IV.txt 740741 742740" > "$dir/served.txt" || cat "$dir/competed.err" >&2
+  kill $server 2> /dev/null
+  wait $server 2> /dev/null
+  identical "competed" "$dir/unscaled.txt" "$dir/served.txt"
+else
+  echo "skip    competed: no perl to connect with"
+fi
+
+echo "$((checks - failed)) of $checks checks passed"
+[ $failed -eq 0 ]
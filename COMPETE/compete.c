@@ -1,51 +1,27 @@
-#include "bc.h"
+#include "libcompete.h"
+#include "output.h"
+#include "shard.h"
+#include "cache.h"
 #include <time.h>
 #include <libgen.h>
 #include <getopt.h>
+#include <limits.h>
 
 extern char *optarg;
 extern int optind;
 
 void free_memory(model_def_struct *model_def, sequence_struct **sequence,
-		PROBABILITY **f_table, PROBABILITY **b_table, PROBABILITY **sf,
-		PROBABILITY **sb, PROBABILITY **sr, int n_seqs, int *motif_starts,
+		PROBABILITY **f_table, PROBABILITY **sf, int n_seqs, int *motif_starts,
 		int *motif_lens, PROBABILITY *motif_conc, int n_motifs,
-		char **motif_names, float** seq_pos_conc_scaler) {
+		char **motif_names) {
   int i;
 
-  // ===========
-  for(i = 0; i < n_motifs + 1; i++) {
-	  free(seq_pos_conc_scaler[i]);
-  }
-  free(seq_pos_conc_scaler);
-  // ==========
-  free(model_def->initial_probs);
-  free(model_def->transition_matrix);
-  if (model_def->n_fixed_states > 0) {
-    free(model_def->fixed_states);
-  }
-  free(model_def->emission_matrix);
-  free(model_def->alphabet);
-  free(model_def->n_parents);
-  free(model_def->n_children);
-  free(model_def->first_silent_parent);
-  free(model_def->first_silent_child);
-  for (i = 0; i < model_def->n_states; i++) {
-    free(model_def->parents[i]);
-    free(model_def->children[i]);
-  }
-  free(model_def->parents);
-  free(model_def->children);
-  free(model_def);
+  free_model(model_def);
 
   for (i = 0; i < n_seqs; i++) {
-    free(sequence[i]->seq);
-    free(sequence[i]);
-    free(f_table[i]);
-    free(b_table[i]);
-    free(sf[i]);
-    free(sb[i]);
-    free(sr[i]);
+    free_sequence(sequence[i]);
+    free_table(f_table[i]);
+    free_table(sf[i]);
   }
 
   if (motif_names != NULL) {
@@ -57,335 +33,757 @@ void free_memory(model_def_struct *model_def, sequence_struct **sequence,
 
   free(sequence);
   free(f_table);
-  free(b_table);
   free(motif_starts);
   free(motif_lens);
   free(sf);
-  free(sb);
-  free(sr);
   free(motif_conc);
 }
 
 
-void find_motif_state_numbers(model_def_struct *model_def, int **starts, int **lens) {
-  int *motif_starts, *motif_lens;
-  int i, j;
-
-  motif_starts = ALLOC(sizeof(int) * (model_def->n_states - model_def->silent_states_begin));
-  motif_lens = ALLOC(sizeof(int) * (model_def->n_states - model_def->silent_states_begin));
-
-  for (i = model_def->silent_states_begin + 1; i < model_def->n_states; i++) {
-    // i is each silent state for a motif
-    int first = -1, second = -1;
-    for (j = 1; j < model_def->silent_states_begin; j++) {
-      if (fetch_transition_prob(model_def, i, j) > 0) {
-        if (first == -1) {
-          first = j;
-        } else {
-          second = j;
-          break;
+/* reads a whitespace-separated table of parameter sets.  the first line that isn't blank or a # comment names the
+   columns, each one of n, u, t or m (comma delimited motif concentrations, as for -m); parameters without a column
+   keep the value in defaults.  returns the number of sets read into *sets_ptr.
+*/
+int read_parameter_sets(char *filename, parameter_set_struct *defaults, int n_motifs, parameter_set_struct **sets_ptr) {
+  parameter_set_struct *sets = NULL;
+  char line[4096], columns[16], *token, *str;
+  int n_sets = 0, n_columns = -1, line_number = 0, i, j;
+  FILE *f;
+
+  if (!(f = fopen(filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", filename);
+    exit(1);
+  }
+
+  while (fgets(line, sizeof(line), f)) {
+    line_number++;
+    token = strtok(line, " \t\r\n");
+    if (!token || token[0] == '#') continue;
+
+    if (n_columns < 0) {
+      // header
+      for (n_columns = 0; token; token = strtok(NULL, " \t\r\n")) {
+        if (strlen(token) != 1 || !strchr("nutm", token[0]) || n_columns == sizeof(columns)) {
+          fprintf(stderr, "%s line %d: unknown column \"%s\", expected n, u, t or m.\n", filename, line_number, token);
+          exit(1);
         }
+        columns[n_columns++] = token[0];
       }
+      continue;
     }
 
-    motif_starts[i - model_def->silent_states_begin - 1] = first > second ? second : first;
-    motif_lens[i - model_def->silent_states_begin - 1] = abs(first - second);
-//    fprintf(stderr, "Motif %d start: %d\tlen: %d\n", i, motif_starts[i - model_def->silent_states_begin - 1], motif_lens[i - model_def->silent_states_begin - 1]);
+    sets = realloc(sets, sizeof(parameter_set_struct) * (n_sets + 1));
+    parameter_set_struct *set = sets + n_sets++;
+    *set = *defaults;
+    set->line = line_number;
+    set->motif_conc = ALLOC(sizeof(PROBABILITY) * (n_motifs > 0 ? n_motifs : 1));
+    memcpy(set->motif_conc, defaults->motif_conc, sizeof(PROBABILITY) * n_motifs);
+
+    for (i = 0; i < n_columns; i++, token = strtok(NULL, " \t\r\n")) {
+      if (!token) {
+        fprintf(stderr, "%s line %d: expected %d columns.\n", filename, line_number, n_columns);
+        exit(1);
+      }
+      switch (columns[i]) {
+        case 'n': set->nuc_conc = atof(token); break;
+        case 'u': set->unbound_conc = atof(token); break;
+        case 't': set->T = atof(token); break;
+        case 'm':
+          // strtok is busy with the line, so walk the commas by hand
+          for (j = 0, str = token; j < n_motifs && *str; j++) {
+            set->motif_conc[j] = atof(str);
+            if (!(str = strchr(str, ','))) break;
+            str++;
+          }
+          break;
+      }
+    }
   }
 
-  *starts = motif_starts;
-  *lens = motif_lens;
+  fclose(f);
+  *sets_ptr = sets;
+  return n_sets;
 }
 
 
-BOOL find_nucleosome_states(model_def_struct *model_def, int *motif_starts, int *motif_lens, int *nuc_start, int *nuc_len) {
-  int distributor_index = model_def->silent_states_begin;
-  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
-  int end_of_last_motif = 1;
-  if (n_motifs > 0) end_of_last_motif = motif_starts[n_motifs-1] + 2*motif_lens[n_motifs-1];
+typedef struct {
+  compete_context_struct **lanes; // one per worker, each with its own clone of the model as parsed
+  sequence_struct *sequence;
+  parameter_set_struct *sets;
+  posterior_writer_struct *writer;
+  pthread_mutex_t output_lock;
+} sweep_struct;
 
-  if ((*nuc_len = distributor_index - end_of_last_motif) > 0) {
-    *nuc_start = distributor_index - *nuc_len;
-    return TRUE;
-  } else {
-    return FALSE;
-  }
-}
 
+typedef struct {
+  sweep_struct *sweep;
+  parameter_set_struct *set;
+} sweep_output_struct;
 
-int find_num_nucleosome_padding_states(model_def_struct *model_def, int nuc_start) {
-// the background states have transitions of exactly 1 leading out of them and into the next state.
-// following this along will show how many there are, plus 4 for the branched background state.
 
-  int i = nuc_start;
-  while (fetch_transition_prob(model_def, i, i + 1) == 1.0) i++;
+// the block is labelled with the options that would reproduce it
+void print_sweep_posterior(void *arg, compete_model_struct *model, sequence_struct *sequence, PROBABILITY *posterior) {
+  sweep_output_struct *output = (sweep_output_struct *)arg;
+  parameter_set_struct *set = output->set;
+  char *label = ALLOC(64 * (model->n_motifs + 4));
+  int j, len = sprintf(label, "sweep line %d: -n %g -u %g -t %g -m ", set->line, set->nuc_conc, set->unbound_conc, set->T);
 
-  return (i - nuc_start + 5);
-}
+  for (j = 0; j < model->n_motifs; j++) len += sprintf(label + len, "%s%g", j ? "," : "", set->motif_conc[j]);
 
+  pthread_mutex_lock(&output->sweep->output_lock);
+  write_posterior_block(output->sweep->writer, label, model->columns, posterior, sequence->len);
+  flush_posterior_writer(output->sweep->writer);
+  pthread_mutex_unlock(&output->sweep->output_lock);
 
-void update_a0k_probabilities(model_def_struct *model_def) {
-// I know the silent states before each motif start at model_def->silent_states_begin + 1
-// I also know that the transitions from each one of these goes to exactly two states, which are the beginning of the forward and reverse motifs respectively.  So abs(index_of_one - index_of_other) must be the length of the motifs.
-// I also know the transition probabilities from the distributor state into each of these.
-// Therefore I have the information I need to implement the updating of a_{0k} as described in my document.
+  free(label);
+}
 
-  int *motif_starts, *motif_lens;
-  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
-  int distributor_index = model_def->silent_states_begin;
-  int i, j;
-  PROBABILITY sum = 0;
 
-  find_motif_state_numbers(model_def, &motif_starts, &motif_lens);
-  // start with background component, which is only 1 long...
-  sum = fetch_transition_prob(model_def, distributor_index, 0);
-  model_def->initial_probs[0] = sum;
+void sweep_task(void *arg, int i, int worker) {
+  sweep_struct *sweep = (sweep_struct *)arg;
+  sweep_output_struct output;
 
-  for (i = 0; i < n_motifs; i++) {
-	PROBABILITY p = fetch_transition_prob(model_def, distributor_index, distributor_index + i + 1);
-	for (j = motif_starts[i]; j < motif_starts[i] + 2 * motif_lens[i]; j++) {
-	  model_def->initial_probs[j] = p;
-	  sum += p;
-	}
-  }
+  output.sweep = sweep;
+  output.set = sweep->sets + i;
+  compete_run(sweep->lanes[worker], sweep->sequence, sweep->sets + i, print_sweep_posterior, &output);
+}
 
-  // determine if nucleosome is present
-  int nuc_len = 0;
-  int nuc_start = 0;
-  if (find_nucleosome_states(model_def, motif_starts, motif_lens, &nuc_start, &nuc_len)) {
-	PROBABILITY p = fetch_transition_prob(model_def, distributor_index, nuc_start);
-	int n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
 
-	// left (normal) padding states
-	for (i = nuc_start; i < nuc_start + n_padding_states - 4; i++) {
-	  model_def->initial_probs[i] = p;
-	  sum += p;
-	}
+/* runs every parameter set against one finalized model_def, n_threads sets at a time.  each worker has its own
+   context, so the parsing and edge lists are shared by all the sets.
+*/
+void run_parameter_sweep(model_def_struct *model_def, sequence_struct *sequence, parameter_set_struct *sets, int n_sets, int n_threads, int checkpoint_interval, int *motif_starts, int *motif_lens, int nuc_start, int nuc_len, posterior_columns_struct *columns, posterior_writer_struct *writer) {
+  compete_model_struct model;
+  sweep_struct sweep;
+  long *cost;
+  int i;
 
-	// branched padding state
-	for (i = nuc_start + n_padding_states - 4; i < nuc_start + n_padding_states; i++) {
-	  model_def->initial_probs[i] = p / 4.0;
-	  sum += p / 4.0;
-	}
+  if (n_threads > n_sets) n_threads = n_sets;
+  if (n_threads < 1) n_threads = 1;
+
+  model.model_def = model_def;
+  model.owned = FALSE;
+  model.n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  model.motif_starts = motif_starts;
+  model.motif_lens = motif_lens;
+  model.nuc_present = nuc_len > 0;
+  model.nuc_start = nuc_start;
+  model.nuc_len = nuc_len;
+  model.columns = columns;
+
+  sweep.lanes = ALLOC(sizeof(compete_context_struct *) * n_threads);
+  for (i = 0; i < n_threads; i++) sweep.lanes[i] = compete_new_context(&model, checkpoint_interval);
+  sweep.sequence = sequence;
+  sweep.sets = sets;
+  sweep.writer = writer;
+  pthread_mutex_init(&sweep.output_lock, NULL);
+
+  // every set costs the same, so they start in file order
+  cost = ALLOC(sizeof(long) * n_sets);
+  for (i = 0; i < n_sets; i++) cost[i] = sequence->len;
+  run_tasks(cost, n_sets, n_threads, sweep_task, &sweep);
+
+  pthread_mutex_destroy(&sweep.output_lock);
+  for (i = 0; i < n_threads; i++) compete_free_context(sweep.lanes[i]);
+  free(sweep.lanes);
+  free(cost);
+}
 
-	// tons of nucleosome states, 16 per sequence position
-	for (i = nuc_start + n_padding_states; i < nuc_start + nuc_len - n_padding_states + 3; i++) {
-	  model_def->initial_probs[i] = p / 16.0;
-	  sum += p / 16.0;
-	}
 
-	// right branching states, all of which are normal
-	for (i = nuc_start + nuc_len - n_padding_states + 3; i < nuc_start + nuc_len; i++) {
-	  model_def->initial_probs[i] = p;
-	  sum += p;
-	}
+/* runs sequence through refresh_forward_backward(): everything, or with --resume only the positions a change of
+   the scaling factors since resume_filename was saved can reach.  the state is then saved to save_state_filename,
+   which may be the same file
+*/
+void run_with_boundary_state(model_def_struct *model_def, sequence_struct *sequence, posterior_columns_struct *columns, posterior_writer_struct *writer, int checkpoint_interval, char *save_state_filename, char *resume_filename) {
+  boundary_state_struct *state;
+  unsigned long fingerprint = run_fingerprint(model_def, sequence, columns);
+  long first = 0, last = sequence->len - 1, from, to;
+  BOOL changed = TRUE;
+
+  if (resume_filename) {
+    state = read_boundary_state(resume_filename);
+    if (state->fingerprint != fingerprint || state->len != sequence->len || state->n_states != model_def->n_states || state->n_columns != columns->n_columns) {
+      fprintf(stderr, "%s was saved for a different model, parameters, fixed states, output columns or sequence.\n", resume_filename);
+      exit(1);
+    }
+    changed = scaling_difference(state->scaling, sequence->scaling, sequence->len, &first, &last);
+  } else {
+    state = alloc_boundary_state(model_def, sequence->len, checkpoint_interval > 0 ? checkpoint_interval : default_checkpoint_interval(sequence->len), 0, columns->n_columns);
+    state->fingerprint = fingerprint;
   }
 
-  for (i = 0; i < model_def->silent_states_begin; i++) {
-	model_def->initial_probs[i] /= sum;
+  if (changed) {
+    refresh_forward_backward(model_def, sequence, state, first, last, columns, &from, &to);
+    if (resume_filename) fprintf(stderr, "Scaling factors changed at positions %ld to %ld; posteriors of %ld to %ld recomputed.\n", first + 1, last + 1, from + 1, to + 1);
+  } else {
+    fprintf(stderr, "No scaling factor changed since %s was saved.\n", resume_filename);
   }
-
-  free(motif_starts);
-  free(motif_lens);
+  write_posterior_block(writer, NULL, columns, state->posterior, sequence->len);
+
+  if (save_state_filename) {
+    // the state records the scaling it now matches, which the sequence still owns
+    free_position_scaling(state->scaling);
+    state->scaling = sequence->scaling;
+    write_boundary_state(save_state_filename, state);
+    state->scaling = NULL;
+  }
+  free_boundary_state(state);
 }
 
 
-void apply_temperature(model_def_struct *model_def, int *motif_starts, int *motif_lens, int nuc_start, int nuc_len, PROBABILITY T) {
-// T is the inverse temperature parameter, as describe in Segal's ImplementationNotes.pdf
-  int i, j, k;
+void print_training_iteration(void *arg, int iteration, double log_likelihood) {
+  FILE *output = (FILE *)arg;
 
-  // scale background emissions
-  for (i = 0; i < model_def->alphabet_length; i++) {
-    PROBABILITY p = fetch_emission_prob(model_def, 0, i);
-    set_emission_prob(model_def, 0, i, pow(p, T));
-  }
+  fprintf(output, "%d\t%.6f\n", iteration, log_likelihood);
+  fflush(output);
+}
 
-  // scale motif emissions
-  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
-  for (i = 0; i < n_motifs; i++) {
-    for (j = motif_starts[i]; j < motif_starts[i] + 2 * motif_lens[i]; j++) {
-      for (k = 0; k < model_def->alphabet_length; k++) {
-        PROBABILITY p = fetch_emission_prob(model_def, j, k);
-        set_emission_prob(model_def, j, k, pow(p, T));
+
+/* the most probable path as a segmentation: one line per element it passes through, with the 1-based first and last
+   positions, the element's name and its strand.  an element starts over wherever the path enters its first state, so
+   adjacent nucleosomes or binding sites stay apart; the unbound positions between them are merged.
+*/
+void write_viterbi_path(FILE *output, int *path, long len, double log_p, int n_motifs, int *motif_starts, int *motif_lens, char **motif_names, BOOL nuc_present, int nuc_start, int nuc_len) {
+  long pos, begin = 0;
+  int element = -1, e, j;
+  char strand = '.';
+  char name[64];
+
+  fprintf(output, "# viterbi log probability %.6f\n", log_p);
+  fprintf(output, "start\tend\telement\tstrand\n");
+
+  for (pos = 0; pos <= len; pos++) {
+    // element of the path at pos: -1 unbound, motifs 0 .. n_motifs - 1, the nucleosome n_motifs, anything else n_motifs + 1
+    BOOL starts = FALSE;
+    char s = '.';
+    if (pos == len) {
+      e = -2;
+    } else if (path[pos] == 0) {
+      e = -1;
+    } else if (nuc_present && path[pos] >= nuc_start && path[pos] < nuc_start + nuc_len) {
+      e = n_motifs;
+      starts = path[pos] == nuc_start;
+    } else {
+      e = n_motifs + 1;
+      for (j = 0; j < n_motifs; j++) {
+        if (path[pos] >= motif_starts[j] && path[pos] < motif_starts[j] + 2 * motif_lens[j]) {
+          e = j;
+          s = path[pos] < motif_starts[j] + motif_lens[j] ? '+' : '-';
+          starts = path[pos] == motif_starts[j] || path[pos] == motif_starts[j] + motif_lens[j];
+        }
       }
     }
+
+    if (pos > 0 && (e != element || s != strand || starts)) {
+      if (element == -1) strcpy(name, "background");
+      else if (element == n_motifs) strcpy(name, "nucleosome");
+      else if (element == n_motifs + 1) strcpy(name, "other");
+      else if (motif_names) strcpy(name, motif_names[element]);
+      else sprintf(name, "motif_%d", element);
+      fprintf(output, "%ld\t%ld\t%s\t%c\n", begin + 1, pos, name, strand);
+      begin = pos;
+    }
+    element = e;
+    strand = s;
   }
+}
 
 
-  // scale nucleosome emissions/transitions
-  if (nuc_start > 0) {
-    int n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
+typedef struct {
+  posterior_writer_struct *writer;
+  posterior_columns_struct *columns;
+  sequence_struct **sequence;
+  posterior_outputs_struct *outputs;  // --outputs or --counts, in place of writer
+  sequence_region_struct *regions;
+} batch_output_struct;
 
-    // number of bases/positions in the actual nucleosome; ideally 147 but practically less due to data limitations; padding on the right is 3 shorter than the left, since there's no branched bg state
-    int n_nuc_pos = (nuc_len - (2 * n_padding_states - 3)) / 16;
 
-    // normal background states in the beginning of the padding
-    for (i = nuc_start; i < nuc_start + n_padding_states - 4; i++) {
-      for (j = 0; j < model_def->alphabet_length; j++) {
-        PROBABILITY p = fetch_emission_prob(model_def, i, j);
-        set_emission_prob(model_def, i, j, pow(p, T));
-      }
-    }
+// with several sequences, each one's block of output is labelled with which one it is
+void print_batch_posterior(void *arg, int seq_index, PROBABILITY *posterior) {
+  batch_output_struct *batch = (batch_output_struct *)arg;
 
-    // normal background states at the end of the padding
-    for (i = nuc_start + nuc_len - (n_padding_states - 3); i < nuc_start + nuc_len; i++) {
-      for (j = 0; j < model_def->alphabet_length; j++) {
-        PROBABILITY p = fetch_emission_prob(model_def, i, j);
-        set_emission_prob(model_def, i, j, pow(p, T));
-      }
-    }
+  char label[64];
 
-    // transitions into branched background state's 4 branches
-    for (i = nuc_start + n_padding_states - 4; i < nuc_start + n_padding_states; i++) {
-      PROBABILITY p = fetch_transition_prob(model_def, nuc_start + n_padding_states - 5, i);
-      set_transition_prob(model_def, nuc_start + n_padding_states - 5, i, pow(p, T));
-    }
+  sprintf(label, "seq_filenames line %d, %ld positions", seq_index + 1, batch->sequence[seq_index]->len);
+  if (batch->outputs) {
+    write_posterior_outputs(batch->outputs, label, batch->regions[seq_index].name, batch->regions[seq_index].begin, posterior, batch->sequence[seq_index]->len);
+    return;
+  }
+  write_posterior_block(batch->writer, label, batch->columns, posterior, batch->sequence[seq_index]->len);
+  flush_posterior_writer(batch->writer);
+}
 
-    // handle the transitions from the branched background state into the first nucleosome states
-    for (i = nuc_start + n_padding_states - 4; i < nuc_start + n_padding_states; i++) {
-      for (j = nuc_start + n_padding_states; j < nuc_start + n_padding_states + 16; j++) {
-        PROBABILITY p = fetch_transition_prob(model_def, i, j);
-        set_transition_prob(model_def, i, j, pow(p, T));
-      }
-    }
 
-    // handle the transitions between nucleosome states
-    for (i = 0; i < n_nuc_pos - 1; i++) {
-      for (j = nuc_start + n_padding_states + 16 * i; j < nuc_start + n_padding_states + 16 * (i + 1); j++) {
-        for (k = nuc_start + n_padding_states + 16 * (i + 1); k < nuc_start + n_padding_states + 16 * (i + 2); k++) {
-          PROBABILITY p = fetch_transition_prob(model_def, j, k);
-          set_transition_prob(model_def, j, k, pow(p, T));
-        }
-      }
-    }
+/* parses -f's from-to:state[,...] list.  each state names the element it begins (0 for unbound, the nucleosome's
+   first state, or a motif's forward first state) and is widened to all of that element's states, both strands of a
+   motif, so a pinned position can be anywhere inside it.  any other state is pinned by itself.
+*/
+int parse_fixed_states(char *str, model_def_struct *model_def, int *motif_starts, int *motif_lens, int n_motifs, BOOL nuc_present, int nuc_start, int nuc_len, fixed_states_struct **fixed_states) {
+  int n = 0, allocated = 8, i;
+  char *token, *saveptr = NULL;
 
-  }
-}
+  *fixed_states = ALLOC(sizeof(fixed_states_struct) * allocated);
+  for (token = strtok_r(str, ",", &saveptr); token; token = strtok_r(NULL, ",", &saveptr)) {
+    long from, to;
+    int state;
+    state_range_struct *range;
 
+    if (sscanf(token, "%ld-%ld:%d", &from, &to, &state) != 3 || from < 1 || to < from || state < 0 || state >= model_def->silent_states_begin) {
+      fprintf(stderr, "Malformed fixed state \"%s\", expected from-to:state with 1 <= from <= to and a normal state.\n", token);
+      exit(1);
+    }
+    if (n == allocated) {
+      allocated *= 2;
+      *fixed_states = realloc(*fixed_states, sizeof(fixed_states_struct) * allocated);
+    }
 
-PROBABILITY posterior_over_range(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *b_table, PROBABILITY *sb, PROBABILITY *sr, int pos, int from, int to) {
-  int i;
-  PROBABILITY sum = 0;
+    range = ALLOC(sizeof(state_range_struct));
+    range->state_from = range->state_to = state;
+    range->next_range = NULL;
+    if (nuc_present && state == nuc_start) {
+      range->state_to = nuc_start + nuc_len - 1;
+    } else {
+      for (i = 0; i < n_motifs; i++) {
+        if (state == motif_starts[i]) range->state_to = motif_starts[i] + 2 * motif_lens[i] - 1;
+      }
+    }
+    // a lone state inside an element can't hold for more than one position, so every row would come out empty
+    if (state != 0 && range->state_to == state) {
+      fprintf(stderr, "Fixed state \"%s\" is not the first state of an element: 0 for unbound, or the nucleosome's or a motif's first state.\n", token);
+      exit(1);
+    }
 
-  for (i = from; i <= to; i++) {
-    sum += posterior_decoding(model_def, sequence, f_table, b_table, sb, sr, pos, i);
+    (*fixed_states)[n].position_from = from - 1;
+    (*fixed_states)[n].position_to = to - 1;
+    (*fixed_states)[n].state_ranges = range;
+    n++;
   }
 
-  return sum;
+  return n;
 }
 
 
-void posterior_output_summed_states(model_def_struct *model_def, sequence_struct *sequence, PROBABILITY *f_table, PROBABILITY *b_table, PROBABILITY *sb, PROBABILITY *sr, int *motif_starts, int *motif_lens, char **motif_names, BOOL output_start_probs_only) {
-  int i, j, k;
-  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
-  int nuc_start, nuc_len, n_padding_states;
-  BOOL nuc_present = FALSE;
+static const char *output_group_names[N_OUTPUT_GROUPS] = {"occupancy", "starts", "padding", "nucleosome"};
 
-  if (nuc_present = find_nucleosome_states(model_def, motif_starts, motif_lens, &nuc_start, &nuc_len)) {
-//    n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
-    n_padding_states = 5;
-  }
 
-  // print header
-  fprintf(model_def->output, "background");
-  if (!motif_names) {
-    for (j = 0; j < n_motifs; j++) {
-      fprintf(model_def->output, "\tmotif_%d", j);
+/* parses --outputs' group[=file][,...] list into the order build_output_columns() lays the groups out in: those
+   without a file first, since they're written to output_file as one table, then each of the others.  with counts,
+   the start groups --counts sums are added last (written nowhere) unless asked for.  returns the number of groups;
+   files[g] is NULL for the ones that go to output_file, *n_main of them
+*/
+int parse_outputs(char *str, BOOL counts, BOOL nuc_present, int *groups, char **files, int *n_main) {
+  int listed[N_OUTPUT_GROUPS], n_listed = 0, n = 0, g, i;
+  char *listed_files[N_OUTPUT_GROUPS], *token, *saveptr = NULL, *file;
+  BOOL asked[N_OUTPUT_GROUPS];
+
+  memset(asked, 0, sizeof(asked));
+  for (token = str ? strtok_r(str, ",", &saveptr) : NULL; token; token = strtok_r(NULL, ",", &saveptr)) {
+    if ((file = strchr(token, '='))) *file++ = '\0';
+    for (g = 0; g < N_OUTPUT_GROUPS && strcmp(token, output_group_names[g]) != 0; g++);
+    if (g == N_OUTPUT_GROUPS || asked[g] || (file && !*file)) {
+      fprintf(stderr, "Bad output \"%s\", expected each of occupancy, starts, padding or nucleosome at most once, with =file or without.\n", token);
+      exit(1);
     }
-  } else {
-    for (j = 0; j < n_motifs; j++) {
-      fprintf(model_def->output, "\t%s", motif_names[j]);
+    if ((g == OUTPUT_PADDING || g == OUTPUT_NUCLEOSOME) && !nuc_present) {
+      fprintf(stderr, "The model has no nucleosome for --outputs %s.\n", token);
+      exit(1);
     }
+    asked[g] = TRUE;
+    listed[n_listed] = g;
+    listed_files[n_listed++] = file;
   }
-  if (nuc_present) fprintf(model_def->output, "\tnuc_padding\tnucleosome");
-  fprintf(model_def->output, "\n");
 
-  for (i = 0; i < sequence->len; i++) {
-    fprintf(model_def->output, "%.20f\t", posterior_decoding(model_def, sequence, f_table, b_table, sb, sr, i, 0));
+  *n_main = 0;
+  for (i = 0; i < n_listed; i++) {
+    if (listed_files[i]) continue;
+    groups[n] = listed[i];
+    files[n++] = NULL;
+    (*n_main)++;
+  }
+  for (i = 0; i < n_listed; i++) {
+    if (!listed_files[i]) continue;
+    groups[n] = listed[i];
+    files[n++] = listed_files[i];
+  }
+  if (counts && !asked[OUTPUT_STARTS]) {
+    groups[n] = OUTPUT_STARTS;
+    files[n++] = NULL;
+  }
+  if (counts && nuc_present && !asked[OUTPUT_NUCLEOSOME]) {
+    groups[n] = OUTPUT_NUCLEOSOME;
+    files[n++] = NULL;
+  }
 
-    for (j = 0; j < n_motifs; j++) {
-      PROBABILITY sum = 0;
-      if (!output_start_probs_only) {
-        sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, motif_starts[j], motif_starts[j] + motif_lens[j] - 1);
-        sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, motif_starts[j] + motif_lens[j], motif_starts[j] + 2 * motif_lens[j] - 1);
-      } else {
-        sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, motif_starts[j], motif_starts[j]);
-        sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, motif_starts[j] + motif_lens[j], motif_starts[j] + motif_lens[j]);
-      }
-      if (j < n_motifs - 1) {
-        fprintf(model_def->output, "%.20f\t", sum);
-      } else {
-        fprintf(model_def->output, "%.20f", sum);
-      }
-    }
+  return n;
+}
 
-    if (nuc_present) {
-      PROBABILITY sum = 0;
 
-      // calculate nuc_padding prob
-      sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, nuc_start, nuc_start + n_padding_states - 1);
-      sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, nuc_start + nuc_len - n_padding_states, nuc_start + nuc_len - 1);
-      fprintf(model_def->output, "\t%.20f", sum);
+/* the sinks of parse_outputs()' groups, the ones without a file sharing writer, and the counts of counts_str
+   (intervals.bed[=file]), which go to output if no file is given
+*/
+posterior_outputs_struct *open_posterior_outputs(posterior_columns_struct *columns, int n_groups, int *groups, char **files, int *first_column, int n_main, char *counts_str, posterior_writer_struct *writer, FILE *output, int n_motifs, int output_format, int output_precision, PROBABILITY output_threshold) {
+  posterior_outputs_struct *outputs = ALLOC(sizeof(posterior_outputs_struct));
+  interval_counts_struct *counts;
+  char *file;
+  int g, j, starts = -1, nucleosome = -1;
+
+  outputs->columns = columns;
+  outputs->n_sinks = 0;
+  outputs->sinks = ALLOC(sizeof(posterior_sink_struct) * (n_groups + 1));
+  outputs->counts = NULL;
+  if (n_main > 0) {
+    outputs->sinks[0].first_column = first_column[0];
+    outputs->sinks[0].n_columns = first_column[n_main] - first_column[0];
+    outputs->sinks[0].writer = writer;
+    outputs->sinks[0].file = NULL;
+    outputs->n_sinks++;
+  }
+  for (g = 0; g < n_groups; g++) {
+    if (groups[g] == OUTPUT_STARTS && starts < 0) starts = first_column[g];
+    if (groups[g] == OUTPUT_NUCLEOSOME && nucleosome < 0) nucleosome = first_column[g];
+    if (!files[g]) continue;
+
+    posterior_sink_struct *sink = outputs->sinks + outputs->n_sinks++;
+    if (!(sink->file = fopen(files[g], "w"))) {
+      fprintf(stderr, "Opening %s for writing failed.\n", files[g]);
+      exit(1);
+    }
+    sink->first_column = first_column[g];
+    sink->n_columns = first_column[g + 1] - first_column[g];
+    sink->writer = open_posterior_writer(sink->file, output_format, output_precision, output_threshold);
+  }
 
-      // calculate nucleosome prob
-      sum = 0;
-      if (!output_start_probs_only) {
-        sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, nuc_start + n_padding_states, nuc_start + nuc_len - n_padding_states - 1);
-      } else {
-        sum += posterior_over_range(model_def, sequence, f_table, b_table, sb, sr, i, nuc_start + n_padding_states, nuc_start + n_padding_states);
+  if (counts_str) {
+    counts = outputs->counts = ALLOC(sizeof(interval_counts_struct));
+    memset(counts, 0, sizeof(interval_counts_struct));
+    if ((file = strchr(counts_str, '='))) *file++ = '\0';
+    if (!read_count_intervals(counts_str, counts)) exit(1);
+    if (file && *file) {
+      if (!(counts->file = fopen(file, "w"))) {
+        fprintf(stderr, "Opening %s for writing failed.\n", file);
+        exit(1);
       }
-      fprintf(model_def->output, "\t%.20f", sum);
+      counts->owned = TRUE;
+    } else if (n_main > 0) {
+      fprintf(stderr, "--counts needs =file when --outputs writes posteriors to output_file too.\n");
+      exit(1);
+    } else {
+      counts->file = output;
     }
 
-    fprintf(model_def->output, "\n");
+    // each motif's starts on both strands, then the nucleosome's, the starts group naming them <name>+ and <name>-
+    counts->n_counts = n_motifs + (nucleosome >= 0 ? 1 : 0);
+    counts->names = ALLOC(sizeof(char *) * counts->n_counts);
+    counts->columns = ALLOC(sizeof(int) * 2 * counts->n_counts);
+    for (j = 0; j < n_motifs; j++) {
+      counts->names[j] = strdup(columns->names[starts + 2 * j]);
+      counts->names[j][strlen(counts->names[j]) - 1] = '\0';
+      counts->columns[2 * j] = starts + 2 * j;
+      counts->columns[2 * j + 1] = starts + 2 * j + 1;
+    }
+    if (nucleosome >= 0) {
+      counts->names[n_motifs] = strdup("nucleosome");
+      counts->columns[2 * n_motifs] = nucleosome;
+      counts->columns[2 * n_motifs + 1] = -1;
+    }
   }
+
+  return outputs;
 }
 
 
 void print_usage(char **argv) {
   fprintf(stderr, "usage: %s [options] model_file seq_file local_conc_scale_file\n", basename(argv[0]));
+  fprintf(stderr, "  local_conc_scale_file has one block of positions per seq_file line, in order, adding up to every sequence\n");
   fprintf(stderr, "  -n  nucleosome_concentration (float)\n");
   fprintf(stderr, "  -m  motif_concentrations (comma delimited string of floats)\n");
   fprintf(stderr, "  -N  motif_labels (comma delimited string of strings, for output file column headers)\n");
   fprintf(stderr, "  -u  unbound_concentration (float)\n");
   fprintf(stderr, "  -t  inverse_temperature (float)\n");
+  fprintf(stderr, "  -f  fixed_states (from-to:state[,from-to:state...]): pin positions from-to (1-based, inclusive) to the element\n");
+  fprintf(stderr, "      whose first state is state (0 unbound, or the nucleosome's or a motif's first state)\n");
   fprintf(stderr, "  -s  output only probabilities of starting each DBF per postion\n");
+  fprintf(stderr, "      --outputs group[=file][,...]: write these from the one pass, each group to its file or, without one, to\n");
+  fprintf(stderr, "          output_file as one table: occupancy (the default columns), starts (each motif's, by strand), padding\n");
+  fprintf(stderr, "          (nuc_padding) and nucleosome (nucleosome_start and nucleosome_dyad)\n");
+  fprintf(stderr, "      --counts intervals.bed[=file]: also write each DBF's expected number of sites in each interval, to file or,\n");
+  fprintf(stderr, "          if no --outputs group goes there, to output_file\n");
+  fprintf(stderr, "  -P  profile: at exit, write per phase times and counters to stderr as one line of JSON\n");
+  fprintf(stderr, "  -V  instead of posteriors, write the most probable path through the model, one line per element it passes\n");
+  fprintf(stderr, "  -c  checkpointed forward-backward: keep only every k-th forward row, memory grows with sqrt(sequence length)\n");
+  fprintf(stderr, "  -k  checkpoint_interval (int, implies -c; default is sqrt(sequence length)), also that of -V\n");
+  fprintf(stderr, "  -p  threads (int): split the sequence into this many chunks run in parallel, 0 for one per CPU\n");
+  fprintf(stderr, "      with several sequences in seq_file, the number run at once (default one per CPU)\n");
+  fprintf(stderr, "  -w  window_length (int): run the sequence as overlapping windows of this many positions, -p of them at a time\n");
+  fprintf(stderr, "  -o  window_overlap (int, default %d): positions added to either side of each window, and discarded\n", DEFAULT_WINDOW_OVERLAP);
+  fprintf(stderr, "  -S  sweep_file: run every parameter set in this table (columns n, u, t, m) against the one model, -p at a time\n");
+  fprintf(stderr, "  -O  output_format: text (default), compact[:precision, default %d], binary (float32) or sparse[:threshold, default %g]\n", DEFAULT_COMPACT_PRECISION, DEFAULT_SPARSE_THRESHOLD);
+  fprintf(stderr, "      --compile-model model.bin: instead of running, write model_file in the binary format compete maps at startup\n");
+  fprintf(stderr, "      --precision float|double: storage of the forward table (default double); float rows are still computed in double\n");
+  fprintf(stderr, "      --train model.bin: instead of posteriors, reestimate the model on the sequences in seq_file (Baum-Welch, -p at a\n");
+  fprintf(stderr, "          time) and write it in the compiled format; --iterations (default %d) and --tolerance (default %g) stop it\n", DEFAULT_TRAIN_ITERATIONS, DEFAULT_TRAIN_TOLERANCE);
+  fprintf(stderr, "      --save-state state.bin: also keep checkpointed forward and backward rows, scale factors and posteriors in state.bin\n");
+  fprintf(stderr, "      --resume state.bin: start from a saved state, recomputing only what changed scaling factors reach\n");
+  fprintf(stderr, "      --mem-limit bytes (K, M, G or T suffix): pick the engine and threads (up to -p) that fit, or refuse to run;\n");
+  fprintf(stderr, "          -c/-k and -w are kept and only checked against it\n");
+  fprintf(stderr, "      --cache dir: keep each run's posteriors and boundary state in dir; a later run of the same model and parameters\n");
+  fprintf(stderr, "          over the same region is served from it, and over an overlapping one only runs what the new ends reach\n");
+  fprintf(stderr, "      --huge-pages: back forward and backward tables and checkpoint rows of 2 MB or more with transparent huge pages\n");
+  fprintf(stderr, "      --dry-run: instead of running, write the engine that would run and its estimated memory use\n");
+  fprintf(stderr, "      --specialize: generate the row loops for this model's topology, compile them with $CC (or cc) and run them;\n");
+  fprintf(stderr, "          kernels are cached by topology in $COMPETE_KERNEL_CACHE (default ~/.cache/compete)\n");
+  fprintf(stderr, "      --duration: run each motif strand as one transition scored by its PWM over the window, not state by state\n");
+  fprintf(stderr, "      --plan-shards manifest.tsv: instead of running, split every seq_file region and -S parameter set into units of\n");
+  fprintf(stderr, "          work of -w positions (plus -o on either side), or of about --shard-cost (default %g) states times positions\n", DEFAULT_SHARD_COST);
+  fprintf(stderr, "      --run-shard unit|all manifest.tsv parts_dir: run one unit of a manifest (or all without a result yet) into parts_dir\n");
+  fprintf(stderr, "      --merge-shards manifest.tsv parts_dir [output_file]: stitch the units' results into the output of a whole run\n");
+  fprintf(stderr, "      --pack-sequence store.pack: instead of running, pack the FASTA (or chr/) files given into a 2-bit sequence store;\n");
+  fprintf(stderr, "          seq_file lines can then name store.pack:record\n");
+  fprintf(stderr, "      --pack-scaling scaling.bin: instead of running, convert the local_conc_scale_file given to the columnar binary format\n");
   fprintf(stderr, "\nexample: %s -n 1.0 -m 0.01,0.1,0.01 -u 1.0 -t 2.0 model.cfg seq_filenames.txt conc_scale.csv > output.txt\n", basename(argv[0]));
 }
 
 
-void parse_opts(int argc, char **argv, PROBABILITY *nuc_conc, PROBABILITY *unbound_conc, PROBABILITY *motif_conc, PROBABILITY *T, char **motif_names, char *fixed_states_str, BOOL *output_start_probs_only) {
+// compete's command line.  parse_opts() sets every default, then the options given
+typedef struct {
+  parameter_set_struct parameters;  // -n, -u, -t and -m
+  char **motif_names;               // -N, 256 entries; main() frees them and sets NULL if none were given
+  char *fixed_states_str;           // -f
+  BOOL output_start_probs_only;     // -s
+  BOOL checkpointed;                // -c, or -k
+  int checkpoint_interval;          // -k, 0 for the default
+  int n_threads;                    // -p, 0 when not given
+  long window, overlap;             // -w and -o
+  char *sweep_filename;             // -S
+  int output_format, output_precision;  // -O
+  PROBABILITY output_threshold;
+  BOOL viterbi_path;                // -V
+  BOOL profile;                     // -P
+  char *compile_filename, *pack_filename, *scaling_filename;  // --compile-model, --pack-sequence and --pack-scaling
+  int table_precision;              // --precision
+  char *train_filename;             // --train, with --iterations and --tolerance
+  int train_iterations;
+  PROBABILITY train_tolerance;
+  char *save_state_filename, *resume_filename;  // --save-state and --resume
+  size_t mem_limit;                 // --mem-limit, 0 for none
+  BOOL dry_run;                     // --dry-run
+  char *plan_shards_filename;       // --plan-shards, with --shard-cost
+  double shard_cost;
+  char *run_shard;                  // --run-shard
+  BOOL merge;                       // --merge-shards
+  BOOL specialize, duration;        // --specialize and --duration
+  char *cache_dir;                  // --cache
+  BOOL huge;                        // --huge-pages
+  char *outputs_str, *counts_str;   // --outputs and --counts
+} options_struct;
+
+
+void parse_opts(int argc, char **argv, options_struct *options) {
+  static struct option long_options[] = {
+    {"compile-model", required_argument, NULL, 'C'},
+    {"pack-sequence", required_argument, NULL, 'K'},
+    {"pack-scaling", required_argument, NULL, 'F'},
+    {"precision", required_argument, NULL, 'R'},
+    {"train", required_argument, NULL, 'T'},
+    {"iterations", required_argument, NULL, 'I'},
+    {"tolerance", required_argument, NULL, 'D'},
+    {"save-state", required_argument, NULL, 'W'},
+    {"resume", required_argument, NULL, 'Z'},
+    {"mem-limit", required_argument, NULL, 'M'},
+    {"dry-run", no_argument, NULL, 'Y'},
+    {"plan-shards", required_argument, NULL, 'G'},
+    {"shard-cost", required_argument, NULL, 'E'},
+    {"run-shard", required_argument, NULL, 'H'},
+    {"merge-shards", no_argument, NULL, 'J'},
+    {"specialize", no_argument, NULL, 'X'},
+    {"duration", no_argument, NULL, 'U'},
+    {"cache", required_argument, NULL, 'A'},
+    {"huge-pages", no_argument, NULL, 'L'},
+    {"outputs", required_argument, NULL, 'B'},
+    {"counts", required_argument, NULL, 'b'},
+    {"help", no_argument, NULL, 'h'},
+    {NULL, 0, NULL, 0}
+  };
   int opt, i;
   char *str, *token;
 
-  while ((opt = getopt(argc, argv, "n:m:u:t:hN:s")) > 0) {
+  options->parameters.nuc_conc = 1.0;
+  options->parameters.unbound_conc = 1.0;
+  options->parameters.T = 1.0;
+  // the number of motifs isn't known before the model is read, so room for at most 256
+  options->parameters.motif_conc = ALLOC(sizeof(PROBABILITY) * 256);
+  for (i = 0; i < 256; i++) options->parameters.motif_conc[i] = 0.01;
+  options->parameters.line = 0;
+  options->motif_names = ALLOC(sizeof(char *) * 256);
+  memset(options->motif_names, 0, sizeof(char *) * 256);
+  options->fixed_states_str = NULL;
+  options->output_start_probs_only = FALSE;
+  options->checkpointed = FALSE;
+  options->checkpoint_interval = 0;
+  options->n_threads = 0;
+  options->window = 0;
+  options->overlap = DEFAULT_WINDOW_OVERLAP;
+  options->sweep_filename = NULL;
+  options->output_format = OUTPUT_TEXT;
+  options->output_precision = DEFAULT_COMPACT_PRECISION;
+  options->output_threshold = DEFAULT_SPARSE_THRESHOLD;
+  options->viterbi_path = FALSE;
+  options->profile = FALSE;
+  options->compile_filename = options->pack_filename = options->scaling_filename = NULL;
+  options->table_precision = TABLE_DOUBLE;
+  options->train_filename = NULL;
+  options->train_iterations = DEFAULT_TRAIN_ITERATIONS;
+  options->train_tolerance = DEFAULT_TRAIN_TOLERANCE;
+  options->save_state_filename = options->resume_filename = NULL;
+  options->mem_limit = 0;
+  options->dry_run = FALSE;
+  options->plan_shards_filename = NULL;
+  options->shard_cost = DEFAULT_SHARD_COST;
+  options->run_shard = NULL;
+  options->merge = FALSE;
+  options->specialize = FALSE;
+  options->duration = FALSE;
+  options->cache_dir = NULL;
+  options->huge = FALSE;
+  options->outputs_str = options->counts_str = NULL;
+
+  while ((opt = getopt_long(argc, argv, "n:m:u:t:hN:f:sck:p:w:o:S:O:VP", long_options, NULL)) > 0) {
     switch (opt) {
       case 'n':
-        *nuc_conc = atof(optarg);
+        options->parameters.nuc_conc = atof(optarg);
         break;
       case 'u':
-        *unbound_conc = atof(optarg);
+        options->parameters.unbound_conc = atof(optarg);
         break;
       case 't':
-        *T = atof(optarg);
+        options->parameters.T = atof(optarg);
         break;
       case 'm':
         for (i = 0, str = optarg; ; i++, str = NULL) {
           token = strtok(str, ",");
           if (token == NULL) break;
-          motif_conc[i] = atof(token);
+          options->parameters.motif_conc[i] = atof(token);
         }
         break;
       case 'N':
         for (i = 0, str = optarg; ; i++, str = NULL) {
           token = strtok(str, ",");
           if (token == NULL) break;
-          motif_names[i] = ALLOC(strlen(token) * sizeof(char));
-          strcpy(motif_names[i], token);
+          options->motif_names[i] = ALLOC(strlen(token) * sizeof(char));
+          strcpy(options->motif_names[i], token);
         }
         break;
+      case 'f':
+        options->fixed_states_str = optarg;
+        break;
       case 's':
-        *output_start_probs_only = TRUE;
+        options->output_start_probs_only = TRUE;
+        break;
+      case 'c':
+        options->checkpointed = TRUE;
+        break;
+      case 'V':
+        options->viterbi_path = TRUE;
+        break;
+      case 'P':
+        options->profile = TRUE;
+        break;
+      case 'k':
+        options->checkpointed = TRUE;
+        options->checkpoint_interval = atoi(optarg);
+        break;
+      case 'p':
+        options->n_threads = atoi(optarg);
+        if (options->n_threads <= 0) options->n_threads = find_num_cpus();
+        break;
+      case 'w':
+        options->window = atol(optarg);
+        break;
+      case 'o':
+        options->overlap = atol(optarg);
+        break;
+      case 'S':
+        options->sweep_filename = optarg;
+        break;
+      case 'C':
+        options->compile_filename = optarg;
+        break;
+      case 'K':
+        options->pack_filename = optarg;
+        break;
+      case 'F':
+        options->scaling_filename = optarg;
+        break;
+      case 'T':
+        options->train_filename = optarg;
+        break;
+      case 'I':
+        options->train_iterations = atoi(optarg);
+        break;
+      case 'D':
+        options->train_tolerance = atof(optarg);
+        break;
+      case 'W':
+        options->save_state_filename = optarg;
+        break;
+      case 'Z':
+        options->resume_filename = optarg;
+        break;
+      case 'M':
+        if ((options->mem_limit = parse_byte_count(optarg)) == 0) {
+          fprintf(stderr, "Bad memory limit \"%s\", expected bytes with an optional K, M, G or T suffix.\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'Y':
+        options->dry_run = TRUE;
+        break;
+      case 'G':
+        options->plan_shards_filename = optarg;
+        break;
+      case 'E':
+        if ((options->shard_cost = atof(optarg)) <= 0) {
+          fprintf(stderr, "Bad shard cost \"%s\", expected a positive number.\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'H':
+        options->run_shard = optarg;
+        break;
+      case 'J':
+        options->merge = TRUE;
+        break;
+      case 'X':
+        options->specialize = TRUE;
+        break;
+      case 'U':
+        options->duration = TRUE;
+        break;
+      case 'A':
+        options->cache_dir = optarg;
+        break;
+      case 'L':
+        options->huge = TRUE;
+        break;
+      case 'B':
+        options->outputs_str = optarg;
+        break;
+      case 'b':
+        options->counts_str = optarg;
+        break;
+      case 'R':
+        if (strcmp(optarg, "double") == 0) options->table_precision = TABLE_DOUBLE;
+        else if (strcmp(optarg, "float") == 0) options->table_precision = TABLE_FLOAT;
+        else {
+          fprintf(stderr, "Unknown precision \"%s\", expected float or double.\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'O':
+        if (!parse_output_format(optarg, &options->output_format, &options->output_precision, &options->output_threshold)) {
+          fprintf(stderr, "Unknown output format \"%s\".\n", optarg);
+          exit(1);
+        }
         break;
 
       case '?':
@@ -401,14 +799,12 @@ void parse_opts(int argc, char **argv, PROBABILITY *nuc_conc, PROBABILITY *unbou
 int main(int argc, char **argv) {
   model_def_struct *model_def;
   sequence_struct **sequence;
-  int n_seqs = 0, i, j;
-  PROBABILITY **f_table, **b_table, **sf, **sb, **sr;
-  PROBABILITY T = 1.0;
-  PROBABILITY nuc_conc = 1.0, unbound_conc = 1.0, *motif_conc;
-  char **motif_names;
+  int n_seqs = 0, i;
+  PROBABILITY **f_table, **sf;
+  options_struct options;
   BOOL nuc_present = FALSE;
-  int n_fixed_states;
-  int *fixed_states;
+  int n_fixed_states = 0;
+  fixed_states_struct *fixed_states = NULL;
 
 
   if (argc < 3) {
@@ -416,39 +812,197 @@ int main(int argc, char **argv) {
     return 0;
   }
 
-  motif_conc = ALLOC(sizeof(PROBABILITY) * 256); // I need to know the number of motifs before parsing, but I can't (easily), so for now I guess a max
-  for (i = 0; i < 256; i++) motif_conc[i] = 0.01;
-  motif_names = ALLOC(sizeof(char*) * 256); // I need to know the number of motifs before parsing, but I can't (easily), so for now I guess a max
-  memset(motif_names, 0, sizeof(char*) * 256);
+  parse_opts(argc, argv, &options);
+  if (options.profile) enable_profiling();
+  if (options.huge) enable_huge_pages();
+
+  if (options.pack_filename) {
+    // compete --pack-sequence genome.pack genome.fa ...: nothing to run, just pack
+    if (optind >= argc) {
+      print_usage(argv);
+      exit(1);
+    }
+    write_sequence_store(options.pack_filename, argv + optind, argc - optind);
+    return 0;
+  }
+
+  if (options.scaling_filename) {
+    // compete --pack-scaling scaling.bin scaling.tsv
+    if (argc - optind != 1) {
+      print_usage(argv);
+      exit(1);
+    }
+    write_scaling_file(argv[optind], options.scaling_filename);
+    return 0;
+  }
 
-  // I'll leave the fixed state logic in here under the hood, but I've removed the interface to it to reduce confusion in these releases
-  char fixed_states_str[256] = {'\0'};
-  BOOL output_start_probs_only = FALSE;
-  parse_opts(argc, argv, &nuc_conc, &unbound_conc, motif_conc, &T, motif_names, fixed_states_str, &output_start_probs_only);
+  if (options.compile_filename) {
+    // compete --compile-model model.bin model.cfg: nothing to run, just convert
+    if (optind >= argc) {
+      print_usage(argv);
+      exit(1);
+    }
+    model_def = initialize_model(argv[optind], NULL, 0);
+    write_compiled_model(model_def, options.compile_filename);
+    free_model(model_def);
+    return 0;
+  }
 
-  if (motif_names[0] == 0) {  // if -N wasn't on the command line, free this up so the output routine doesn't try to use it later
-    free(motif_names);
-    motif_names = NULL;
+  if (options.motif_names[0] == 0) {  // if -N wasn't on the command line, free this up so the output routine doesn't try to use it later
+    free(options.motif_names);
+    options.motif_names = NULL;
+  }
+
+  if (options.run_shard || options.merge) {
+    // compete --run-shard unit|all manifest.tsv parts_dir, or compete --merge-shards manifest.tsv parts_dir [output_file]
+    if (argc - optind < 2 || argc - optind > (options.merge ? 3 : 2) || (options.run_shard && options.merge)) {
+      print_usage(argv);
+      exit(1);
+    }
+    shard_manifest_struct *manifest = read_shard_manifest(argv[optind]);
+    char *parts_dir = argv[optind + 1];
+    int missing = 0;
+
+    if (options.run_shard) {
+      int unit = atoi(options.run_shard);
+      if (strcmp(options.run_shard, "all") != 0 && (unit < 0 || unit >= manifest->n_units)) {
+        fprintf(stderr, "There is no unit %s in %s, which has %d.\n", options.run_shard, argv[optind], manifest->n_units);
+        exit(1);
+      }
+      // every unit's columns are the ones the manifest was planned with
+      if (options.motif_names || options.output_start_probs_only) {
+        fprintf(stderr, "-N and -s are recorded in %s by --plan-shards, and cannot be given to --run-shard.\n", argv[optind]);
+        exit(1);
+      }
+      compete_model_struct *model = compete_load_model(manifest->model_filename, manifest->motif_names, manifest->start_probs_only);
+      if (options.specialize) specialize_model(model->model_def);
+      int interval = !options.checkpointed ? 0 : (options.checkpoint_interval > 0 ? options.checkpoint_interval : -1);
+      if (strcmp(options.run_shard, "all") == 0) {
+        for (i = 0; i < manifest->n_units; i++) run_shard_unit(manifest, i, parts_dir, model, interval);
+      } else {
+        run_shard_unit(manifest, unit, parts_dir, model, interval);
+      }
+      compete_free_model(model);
+    } else {
+      FILE *output = stdout;
+      if (argc - optind > 2 && !(output = fopen(argv[optind + 2], "w"))) {
+        fprintf(stderr, "Opening %s for writing failed.\n", argv[optind + 2]);
+        exit(1);
+      }
+      posterior_writer_struct *writer = open_posterior_writer(output, options.output_format, options.output_precision, options.output_threshold);
+      missing = merge_shards(manifest, parts_dir, writer);
+      close_posterior_writer(writer);
+      if (output != stdout) fclose(output);
+      if (missing > 0) fprintf(stderr, "%d of %d units have no partial result in %s.\n", missing, manifest->n_units, parts_dir);
+    }
+
+    free_shard_manifest(manifest);
+    return missing > 0 ? 1 : 0;
+  }
+
+  if (options.plan_shards_filename) {
+    // compete --plan-shards manifest.tsv model_file seq_file local_conc_scale_file: nothing to run, just split
+    if (argc - optind != 3) {
+      print_usage(argv);
+      exit(1);
+    }
+    model_def = initialize_model(argv[optind], NULL, 0);
+    int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+    parameter_set_struct *sets = &options.parameters;
+    int n_sets = 1;
+    if (options.sweep_filename) n_sets = read_parameter_sets(options.sweep_filename, &options.parameters, n_motifs, &sets);
+
+    int n_units = plan_shards(options.plan_shards_filename, argv[optind], argv[optind + 1], argv[optind + 2], model_def->n_states, n_motifs, options.motif_names, options.output_start_probs_only, sets, n_sets, options.window, options.overlap, options.shard_cost);
+    fprintf(stderr, "%d units in %s\n", n_units, options.plan_shards_filename);
+
+    if (options.sweep_filename) {
+      for (i = 0; i < n_sets; i++) free(sets[i].motif_conc);
+      free(sets);
+    }
+    free_model(model_def);
+    return 0;
   }
 
   model_def = initialize_model(argv[optind], NULL, 0);
   n_seqs = read_sequence(argv[optind + 1], &sequence);
 
+  if (options.sweep_filename && (n_seqs > 1 || options.window > 0)) {
+    fprintf(stderr, "-S needs a single sequence in %s, and cannot be combined with -w.\n", argv[optind + 1]);
+    exit(1);
+  }
+
+  if (n_seqs > 1) {
+    // a batch of sequences is spread over the pool one sequence per task
+    if (options.window > 0) {
+      fprintf(stderr, "-w needs a single sequence in %s.\n", argv[optind + 1]);
+      exit(1);
+    }
+    if (options.n_threads <= 0) options.n_threads = find_num_cpus();
+  } else if (options.checkpointed && (options.n_threads > 1 || options.window > 0)) {
+    fprintf(stderr, "-c/-k cannot be combined with -p or -w.\n");
+    exit(1);
+  }
+
+  if (options.train_filename && (options.viterbi_path || options.sweep_filename || options.window > 0 || options.checkpointed || options.output_format != OUTPUT_TEXT || options.table_precision != TABLE_DOUBLE)) {
+    fprintf(stderr, "--train cannot be combined with -V, -S, -w, -c/-k, -O or --precision.\n");
+    exit(1);
+  }
+
+  // boundary states are kept at checkpoints; -k sets their interval
+  if ((options.save_state_filename || options.resume_filename) && (n_seqs > 1 || options.n_threads > 1 || options.window > 0 || options.sweep_filename || options.viterbi_path || options.train_filename || options.table_precision != TABLE_DOUBLE)) {
+    fprintf(stderr, "--save-state and --resume need a single sequence, and cannot be combined with -p, -w, -S, -V, --train or --precision.\n");
+    exit(1);
+  }
+
+  // the Viterbi path is always checkpointed; -k sets its interval
+  if (options.viterbi_path && (n_seqs > 1 || options.n_threads > 1 || options.window > 0 || options.sweep_filename || options.output_format != OUTPUT_TEXT || options.table_precision != TABLE_DOUBLE)) {
+    fprintf(stderr, "-V needs a single sequence, and cannot be combined with -p, -w, -S, -O or --precision.\n");
+    exit(1);
+  }
+
+  // the other modes run one engine of their own
+  if ((options.mem_limit > 0 || options.dry_run) && (options.sweep_filename || options.viterbi_path || options.train_filename || options.save_state_filename || options.resume_filename)) {
+    fprintf(stderr, "--mem-limit and --dry-run cannot be combined with -S, -V, --train, --save-state or --resume.\n");
+    exit(1);
+  }
+
+  // the duration engine keeps a whole (compact) forward table of one sequence at a time
+  if (options.duration && (options.sweep_filename || options.viterbi_path || options.fixed_states_str || options.checkpointed || options.window > 0 || options.train_filename || options.save_state_filename || options.resume_filename || options.table_precision != TABLE_DOUBLE || options.mem_limit > 0 || options.dry_run)) {
+    fprintf(stderr, "--duration cannot be combined with -S, -V, -f, -c/-k, -w, --train, --save-state, --resume, --precision, --mem-limit or --dry-run.\n");
+    exit(1);
+  }
+  // sequences run in parallel, but each one on a single thread
+  if (options.duration && n_seqs == 1 && options.n_threads > 1) {
+    fprintf(stderr, "--duration runs each sequence on one thread; -p needs more than one sequence.\n");
+    exit(1);
+  }
+
+  // cached runs are boundary state runs of one region, whose positions the cache entries are keyed by
+  if (options.cache_dir && (n_seqs > 1 || options.n_threads > 1 || options.window > 0 || options.sweep_filename || options.viterbi_path || options.fixed_states_str || options.train_filename || options.save_state_filename || options.resume_filename || options.table_precision != TABLE_DOUBLE || options.mem_limit > 0 || options.dry_run || options.duration)) {
+    fprintf(stderr, "--cache needs a single sequence, and cannot be combined with -p, -w, -S, -V, -f, --train, --save-state, --resume, --precision, --mem-limit, --dry-run or --duration.\n");
+    exit(1);
+  }
+
+  // -S, -V, --train and the boundary state runs write through outputs of their own
+  if ((options.outputs_str || options.counts_str) && (options.output_start_probs_only || options.sweep_filename || options.viterbi_path || options.train_filename || options.save_state_filename || options.resume_filename || options.cache_dir)) {
+    fprintf(stderr, "--outputs and --counts cannot be combined with -s, -S, -V, --train, --save-state, --resume or --cache.\n");
+    exit(1);
+  }
+
+  // only the engines that keep a whole forward table have a float counterpart.  under --mem-limit, -p is only the
+  // most threads to plan for
+  if (options.table_precision == TABLE_FLOAT && (options.checkpointed || (n_seqs == 1 && options.n_threads > 1 && options.window <= 0 && !options.sweep_filename && options.mem_limit == 0))) {
+    fprintf(stderr, "--precision float cannot be combined with -c/-k, or with -p unless -w, -S or several sequences are given.\n");
+    exit(1);
+  }
+  model_def->table_precision = options.table_precision;
+
+  // the tables are only allocated once the engine is known; every engine but the single sequence full one keeps
+  // its own
   f_table = ALLOC(sizeof(PROBABILITY *) * n_seqs);
-  b_table = ALLOC(sizeof(PROBABILITY *) * n_seqs);
   sf = ALLOC(sizeof(PROBABILITY *) * n_seqs);
-  sb = ALLOC(sizeof(PROBABILITY *) * n_seqs);
-  sr = ALLOC(sizeof(PROBABILITY *) * n_seqs);
-  for (i = 0; i < n_seqs; i++) {
-    f_table[i] = ALLOC(sizeof(PROBABILITY) * model_def->n_states * sequence[i]->len);
-    b_table[i] = ALLOC(sizeof(PROBABILITY) * model_def->n_states * sequence[i]->len);
-    sf[i] = ALLOC(sizeof(PROBABILITY) * sequence[i]->len);
-    sb[i] = ALLOC(sizeof(PROBABILITY) * sequence[i]->len);
-    sr[i] = ALLOC(sizeof(PROBABILITY) * sequence[i]->len);
-    memset(sf[i], 0, sizeof(PROBABILITY) * sequence[i]->len);
-    memset(sb[i], 0, sizeof(PROBABILITY) * sequence[i]->len);
-    memset(sr[i], 0, sizeof(PROBABILITY) * sequence[i]->len);
-  }
+  memset(f_table, 0, sizeof(PROBABILITY *) * n_seqs);
+  memset(sf, 0, sizeof(PROBABILITY *) * n_seqs);
 
 
 //  if (!verify_model(model_def)) return -1;
@@ -466,6 +1020,115 @@ int main(int argc, char **argv) {
 //  for (i = 0; i < n_motifs; i++)
 //    fprintf(stderr, "Motif %d Conc.: %f\n", i, motif_conc[i]);
 
+  // the sequence position specific concentration scaling factors are one block per sequence, in seq_file order,
+  // and scale the distributor's transitions into each element as it's run
+  int *scaled_states = ALLOC(sizeof(int) * (n_motifs + 1));
+  for (i = 0; i < n_motifs; i++) scaled_states[i] = model_def->silent_states_begin + i + 1;
+  scaled_states[n_motifs] = nuc_start;
+  long *seq_lens = ALLOC(sizeof(long) * n_seqs);
+  position_scaling_struct **scalings = ALLOC(sizeof(position_scaling_struct *) * n_seqs);
+  for (i = 0; i < n_seqs; i++) seq_lens[i] = sequence[i]->len;
+  profile_timer_struct timer;
+  profile_start(&timer);
+  read_sequence_scalings(argv[optind + 2], n_motifs + (nuc_present ? 1 : 0), scaled_states, seq_lens, n_seqs, scalings);
+  profile_stop(&timer, PHASE_SCALING);
+  for (i = 0; i < n_seqs; i++) sequence[i]->scaling = scalings[i];
+  free(scalings);
+  free(seq_lens);
+  free(scaled_states);
+
+  // fixed positions are compiled once per sequence into the masks the row kernels apply
+  if (options.fixed_states_str) {
+    n_fixed_states = parse_fixed_states(options.fixed_states_str, model_def, motif_starts, motif_lens, n_motifs, nuc_present, nuc_start, nuc_len, &fixed_states);
+    model_def->fixed_states = fixed_states;
+    model_def->n_fixed_states = n_fixed_states;
+    for (i = 0; i < n_seqs; i++) sequence[i]->fixed_masks = build_fixed_state_masks(model_def, sequence[i]->len);
+  }
+
+  // a sweep keeps the model as parsed, and applies each of its parameter sets to a copy
+  if (!options.sweep_filename) apply_parameter_set(model_def, &options.parameters, motif_starts, motif_lens, nuc_start, nuc_len);
+  finalize_model(model_def);
+
+  if (nuc_present) {
+    // the 16-per-position dinucleotide states sit between the left and right padding, as in apply_temperature()
+    int n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
+    int n_nuc_pos = (nuc_len - (2 * n_padding_states - 3)) / 16;
+    enable_nucleosome_kernel(model_def, nuc_start + n_padding_states, n_nuc_pos);
+  }
+  // the generated loops are those of the finished topology, nucleosome kernel included
+  if (options.specialize) specialize_model(model_def);
+
+  // every output of a run is a group of columns of the one posterior table its engine fills
+  posterior_columns_struct *columns;
+  int n_groups = 0, n_main = 0, groups[2 * N_OUTPUT_GROUPS], first_column[2 * N_OUTPUT_GROUPS + 1];
+  char *group_files[2 * N_OUTPUT_GROUPS];
+  if (options.outputs_str || options.counts_str) {
+    n_groups = parse_outputs(options.outputs_str, options.counts_str != NULL, nuc_present, groups, group_files, &n_main);
+    columns = build_output_columns(model_def, motif_starts, motif_lens, options.motif_names, n_groups, groups, first_column);
+  } else {
+    columns = build_summed_state_columns(model_def, motif_starts, motif_lens, options.motif_names, options.output_start_probs_only);
+  }
+
+  if (options.mem_limit > 0 || options.dry_run) {
+    // everything but the engine's tables is in memory by now, and those are sized from the model and the lengths
+    memory_plan_struct plan;
+    BOOL fits = TRUE;
+
+    memset(&plan, 0, sizeof(memory_plan_struct));
+    plan.reserved = OUTPUT_BUFFER_SIZE + (1 << 20);  // and a megabyte of bookkeeping too small to count one by one
+    if (options.mem_limit == 0 || options.checkpointed || options.window > 0) {
+      // the engine the options select
+      plan.n_threads = options.n_threads > 1 ? options.n_threads : 1;
+      plan.checkpoint_interval = options.checkpoint_interval > 0 ? options.checkpoint_interval : 0;
+      plan.window = options.window;
+      plan.overlap = options.overlap;
+      if (options.checkpointed) plan.engine = ENGINE_CHECKPOINTED;
+      else if (n_seqs > 1) plan.engine = ENGINE_FULL;
+      else if (options.window > 0) plan.engine = ENGINE_WINDOWED;
+      else if (options.n_threads > 1) plan.engine = ENGINE_PARALLEL;
+      else plan.engine = ENGINE_FULL;
+      if (n_seqs == 1 && plan.engine != ENGINE_PARALLEL && plan.engine != ENGINE_WINDOWED) plan.n_threads = 1;
+      estimate_memory(model_def, sequence, n_seqs, columns->n_columns, &plan);
+      fits = options.mem_limit == 0 || plan_total(&plan) <= options.mem_limit;
+    } else {
+      fits = plan_memory(model_def, sequence, n_seqs, columns->n_columns, options.n_threads > 0 ? options.n_threads : find_num_cpus(), options.overlap, options.mem_limit, &plan);
+    }
+    if (plan.engine == ENGINE_CHECKPOINTED && n_seqs == 1 && plan.checkpoint_interval == 0) plan.checkpoint_interval = default_checkpoint_interval(sequence[0]->len);
+
+    if (options.dry_run) {
+      const char *engine_names[] = {"full", "checkpointed", "parallel", "windowed"};
+      printf("engine\t%s\n", engine_names[plan.engine]);
+      printf("threads\t%d\n", plan.n_threads);
+      if (plan.engine == ENGINE_CHECKPOINTED) {
+        if (plan.checkpoint_interval > 0) printf("checkpoint_interval\t%d\n", plan.checkpoint_interval);
+        else printf("checkpoint_interval\tdefault\n");
+      }
+      if (plan.engine == ENGINE_WINDOWED) printf("window\t%ld\noverlap\t%ld\n", plan.window, plan.overlap);
+      printf("model_bytes\t%zu\n", plan.model);
+      printf("model_build_bytes\t%zu\n", plan.model_build);
+      printf("sequence_bytes\t%zu\n", plan.sequences);
+      printf("scaling_bytes\t%zu\n", plan.scaling);
+      printf("table_bytes\t%zu\n", plan.tables);
+      printf("output_bytes\t%zu\n", plan.output + plan.reserved);
+      printf("total_bytes\t%zu\n", plan_total(&plan));
+      if (options.mem_limit > 0) printf("limit_bytes\t%zu\n", options.mem_limit);
+    }
+    if (!fits) {
+      fprintf(stderr, "The run needs at least %zu bytes, over the memory limit of %zu.\n", plan_total(&plan), options.mem_limit);
+      exit(1);
+    }
+    if (options.dry_run) {
+      free_posterior_columns(columns);
+      free_memory(model_def, sequence, f_table, sf, n_seqs, motif_starts, motif_lens, options.parameters.motif_conc, n_motifs, options.motif_names);
+      return 0;
+    }
+
+    options.checkpointed = plan.engine == ENGINE_CHECKPOINTED;
+    options.checkpoint_interval = plan.checkpoint_interval;
+    options.window = plan.engine == ENGINE_WINDOWED ? plan.window : 0;
+    options.n_threads = plan.n_threads;
+  }
+
   if (argc - optind > 3) {
     if (!(model_def->output = fopen(argv[optind + 3], "w"))) {
       fprintf(stderr, "Opening %s for writing failed.\n", argv[optind + 3]);
@@ -475,37 +1138,99 @@ int main(int argc, char **argv) {
     model_def->output = stdout;
   }
 
-  set_transition_prob(model_def, model_def->silent_states_begin, 0, unbound_conc);
-  set_transition_prob(model_def, model_def->silent_states_begin, nuc_start, nuc_conc);
-  for (i = 0; i < n_motifs; i++)
-    set_transition_prob(model_def, model_def->silent_states_begin, model_def->silent_states_begin + i + 1, motif_conc[i]);
-
-   // ======================================
-   // read in the sequence position specific concentration scaling factors
-   float** seq_pos_conc_scaler = ALLOC((n_motifs + 1) * sizeof(float *));
-   for(i = 0; i < n_motifs + 1; i++) {
-     seq_pos_conc_scaler[i] = ALLOC(sequence[0]->len * sizeof(float));
-   }
-   load_seq_pos_conc_scaler(argv[optind + 2], seq_pos_conc_scaler,
-						  sequence[0]->len, n_motifs, nuc_present);
-   // ======================================
-
-  apply_temperature(model_def, motif_starts, motif_lens, nuc_start, nuc_len, T);
-  update_a0k_probabilities(model_def);
+  PROBABILITY *posterior = NULL;
+  // -P reports it for the engines that have the whole sequence's scaling factors
+  double likelihood = NAN;
+  posterior_writer_struct *writer = open_posterior_writer(model_def->output, options.output_format, options.output_precision, options.output_threshold);
+  posterior_outputs_struct *outputs = NULL;
+  sequence_region_struct *regions = NULL;
+  if (options.outputs_str || options.counts_str) {
+    outputs = open_posterior_outputs(columns, n_groups, groups, group_files, first_column, n_main, options.counts_str, writer, model_def->output, n_motifs, options.output_format, options.output_precision, options.output_threshold);
+    if (read_sequence_regions(argv[optind + 1], &regions) != n_seqs) {
+      fprintf(stderr, "%s changed while it was read.\n", argv[optind + 1]);
+      exit(1);
+    }
+  }
 
-  fb_on_all_seqs(model_def, sequence, f_table, b_table, sf, sb, n_seqs,
-		  seq_pos_conc_scaler,n_motifs,motif_starts,motif_lens, nuc_present);
+  if (options.train_filename) {
+    fprintf(model_def->output, "iteration\tlog_likelihood\n");
+    baum_welch(model_def, sequence, n_seqs, options.n_threads > 0 ? options.n_threads : find_num_cpus(), options.train_tolerance, options.train_iterations, tie_expected_counts, update_a0k_probabilities, print_training_iteration, model_def->output);
+    write_compiled_model(model_def, options.train_filename);
+  } else if (options.cache_dir) {
+    char name[PATH_MAX];
+    long begin;
+    if (!read_first_region(argv[optind + 1], name, &begin)) exit(1);
+    run_with_result_cache(model_def, sequence[0], name, begin, columns, writer, options.checkpoint_interval, options.cache_dir);
+  } else if (options.save_state_filename || options.resume_filename) {
+    run_with_boundary_state(model_def, sequence[0], columns, writer, options.checkpoint_interval, options.save_state_filename, options.resume_filename);
+  } else if (options.viterbi_path) {
+    int *path = ALLOC(sizeof(int) * sequence[0]->len);
+    double log_p = viterbi(model_def, sequence[0], options.checkpoint_interval, path);
+    profile_start(&timer);
+    write_viterbi_path(model_def->output, path, sequence[0]->len, log_p, n_motifs, motif_starts, motif_lens, options.motif_names, nuc_present, nuc_start, nuc_len);
+    profile_stop(&timer, PHASE_OUTPUT);
+    free(path);
+  } else if (options.sweep_filename) {
+    parameter_set_struct *sets;
+    int n_sets = read_parameter_sets(options.sweep_filename, &options.parameters, n_motifs, &sets);
+    int interval = options.checkpointed ? (options.checkpoint_interval > 0 ? options.checkpoint_interval : default_checkpoint_interval(sequence[0]->len)) : 0;
+    run_parameter_sweep(model_def, sequence[0], sets, n_sets, options.n_threads > 0 ? options.n_threads : find_num_cpus(), interval, motif_starts, motif_lens, nuc_start, nuc_len, columns, writer);
+    for (i = 0; i < n_sets; i++) free(sets[i].motif_conc);
+    free(sets);
+  } else if (n_seqs > 1) {
+    batch_output_struct batch;
+    batch.writer = writer;
+    batch.columns = columns;
+    batch.sequence = sequence;
+    batch.outputs = outputs;
+    batch.regions = regions;
+    if (options.duration) {
+      if (!duration_on_all_seqs(model_def, sequence, n_seqs, options.n_threads, columns, print_batch_posterior, &batch)) exit(1);
+    } else {
+      posterior_on_all_seqs(model_def, sequence, n_seqs, options.n_threads, options.checkpointed ? (options.checkpoint_interval > 0 ? options.checkpoint_interval : -1) : 0, columns, print_batch_posterior, &batch);
+    }
+  } else {
+    posterior = ALLOC(sizeof(PROBABILITY) * columns->n_columns * sequence[0]->len);
+
+    if (options.duration) {
+      if (!duration_forward_backward(model_def, sequence[0], columns, posterior)) exit(1);
+    } else if (options.checkpointed) {
+      if (options.checkpoint_interval <= 0) options.checkpoint_interval = default_checkpoint_interval(sequence[0]->len);
+      checkpointed_forward_backward(model_def, sequence[0], options.checkpoint_interval, columns, posterior);
+    } else if (options.window > 0) {
+      windowed_forward_backward(model_def, sequence[0], options.window, options.overlap, options.n_threads, columns, posterior);
+    } else if (options.n_threads > 1) {
+      likelihood = parallel_forward_backward(model_def, sequence[0], options.n_threads, columns, posterior);
+    } else {
+      // the backward pass is fused with the posterior summation, so only the forward table is kept
+      f_table[0] = alloc_table(forward_table_size(model_def, sequence[0]->len));
+      sf[0] = alloc_table(sizeof(PROBABILITY) * sequence[0]->len);
+      forward_fused_posterior(model_def, sequence[0], f_table[0], sf[0], columns, posterior);
+      likelihood = log_likelihood(sf, sequence, 1);
+    }
+    if (outputs) write_posterior_outputs(outputs, NULL, regions[0].name, regions[0].begin, posterior, sequence[0]->len);
+    else write_posterior_block(writer, NULL, columns, posterior, sequence[0]->len);
+  }
 
-  calc_sr(sf[0], sb[0], sequence[0]->len, sr[0]);
-  posterior_output_summed_states(model_def, sequence[0], f_table[0], b_table[0],
-		  sb[0], sr[0], motif_starts, motif_lens, motif_names, output_start_probs_only);
+  if (outputs) {
+    close_posterior_outputs(outputs);
+    free(regions);
+  }
+  close_posterior_writer(writer);
+  free(posterior);
+  free_posterior_columns(columns);
 
 //  print_forward_table(model_def, sequence[0], f_table[0], sf[0],-1);
 //  fprintf(model_def->output, "\n");
 //  print_backward_table(model_def, sequence[0], b_table[0], sb[0],-1);
   fclose(model_def->output);
-  free_memory(model_def, sequence, f_table, b_table, sf, sb, sr, n_seqs,
-		  motif_starts, motif_lens, motif_conc, n_motifs, motif_names, seq_pos_conc_scaler);
+  if (options.profile) {
+    long n_positions = 0;
+    for (i = 0; i < n_seqs; i++) n_positions += sequence[i]->len;
+    write_profile(stderr, model_def, n_positions, likelihood);
+  }
+  free_memory(model_def, sequence, f_table, sf, n_seqs,
+		  motif_starts, motif_lens, options.parameters.motif_conc, n_motifs, options.motif_names);
 
   return 0;
 }
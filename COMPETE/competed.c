@@ -0,0 +1,459 @@
+#include "libcompete.h"
+#include "output.h"
+#include <libgen.h>
+#include <getopt.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern char *optarg;
+extern int optind;
+
+/* competed: compete as a long-lived server.  the model is loaded and finalized once, then requests for regions
+   arrive over a Unix socket, one line each:
+
+     sequence begin end [-n nuc_conc] [-u unbound_conc] [-t inverse_temperature] [-m motif_concs] [-O format]
+
+   sequence, begin and end as on a seq_filenames line, and the options as for compete, defaulting to those competed
+   was started with.  the answer is "ok bytes\n" followed by that many bytes of posteriors in the -O format, or
+   "error message\n".  a connection can send any number of requests, which are answered in order.
+
+   the main thread polls the listening socket and every idle connection.  a connection with something to read is
+   queued for the worker pool, and handed back once the worker has answered every complete request it holds, so
+   connections take turns rather than each holding a thread.
+*/
+
+#define REQUEST_LENGTH 4096          // longest request line, newline included
+#define DEFAULT_MAX_REGION 1000000   // longest region served, so one request can't take all the memory
+
+
+typedef struct c_s {
+  int fd;
+  char buffer[REQUEST_LENGTH];  // what has been read of the connection's requests
+  size_t used;
+  struct c_s *next;             // in the request queue
+} connection_struct;
+
+
+typedef struct {
+  compete_model_struct *model;
+  parameter_set_struct defaults;
+  int output_format, output_precision;
+  PROBABILITY output_threshold;
+  long max_region;
+  int checkpoint_interval;      // of every worker's context
+  connection_struct *head, *tail;  // connections with requests waiting, under lock
+  BOOL stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  int wake[2];                  // workers write served connections here, for the main thread to poll again
+} server_struct;
+
+
+// where a request's posteriors are written
+typedef struct {
+  FILE *file;
+  int format, precision;
+  PROBABILITY threshold;
+} reply_struct;
+
+
+static volatile sig_atomic_t stop_requested = 0;
+
+void request_stop(int signal) {
+  stop_requested = 1;
+}
+
+
+BOOL send_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = send(fd, data, size, 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return FALSE;
+    data += n;
+    size -= n;
+  }
+  return TRUE;
+}
+
+
+BOOL send_error(int fd, const char *message) {
+  char line[256];
+
+  snprintf(line, sizeof(line), "error %s\n", message);
+  return send_all(fd, line, strlen(line));
+}
+
+
+void write_reply(void *arg, compete_model_struct *model, sequence_struct *sequence, PROBABILITY *posterior) {
+  reply_struct *reply = (reply_struct *)arg;
+  posterior_writer_struct *writer = open_posterior_writer(reply->file, reply->format, reply->precision, reply->threshold);
+
+  write_posterior_block(writer, NULL, model->columns, posterior, sequence->len);
+  close_posterior_writer(writer);
+}
+
+
+// answers one request line.  FALSE if the connection has gone
+BOOL serve_request(server_struct *server, compete_context_struct *context, char *line, int fd) {
+  compete_model_struct *model = server->model;
+  parameter_set_struct set = server->defaults;
+  reply_struct reply;
+  sequence_struct *sequence;
+  PROBABILITY motif_conc[256];
+  char *name, *token, *end, *save, *str, header[64], *data = NULL;
+  long begin_read, end_read;
+  struct stat sb;
+  size_t size = 0;
+  BOOL sent;
+  int i;
+
+  memcpy(motif_conc, server->defaults.motif_conc, sizeof(PROBABILITY) * model->n_motifs);
+  set.motif_conc = motif_conc;
+  reply.format = server->output_format;
+  reply.precision = server->output_precision;
+  reply.threshold = server->output_threshold;
+
+  if (!(name = strtok_r(line, " \t\r", &save))) return send_error(fd, "empty request");
+  if (!(token = strtok_r(NULL, " \t\r", &save)) || (begin_read = strtol(token, &end, 10), *end)) return send_error(fd, "expected sequence begin end");
+  if (!(token = strtok_r(NULL, " \t\r", &save)) || (end_read = strtol(token, &end, 10), *end)) return send_error(fd, "expected sequence begin end");
+
+  while ((token = strtok_r(NULL, " \t\r", &save))) {
+    char *value = strtok_r(NULL, " \t\r", &save);
+    if (strlen(token) != 2 || token[0] != '-' || !value) return send_error(fd, "expected -n, -u, -t, -m or -O and a value");
+    switch (token[1]) {
+      case 'n': set.nuc_conc = atof(value); break;
+      case 'u': set.unbound_conc = atof(value); break;
+      case 't': set.T = atof(value); break;
+      case 'm':
+        for (i = 0, str = value; i < model->n_motifs && *str; i++) {
+          motif_conc[i] = atof(str);
+          if (!(str = strchr(str, ','))) break;
+          str++;
+        }
+        break;
+      case 'O':
+        if (!parse_output_format(value, &reply.format, &reply.precision, &reply.threshold)) return send_error(fd, "unknown output format");
+        break;
+      default:
+        return send_error(fd, "expected -n, -u, -t, -m or -O and a value");
+    }
+  }
+
+  // refused before anything is read.  end -1 runs to the end of a plain file; a store's record is mapped, not read,
+  // so its length is checked once it's mapped
+  if (end_read < 0 && stat(name, &sb) == 0) end_read = sb.st_size;
+  if (end_read >= begin_read && begin_read >= 1 && end_read - begin_read + 1 > server->max_region) return send_error(fd, "region longer than the server's -L");
+
+  sequence = ALLOC(sizeof(sequence_struct));
+  if (!read_sequence_region(name, begin_read, end_read, sequence)) {
+    free(sequence);
+    return send_error(fd, "cannot read that region");
+  }
+  if (sequence->len > server->max_region) {
+    free_sequence(sequence);
+    return send_error(fd, "region longer than the server's -L");
+  }
+
+  // the reply goes to memory first, so its length can lead it
+  reply.file = open_memstream(&data, &size);
+  compete_run(context, sequence, &set, write_reply, &reply);
+  fclose(reply.file);
+  free_sequence(sequence);
+
+  snprintf(header, sizeof(header), "ok %zu\n", size);
+  sent = send_all(fd, header, strlen(header)) && send_all(fd, data, size);
+  free(data);
+  return sent;
+}
+
+
+// reads what has arrived on connection and answers every complete request in it.  FALSE once it's closed
+BOOL serve_connection(server_struct *server, compete_context_struct *context, connection_struct *connection) {
+  ssize_t n;
+  char *newline;
+
+  do {
+    n = recv(connection->fd, connection->buffer + connection->used, REQUEST_LENGTH - connection->used, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n <= 0) return FALSE;
+  connection->used += n;
+
+  while ((newline = memchr(connection->buffer, '\n', connection->used))) {
+    size_t length = newline - connection->buffer + 1;
+    *newline = '\0';
+    if (!serve_request(server, context, connection->buffer, connection->fd)) return FALSE;
+    memmove(connection->buffer, connection->buffer + length, connection->used - length);
+    connection->used -= length;
+  }
+
+  if (connection->used == REQUEST_LENGTH) {
+    send_error(connection->fd, "request too long");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+
+void *server_worker(void *arg) {
+  server_struct *server = (server_struct *)arg;
+  compete_context_struct *context = compete_new_context(server->model, server->checkpoint_interval);
+  connection_struct *connection;
+
+  for (;;) {
+    pthread_mutex_lock(&server->lock);
+    while (!server->head && !server->stopping) pthread_cond_wait(&server->ready, &server->lock);
+    if (!server->head) {
+      pthread_mutex_unlock(&server->lock);
+      break;
+    }
+    connection = server->head;
+    if (!(server->head = connection->next)) server->tail = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    if (serve_connection(server, context, connection)) {
+      if (write(server->wake[1], &connection, sizeof(connection)) == sizeof(connection)) continue;
+    }
+    close(connection->fd);
+    free(connection);
+  }
+
+  compete_free_context(context);
+  return NULL;
+}
+
+
+void queue_connection(server_struct *server, connection_struct *connection) {
+  connection->next = NULL;
+  pthread_mutex_lock(&server->lock);
+  if (server->tail) server->tail->next = connection;
+  else server->head = connection;
+  server->tail = connection;
+  pthread_cond_signal(&server->ready);
+  pthread_mutex_unlock(&server->lock);
+}
+
+
+int listen_on(char *path) {
+  struct sockaddr_un address;
+  int fd;
+
+  if (strlen(path) >= sizeof(address.sun_path)) {
+    fprintf(stderr, "Socket path %s is too long.\n", path);
+    exit(1);
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+
+  unlink(path);
+  if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+    fprintf(stderr, "Listening on %s failed: %s.\n", path, strerror(errno));
+    exit(1);
+  }
+  return fd;
+}
+
+
+// polls for new connections, requests on idle ones and connections handed back, until SIGINT or SIGTERM
+void run_server(server_struct *server, int listen_fd) {
+  connection_struct **idle = NULL, *connection;
+  struct pollfd *fds = NULL;
+  int n_idle = 0, allocated = 0, i, j, fd;
+
+  while (!stop_requested) {
+    if (n_idle + 2 > allocated) {
+      allocated = 2 * (n_idle + 2);
+      idle = realloc(idle, sizeof(connection_struct *) * allocated);
+      fds = realloc(fds, sizeof(struct pollfd) * allocated);
+    }
+    fds[0].fd = listen_fd;
+    fds[1].fd = server->wake[0];
+    for (i = 0; i < n_idle; i++) fds[i + 2].fd = idle[i]->fd;
+    for (i = 0; i < n_idle + 2; i++) fds[i].events = POLLIN;
+
+    if (poll(fds, n_idle + 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      fprintf(stderr, "poll failed: %s.\n", strerror(errno));
+      break;
+    }
+
+    // requests first, while idle still matches fds
+    for (i = 0, j = 0; i < n_idle; i++) {
+      if (fds[i + 2].revents) queue_connection(server, idle[i]);
+      else idle[j++] = idle[i];
+    }
+    n_idle = j;
+
+    if (fds[1].revents & POLLIN) {
+      if (read(server->wake[0], &connection, sizeof(connection)) == sizeof(connection)) {
+        if (n_idle == allocated) {
+          allocated *= 2;
+          idle = realloc(idle, sizeof(connection_struct *) * allocated);
+          fds = realloc(fds, sizeof(struct pollfd) * allocated);
+        }
+        idle[n_idle++] = connection;
+      }
+    }
+
+    if ((fds[0].revents & POLLIN) && (fd = accept(listen_fd, NULL, NULL)) >= 0) {
+      connection = ALLOC(sizeof(connection_struct));
+      connection->fd = fd;
+      connection->used = 0;
+      queue_connection(server, connection);
+    }
+  }
+
+  for (i = 0; i < n_idle; i++) {
+    close(idle[i]->fd);
+    free(idle[i]);
+  }
+  free(idle);
+  free(fds);
+}
+
+
+void print_usage(char **argv) {
+  fprintf(stderr, "usage: %s [options] model_file socket_path\n", basename(argv[0]));
+  fprintf(stderr, "  -n  nucleosome_concentration (float), the default of requests without -n\n");
+  fprintf(stderr, "  -m  motif_concentrations (comma delimited string of floats), likewise\n");
+  fprintf(stderr, "  -u  unbound_concentration (float), likewise\n");
+  fprintf(stderr, "  -t  inverse_temperature (float), likewise\n");
+  fprintf(stderr, "  -N  motif_labels (comma delimited string of strings, for output column headers)\n");
+  fprintf(stderr, "  -s  output only probabilities of starting each DBF per postion\n");
+  fprintf(stderr, "  -O  output_format of requests without -O: text (default), compact[:precision], binary or sparse[:threshold]\n");
+  fprintf(stderr, "  -p  threads (int): requests answered at once (default one per CPU)\n");
+  fprintf(stderr, "  -k  checkpoint_interval (int): run every request checkpointed, 0 for sqrt(region length)\n");
+  fprintf(stderr, "  -L  longest region served (default %d)\n", DEFAULT_MAX_REGION);
+  fprintf(stderr, "\nrequests are lines of \"sequence begin end [-n x] [-u x] [-t x] [-m x,y,...] [-O format]\", as in seq_file;\n");
+  fprintf(stderr, "each is answered with \"ok bytes\" and that many bytes of posteriors, or \"error message\"\n");
+}
+
+
+int main(int argc, char **argv) {
+  server_struct server;
+  PROBABILITY motif_conc[256];
+  char *motif_names[256], *str, *token;
+  BOOL output_start_probs_only = FALSE, checkpointed = FALSE;
+  int n_threads = 0, opt, i, listen_fd;
+  pthread_t *threads;
+  struct sigaction action;
+  connection_struct *connection;
+
+  for (i = 0; i < 256; i++) motif_conc[i] = 0.01;
+  memset(motif_names, 0, sizeof(motif_names));
+  server.defaults.nuc_conc = 1.0;
+  server.defaults.unbound_conc = 1.0;
+  server.defaults.T = 1.0;
+  server.defaults.motif_conc = motif_conc;
+  server.defaults.line = 0;
+  server.output_format = OUTPUT_TEXT;
+  server.output_precision = DEFAULT_COMPACT_PRECISION;
+  server.output_threshold = DEFAULT_SPARSE_THRESHOLD;
+  server.max_region = DEFAULT_MAX_REGION;
+  server.checkpoint_interval = 0;
+
+  while ((opt = getopt(argc, argv, "n:m:u:t:N:sO:p:k:L:h")) > 0) {
+    switch (opt) {
+      case 'n':
+        server.defaults.nuc_conc = atof(optarg);
+        break;
+      case 'u':
+        server.defaults.unbound_conc = atof(optarg);
+        break;
+      case 't':
+        server.defaults.T = atof(optarg);
+        break;
+      case 'm':
+        for (i = 0, str = optarg; i < 256; i++, str = NULL) {
+          if (!(token = strtok(str, ","))) break;
+          motif_conc[i] = atof(token);
+        }
+        break;
+      case 'N':
+        for (i = 0, str = optarg; i < 256; i++, str = NULL) {
+          if (!(token = strtok(str, ","))) break;
+          motif_names[i] = strdup(token);
+        }
+        break;
+      case 's':
+        output_start_probs_only = TRUE;
+        break;
+      case 'O':
+        if (!parse_output_format(optarg, &server.output_format, &server.output_precision, &server.output_threshold)) {
+          fprintf(stderr, "Unknown output format \"%s\".\n", optarg);
+          exit(1);
+        }
+        break;
+      case 'p':
+        n_threads = atoi(optarg);
+        break;
+      case 'k':
+        checkpointed = TRUE;
+        server.checkpoint_interval = atoi(optarg);
+        break;
+      case 'L':
+        server.max_region = atol(optarg);
+        break;
+      case 'h':
+      default:
+        print_usage(argv);
+        exit(0);
+    }
+  }
+  if (argc - optind != 2) {
+    print_usage(argv);
+    exit(1);
+  }
+  if (n_threads <= 0) n_threads = find_num_cpus();
+  if (checkpointed && server.checkpoint_interval <= 0) server.checkpoint_interval = -1;
+
+  server.model = compete_load_model(argv[optind], motif_names[0] ? motif_names : NULL, output_start_probs_only);
+  for (i = 0; i < 256; i++) free(motif_names[i]);
+  server.head = server.tail = NULL;
+  server.stopping = FALSE;
+  pthread_mutex_init(&server.lock, NULL);
+  pthread_cond_init(&server.ready, NULL);
+  if (pipe(server.wake) != 0) {
+    fprintf(stderr, "pipe failed: %s.\n", strerror(errno));
+    exit(1);
+  }
+
+  // a client hanging up mid-reply is only that connection's problem; SIGINT and SIGTERM stop the server cleanly
+  signal(SIGPIPE, SIG_IGN);
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = request_stop;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  listen_fd = listen_on(argv[optind + 1]);
+  threads = ALLOC(sizeof(pthread_t) * n_threads);
+  for (i = 0; i < n_threads; i++) pthread_create(threads + i, NULL, server_worker, &server);
+
+  run_server(&server, listen_fd);
+
+  // the workers finish what's queued first
+  pthread_mutex_lock(&server.lock);
+  server.stopping = TRUE;
+  pthread_cond_broadcast(&server.ready);
+  pthread_mutex_unlock(&server.lock);
+  for (i = 0; i < n_threads; i++) pthread_join(threads[i], NULL);
+  // and whatever they handed back after the main thread stopped polling
+  fcntl(server.wake[0], F_SETFL, O_NONBLOCK);
+  while (read(server.wake[0], &connection, sizeof(connection)) == sizeof(connection)) {
+    close(connection->fd);
+    free(connection);
+  }
+
+  close(listen_fd);
+  unlink(argv[optind + 1]);
+  close(server.wake[0]);
+  close(server.wake[1]);
+  pthread_mutex_destroy(&server.lock);
+  pthread_cond_destroy(&server.ready);
+  free(threads);
+  compete_free_model(server.model);
+  return 0;
+}
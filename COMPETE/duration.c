@@ -0,0 +1,629 @@
+#include "bc.h"
+
+/* forward-backward with every motif chain collapsed into one duration transition.  a chain (a motif strand: states
+   start .. start + len - 1, each fed by the one before, entered from a silent state and leaving to the distributor)
+   is only ever occupied whole, one state per position, so a path through it is fixed by the position it starts at.
+   the rows keep the states outside chains as before; of each chain the forward rows only hold the end state, and
+   the backward rows the start state, both filled from len rows away with the PWM likelihood of the window and the
+   scale factors in between.  the silent states then pass them on as usual.  the joint probability of each start
+   is summed into the posterior columns over the window it covers, by blocked prefix sums.
+
+   the PWM likelihood of every start is precomputed for both passes, a block of starts at a time, as a straight
+   product over the motif columns that the compiler vectorizes.  states in chains are never visited, so a row costs
+   the states outside chains plus a few operations per chain, whatever the motif lengths.  the forward rows kept
+   hold the states outside chains and the silent states, and the likelihoods one value per chain and position.
+
+   rows are normalized over the states they hold, which makes the scale factors differ from the full engine's, but
+   not the posteriors.  only the last row has to sum over every state, chains under way included, for the product
+   of the forward scale factors to be the sequence's probability.
+*/
+
+#define DURATION_MIN_CHAIN 2
+#define DURATION_BLOCK 512  // starts scored at once, in cache
+
+
+typedef struct {
+  int silent;           // the silent state entering it
+  int start, len;
+  PROBABILITY enter;    // silent -> start
+  PROBABILITY through;  // product of the transitions along the chain
+  PROBABILITY leave;    // end -> distributor
+  PROBABILITY *pwm;     // pwm[k * alphabet_length + c]: emission of c by state start + k
+} duration_chain_struct;
+
+// chain states from .. to (offsets) summed into column, from the joint probability of each start
+typedef struct {
+  int column;
+  duration_chain_struct *chain;
+  int from, to;
+  PROBABILITY *block;   // the joint probabilities of the block being filled, indexed by offset % width
+  PROBABILITY *upper;   // prefix sums of the block above it
+  PROBABILITY suffix;   // sum of the current block from the last offset pushed on
+  int index;            // of that offset in its block, -1 before the first
+} duration_range_struct;
+
+// states state_from .. state_to, held at compact_from on in the compact forward rows
+typedef struct {
+  int column;
+  int state_from, state_to, compact_from;
+} duration_kept_range_struct;
+
+typedef struct {
+  model_def_struct *model_def;
+  sequence_struct *sequence;
+  unsigned char *symbols;
+  long len;
+
+  int n_chains, max_len;
+  duration_chain_struct *chains;
+  // track[s * n_chains + c]: emission of the window starting at s by chain c's states from its second on, 0 for
+  // windows past the end.  a row's chains are side by side, as the passes read them
+  PROBABILITY *track;
+
+  // states outside chains, as runs [from, to)
+  int n_runs, *run_from, *run_to;
+  // the same minus the nucleosome kernel's states, forward and backward
+  int n_update_runs[2], *update_from[2], *update_to[2];
+
+  int n_compact;        // kept states, then the silent states
+  int compact_silent;
+
+  int n_ranges, n_kept_ranges;
+  duration_range_struct *ranges;
+  duration_kept_range_struct *kept_ranges;
+} duration_struct;
+
+
+static void kernel_skip(model_def_struct *model_def, BOOL forward, int *skip_from, int *skip_to) {
+  nucleosome_kernel_struct *kernel = model_def->nuc_kernel;
+
+  if (!kernel) {
+    *skip_from = *skip_to = model_def->silent_states_begin;
+  } else if (forward) {
+    *skip_from = kernel->first_state + 16;
+    *skip_to = kernel->first_state + 16 * kernel->n_positions;
+  } else {
+    *skip_from = kernel->first_state;
+    *skip_to = kernel->first_state + 16 * (kernel->n_positions - 1);
+  }
+}
+
+
+static void add_run(int *n_runs, int *from, int *to, int a, int b) {
+  if (a >= b) return;
+  from[*n_runs] = a;
+  to[(*n_runs)++] = b;
+}
+
+
+int find_duration_chains(model_def_struct *model_def, int *starts, int *lens) {
+  int distributor = model_def->silent_states_begin;
+  int i, j, n = 0;
+
+  for (i = 0; i < distributor; i++) {
+    if (model_def->n_parents[i] != 1 || model_def->parent_edges[i][0].state < distributor) continue;
+    for (j = i; j + 1 < distributor && model_def->n_children[j] == 1 && model_def->child_edges[j][0].state == j + 1 && model_def->n_parents[j + 1] == 1; j++);
+    if (j - i + 1 < DURATION_MIN_CHAIN || model_def->n_children[j] != 1 || model_def->child_edges[j][0].state != distributor) continue;
+    if (starts) starts[n] = i;
+    if (lens) lens[n] = j - i + 1;
+    n++;
+    i = j;
+  }
+  return n;
+}
+
+
+// fills d->track, one block of starts at a time
+static void score_chains(duration_struct *d) {
+  int alphabet_length = d->model_def->alphabet_length, c, k;
+  PROBABILITY block[DURATION_BLOCK];
+  long from, count, i;
+
+  d->track = alloc_table(sizeof(PROBABILITY) * d->n_chains * d->len);
+  for (from = 0; from < d->len; from += DURATION_BLOCK) {
+    for (c = 0; c < d->n_chains; c++) {
+      duration_chain_struct *chain = d->chains + c;
+      count = d->len - chain->len + 1 - from;
+      if (count > DURATION_BLOCK) count = DURATION_BLOCK;
+      if (count < 0) count = 0;
+      for (i = 0; i < count; i++) block[i] = 1;
+      // one motif column at a time over the whole block, so the inner loop is a plain gather and multiply
+      for (k = 1; k < chain->len; k++) {
+        const PROBABILITY *pwm = chain->pwm + k * alphabet_length;
+        const unsigned char *x = d->symbols + from + k;
+        for (i = 0; i < count; i++) block[i] *= pwm[x[i]];
+      }
+      for (i = 0; i < DURATION_BLOCK && from + i < d->len; i++) d->track[(unsigned long)(from + i) * d->n_chains + c] = i < count ? block[i] : 0;
+    }
+  }
+}
+
+
+static BOOL setup_duration(duration_struct *d, model_def_struct *model_def, sequence_struct *sequence, posterior_columns_struct *columns) {
+  int distributor = model_def->silent_states_begin;
+  int *chain_of, i, j, k, c, f;
+  state_range_struct *range;
+
+  memset(d, 0, sizeof(duration_struct));
+  if (!model_def->emission_by_chr || !model_def->child_emission_weights) {
+    fprintf(stderr, "The duration engine needs a finalized model.\n");
+    return FALSE;
+  }
+  if (sequence->fixed_masks) {
+    fprintf(stderr, "The duration engine cannot run sequences with fixed states.\n");
+    return FALSE;
+  }
+
+  d->model_def = model_def;
+  d->sequence = sequence;
+  d->len = sequence->len;
+  d->n_chains = find_duration_chains(model_def, NULL, NULL);
+
+  int *starts = ALLOC(sizeof(int) * (d->n_chains + 1)), *lens = ALLOC(sizeof(int) * (d->n_chains + 1));
+  find_duration_chains(model_def, starts, lens);
+  chain_of = ALLOC(sizeof(int) * model_def->n_states);
+  for (i = 0; i < model_def->n_states; i++) chain_of[i] = -1;
+
+  d->chains = ALLOC(sizeof(duration_chain_struct) * (d->n_chains + 1));
+  for (c = 0; c < d->n_chains; c++) {
+    duration_chain_struct *chain = d->chains + c;
+    chain->start = starts[c];
+    chain->len = lens[c];
+    chain->silent = model_def->parent_edges[chain->start][0].state;
+    chain->enter = model_def->parent_edges[chain->start][0].prob;
+    chain->leave = model_def->child_edges[chain->start + chain->len - 1][0].prob;
+    chain->through = 1;
+    for (k = 1; k < chain->len; k++) chain->through *= model_def->parent_edges[chain->start + k][0].prob;
+    chain->pwm = ALLOC(sizeof(PROBABILITY) * chain->len * model_def->alphabet_length);
+    for (k = 0; k < chain->len; k++) {
+      for (i = 0; i < model_def->alphabet_length; i++) chain->pwm[k * model_def->alphabet_length + i] = model_def->emission_by_chr[(unsigned long)model_def->emission_stride * i + chain->start + k];
+      chain_of[chain->start + k] = c;
+    }
+    if (chain->len > d->max_len) d->max_len = chain->len;
+  }
+  free(starts);
+  free(lens);
+
+  if (sequence->scaling) {
+    for (i = 0; i < sequence->scaling->n_columns; i++) {
+      if (sequence->scaling->states[i] < distributor && chain_of[sequence->scaling->states[i]] >= 0) {
+        fprintf(stderr, "The duration engine cannot scale state %d, which is inside a motif chain.\n", sequence->scaling->states[i]);
+        free(chain_of);
+        return FALSE;
+      }
+    }
+  }
+
+  // runs of states outside chains, and the compact layout of the forward rows
+  d->run_from = ALLOC(sizeof(int) * (d->n_chains + 1));
+  d->run_to = ALLOC(sizeof(int) * (d->n_chains + 1));
+  for (i = 0, c = 0; c <= d->n_chains; c++) {
+    int end = c < d->n_chains ? d->chains[c].start : distributor;
+    add_run(&d->n_runs, d->run_from, d->run_to, i, end);
+    if (c < d->n_chains) i = d->chains[c].start + d->chains[c].len;
+  }
+  for (f = 0; f < 2; f++) {
+    int skip_from, skip_to;
+    kernel_skip(model_def, f, &skip_from, &skip_to);
+    d->update_from[f] = ALLOC(sizeof(int) * 2 * (d->n_runs + 1));
+    d->update_to[f] = ALLOC(sizeof(int) * 2 * (d->n_runs + 1));
+    for (i = 0; i < d->n_runs; i++) {
+      int a = d->run_from[i], b = d->run_to[i];
+      add_run(&d->n_update_runs[f], d->update_from[f], d->update_to[f], a, b < skip_from ? b : skip_from);
+      add_run(&d->n_update_runs[f], d->update_from[f], d->update_to[f], a > skip_to ? a : skip_to, b);
+    }
+  }
+  int *compact_of = ALLOC(sizeof(int) * model_def->n_states);
+  for (i = 0; i < d->n_runs; i++) {
+    for (j = d->run_from[i]; j < d->run_to[i]; j++) compact_of[j] = d->n_compact++;
+  }
+  d->compact_silent = d->n_compact;
+  d->n_compact += model_def->n_states - distributor;
+
+  // split each column's ranges into pieces inside one chain and pieces outside any
+  for (c = 0; c < columns->n_columns; c++) {
+    for (range = columns->ranges[c]; range; range = range->next_range) {
+      for (i = range->state_from; i <= range->state_to; i = j + 1) {
+        if (i < distributor && chain_of[i] >= 0) {
+          duration_chain_struct *chain = d->chains + chain_of[i];
+          for (j = i; j < range->state_to && j + 1 < chain->start + chain->len; j++);
+          d->ranges = realloc(d->ranges, sizeof(duration_range_struct) * (d->n_ranges + 1));
+          duration_range_struct *r = d->ranges + d->n_ranges++;
+          memset(r, 0, sizeof(duration_range_struct));
+          r->column = c;
+          r->chain = chain;
+          r->from = i - chain->start;
+          r->to = j - chain->start;
+        } else {
+          // normal states outside chains are contiguous in the compact rows up to the next chain, and the silent
+          // states are among themselves
+          for (j = i; j < range->state_to && (i < distributor ? j + 1 < distributor && chain_of[j + 1] < 0 : TRUE); j++);
+          d->kept_ranges = realloc(d->kept_ranges, sizeof(duration_kept_range_struct) * (d->n_kept_ranges + 1));
+          duration_kept_range_struct *r = d->kept_ranges + d->n_kept_ranges++;
+          r->column = c;
+          r->state_from = i;
+          r->state_to = j;
+          r->compact_from = i < distributor ? compact_of[i] : d->compact_silent + i - distributor;
+        }
+      }
+    }
+  }
+  for (i = 0; i < d->n_ranges; i++) {
+    int width = d->ranges[i].to - d->ranges[i].from + 1;
+    d->ranges[i].block = ALLOC(sizeof(PROBABILITY) * width);
+    d->ranges[i].upper = ALLOC(sizeof(PROBABILITY) * width);
+    memset(d->ranges[i].block, 0, sizeof(PROBABILITY) * width);
+    memset(d->ranges[i].upper, 0, sizeof(PROBABILITY) * width);
+    d->ranges[i].index = -1;
+  }
+  free(compact_of);
+  free(chain_of);
+
+  d->symbols = ALLOC(d->len);
+  for (i = 0; i < d->len; i++) d->symbols[i] = fetch_symbol(sequence, i);
+  score_chains(d);
+  return TRUE;
+}
+
+
+static void free_duration(duration_struct *d) {
+  int i;
+
+  for (i = 0; i < d->n_chains; i++) {
+    free(d->chains[i].pwm);
+  }
+  for (i = 0; i < d->n_ranges; i++) {
+    free(d->ranges[i].block);
+    free(d->ranges[i].upper);
+  }
+  for (i = 0; i < 2; i++) {
+    free(d->update_from[i]);
+    free(d->update_to[i]);
+  }
+  free(d->chains);
+  free(d->run_from);
+  free(d->run_to);
+  free(d->ranges);
+  free(d->kept_ranges);
+  free(d->symbols);
+  free_table(d->track);
+}
+
+
+static PROBABILITY chain_emission(duration_struct *d, duration_chain_struct *chain, int k, long pos) {
+  return chain->pwm[k * d->model_def->alphabet_length + d->symbols[pos]];
+}
+
+
+/* forward value of chain state start + j at row p, before the row is normalized: the chain entered at p - j, from
+   the silent state of row p - j - 1 or, for a start before the sequence, from the initial probabilities.
+   inv_f[k] is 1 over the product of the scale factors of rows p - k .. p - 1.
+*/
+static PROBABILITY chain_forward(duration_struct *d, duration_chain_struct *chain, PROBABILITY *f_compact, long p, int j, PROBABILITY *inv_f) {
+  model_def_struct *model_def = d->model_def;
+  long s = p - j;
+  PROBABILITY v;
+  int k, first;
+
+  if (s >= 1) {
+    v = f_compact[(unsigned long)d->n_compact * (s - 1) + d->compact_silent + chain->silent - model_def->silent_states_begin] * chain->enter;
+    first = 0;
+  } else {
+    first = -s;
+    v = model_def->initial_probs[chain->start + first];
+  }
+  v *= chain_emission(d, chain, first, s + first);
+  for (k = first + 1; k <= j; k++) v *= model_def->parent_edges[chain->start + k][0].prob * chain_emission(d, chain, k, s + k);
+  return v * inv_f[p - s - first];
+}
+
+
+/* backward value of chain state start + j at row p, before the row is normalized: the rest of the chain, then the
+   distributor of backward row end + 1, or nothing more when the sequence ends first.  b_distributor holds the
+   normalized distributor of every backward row, and inv_b[k] 1 over the product of the scale factors of rows p + 1 .. p + k.
+*/
+static PROBABILITY chain_backward(duration_struct *d, duration_chain_struct *chain, PROBABILITY *b_distributor, long p, int j, PROBABILITY *inv_b) {
+  model_def_struct *model_def = d->model_def;
+  long end = p + chain->len - 1 - j;
+  long last = end < d->len - 1 ? end : d->len - 1;
+  PROBABILITY v = 1;
+  int k;
+
+  for (k = j + 1; k <= j + last - p; k++) v *= model_def->parent_edges[chain->start + k][0].prob * chain_emission(d, chain, k, p + k - j);
+  if (end < d->len - 1) v *= chain->leave * b_distributor[end + 1];
+  return v * inv_b[last - p];
+}
+
+
+static void duration_normal_row(duration_struct *d, PROBABILITY *prev_row, PROBABILITY *row, char chr, BOOL forward) {
+  model_def_struct *model_def = d->model_def;
+  int f = forward ? 1 : 0, r, i, j;
+
+  if (forward) {
+    const PROBABILITY *em = model_def->emission_by_chr + (unsigned long)model_def->emission_stride * chr;
+    for (r = 0; r < d->n_update_runs[f]; r++) {
+      for (i = d->update_from[f][r]; i < d->update_to[f][r]; i++) {
+        edge_struct *edges = model_def->parent_edges[i];
+        PROBABILITY sum = 0;
+        for (j = 0; j < model_def->n_parents[i]; j++) {
+          sum += prev_row[edges[j].state] * edges[j].prob;
+        }
+        row[i] = sum * em[i];
+      }
+    }
+    if (model_def->nuc_kernel) update_nucleosome_block_forward(model_def, prev_row, row, chr);
+  } else {
+    const PROBABILITY *weights = model_def->child_emission_weights + (unsigned long)model_def->n_edges * chr;
+    for (r = 0; r < d->n_update_runs[f]; r++) {
+      for (i = d->update_from[f][r]; i < d->update_to[f][r]; i++) {
+        edge_struct *edges = model_def->child_edges[i];
+        const PROBABILITY *w = weights + (edges - model_def->child_edge_pool);
+        PROBABILITY sum = 0;
+        for (j = 0; j < model_def->n_children[i]; j++) {
+          sum += prev_row[edges[j].state] * w[j];
+        }
+        row[i] = sum;
+      }
+    }
+    if (model_def->nuc_kernel) update_nucleosome_block_backward(model_def, prev_row, row, chr);
+  }
+}
+
+
+// sums the states the row holds, plus extra, and divides them and the silent states by it
+static PROBABILITY duration_normalize(duration_struct *d, PROBABILITY *row, BOOL forward, PROBABILITY extra) {
+  model_def_struct *model_def = d->model_def;
+  PROBABILITY s = extra;
+  int r, i;
+
+  for (r = 0; r < d->n_runs; r++) {
+    for (i = d->run_from[r]; i < d->run_to[r]; i++) s += row[i];
+  }
+  for (i = 0; i < d->n_chains; i++) s += row[d->chains[i].start + (forward ? d->chains[i].len - 1 : 0)];
+
+  for (r = 0; r < d->n_runs; r++) {
+    for (i = d->run_from[r]; i < d->run_to[r]; i++) row[i] /= s;
+  }
+  for (i = 0; i < d->n_chains; i++) row[d->chains[i].start + (forward ? d->chains[i].len - 1 : 0)] /= s;
+  for (i = model_def->silent_states_begin; i < model_def->n_states; i++) row[i] /= s;
+  return s;
+}
+
+
+// joint probability of the chain starting at offset o - (len - 1); offsets come in descending, one at a time
+static void push_start(duration_struct *d, duration_range_struct *r, long o, PROBABILITY joint, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  int width = r->to - r->from + 1, i;
+  long t = o - (r->chain->len - 1) + r->to;
+  PROBABILITY sum;
+
+  if (r->index < 0) {
+    r->index = o % width;
+  } else if (r->index == 0) {
+    // the block above is complete
+    sum = 0;
+    for (i = 0; i < width; i++) {
+      sum += r->block[i];
+      r->upper[i] = sum;
+    }
+    memset(r->block, 0, sizeof(PROBABILITY) * width);
+    r->suffix = 0;
+    r->index = width - 1;
+  } else {
+    r->index--;
+  }
+  r->block[r->index] = joint;
+  r->suffix += joint;
+
+  // t's window is offsets o .. o + width - 1, the rest of this block and the head of the one above
+  sum = r->suffix;
+  if (r->index) sum += r->upper[r->index - 1];
+  if (t >= 0 && t < d->len) posterior[(unsigned long)columns->n_columns * t + r->column] += sum;
+}
+
+
+BOOL duration_forward_backward(model_def_struct *model_def, sequence_struct *sequence, posterior_columns_struct *columns, PROBABILITY *posterior) {
+  int distributor = model_def->silent_states_begin;
+  unsigned long n = model_def->n_states;
+  PROBABILITY *f_compact, *sf, *sb, *b_distributor, *rows, *inv_f, *inv_b, *tmp;
+  PROBABILITY s, scale = 1, scale_f, log_sr = 0;  // scale is row 0's once the backward loop is done
+  profile_timer_struct timer;
+  double pt = 0;
+  duration_struct d;
+  long len = sequence->len, t;
+  int c, i, j, r;
+
+  if (!setup_duration(&d, model_def, sequence, columns)) {
+    free_duration(&d);
+    return FALSE;
+  }
+
+  f_compact = alloc_table(sizeof(PROBABILITY) * d.n_compact * len);
+  sf = alloc_table(sizeof(PROBABILITY) * len);
+  sb = alloc_table(sizeof(PROBABILITY) * len);
+  b_distributor = alloc_table(sizeof(PROBABILITY) * len);
+  rows = ALLOC(sizeof(PROBABILITY) * n * 2);
+  inv_f = ALLOC(sizeof(PROBABILITY) * (d.max_len + 1));
+  inv_b = ALLOC(sizeof(PROBABILITY) * (d.max_len + 1));
+
+  profile_start(&timer);
+  for (t = 0; t < len; t++) {
+    PROBABILITY *row = rows + n * (t % 2), *prev_row = rows + n * ((t + 1) % 2), extra = 0;
+    char chr = d.symbols[t];
+
+    // scale factors of the rows a chain ending here has run through
+    inv_f[0] = 1;
+    for (i = 1; i <= d.max_len; i++) inv_f[i] = t - i >= 0 ? inv_f[i - 1] / sf[t - i] : inv_f[i - 1];
+
+    if (t == 0) {
+      for (r = 0; r < d.n_runs; r++) {
+        for (i = d.run_from[r]; i < d.run_to[r]; i++) row[i] = model_def->initial_probs[i] * fetch_emission_prob(model_def, i, chr);
+      }
+    } else {
+      duration_normal_row(&d, prev_row, row, chr, TRUE);
+      scale_distributor_edges(model_def, sequence, prev_row, row, t, TRUE);
+    }
+    for (c = 0; c < d.n_chains; c++) {
+      duration_chain_struct *chain = d.chains + c;
+      long start = t - chain->len + 1;
+      if (start >= 1) {
+        PROBABILITY entered = f_compact[(unsigned long)d.n_compact * (start - 1) + d.compact_silent + chain->silent - distributor] * chain->enter;
+        row[chain->start + chain->len - 1] = entered * chain->through * chain_emission(&d, chain, 0, start) * d.track[(unsigned long)start * d.n_chains + c] * inv_f[chain->len - 1];
+      } else {
+        row[chain->start + chain->len - 1] = chain_forward(&d, chain, f_compact, t, chain->len - 1, inv_f);
+      }
+      // the last row's sum covers the chains still under way, and the chain states in them are never held
+      if (t == len - 1) {
+        for (j = 0; j < chain->len - 1; j++) extra += chain_forward(&d, chain, f_compact, t, j, inv_f);
+      }
+    }
+    update_silent_row(model_def, row, chr, TRUE);
+    scale_distributor_edges(model_def, sequence, NULL, row, t, TRUE);
+    sf[t] = duration_normalize(&d, row, TRUE, extra);
+
+    PROBABILITY *stored = f_compact + (unsigned long)d.n_compact * t;
+    for (r = 0, i = 0; r < d.n_runs; r++) {
+      memcpy(stored + i, row + d.run_from[r], sizeof(PROBABILITY) * (d.run_to[r] - d.run_from[r]));
+      i += d.run_to[r] - d.run_from[r];
+    }
+    memcpy(stored + d.compact_silent, row + distributor, sizeof(PROBABILITY) * (n - distributor));
+  }
+  profile_stop(&timer, PHASE_FORWARD);
+
+  profile_start(&timer);
+  PROBABILITY *b_row = rows, *b_next = rows + n;
+  for (t = len - 1; t >= 0; t--) {
+    char chr = d.symbols[t];
+    PROBABILITY *f_row = f_compact + (unsigned long)d.n_compact * t, *out = posterior + (unsigned long)columns->n_columns * t;
+
+    inv_b[0] = 1;
+    for (i = 1; i <= d.max_len; i++) inv_b[i] = t + i < len ? inv_b[i - 1] / sb[t + i] : inv_b[i - 1];
+
+    if (t == len - 1) {
+      PROBABILITY each = 1.0 / distributor;
+      for (r = 0; r < d.n_runs; r++) {
+        for (i = d.run_from[r]; i < d.run_to[r]; i++) b_row[i] = each;
+      }
+      for (c = 0; c < d.n_chains; c++) b_row[d.chains[c].start] = each;
+      update_silent_row(model_def, b_row, chr, FALSE);
+      scale_distributor_edges(model_def, sequence, NULL, b_row, t, FALSE);
+      s = distributor;
+    } else {
+      duration_normal_row(&d, b_next, b_row, d.symbols[t + 1], FALSE);
+      for (c = 0; c < d.n_chains; c++) {
+        duration_chain_struct *chain = d.chains + c;
+        if (t + chain->len < len) b_row[chain->start] = chain->through * d.track[(unsigned long)t * d.n_chains + c] * chain->leave * b_distributor[t + chain->len] * inv_b[chain->len - 1];
+        else b_row[chain->start] = chain_backward(&d, chain, b_distributor, t, 0, inv_b);
+      }
+      update_silent_row(model_def, b_row, chr, FALSE);
+      scale_distributor_edges(model_def, sequence, NULL, b_row, t, FALSE);
+      s = duration_normalize(&d, b_row, FALSE, 0);
+    }
+    sb[t] = s;
+    b_distributor[t] = b_row[distributor];
+
+    // same recursion as calc_log_sr, run alongside the backward rows
+    if (t < len - 1) log_sr += log(sb[t + 1]) - log(sf[t + 1]);
+    scale = POSTERIOR_SCALE(s, log_sr);
+    scale_f = exp(log(s) + log_sr - log(sf[t]));
+
+    if (profiling) pt = profile_wall_clock();
+    for (c = 0; c < columns->n_columns; c++) out[c] = 0;
+    for (r = 0; r < d.n_kept_ranges; r++) {
+      duration_kept_range_struct *k = d.kept_ranges + r;
+      PROBABILITY sum = 0;
+      for (i = 0; i <= k->state_to - k->state_from; i++) sum += scale * f_row[k->compact_from + i] * b_row[k->state_from + i];
+      out[k->column] += sum;
+    }
+    for (r = 0; r < d.n_ranges; r++) {
+      duration_chain_struct *chain = d.ranges[r].chain;
+      PROBABILITY entered = t ? f_compact[(unsigned long)d.n_compact * (t - 1) + d.compact_silent + chain->silent - distributor] * chain->enter : model_def->initial_probs[chain->start];
+      PROBABILITY joint = scale_f * entered * chain_emission(&d, chain, 0, t) * b_row[chain->start];
+      push_start(&d, d.ranges + r, t + chain->len - 1, joint, columns, posterior);
+    }
+    if (profiling) timer.nested += profile_wall_clock() - pt;
+
+    tmp = b_next;
+    b_next = b_row;
+    b_row = tmp;
+  }
+
+  // chains the sequence begins inside of: state start + j at row 0, with inv_b still that of row 0
+  if (profiling) pt = profile_wall_clock();
+  for (r = 0; r < d.n_ranges; r++) {
+    duration_chain_struct *chain = d.ranges[r].chain;
+    for (j = 1; j < chain->len; j++) {
+      PROBABILITY forward = model_def->initial_probs[chain->start + j] * chain_emission(&d, chain, j, 0) / sf[0];
+      PROBABILITY joint = scale * forward * chain_backward(&d, chain, b_distributor, 0, j, inv_b) / sb[0];
+      push_start(&d, d.ranges + r, chain->len - 1 - j, joint, columns, posterior);
+    }
+  }
+  if (profiling) timer.nested += profile_wall_clock() - pt;
+  profile_stop_nested(&timer, PHASE_BACKWARD, PHASE_POSTERIOR);
+
+  free_table(f_compact);
+  free_table(sf);
+  free_table(sb);
+  free_table(b_distributor);
+  free(rows);
+  free(inv_f);
+  free(inv_b);
+  free_duration(&d);
+  return TRUE;
+}
+
+
+typedef struct {
+  model_def_struct *model_def;
+  sequence_struct **sequence;
+  posterior_columns_struct *columns;
+  void (*done)(void *, int, PROBABILITY *);
+  void *done_arg;
+  pthread_mutex_t done_lock;
+  BOOL failed;                    // a sequence was refused; the ones not started yet are skipped
+  scratch_table_struct *scratch;  // each worker's posteriors
+} duration_task_struct;
+
+
+static void duration_task(void *arg, int i, int worker) {
+  duration_task_struct *task = (duration_task_struct *)arg;
+  sequence_struct *sequence = task->sequence[i];
+  PROBABILITY *posterior;
+  BOOL ok;
+
+  pthread_mutex_lock(&task->done_lock);
+  ok = !task->failed;
+  pthread_mutex_unlock(&task->done_lock);
+  if (!ok) return;
+
+  posterior = reserve_scratch_table(task->scratch + worker, sizeof(PROBABILITY) * task->columns->n_columns * sequence->len);
+  ok = duration_forward_backward(task->model_def, sequence, task->columns, posterior);
+
+  pthread_mutex_lock(&task->done_lock);
+  if (!ok) task->failed = TRUE;
+  else if (!task->failed) task->done(task->done_arg, i, posterior);
+  pthread_mutex_unlock(&task->done_lock);
+}
+
+
+BOOL duration_on_all_seqs(model_def_struct *model_def, sequence_struct **sequence, int n_seqs, int n_threads, posterior_columns_struct *columns, void (*done)(void *, int, PROBABILITY *), void *done_arg) {
+  duration_task_struct task;
+  int i;
+
+  task.model_def = model_def;
+  task.sequence = sequence;
+  task.columns = columns;
+  task.done = done;
+  task.done_arg = done_arg;
+  task.failed = FALSE;
+  pthread_mutex_init(&task.done_lock, NULL);
+  if (n_threads < 1) n_threads = 1;
+  task.scratch = ALLOC(sizeof(scratch_table_struct) * n_threads);
+  memset(task.scratch, 0, sizeof(scratch_table_struct) * n_threads);
+
+  run_sequence_tasks(sequence, n_seqs, n_threads, duration_task, &task);
+
+  for (i = 0; i < n_threads; i++) free_scratch_table(task.scratch + i);
+  free(task.scratch);
+  pthread_mutex_destroy(&task.done_lock);
+  return !task.failed;
+}
@@ -0,0 +1,580 @@
+#include "libcompete.h"
+
+
+void find_motif_state_numbers(model_def_struct *model_def, int **starts, int **lens) {
+  int *motif_starts, *motif_lens;
+  int i, j;
+
+  motif_starts = ALLOC(sizeof(int) * (model_def->n_states - model_def->silent_states_begin));
+  motif_lens = ALLOC(sizeof(int) * (model_def->n_states - model_def->silent_states_begin));
+
+  for (i = model_def->silent_states_begin + 1; i < model_def->n_states; i++) {
+    // i is each silent state for a motif
+    int first = -1, second = -1;
+    for (j = 1; j < model_def->silent_states_begin; j++) {
+      if (fetch_transition_prob(model_def, i, j) > 0) {
+        if (first == -1) {
+          first = j;
+        } else {
+          second = j;
+          break;
+        }
+      }
+    }
+
+    motif_starts[i - model_def->silent_states_begin - 1] = first > second ? second : first;
+    motif_lens[i - model_def->silent_states_begin - 1] = abs(first - second);
+//    fprintf(stderr, "Motif %d start: %d\tlen: %d\n", i, motif_starts[i - model_def->silent_states_begin - 1], motif_lens[i - model_def->silent_states_begin - 1]);
+  }
+
+  *starts = motif_starts;
+  *lens = motif_lens;
+}
+
+
+BOOL find_nucleosome_states(model_def_struct *model_def, int *motif_starts, int *motif_lens, int *nuc_start, int *nuc_len) {
+  int distributor_index = model_def->silent_states_begin;
+  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  int end_of_last_motif = 1;
+  if (n_motifs > 0) end_of_last_motif = motif_starts[n_motifs-1] + 2*motif_lens[n_motifs-1];
+
+  if ((*nuc_len = distributor_index - end_of_last_motif) > 0) {
+    *nuc_start = distributor_index - *nuc_len;
+    return TRUE;
+  } else {
+    return FALSE;
+  }
+}
+
+
+int find_num_nucleosome_padding_states(model_def_struct *model_def, int nuc_start) {
+// the background states have transitions of exactly 1 leading out of them and into the next state.
+// following this along will show how many there are, plus 4 for the branched background state.
+
+  int i = nuc_start;
+  while (fetch_transition_prob(model_def, i, i + 1) == 1.0) i++;
+
+  return (i - nuc_start + 5);
+}
+
+
+void update_a0k_probabilities(model_def_struct *model_def) {
+// I know the silent states before each motif start at model_def->silent_states_begin + 1
+// I also know that the transitions from each one of these goes to exactly two states, which are the beginning of the forward and reverse motifs respectively.  So abs(index_of_one - index_of_other) must be the length of the motifs.
+// I also know the transition probabilities from the distributor state into each of these.
+// Therefore I have the information I need to implement the updating of a_{0k} as described in my document.
+
+  int *motif_starts, *motif_lens;
+  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  int distributor_index = model_def->silent_states_begin;
+  int i, j;
+  PROBABILITY sum = 0;
+
+  find_motif_state_numbers(model_def, &motif_starts, &motif_lens);
+  // start with background component, which is only 1 long...
+  sum = fetch_transition_prob(model_def, distributor_index, 0);
+  model_def->initial_probs[0] = sum;
+
+  for (i = 0; i < n_motifs; i++) {
+	PROBABILITY p = fetch_transition_prob(model_def, distributor_index, distributor_index + i + 1);
+	for (j = motif_starts[i]; j < motif_starts[i] + 2 * motif_lens[i]; j++) {
+	  model_def->initial_probs[j] = p;
+	  sum += p;
+	}
+  }
+
+  // determine if nucleosome is present
+  int nuc_len = 0;
+  int nuc_start = 0;
+  if (find_nucleosome_states(model_def, motif_starts, motif_lens, &nuc_start, &nuc_len)) {
+	PROBABILITY p = fetch_transition_prob(model_def, distributor_index, nuc_start);
+	int n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
+
+	// left (normal) padding states
+	for (i = nuc_start; i < nuc_start + n_padding_states - 4; i++) {
+	  model_def->initial_probs[i] = p;
+	  sum += p;
+	}
+
+	// branched padding state
+	for (i = nuc_start + n_padding_states - 4; i < nuc_start + n_padding_states; i++) {
+	  model_def->initial_probs[i] = p / 4.0;
+	  sum += p / 4.0;
+	}
+
+	// tons of nucleosome states, 16 per sequence position
+	for (i = nuc_start + n_padding_states; i < nuc_start + nuc_len - n_padding_states + 3; i++) {
+	  model_def->initial_probs[i] = p / 16.0;
+	  sum += p / 16.0;
+	}
+
+	// right branching states, all of which are normal
+	for (i = nuc_start + nuc_len - n_padding_states + 3; i < nuc_start + nuc_len; i++) {
+	  model_def->initial_probs[i] = p;
+	  sum += p;
+	}
+  }
+
+  for (i = 0; i < model_def->silent_states_begin; i++) {
+	model_def->initial_probs[i] /= sum;
+  }
+
+  free(motif_starts);
+  free(motif_lens);
+}
+
+
+// count of the edge parent -> child, or NULL if there is none
+static PROBABILITY *edge_count(model_def_struct *model_def, expected_counts_struct *counts, int parent, int child) {
+  edge_struct *edges = model_def->parent_edges[child];
+  int j;
+
+  for (j = 0; j < model_def->n_parents[child]; j++) {
+    if (edges[j].state == parent) return counts->transitions + (edges - model_def->parent_edge_pool) + j;
+  }
+  return NULL;
+}
+
+
+// index of the complement of each letter of the alphabet, or -1
+static void find_complements(model_def_struct *model_def, int *complement) {
+  static const char *pairs = "ATTACGGC";
+  int a, b, k;
+
+  for (a = 0; a < model_def->alphabet_length; a++) {
+    complement[a] = -1;
+    for (k = 0; pairs[k]; k += 2) {
+      if (toupper(model_def->alphabet[a]) != pairs[k]) continue;
+      for (b = 0; b < model_def->alphabet_length; b++) {
+        if (toupper(model_def->alphabet[b]) == pairs[k + 1]) complement[a] = b;
+      }
+    }
+  }
+}
+
+
+void tie_expected_counts(model_def_struct *model_def, expected_counts_struct *counts) {
+  int *motif_starts, *motif_lens;
+  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  int distributor_index = model_def->silent_states_begin;
+  int n = model_def->alphabet_length;
+  int *complement = ALLOC(sizeof(int) * n);
+  PROBABILITY *pooled = ALLOC(sizeof(PROBABILITY) * n);
+  BOOL complemented = TRUE;
+  int i, b, m;
+
+  find_motif_state_numbers(model_def, &motif_starts, &motif_lens);
+  find_complements(model_def, complement);
+  for (b = 0; b < n; b++) {
+    if (complement[b] < 0) complemented = FALSE;
+  }
+
+  for (m = 0; m < n_motifs; m++) {
+    PROBABILITY *forward = edge_count(model_def, counts, distributor_index + m + 1, motif_starts[m]);
+    PROBABILITY *reverse = edge_count(model_def, counts, distributor_index + m + 1, motif_starts[m] + motif_lens[m]);
+    if (forward && reverse) *forward = *reverse = (*forward + *reverse) / 2;
+
+    // position i of the forward strand is position motif_lens[m] - 1 - i of the reverse one.  an alphabet without
+    // complements leaves the strands untied
+    if (!complemented) continue;
+    for (i = 0; i < motif_lens[m]; i++) {
+      PROBABILITY *e_f = counts->emissions + (motif_starts[m] + i) * n;
+      PROBABILITY *e_r = counts->emissions + (motif_starts[m] + 2 * motif_lens[m] - 1 - i) * n;
+      for (b = 0; b < n; b++) pooled[b] = e_f[b] + e_r[complement[b]];
+      for (b = 0; b < n; b++) e_f[b] = e_r[complement[b]] = pooled[b];
+    }
+  }
+
+  // the branches share out their count by their current weights, which the M step then gives back
+  int nuc_len = 0;
+  int nuc_start = 0;
+  if (find_nucleosome_states(model_def, motif_starts, motif_lens, &nuc_start, &nuc_len)) {
+    int n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
+    int branch = nuc_start + n_padding_states - 5;
+    PROBABILITY count = 0, weight = 0;
+    for (i = branch + 1; i <= branch + 4; i++) {
+      PROBABILITY *c = edge_count(model_def, counts, branch, i);
+      if (!c) continue;
+      count += *c;
+      weight += fetch_transition_prob(model_def, branch, i);
+    }
+    for (i = branch + 1; i <= branch + 4 && weight > 0; i++) {
+      PROBABILITY *c = edge_count(model_def, counts, branch, i);
+      if (c) *c = count * fetch_transition_prob(model_def, branch, i) / weight;
+    }
+  }
+
+  free(complement);
+  free(pooled);
+  free(motif_starts);
+  free(motif_lens);
+}
+
+
+void apply_temperature(model_def_struct *model_def, int *motif_starts, int *motif_lens, int nuc_start, int nuc_len, PROBABILITY T) {
+// T is the inverse temperature parameter, as describe in Segal's ImplementationNotes.pdf
+  int i, j, k;
+
+  // scale background emissions
+  for (i = 0; i < model_def->alphabet_length; i++) {
+    PROBABILITY p = fetch_emission_prob(model_def, 0, i);
+    set_emission_prob(model_def, 0, i, pow(p, T));
+  }
+
+  // scale motif emissions
+  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  for (i = 0; i < n_motifs; i++) {
+    for (j = motif_starts[i]; j < motif_starts[i] + 2 * motif_lens[i]; j++) {
+      for (k = 0; k < model_def->alphabet_length; k++) {
+        PROBABILITY p = fetch_emission_prob(model_def, j, k);
+        set_emission_prob(model_def, j, k, pow(p, T));
+      }
+    }
+  }
+
+
+  // scale nucleosome emissions/transitions
+  if (nuc_start > 0) {
+    int n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
+
+    // number of bases/positions in the actual nucleosome; ideally 147 but practically less due to data limitations; padding on the right is 3 shorter than the left, since there's no branched bg state
+    int n_nuc_pos = (nuc_len - (2 * n_padding_states - 3)) / 16;
+
+    // normal background states in the beginning of the padding
+    for (i = nuc_start; i < nuc_start + n_padding_states - 4; i++) {
+      for (j = 0; j < model_def->alphabet_length; j++) {
+        PROBABILITY p = fetch_emission_prob(model_def, i, j);
+        set_emission_prob(model_def, i, j, pow(p, T));
+      }
+    }
+
+    // normal background states at the end of the padding
+    for (i = nuc_start + nuc_len - (n_padding_states - 3); i < nuc_start + nuc_len; i++) {
+      for (j = 0; j < model_def->alphabet_length; j++) {
+        PROBABILITY p = fetch_emission_prob(model_def, i, j);
+        set_emission_prob(model_def, i, j, pow(p, T));
+      }
+    }
+
+    // transitions into branched background state's 4 branches
+    for (i = nuc_start + n_padding_states - 4; i < nuc_start + n_padding_states; i++) {
+      PROBABILITY p = fetch_transition_prob(model_def, nuc_start + n_padding_states - 5, i);
+      set_transition_prob(model_def, nuc_start + n_padding_states - 5, i, pow(p, T));
+    }
+
+    // handle the transitions from the branched background state into the first nucleosome states
+    for (i = nuc_start + n_padding_states - 4; i < nuc_start + n_padding_states; i++) {
+      for (j = nuc_start + n_padding_states; j < nuc_start + n_padding_states + 16; j++) {
+        PROBABILITY p = fetch_transition_prob(model_def, i, j);
+        set_transition_prob(model_def, i, j, pow(p, T));
+      }
+    }
+
+    // handle the transitions between nucleosome states
+    for (i = 0; i < n_nuc_pos - 1; i++) {
+      for (j = nuc_start + n_padding_states + 16 * i; j < nuc_start + n_padding_states + 16 * (i + 1); j++) {
+        for (k = nuc_start + n_padding_states + 16 * (i + 1); k < nuc_start + n_padding_states + 16 * (i + 2); k++) {
+          PROBABILITY p = fetch_transition_prob(model_def, j, k);
+          set_transition_prob(model_def, j, k, pow(p, T));
+        }
+      }
+    }
+
+  }
+}
+
+
+state_range_struct *append_state_range(state_range_struct *list, int from, int to) {
+  state_range_struct *range = ALLOC(sizeof(state_range_struct));
+  state_range_struct *last;
+
+  range->state_from = from;
+  range->state_to = to;
+  range->next_range = NULL;
+  if (!list) return range;
+
+  for (last = list; last->next_range; last = last->next_range);
+  last->next_range = range;
+  return list;
+}
+
+
+posterior_columns_struct *build_summed_state_columns(model_def_struct *model_def, int *motif_starts, int *motif_lens, char **motif_names, BOOL output_start_probs_only) {
+  posterior_columns_struct *columns;
+  int j, c;
+  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  int nuc_start, nuc_len, n_padding_states;
+  BOOL nuc_present = FALSE;
+  char name[64];
+
+  if (nuc_present = find_nucleosome_states(model_def, motif_starts, motif_lens, &nuc_start, &nuc_len)) {
+//    n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
+    n_padding_states = 5;
+  }
+
+  columns = ALLOC(sizeof(posterior_columns_struct));
+  columns->n_columns = 1 + n_motifs + (nuc_present ? 2 : 0);
+  columns->names = ALLOC(sizeof(char *) * columns->n_columns);
+  columns->ranges = ALLOC(sizeof(state_range_struct *) * columns->n_columns);
+  memset(columns->ranges, 0, sizeof(state_range_struct *) * columns->n_columns);
+
+  c = 0;
+  columns->names[c] = strdup("background");
+  columns->ranges[c] = append_state_range(NULL, 0, 0);
+  c++;
+
+  for (j = 0; j < n_motifs; j++, c++) {
+    if (!motif_names) {
+      sprintf(name, "motif_%d", j);
+      columns->names[c] = strdup(name);
+    } else {
+      columns->names[c] = strdup(motif_names[j]);
+    }
+
+    if (!output_start_probs_only) {
+      columns->ranges[c] = append_state_range(columns->ranges[c], motif_starts[j], motif_starts[j] + motif_lens[j] - 1);
+      columns->ranges[c] = append_state_range(columns->ranges[c], motif_starts[j] + motif_lens[j], motif_starts[j] + 2 * motif_lens[j] - 1);
+    } else {
+      columns->ranges[c] = append_state_range(columns->ranges[c], motif_starts[j], motif_starts[j]);
+      columns->ranges[c] = append_state_range(columns->ranges[c], motif_starts[j] + motif_lens[j], motif_starts[j] + motif_lens[j]);
+    }
+  }
+
+  if (nuc_present) {
+    columns->names[c] = strdup("nuc_padding");
+    columns->ranges[c] = append_state_range(columns->ranges[c], nuc_start, nuc_start + n_padding_states - 1);
+    columns->ranges[c] = append_state_range(columns->ranges[c], nuc_start + nuc_len - n_padding_states, nuc_start + nuc_len - 1);
+    c++;
+
+    columns->names[c] = strdup("nucleosome");
+    if (!output_start_probs_only) {
+      columns->ranges[c] = append_state_range(columns->ranges[c], nuc_start + n_padding_states, nuc_start + nuc_len - n_padding_states - 1);
+    } else {
+      columns->ranges[c] = append_state_range(columns->ranges[c], nuc_start + n_padding_states, nuc_start + n_padding_states);
+    }
+    c++;
+  }
+
+  return columns;
+}
+
+
+static void add_output_column(posterior_columns_struct *columns, char *name, state_range_struct *ranges) {
+  columns->names[columns->n_columns] = strdup(name);
+  columns->ranges[columns->n_columns] = ranges;
+  columns->n_columns++;
+}
+
+
+/* the states of the nucleosome element at its position-th position: the left padding's chain, then its branched
+   state (four), the dinucleotide blocks (sixteen each) and the right padding's chain, one state per position
+*/
+static state_range_struct *nucleosome_position_states(int nuc_start, int n_padding_states, int n_nuc_pos, int position) {
+  int chain = n_padding_states - 4;
+
+  if (position < chain) return append_state_range(NULL, nuc_start + position, nuc_start + position);
+  if (position == chain) return append_state_range(NULL, nuc_start + chain, nuc_start + n_padding_states - 1);
+  if (position <= chain + n_nuc_pos) {
+    int block = nuc_start + n_padding_states + 16 * (position - chain - 1);
+    return append_state_range(NULL, block, block + 15);
+  }
+  position = nuc_start + n_padding_states + 16 * n_nuc_pos + position - chain - 1 - n_nuc_pos;
+  return append_state_range(NULL, position, position);
+}
+
+
+posterior_columns_struct *build_output_columns(model_def_struct *model_def, int *motif_starts, int *motif_lens, char **motif_names, int n_groups, int *groups, int *first_column) {
+  posterior_columns_struct *columns, *occupancy;
+  int n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  int nuc_start, nuc_len, n_padding_states = 0, n_nuc_pos = 0, n_nuc_positions = 0;
+  int g, i, j, capacity;
+  BOOL nuc_present;
+  char name[256];
+
+  if (nuc_present = find_nucleosome_states(model_def, motif_starts, motif_lens, &nuc_start, &nuc_len)) {
+    // the 16-per-position dinucleotide states sit between the left and right padding, as in apply_temperature()
+    n_padding_states = find_num_nucleosome_padding_states(model_def, nuc_start);
+    n_nuc_pos = (nuc_len - (2 * n_padding_states - 3)) / 16;
+    n_nuc_positions = n_padding_states - 3 + n_nuc_pos + nuc_len - n_padding_states - 16 * n_nuc_pos;
+  }
+
+  capacity = 0;
+  for (g = 0; g < n_groups; g++) capacity += groups[g] == OUTPUT_STARTS ? 2 * n_motifs : 3 + n_motifs;
+  columns = ALLOC(sizeof(posterior_columns_struct));
+  columns->n_columns = 0;
+  columns->names = ALLOC(sizeof(char *) * (capacity > 0 ? capacity : 1));
+  columns->ranges = ALLOC(sizeof(state_range_struct *) * (capacity > 0 ? capacity : 1));
+
+  for (g = 0; g < n_groups; g++) {
+    first_column[g] = columns->n_columns;
+    switch (groups[g]) {
+      case OUTPUT_OCCUPANCY:
+        occupancy = build_summed_state_columns(model_def, motif_starts, motif_lens, motif_names, FALSE);
+        for (i = 0; i < occupancy->n_columns; i++) {
+          columns->names[columns->n_columns] = occupancy->names[i];
+          columns->ranges[columns->n_columns++] = occupancy->ranges[i];
+        }
+        free(occupancy->names);
+        free(occupancy->ranges);
+        free(occupancy);
+        break;
+
+      case OUTPUT_STARTS:
+        // a site's first state on either strand is at its leftmost position
+        for (j = 0; j < n_motifs; j++) {
+          if (motif_names) snprintf(name, sizeof(name), "%s+", motif_names[j]);
+          else snprintf(name, sizeof(name), "motif_%d+", j);
+          add_output_column(columns, name, append_state_range(NULL, motif_starts[j], motif_starts[j]));
+          name[strlen(name) - 1] = '-';
+          add_output_column(columns, name, append_state_range(NULL, motif_starts[j] + motif_lens[j], motif_starts[j] + motif_lens[j]));
+        }
+        break;
+
+      case OUTPUT_PADDING:
+        // the states of build_summed_state_columns()' nuc_padding column, five on either side
+        if (!nuc_present) break;
+        add_output_column(columns, "nuc_padding", append_state_range(append_state_range(NULL, nuc_start, nuc_start + 4), nuc_start + nuc_len - 5, nuc_start + nuc_len - 1));
+        break;
+
+      case OUTPUT_NUCLEOSOME:
+        // the nucleosome proper lies between the five positions of padding on either side, as in the columns above
+        if (!nuc_present) break;
+        add_output_column(columns, "nucleosome_start", nucleosome_position_states(nuc_start, n_padding_states, n_nuc_pos, 5));
+        add_output_column(columns, "nucleosome_dyad", nucleosome_position_states(nuc_start, n_padding_states, n_nuc_pos, 5 + (n_nuc_positions - 11) / 2));
+        break;
+    }
+  }
+  first_column[n_groups] = columns->n_columns;
+
+  return columns;
+}
+
+
+void free_posterior_columns(posterior_columns_struct *columns) {
+  int i;
+  state_range_struct *range, *next;
+
+  for (i = 0; i < columns->n_columns; i++) {
+    free(columns->names[i]);
+    for (range = columns->ranges[i]; range; range = next) {
+      next = range->next_range;
+      free(range);
+    }
+  }
+  free(columns->names);
+  free(columns->ranges);
+  free(columns);
+}
+
+
+void apply_parameter_set(model_def_struct *model_def, parameter_set_struct *set, int *motif_starts, int *motif_lens, int nuc_start, int nuc_len) {
+  int i, n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  profile_timer_struct timer;
+
+  profile_start(&timer);
+  set_transition_prob(model_def, model_def->silent_states_begin, 0, set->unbound_conc);
+  set_transition_prob(model_def, model_def->silent_states_begin, nuc_start, set->nuc_conc);
+  for (i = 0; i < n_motifs; i++)
+    set_transition_prob(model_def, model_def->silent_states_begin, model_def->silent_states_begin + i + 1, set->motif_conc[i]);
+
+  apply_temperature(model_def, motif_starts, motif_lens, nuc_start, nuc_len, set->T);
+  update_a0k_probabilities(model_def);
+  profile_stop(&timer, PHASE_TEMPERATURE);
+}
+
+
+compete_model_struct *compete_load_model(char *filename, char **motif_names, BOOL output_start_probs_only) {
+  compete_model_struct *model;
+  model_def_struct *model_def = initialize_model(filename, NULL, 0);
+
+  finalize_model(model_def);
+  model = compete_wrap_model(model_def, motif_names, output_start_probs_only);
+  model->owned = TRUE;
+  return model;
+}
+
+
+compete_model_struct *compete_wrap_model(model_def_struct *model_def, char **motif_names, BOOL output_start_probs_only) {
+  compete_model_struct *model = ALLOC(sizeof(compete_model_struct));
+
+  model->model_def = model_def;
+  model->owned = FALSE;
+  model->n_motifs = model_def->n_states - model_def->silent_states_begin - 1;
+  find_motif_state_numbers(model_def, &model->motif_starts, &model->motif_lens);
+  model->nuc_start = model->nuc_len = 0;
+  model->nuc_present = find_nucleosome_states(model_def, model->motif_starts, model->motif_lens, &model->nuc_start, &model->nuc_len);
+  if (model->nuc_present && !model_def->nuc_kernel) {
+    // the 16-per-position dinucleotide states sit between the left and right padding, as in apply_temperature()
+    int n_padding_states = find_num_nucleosome_padding_states(model_def, model->nuc_start);
+    int n_nuc_pos = (model->nuc_len - (2 * n_padding_states - 3)) / 16;
+    enable_nucleosome_kernel(model_def, model->nuc_start + n_padding_states, n_nuc_pos);
+  }
+  model->columns = build_summed_state_columns(model_def, model->motif_starts, model->motif_lens, motif_names, output_start_probs_only);
+
+  return model;
+}
+
+
+void compete_free_model(compete_model_struct *model) {
+  if (model->owned) free_model(model->model_def);
+  free(model->motif_starts);
+  free(model->motif_lens);
+  free_posterior_columns(model->columns);
+  free(model);
+}
+
+
+compete_context_struct *compete_new_context(compete_model_struct *model, int checkpoint_interval) {
+  compete_context_struct *context = ALLOC(sizeof(compete_context_struct));
+
+  context->model = model;
+  context->lane = clone_model(model->model_def);
+  context->checkpoint_interval = checkpoint_interval;
+  context->f_table = NULL;
+  context->sf = NULL;
+  context->posterior = NULL;
+  context->capacity = 0;
+  return context;
+}
+
+
+void compete_free_context(compete_context_struct *context) {
+  free_model_clone(context->lane);
+  free_table(context->f_table);
+  free_table(context->sf);
+  free_table(context->posterior);
+  free(context);
+}
+
+
+void compete_run(compete_context_struct *context, sequence_struct *sequence, parameter_set_struct *set, compete_sink sink, void *sink_arg) {
+  compete_model_struct *model = context->model;
+  model_def_struct *model_def = context->lane;
+  int n_columns = model->columns->n_columns;
+
+  // the buffers only ever grow, so a context serving many small regions allocates once
+  if (sequence->len > context->capacity) {
+    free_table(context->f_table);
+    free_table(context->sf);
+    free_table(context->posterior);
+    context->capacity = sequence->len;
+    context->f_table = context->checkpoint_interval != 0 ? NULL : alloc_table(forward_table_size(model_def, context->capacity));
+    context->sf = context->checkpoint_interval != 0 ? NULL : alloc_table(sizeof(PROBABILITY) * context->capacity);
+    context->posterior = alloc_table(sizeof(PROBABILITY) * n_columns * context->capacity);
+  }
+
+  // only the probabilities change from run to run, so the lane's state and edge lists are reused as they are
+  restore_model_probabilities(model_def, model->model_def);
+  apply_parameter_set(model_def, set, model->motif_starts, model->motif_lens, model->nuc_start, model->nuc_len);
+  refresh_nucleosome_kernel(model_def);
+  refresh_emission_tables(model_def);
+
+  if (context->checkpoint_interval != 0) {
+    int interval = context->checkpoint_interval > 0 ? context->checkpoint_interval : default_checkpoint_interval(sequence->len);
+    checkpointed_forward_backward(model_def, sequence, interval, model->columns, context->posterior);
+  } else {
+    forward_fused_posterior(model_def, sequence, context->f_table, context->sf, model->columns, context->posterior);
+  }
+
+  sink(sink_arg, model, sequence, context->posterior);
+}
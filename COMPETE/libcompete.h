@@ -0,0 +1,112 @@
+#ifndef LIBCOMPETE_H
+#define LIBCOMPETE_H
+
+#include "bc.h"
+
+/* libcompete: the COMPETE model on top of the bc.c engines (which states are motifs and the nucleosome, how the
+   concentrations and temperature change their probabilities, which posteriors make up each output column) and a
+   reentrant way to run it.  a compete_model_struct is finalized once and only ever read afterwards, so any number of
+   threads can share it.  each thread runs through a compete_context_struct of its own, which owns the copy of the
+   probabilities a parameter set overwrites and the tables and posteriors a run fills in.
+*/
+
+
+// column groups of a multi-output run (compete --outputs), which one forward-backward pass fills together
+#define OUTPUT_OCCUPANCY 0   // the columns of build_summed_state_columns(): background, motifs, nuc_padding, nucleosome
+#define OUTPUT_STARTS 1      // each motif's start probabilities by strand, <name>+ and <name>-
+#define OUTPUT_PADDING 2     // nuc_padding alone
+#define OUTPUT_NUCLEOSOME 3  // nucleosome_start and nucleosome_dyad: the nucleosome's first and middle positions
+#define N_OUTPUT_GROUPS 4
+
+
+// the distributor transitions and temperature of one run; the options -n, -u, -t and -m
+typedef struct {
+  PROBABILITY nuc_conc, unbound_conc, T;
+  PROBABILITY *motif_conc;
+  int line; // line of the sweep file it came from
+} parameter_set_struct;
+
+
+typedef struct {
+  model_def_struct *model_def;  // finalized, with no parameter set applied
+  BOOL owned;                   // model_def is freed with the model
+  int n_motifs;
+  int *motif_starts, *motif_lens;
+  BOOL nuc_present;
+  int nuc_start, nuc_len;
+  posterior_columns_struct *columns;
+} compete_model_struct;
+
+
+typedef struct {
+  compete_model_struct *model;
+  model_def_struct *lane;        // clone of model->model_def, whose probabilities each run overwrites
+  int checkpoint_interval;       // 0 for whole forward tables, negative for each sequence's default interval
+  void *f_table;                 // whole table buffers, and the posteriors.  they grow to the longest sequence run
+  PROBABILITY *sf, *posterior;
+  long capacity;                 // positions the buffers hold
+} compete_context_struct;
+
+
+// receives the posteriors of a compete_run(), sequence->len by model->columns->n_columns.  they're the context's,
+// and only valid until its next run
+typedef void (*compete_sink)(void *arg, compete_model_struct *model, sequence_struct *sequence, PROBABILITY *posterior);
+
+
+void find_motif_state_numbers(model_def_struct *model_def, int **starts, int **lens);
+
+BOOL find_nucleosome_states(model_def_struct *model_def, int *motif_starts, int *motif_lens, int *nuc_start, int *nuc_len);
+
+int find_num_nucleosome_padding_states(model_def_struct *model_def, int nuc_start);
+
+// initial probabilities of the normal states, from the distributor's transitions into each element
+void update_a0k_probabilities(model_def_struct *model_def);
+
+/* tie_func of compete --train: each motif's strands share their edge from the motif's silent state and emit
+   reverse complements of each other, so their counts are pooled.  the edges into the nucleosome's branched padding
+   states carry the background distribution, which the M step doesn't reestimate, and are held fixed
+*/
+void tie_expected_counts(model_def_struct *model_def, expected_counts_struct *counts);
+
+void apply_temperature(model_def_struct *model_def, int *motif_starts, int *motif_lens, int nuc_start, int nuc_len, PROBABILITY T);
+
+state_range_struct *append_state_range(state_range_struct *list, int from, int to);
+
+// background, each motif (named motif_i unless motif_names is given), and the nucleosome padding and body
+posterior_columns_struct *build_summed_state_columns(model_def_struct *model_def, int *motif_starts, int *motif_lens, char **motif_names, BOOL output_start_probs_only);
+
+/* INPUTS:
+   groups: n_groups of OUTPUT_OCCUPANCY ... OUTPUT_NUCLEOSOME, in the order their columns are wanted
+   OUTPUTS:
+   the groups' columns one after the other, group g's from first_column[g] (n_groups + 1 entries) on.  the
+   nucleosome groups have no columns in models without nucleosomes
+*/
+posterior_columns_struct *build_output_columns(model_def_struct *model_def, int *motif_starts, int *motif_lens, char **motif_names, int n_groups, int *groups, int *first_column);
+
+void free_posterior_columns(posterior_columns_struct *columns);
+
+void apply_parameter_set(model_def_struct *model_def, parameter_set_struct *set, int *motif_starts, int *motif_lens, int nuc_start, int nuc_len);
+
+
+// reads filename (a config or compiled model) and finalizes it
+compete_model_struct *compete_load_model(char *filename, char **motif_names, BOOL output_start_probs_only);
+
+// the same around a finalized model_def the caller keeps, enabling its nucleosome kernel if it hasn't been
+compete_model_struct *compete_wrap_model(model_def_struct *model_def, char **motif_names, BOOL output_start_probs_only);
+
+void compete_free_model(compete_model_struct *model);
+
+compete_context_struct *compete_new_context(compete_model_struct *model, int checkpoint_interval);
+
+void compete_free_context(compete_context_struct *context);
+
+/* INPUTS:
+   context: the calling thread's context
+   sequence: sequence to run the model on
+   set: concentrations and temperature to apply to the model first
+   OUTPUTS:
+   calls sink(sink_arg, model, sequence, posterior) with the summed posteriors of every position
+*/
+void compete_run(compete_context_struct *context, sequence_struct *sequence, parameter_set_struct *set, compete_sink sink, void *sink_arg);
+
+#endif
@@ -0,0 +1,391 @@
+#include "output.h"
+
+
+BOOL parse_output_format(char *str, int *format, int *precision, PROBABILITY *threshold) {
+  char *arg = strchr(str, ':');
+  size_t len = arg ? arg - str : strlen(str);
+
+  if (arg) arg++;
+  if (len == 4 && strncmp(str, "text", len) == 0 && !arg) {
+    *format = OUTPUT_TEXT;
+  } else if (len == 7 && strncmp(str, "compact", len) == 0) {
+    *format = OUTPUT_COMPACT;
+    if (arg) *precision = atoi(arg);
+    if (*precision < 0 || *precision > MAX_COMPACT_PRECISION) return FALSE;
+  } else if (len == 6 && strncmp(str, "binary", len) == 0 && !arg) {
+    *format = OUTPUT_BINARY;
+  } else if (len == 6 && strncmp(str, "sparse", len) == 0) {
+    *format = OUTPUT_SPARSE;
+    if (arg) *threshold = atof(arg);
+  } else {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+
+posterior_writer_struct *open_posterior_writer(FILE *file, int format, int precision, PROBABILITY threshold) {
+  posterior_writer_struct *writer = ALLOC(sizeof(posterior_writer_struct));
+
+  writer->file = file;
+  writer->format = format;
+  writer->precision = precision;
+  writer->threshold = threshold;
+  writer->buffer = ALLOC(OUTPUT_BUFFER_SIZE);
+  writer->used = 0;
+
+  return writer;
+}
+
+
+void flush_posterior_writer(posterior_writer_struct *writer) {
+  if (writer->used > 0 && fwrite(writer->buffer, writer->used, 1, writer->file) != 1) {
+    fprintf(stderr, "Error writing output.  Exiting.\n");
+    exit(1);
+  }
+  writer->used = 0;
+  fflush(writer->file);
+}
+
+
+void close_posterior_writer(posterior_writer_struct *writer) {
+  profile_timer_struct timer;
+
+  profile_start(&timer);
+  flush_posterior_writer(writer);
+  profile_stop(&timer, PHASE_OUTPUT);
+  free(writer->buffer);
+  free(writer);
+}
+
+
+// room for at least size more bytes in the buffer
+static void reserve(posterior_writer_struct *writer, size_t size) {
+  if (writer->used + size > OUTPUT_BUFFER_SIZE) flush_posterior_writer(writer);
+  if (size > OUTPUT_BUFFER_SIZE) {
+    fprintf(stderr, "Output record too long.  Exiting.\n");
+    exit(1);
+  }
+}
+
+
+static void put_bytes(posterior_writer_struct *writer, const void *data, size_t size) {
+  reserve(writer, size);
+  memcpy(writer->buffer + writer->used, data, size);
+  writer->used += size;
+}
+
+
+static void put_string(posterior_writer_struct *writer, const char *str) {
+  put_bytes(writer, str, strlen(str));
+}
+
+
+static void put_printf(posterior_writer_struct *writer, const char *format, ...) {
+  va_list ap;
+  int n;
+
+  reserve(writer, 256);
+  va_start(ap, format);
+  n = vsnprintf(writer->buffer + writer->used, OUTPUT_BUFFER_SIZE - writer->used, format, ap);
+  va_end(ap);
+  if (n >= OUTPUT_BUFFER_SIZE - writer->used) {
+    // didn't fit after all; make room and try again
+    flush_posterior_writer(writer);
+    reserve(writer, n + 1);
+    va_start(ap, format);
+    vsnprintf(writer->buffer + writer->used, OUTPUT_BUFFER_SIZE - writer->used, format, ap);
+    va_end(ap);
+  }
+  writer->used += n;
+}
+
+
+// "%.<precision>f" without the trailing zeros (and without the point, if nothing is left after it).  values that
+// fit are written by hand, since snprintf dominates the run time of small models
+static void put_compact(posterior_writer_struct *writer, PROBABILITY p) {
+  static const double scale[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9};
+  char digits[32], *out;
+  int precision = writer->precision, i, n;
+
+  reserve(writer, 64);
+  out = writer->buffer + writer->used;
+
+  if (precision > 9 || !(p >= 0 && p < 1e9)) {
+    // out of the fast path's range (including nan)
+    n = snprintf(out, 64, "%.*f", precision, p);
+    if (precision > 0) {
+      while (out[n - 1] == '0') n--;
+      if (out[n - 1] == '.') n--;
+    }
+    writer->used += n;
+    return;
+  }
+
+  unsigned long long v = (unsigned long long)llround(p * scale[precision]);
+  unsigned long long whole = v / (unsigned long long)scale[precision];
+  unsigned long long frac = v % (unsigned long long)scale[precision];
+
+  n = 0;
+  do {
+    digits[n++] = '0' + whole % 10;
+    whole /= 10;
+  } while (whole);
+  for (i = 0; i < n; i++) *out++ = digits[n - 1 - i];
+
+  if (frac) {
+    // drop the trailing zeros, then write the rest zero padded to the remaining width
+    int width = precision;
+    while (frac % 10 == 0) {
+      frac /= 10;
+      width--;
+    }
+    *out++ = '.';
+    for (i = width - 1; i >= 0; i--) {
+      out[i] = '0' + frac % 10;
+      frac /= 10;
+    }
+    out += width;
+  }
+
+  writer->used = out - writer->buffer;
+}
+
+
+static void write_text_block(posterior_writer_struct *writer, char *label, posterior_columns_struct *columns, int first, int n, PROBABILITY *posterior, long len) {
+  long i;
+  int j;
+
+  if (label) put_printf(writer, "# %s\n", label);
+
+  // header
+  for (j = first; j < first + n; j++) {
+    if (j > first) put_string(writer, "\t");
+    put_string(writer, columns->names[j]);
+  }
+  put_string(writer, "\n");
+
+  for (i = 0; i < len; i++) {
+    PROBABILITY *row = posterior + (unsigned long)columns->n_columns * i;
+    for (j = first; j < first + n; j++) {
+      if (j > first) put_string(writer, "\t");
+      if (writer->format == OUTPUT_TEXT) put_printf(writer, "%.20f", row[j]);
+      else put_compact(writer, row[j]);
+    }
+    put_string(writer, "\n");
+  }
+}
+
+
+// background (the first column) is left out, since it is above any useful threshold nearly everywhere
+static void write_sparse_block(posterior_writer_struct *writer, char *label, posterior_columns_struct *columns, int first, int n, PROBABILITY *posterior, long len) {
+  long i;
+  int j;
+
+  if (label) put_printf(writer, "# %s\n", label);
+  put_printf(writer, "# sparse, %ld positions, threshold %g\n", len, writer->threshold);
+  put_string(writer, "position\tdbf\toccupancy\n");
+
+  for (i = 0; i < len; i++) {
+    PROBABILITY *row = posterior + (unsigned long)columns->n_columns * i;
+    for (j = first > 0 ? first : 1; j < first + n; j++) {
+      if (row[j] <= writer->threshold) continue;
+      put_printf(writer, "%ld\t%s\t", i, columns->names[j]);
+      put_compact(writer, row[j]);
+      put_string(writer, "\n");
+    }
+  }
+}
+
+
+static void write_binary_block(posterior_writer_struct *writer, char *label, posterior_columns_struct *columns, int first, int n, PROBABILITY *posterior, long len) {
+  static const char padding[4] = {0};
+  int version = POSTERIOR_BINARY_VERSION, label_len = label ? strlen(label) : 0;
+  long long n_rows = len;
+  size_t header_size;
+  long i;
+  int j;
+
+  put_bytes(writer, POSTERIOR_BINARY_MAGIC, 8);
+  put_bytes(writer, &version, sizeof(int));
+  put_bytes(writer, &n, sizeof(int));
+  put_bytes(writer, &n_rows, sizeof(long long));
+  put_bytes(writer, &label_len, sizeof(int));
+  put_bytes(writer, label, label_len);
+  header_size = 8 + 3 * sizeof(int) + sizeof(long long) + label_len;
+  for (j = first; j < first + n; j++) {
+    put_bytes(writer, columns->names[j], strlen(columns->names[j]) + 1);
+    header_size += strlen(columns->names[j]) + 1;
+  }
+  put_bytes(writer, padding, (4 - header_size % 4) % 4);
+
+  for (i = 0; i < len; i++) {
+    PROBABILITY *row = posterior + (unsigned long)columns->n_columns * i + first;
+    reserve(writer, sizeof(float) * n);
+    float *out = (float *)(writer->buffer + writer->used);
+    for (j = 0; j < n; j++) {
+      float v = row[j];
+      memcpy(out + j, &v, sizeof(float));
+    }
+    writer->used += sizeof(float) * n;
+  }
+}
+
+
+void write_posterior_columns(posterior_writer_struct *writer, char *label, posterior_columns_struct *columns, int first, int n, PROBABILITY *posterior, long len) {
+  profile_timer_struct timer;
+
+  profile_start(&timer);
+  switch (writer->format) {
+    case OUTPUT_BINARY:
+      write_binary_block(writer, label, columns, first, n, posterior, len);
+      break;
+    case OUTPUT_SPARSE:
+      write_sparse_block(writer, label, columns, first, n, posterior, len);
+      break;
+    default:
+      write_text_block(writer, label, columns, first, n, posterior, len);
+  }
+  profile_stop(&timer, PHASE_OUTPUT);
+}
+
+
+void write_posterior_block(posterior_writer_struct *writer, char *label, posterior_columns_struct *columns, PROBABILITY *posterior, long len) {
+  write_posterior_columns(writer, label, columns, 0, columns->n_columns, posterior, len);
+}
+
+
+BOOL read_count_intervals(char *filename, interval_counts_struct *counts) {
+  char line[4096], chrom[1024], name[1024];
+  int allocated = 64, line_number = 0, n;
+  long from, to;
+  FILE *f;
+
+  if (!(f = fopen(filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", filename);
+    return FALSE;
+  }
+
+  counts->n_intervals = 0;
+  counts->intervals = ALLOC(sizeof(count_interval_struct) * allocated);
+  while (fgets(line, sizeof(line), f)) {
+    line_number++;
+    // comments, and the header lines genome browsers put before the intervals
+    if (line[strspn(line, " \t\r\n")] == '\0' || line[0] == '#' || strncmp(line, "track", 5) == 0 || strncmp(line, "browser", 7) == 0) continue;
+    if ((n = sscanf(line, "%1023s %ld %ld %1023s", chrom, &from, &to, name)) < 3 || from < 0 || to < from) {
+      fprintf(stderr, "%s line %d is not a BED interval.\n", filename, line_number);
+      fclose(f);
+      return FALSE;
+    }
+
+    if (counts->n_intervals == allocated) {
+      allocated *= 2;
+      counts->intervals = realloc(counts->intervals, sizeof(count_interval_struct) * allocated);
+    }
+    counts->intervals[counts->n_intervals].chrom = strdup(chrom);
+    counts->intervals[counts->n_intervals].name = n > 3 ? strdup(name) : NULL;
+    counts->intervals[counts->n_intervals].from = from;
+    counts->intervals[counts->n_intervals].to = to;
+    counts->n_intervals++;
+  }
+
+  fclose(f);
+  return TRUE;
+}
+
+
+// TRUE if a BED chromosome names the seq_file region: by the name itself, past "store:", or by its file name
+static BOOL chrom_matches(char *chrom, char *region) {
+  char *base = strrchr(region, ':') ? strrchr(region, ':') + 1 : (strrchr(region, '/') ? strrchr(region, '/') + 1 : region);
+  char *extension = strrchr(base, '.');
+
+  if (strcmp(chrom, region) == 0 || strcmp(chrom, base) == 0) return TRUE;
+  return extension && (size_t)(extension - base) == strlen(chrom) && strncmp(chrom, base, extension - base) == 0;
+}
+
+
+static void write_interval_counts(interval_counts_struct *counts, int n_columns, char *label, char *region, long begin, PROBABILITY *posterior, long len) {
+  long from, to, p;
+  int i, j;
+
+  if (!counts->header_written) {
+    fprintf(counts->file, "chrom\tstart\tend\tname");
+    for (j = 0; j < counts->n_counts; j++) fprintf(counts->file, "\t%s", counts->names[j]);
+    fprintf(counts->file, "\n");
+    counts->header_written = TRUE;
+  }
+  if (label) fprintf(counts->file, "# %s\n", label);
+
+  for (i = 0; i < counts->n_intervals; i++) {
+    count_interval_struct *interval = counts->intervals + i;
+
+    // BED positions are 0-based, the region's 1-based
+    from = interval->from > begin - 1 ? interval->from : begin - 1;
+    to = interval->to < begin - 1 + len ? interval->to : begin - 1 + len;
+    if (from >= to || !chrom_matches(interval->chrom, region)) continue;
+
+    fprintf(counts->file, "%s\t%ld\t%ld\t%s", interval->chrom, from, to, interval->name ? interval->name : ".");
+    for (j = 0; j < counts->n_counts; j++) {
+      PROBABILITY sum = 0;
+      for (p = from - (begin - 1); p < to - (begin - 1); p++) {
+        PROBABILITY *row = posterior + (unsigned long)n_columns * p;
+        sum += row[counts->columns[2 * j]];
+        if (counts->columns[2 * j + 1] >= 0) sum += row[counts->columns[2 * j + 1]];
+      }
+      fprintf(counts->file, "\t%.10g", sum);
+    }
+    fprintf(counts->file, "\n");
+  }
+}
+
+
+void write_posterior_outputs(posterior_outputs_struct *outputs, char *label, char *region, long begin, PROBABILITY *posterior, long len) {
+  profile_timer_struct timer;
+  int i;
+
+  for (i = 0; i < outputs->n_sinks; i++) {
+    posterior_sink_struct *sink = outputs->sinks + i;
+    write_posterior_columns(sink->writer, label, outputs->columns, sink->first_column, sink->n_columns, posterior, len);
+    flush_posterior_writer(sink->writer);
+  }
+
+  if (outputs->counts) {
+    profile_start(&timer);
+    write_interval_counts(outputs->counts, outputs->columns->n_columns, label, region, begin, posterior, len);
+    profile_stop(&timer, PHASE_OUTPUT);
+  }
+}
+
+
+void close_posterior_outputs(posterior_outputs_struct *outputs) {
+  interval_counts_struct *counts = outputs->counts;
+  int i;
+
+  for (i = 0; i < outputs->n_sinks; i++) {
+    if (!outputs->sinks[i].file) continue;
+    close_posterior_writer(outputs->sinks[i].writer);
+    if (fclose(outputs->sinks[i].file) != 0) {
+      fprintf(stderr, "Error writing output.  Exiting.\n");
+      exit(1);
+    }
+  }
+  free(outputs->sinks);
+
+  if (counts) {
+    if (counts->owned ? fclose(counts->file) != 0 : fflush(counts->file) != 0) {
+      fprintf(stderr, "Error writing output.  Exiting.\n");
+      exit(1);
+    }
+    for (i = 0; i < counts->n_intervals; i++) {
+      free(counts->intervals[i].chrom);
+      free(counts->intervals[i].name);
+    }
+    free(counts->intervals);
+    for (i = 0; i < counts->n_counts; i++) free(counts->names[i]);
+    free(counts->names);
+    free(counts->columns);
+    free(counts);
+  }
+  free(outputs);
+}
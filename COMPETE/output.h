@@ -0,0 +1,114 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "bc.h"
+#include <stdarg.h>
+
+// posterior output formats, selected with -O
+#define OUTPUT_TEXT 0     // tab-delimited, "%.20f" per cell, as compete has always written
+#define OUTPUT_COMPACT 1  // tab-delimited, fixed precision with trailing zeros dropped
+#define OUTPUT_BINARY 2   // float32 rows behind a header naming the columns
+#define OUTPUT_SPARSE 3   // one line per position and DBF whose occupancy is above a threshold
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+#define DEFAULT_COMPACT_PRECISION 6
+#define MAX_COMPACT_PRECISION 20  // OUTPUT_TEXT's, so compact can stand in for it
+#define DEFAULT_SPARSE_THRESHOLD 0.01
+
+// binary blocks start with this; see write_posterior_block() for the layout
+#define POSTERIOR_BINARY_MAGIC "COMPETEp"
+#define POSTERIOR_BINARY_VERSION 1
+
+
+typedef struct {
+  FILE *file;
+  int format;
+  int precision;          // OUTPUT_COMPACT and OUTPUT_SPARSE: digits after the decimal point, at most MAX_COMPACT_PRECISION
+  PROBABILITY threshold;  // OUTPUT_SPARSE: smallest occupancy written
+  char *buffer;           // OUTPUT_BUFFER_SIZE bytes, flushed to file when full
+  size_t used;
+} posterior_writer_struct;
+
+
+// parses a -O argument: text, compact[:precision], binary or sparse[:threshold].  returns FALSE if it makes no sense
+BOOL parse_output_format(char *str, int *format, int *precision, PROBABILITY *threshold);
+
+posterior_writer_struct *open_posterior_writer(FILE *file, int format, int precision, PROBABILITY threshold);
+
+/* INPUTS:
+   writer: where to write
+   label: if not NULL, a line identifying the block (a "# " comment in the text formats, part of the header in binary)
+   columns: names of the len by columns->n_columns posterior table's columns
+   posterior: the table, row index is sequence position
+
+   binary blocks are: POSTERIOR_BINARY_MAGIC, then int32 version, int32 n_columns, int64 n_rows, int32 label length and
+   the label, then each column name NUL-terminated, zero padding to a multiple of 4 bytes from the start of the block,
+   and finally n_rows rows of n_columns float32s.  everything is in the byte order of the machine that wrote it.
+*/
+void write_posterior_block(posterior_writer_struct *writer, char *label, posterior_columns_struct *columns, PROBABILITY *posterior, long len);
+
+// the same for n of the table's columns, from column first on
+void write_posterior_columns(posterior_writer_struct *writer, char *label, posterior_columns_struct *columns, int first, int n, PROBABILITY *posterior, long len);
+
+// one destination of a multi-output run (compete --outputs): n_columns of the run's columns from first_column on
+typedef struct {
+  int first_column, n_columns;
+  posterior_writer_struct *writer;
+  FILE *file;  // opened for the sink, or NULL if writer is the run's main one, which the caller closes
+} posterior_sink_struct;
+
+
+// a line of a BED file: from is 0-based and to exclusive
+typedef struct {
+  char *chrom, *name;  // name is NULL if the line has no fourth field
+  long from, to;
+} count_interval_struct;
+
+
+/* expected number of sites of each DBF in each interval of a BED file (compete --counts): the sum over the
+   interval's positions of the probability that a site starts there, on either strand.  written as text, one line
+   per interval and sequence region it overlaps, clipped to the region
+*/
+typedef struct {
+  int n_intervals;
+  count_interval_struct *intervals;
+  int n_counts;
+  char **names;   // the DBFs counted
+  int *columns;   // [n_counts][2]: the run's columns summed into each count, the second -1 if there's only one
+  FILE *file;
+  BOOL owned;     // file is closed with the counts
+  BOOL header_written;
+} interval_counts_struct;
+
+
+// everything a multi-output run writes from the posteriors of its one pass
+typedef struct {
+  posterior_columns_struct *columns;  // the run's
+  int n_sinks;
+  posterior_sink_struct *sinks;
+  interval_counts_struct *counts;     // NULL unless counts are written
+} posterior_outputs_struct;
+
+
+// reads filename's intervals into counts.  returns FALSE, with a message, if it can't
+BOOL read_count_intervals(char *filename, interval_counts_struct *counts);
+
+/* INPUTS:
+   label: as for write_posterior_block(), for every sink
+   region, begin: the seq_file name and first position (1-based) of the len position sequence the posteriors are of,
+   which counts are matched to the BED chromosomes by: the name itself, the part after "store:", or its file name
+   with or without the extension
+*/
+void write_posterior_outputs(posterior_outputs_struct *outputs, char *label, char *region, long begin, PROBABILITY *posterior, long len);
+
+// flushes every sink and the counts, closing the files they opened, and frees outputs; outputs->columns is left
+void close_posterior_outputs(posterior_outputs_struct *outputs);
+
+// write everything buffered so far
+void flush_posterior_writer(posterior_writer_struct *writer);
+
+// flushes and frees the writer; the file is left open
+void close_posterior_writer(posterior_writer_struct *writer);
+
+#endif
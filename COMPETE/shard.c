@@ -0,0 +1,466 @@
+#include "shard.h"
+#include <limits.h>
+
+
+// filename made absolute, so workers started elsewhere find it; as given if it can't be resolved
+static void write_manifest_path(FILE *f, char *key, char *filename) {
+  char path[PATH_MAX];
+
+  fprintf(f, "# %s\t%s\n", key, filename && realpath(filename, path) ? path : (filename ? filename : ""));
+}
+
+
+int plan_shards(char *manifest_filename, char *model_filename, char *seq_filename, char *scaling_filename, int n_states, int n_motifs, char **motif_names, BOOL start_probs_only, parameter_set_struct *sets, int n_sets, long window, long overlap, double unit_cost) {
+  FILE *f, *f_index;
+  char name[256];
+  long begin_read, end_read, len, core_from, core_to;
+  int line = 0, n_units = 0, s, j;
+
+  if (overlap < 0) overlap = 0;
+  // a core shorter than the overlap would spend most of the unit on discarded positions
+  if (window > 0 && window < overlap) {
+    fprintf(stderr, "-w %ld is shorter than -o %ld.\n", window, overlap);
+    exit(1);
+  }
+  if (window <= 0) {
+    window = (long)(unit_cost / n_states) - 2 * overlap;
+    if (window < overlap) window = overlap;
+    if (window < 1) window = 1;
+  }
+  if (motif_names) {
+    for (j = 0; j < n_motifs && motif_names[j]; j++);
+    if (j < n_motifs) {
+      fprintf(stderr, "-N names %d motifs, but %s has %d.\n", j, model_filename, n_motifs);
+      exit(1);
+    }
+  }
+
+  if (!(f_index = fopen(seq_filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", seq_filename);
+    exit(1);
+  }
+  if (!(f = fopen(manifest_filename, "w"))) {
+    fprintf(stderr, "Opening %s for writing failed.\n", manifest_filename);
+    exit(1);
+  }
+
+  fprintf(f, "# compete shard manifest\t%d\n", SHARD_MANIFEST_VERSION);
+  write_manifest_path(f, "model", model_filename);
+  write_manifest_path(f, "seq_file", seq_filename);
+  write_manifest_path(f, "scaling", scaling_filename);
+  fprintf(f, "# overlap\t%ld\n", overlap);
+  fprintf(f, "# motifs\t%d\n", n_motifs);
+  fprintf(f, "# motif_names\t");
+  if (!motif_names || n_motifs == 0) fprintf(f, "-");
+  for (j = 0; motif_names && j < n_motifs; j++) fprintf(f, "%s%s", j ? "," : "", motif_names[j]);
+  fprintf(f, "\n# start_probs_only\t%d\n", start_probs_only ? 1 : 0);
+  fprintf(f, "unit\tline\tsequence\tbegin\tend\tset\tn\tu\tt\tm\tfrom\tto\tcore_from\tcore_to\tcost\n");
+
+  while (fscanf(f_index, "%255s %ld %ld\n", name, &begin_read, &end_read) > 0) {
+    sequence_struct *sequence = ALLOC(sizeof(sequence_struct));
+
+    line++;
+    if (!read_sequence_region(name, begin_read, end_read, sequence)) {
+      fprintf(stderr, "%s line %d.  Exiting.\n", seq_filename, line);
+      exit(1);
+    }
+    len = sequence->len;
+    free_sequence(sequence);
+
+    for (s = 0; s < n_sets; s++) {
+      for (core_from = 0; core_from < len; core_from = core_to) {
+        long from, to;
+        core_to = core_from + window < len ? core_from + window : len;
+        from = core_from - overlap > 0 ? core_from - overlap : 0;
+        to = core_to + overlap < len ? core_to + overlap : len;
+
+        fprintf(f, "%d\t%d\t%s\t%ld\t%ld\t%d\t%.17g\t%.17g\t%.17g\t", n_units++, line, name, begin_read, end_read, sets[s].line, sets[s].nuc_conc, sets[s].unbound_conc, sets[s].T);
+        if (n_motifs == 0) fprintf(f, "-");
+        for (j = 0; j < n_motifs; j++) fprintf(f, "%s%.17g", j ? "," : "", sets[s].motif_conc[j]);
+        fprintf(f, "\t%ld\t%ld\t%ld\t%ld\t%.6g\n", from, to, core_from, core_to, (double)n_states * (to - from));
+      }
+    }
+  }
+
+  fclose(f_index);
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Error writing %s.  Exiting.\n", manifest_filename);
+    exit(1);
+  }
+  return n_units;
+}
+
+
+shard_manifest_struct *read_shard_manifest(char *filename) {
+  shard_manifest_struct *manifest;
+  char line[8192], *key, *value, *token, *save, *str, *motif_names = NULL;
+  unsigned long settings = 14695981039346656037UL;
+  int allocated = 0, line_number = 0, version = 0, field, j;
+  FILE *f;
+
+  if (!(f = fopen(filename, "r"))) {
+    fprintf(stderr, "Opening %s for reading failed.\n", filename);
+    exit(1);
+  }
+
+  manifest = ALLOC(sizeof(shard_manifest_struct));
+  memset(manifest, 0, sizeof(shard_manifest_struct));
+  manifest->n_motifs = -1;
+
+  while (fgets(line, sizeof(line), f)) {
+    line_number++;
+    line[strcspn(line, "\r\n")] = '\0';
+
+    if (line[0] == '#') {
+      // every unit's partial depends on these
+      settings = fingerprint_bytes(settings, line, strlen(line));
+      key = strtok_r(line + 1, "\t", &save);
+      value = strtok_r(NULL, "\t", &save);
+      while (key && *key == ' ') key++;
+      if (!key || !value) continue;
+      if (strcmp(key, "compete shard manifest") == 0) version = atoi(value);
+      else if (strcmp(key, "model") == 0) manifest->model_filename = strdup(value);
+      else if (strcmp(key, "seq_file") == 0) manifest->seq_filename = strdup(value);
+      else if (strcmp(key, "scaling") == 0) manifest->scaling_filename = strdup(value);
+      else if (strcmp(key, "overlap") == 0) manifest->overlap = atol(value);
+      else if (strcmp(key, "motifs") == 0) manifest->n_motifs = atoi(value);
+      else if (strcmp(key, "motif_names") == 0) motif_names = strdup(value);
+      else if (strcmp(key, "start_probs_only") == 0) manifest->start_probs_only = atoi(value) != 0;
+      continue;
+    }
+    if (line[0] == '\0' || strncmp(line, "unit\t", 5) == 0) continue;
+
+    if (version != SHARD_MANIFEST_VERSION || manifest->n_motifs < 0 || !manifest->model_filename || !motif_names) {
+      fprintf(stderr, "%s is not a compete shard manifest, or was written by an incompatible version.\n", filename);
+      exit(1);
+    }
+    if (strcmp(motif_names, "-") != 0 && !manifest->motif_names) {
+      manifest->motif_names = ALLOC(sizeof(char *) * manifest->n_motifs);
+      for (j = 0, token = strtok_r(motif_names, ",", &save); token && j < manifest->n_motifs; j++, token = strtok_r(NULL, ",", &save)) manifest->motif_names[j] = strdup(token);
+      if (j < manifest->n_motifs || token) {
+        fprintf(stderr, "%s names %s%d motifs, but has %d.\n", filename, token ? "more than " : "", j, manifest->n_motifs);
+        exit(1);
+      }
+    }
+
+    if (manifest->n_units == allocated) {
+      allocated = allocated ? 2 * allocated : 64;
+      manifest->units = realloc(manifest->units, sizeof(shard_unit_struct) * allocated);
+    }
+    shard_unit_struct *unit = manifest->units + manifest->n_units;
+    unit->fingerprint = fingerprint_bytes(settings, line, strlen(line));
+    unit->set.motif_conc = ALLOC(sizeof(PROBABILITY) * (manifest->n_motifs > 0 ? manifest->n_motifs : 1));
+    unit->sequence = NULL;
+
+    for (field = 0, token = strtok_r(line, "\t", &save); token && field < 15; field++, token = strtok_r(NULL, "\t", &save)) {
+      switch (field) {
+        case 0: unit->unit = atoi(token); break;
+        case 1: unit->line = atoi(token); break;
+        case 2: unit->sequence = strdup(token); break;
+        case 3: unit->begin = atol(token); break;
+        case 4: unit->end = atol(token); break;
+        case 5: unit->set.line = atoi(token); break;
+        case 6: unit->set.nuc_conc = atof(token); break;
+        case 7: unit->set.unbound_conc = atof(token); break;
+        case 8: unit->set.T = atof(token); break;
+        case 9:
+          for (j = 0, str = token; j < manifest->n_motifs && *str; j++) {
+            unit->set.motif_conc[j] = atof(str);
+            if (!(str = strchr(str, ','))) break;
+            str++;
+          }
+          break;
+        case 10: unit->from = atol(token); break;
+        case 11: unit->to = atol(token); break;
+        case 12: unit->core_from = atol(token); break;
+        case 13: unit->core_to = atol(token); break;
+        case 14: unit->cost = atof(token); break;
+      }
+    }
+    if (field != 15 || unit->unit != manifest->n_units || unit->from > unit->core_from || unit->core_from >= unit->core_to || unit->core_to > unit->to) {
+      fprintf(stderr, "%s line %d: not a unit of the manifest.\n", filename, line_number);
+      exit(1);
+    }
+    manifest->n_units++;
+  }
+
+  fclose(f);
+  free(motif_names);
+  return manifest;
+}
+
+
+void free_shard_manifest(shard_manifest_struct *manifest) {
+  int i;
+
+  for (i = 0; i < manifest->n_units; i++) {
+    free(manifest->units[i].sequence);
+    free(manifest->units[i].set.motif_conc);
+  }
+  free(manifest->units);
+  if (manifest->motif_names) {
+    for (i = 0; i < manifest->n_motifs; i++) free(manifest->motif_names[i]);
+    free(manifest->motif_names);
+  }
+  free(manifest->model_filename);
+  free(manifest->seq_filename);
+  free(manifest->scaling_filename);
+  free(manifest);
+}
+
+
+char *shard_partial_filename(char *parts_dir, int unit) {
+  char *filename = ALLOC(strlen(parts_dir) + 32);
+
+  sprintf(filename, "%s/unit_%d.part", parts_dir, unit);
+  return filename;
+}
+
+
+/* opens unit's partial and reads its header and column names, leaving f at the first row.  NULL unless it's the
+   partial of that unit of the manifest, with every row there
+*/
+static FILE *open_shard_partial(shard_manifest_struct *manifest, int unit, char *parts_dir, shard_partial_header_struct *header, char ***names) {
+  shard_unit_struct *u = manifest->units + unit;
+  char *filename = shard_partial_filename(parts_dir, unit);
+  FILE *f = fopen(filename, "rb");
+  struct stat sb;
+  long offset;
+  int c, i;
+
+  free(filename);
+  if (!f) return NULL;
+  if (fread(header, sizeof(shard_partial_header_struct), 1, f) != 1 || memcmp(header->magic, SHARD_PARTIAL_MAGIC, sizeof(header->magic)) != 0 || header->version != SHARD_PARTIAL_VERSION || header->unit != unit || header->fingerprint != u->fingerprint || header->n_rows != u->core_to - u->core_from || header->n_columns < 1) {
+    fclose(f);
+    return NULL;
+  }
+
+  *names = ALLOC(sizeof(char *) * header->n_columns);
+  for (i = 0; i < header->n_columns; i++) {
+    char name[256];
+    int length = 0;
+    while ((c = fgetc(f)) > 0) {
+      if (length < sizeof(name) - 1) name[length++] = c;
+    }
+    name[length] = '\0';
+    (*names)[i] = strdup(name);
+    if (c < 0) break;
+  }
+
+  // a partial only has its full size once it was written through
+  offset = (ftell(f) + 7) / 8 * 8;
+  fstat(fileno(f), &sb);
+  if (i < header->n_columns || sb.st_size != offset + (long)sizeof(PROBABILITY) * header->n_columns * header->n_rows) {
+    for (; i >= 0; i--) if (i < header->n_columns) free((*names)[i]);
+    free(*names);
+    fclose(f);
+    return NULL;
+  }
+  fseek(f, offset, SEEK_SET);
+  return f;
+}
+
+
+static void free_names(char **names, int n) {
+  int i;
+
+  for (i = 0; i < n; i++) free(names[i]);
+  free(names);
+}
+
+
+BOOL shard_partial_done(shard_manifest_struct *manifest, int unit, char *parts_dir, int n_columns) {
+  shard_partial_header_struct header;
+  char **names;
+  FILE *f = open_shard_partial(manifest, unit, parts_dir, &header, &names);
+
+  if (!f) return FALSE;
+  fclose(f);
+  free_names(names, header.n_columns);
+  return n_columns <= 0 || header.n_columns == n_columns;
+}
+
+
+typedef struct {
+  shard_manifest_struct *manifest;
+  int unit;
+  char *parts_dir;
+} shard_output_struct;
+
+
+// compete_run() sink of a unit: its core rows go to the partial
+static void write_shard_partial(void *arg, compete_model_struct *model, sequence_struct *sequence, PROBABILITY *posterior) {
+  shard_output_struct *output = (shard_output_struct *)arg;
+  shard_unit_struct *u = output->manifest->units + output->unit;
+  posterior_columns_struct *columns = model->columns;
+  shard_partial_header_struct header;
+  char *filename = shard_partial_filename(output->parts_dir, output->unit);
+  char *temporary = ALLOC(strlen(filename) + 32);
+  static const char zeros[8] = {0};
+  long offset;
+  FILE *f;
+  int i;
+
+  sprintf(temporary, "%s.%d.tmp", filename, (int)getpid());
+  if (!(f = fopen(temporary, "wb"))) {
+    fprintf(stderr, "Opening %s for writing failed.\n", temporary);
+    exit(1);
+  }
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, SHARD_PARTIAL_MAGIC, sizeof(header.magic));
+  header.version = SHARD_PARTIAL_VERSION;
+  header.unit = output->unit;
+  header.n_columns = columns->n_columns;
+  header.n_rows = u->core_to - u->core_from;
+  header.fingerprint = u->fingerprint;
+  fwrite(&header, sizeof(header), 1, f);
+  offset = sizeof(header);
+  for (i = 0; i < columns->n_columns; i++) {
+    fwrite(columns->names[i], strlen(columns->names[i]) + 1, 1, f);
+    offset += strlen(columns->names[i]) + 1;
+  }
+  fwrite(zeros, (8 - offset % 8) % 8, 1, f);
+  fwrite(posterior + (unsigned long)columns->n_columns * (u->core_from - u->from), sizeof(PROBABILITY) * columns->n_columns, header.n_rows, f);
+
+  if (fclose(f) != 0 || rename(temporary, filename) != 0) {
+    fprintf(stderr, "Error writing %s.  Exiting.\n", filename);
+    unlink(temporary);
+    exit(1);
+  }
+  free(temporary);
+  free(filename);
+}
+
+
+void run_shard_unit(shard_manifest_struct *manifest, int unit, char *parts_dir, compete_model_struct *model, int checkpoint_interval) {
+  shard_unit_struct *u = manifest->units + unit;
+  compete_context_struct *context;
+  shard_output_struct output;
+  sequence_struct *sequence, window;
+  int i;
+
+  if (manifest->n_motifs != model->n_motifs) {
+    fprintf(stderr, "The manifest has %d motifs, but %s has %d.\n", manifest->n_motifs, manifest->model_filename, model->n_motifs);
+    exit(1);
+  }
+  if (shard_partial_done(manifest, unit, parts_dir, model->columns->n_columns)) return;
+
+  sequence = ALLOC(sizeof(sequence_struct));
+  if (!read_sequence_region(u->sequence, u->begin, u->end, sequence)) {
+    fprintf(stderr, "Unit %d.  Exiting.\n", unit);
+    exit(1);
+  }
+  if (sequence->len < u->to) {
+    fprintf(stderr, "Unit %d runs to position %ld, but %s is only %ld long now.\n", unit, u->to, u->sequence, sequence->len);
+    exit(1);
+  }
+
+  // the scaling file is one block per seq_file line, as in a normal run; each line's length is where its last
+  // unit's core ends
+  if (manifest->scaling_filename && *manifest->scaling_filename) {
+    int *scaled_states = ALLOC(sizeof(int) * (model->n_motifs + 1));
+    int n_lines = 0;
+    for (i = 0; i < model->n_motifs; i++) scaled_states[i] = model->model_def->silent_states_begin + i + 1;
+    scaled_states[model->n_motifs] = model->nuc_start;
+    for (i = 0; i < manifest->n_units; i++) if (manifest->units[i].line > n_lines) n_lines = manifest->units[i].line;
+    long *line_lens = ALLOC(sizeof(long) * n_lines);
+    position_scaling_struct **scalings = ALLOC(sizeof(position_scaling_struct *) * n_lines);
+    memset(line_lens, 0, sizeof(long) * n_lines);
+    for (i = 0; i < manifest->n_units; i++) {
+      if (manifest->units[i].core_to > line_lens[manifest->units[i].line - 1]) line_lens[manifest->units[i].line - 1] = manifest->units[i].core_to;
+    }
+    read_sequence_scalings(manifest->scaling_filename, model->n_motifs + (model->nuc_present ? 1 : 0), scaled_states, line_lens, n_lines, scalings);
+    for (i = 0; i < n_lines; i++) {
+      if (i == u->line - 1) sequence->scaling = scalings[i];
+      else free_position_scaling(scalings[i]);
+    }
+    free(scalings);
+    free(line_lens);
+    free(scaled_states);
+  }
+
+  sequence_view(sequence, u->from, u->to - u->from, &window);
+  output.manifest = manifest;
+  output.unit = unit;
+  output.parts_dir = parts_dir;
+  context = compete_new_context(model, checkpoint_interval);
+  compete_run(context, &window, &u->set, write_shard_partial, &output);
+  compete_free_context(context);
+  free_sequence(sequence);
+}
+
+
+int merge_shards(shard_manifest_struct *manifest, char *parts_dir, posterior_writer_struct *writer) {
+  shard_partial_header_struct header;
+  posterior_columns_struct columns;
+  PROBABILITY *posterior;
+  char **names, *label;
+  int missing = 0, n_lines = 0, length, first, last, i, j;
+  FILE *f;
+
+  for (i = 0; i < manifest->n_units; i++) {
+    if (!shard_partial_done(manifest, i, parts_dir, 0)) {
+      fprintf(stderr, "unit %d has no partial result\n", i);
+      missing++;
+    }
+  }
+  if (missing > 0) return missing;
+  for (i = 0; i < manifest->n_units; i++) if (manifest->units[i].line > n_lines) n_lines = manifest->units[i].line;
+
+  label = ALLOC(64 * (manifest->n_motifs + 4));
+  for (first = 0; first < manifest->n_units; first = last) {
+    shard_unit_struct *u = manifest->units + first;
+    long len;
+
+    // a track is every unit of the same region and parameter set, its cores in order from 0
+    for (last = first + 1; last < manifest->n_units && manifest->units[last].line == u->line && manifest->units[last].set.line == u->set.line && manifest->units[last].core_from == manifest->units[last - 1].core_to; last++);
+    if (u->core_from != 0) {
+      fprintf(stderr, "Unit %d starts a track at position %ld.  Exiting.\n", first, u->core_from);
+      exit(1);
+    }
+    len = manifest->units[last - 1].core_to;
+
+    posterior = NULL;
+    columns.n_columns = 0;
+    for (i = first; i < last; i++) {
+      f = open_shard_partial(manifest, i, parts_dir, &header, &names);
+      if (!posterior) {
+        columns.n_columns = header.n_columns;
+        columns.names = names;
+        columns.ranges = NULL;
+        posterior = ALLOC(sizeof(PROBABILITY) * columns.n_columns * len);
+      } else {
+        for (j = 0; j < header.n_columns && j < columns.n_columns && strcmp(names[j], columns.names[j]) == 0; j++);
+        if (header.n_columns != columns.n_columns || j < columns.n_columns) {
+          fprintf(stderr, "Unit %d's columns differ from unit %d's.  Exiting.\n", i, first);
+          exit(1);
+        }
+        free_names(names, header.n_columns);
+      }
+      if (fread(posterior + (unsigned long)columns.n_columns * manifest->units[i].core_from, sizeof(PROBABILITY) * columns.n_columns, header.n_rows, f) != header.n_rows) {
+        fprintf(stderr, "Error reading the partial result of unit %d.  Exiting.\n", i);
+        exit(1);
+      }
+      fclose(f);
+    }
+
+    // blocks are labelled as a normal run of the same seq_file and sweep would label them
+    if (n_lines > 1 && u->set.line > 0) length = sprintf(label, "seq_filenames line %d, sweep line %d: ", u->line, u->set.line);
+    else if (u->set.line > 0) length = sprintf(label, "sweep line %d: ", u->set.line);
+    else if (n_lines > 1) length = sprintf(label, "seq_filenames line %d, %ld positions", u->line, len);
+    else length = 0;
+    if (u->set.line > 0) {
+      length += sprintf(label + length, "-n %g -u %g -t %g -m ", u->set.nuc_conc, u->set.unbound_conc, u->set.T);
+      for (j = 0; j < manifest->n_motifs; j++) length += sprintf(label + length, "%s%g", j ? "," : "", u->set.motif_conc[j]);
+    }
+
+    write_posterior_block(writer, length > 0 ? label : NULL, &columns, posterior, len);
+    flush_posterior_writer(writer);
+    free_names(columns.names, columns.n_columns);
+    free(posterior);
+  }
+
+  free(label);
+  return 0;
+}
@@ -0,0 +1,100 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "libcompete.h"
+#include "output.h"
+
+/* sharded runs: compete --plan-shards splits every seq_file region by every parameter set into units of work of
+   about the same cost, each a window of one region whose core positions it owns, extended by the overlap on either
+   side as in windowed_forward_backward().  a manifest lists them, and any number of machines run units from it
+   (compete --run-shard), each leaving a partial result in a shared directory.  compete --merge-shards stitches the
+   cores back into one track per region and parameter set, once every unit's partial is there.
+
+   the manifest is tab-delimited text: "# key<TAB>value" lines naming the model, seq_file and scaling file (absolute
+   paths), the overlap, and the output columns (-N's motif names, or "-", and -s), then a header line and one line
+   per unit.  positions are 0-based and half-open within the unit's region, and cost is n_states times the window's
+   length.
+*/
+
+#define SHARD_MANIFEST_VERSION 2
+#define DEFAULT_SHARD_COST 1e10  // n_states times positions per unit: a few minutes of the nucleosome model
+
+// partial results start with this, and are refused unless the version matches
+#define SHARD_PARTIAL_MAGIC "COMPETEu"
+#define SHARD_PARTIAL_VERSION 1
+
+
+typedef struct {
+  int unit;
+  int line;                  // of seq_file, from 1
+  char *sequence;            // the region, as on that line
+  long begin, end;
+  parameter_set_struct set;  // set.line is the sweep file line, 0 for the command line's parameters
+  long from, to;             // window run
+  long core_from, core_to;   // of it, positions kept
+  double cost;
+  unsigned long fingerprint; // of the manifest's "#" lines and the unit's line, which its partial has to match
+} shard_unit_struct;
+
+
+typedef struct {
+  char *model_filename, *seq_filename, *scaling_filename;
+  long overlap;
+  int n_motifs;
+  char **motif_names;        // -N when planned, n_motifs of them; NULL without
+  BOOL start_probs_only;     // -s when planned
+  int n_units;
+  shard_unit_struct *units;
+} shard_manifest_struct;
+
+
+// partial files are this header, the n_columns NUL-terminated column names padded to a multiple of 8 bytes from
+// the start of the file, and n_rows (core_to - core_from) rows of n_columns doubles
+typedef struct {
+  char magic[8];
+  int version;
+  int unit;
+  int n_columns;
+  int pad;
+  long long n_rows;
+  unsigned long fingerprint;
+} shard_partial_header_struct;
+
+
+/* INPUTS:
+   manifest_filename: manifest to write
+   model_filename, seq_filename, scaling_filename: the files of a normal run, recorded for the workers
+   n_states: states of the model, for the cost of each unit
+   motif_names, start_probs_only: -N and -s, which every unit's output columns are built with
+   sets: the n_sets parameter sets to run every region with, n_motifs motif concentrations each
+   window: if positive, the core positions of each unit, at least overlap; otherwise as many as bring a unit to
+           unit_cost
+   overlap: positions each window is extended by on either side
+   returns the number of units written
+*/
+int plan_shards(char *manifest_filename, char *model_filename, char *seq_filename, char *scaling_filename, int n_states, int n_motifs, char **motif_names, BOOL start_probs_only, parameter_set_struct *sets, int n_sets, long window, long overlap, double unit_cost);
+
+shard_manifest_struct *read_shard_manifest(char *filename);
+
+void free_shard_manifest(shard_manifest_struct *manifest);
+
+// where unit's partial result lives in parts_dir; the caller frees it
+char *shard_partial_filename(char *parts_dir, int unit);
+
+// TRUE if unit's partial in parts_dir is complete and matches the manifest
+BOOL shard_partial_done(shard_manifest_struct *manifest, int unit, char *parts_dir, int n_columns);
+
+/* runs unit (its index in the manifest) of model, with a context checkpointed as checkpoint_interval says, unless
+   its partial is already done.  model's columns have to be built with the manifest's motif_names and
+   start_probs_only.  the partial is written under a temporary name and renamed into place, so a worker
+   that dies leaves nothing behind to be mistaken for a result.
+*/
+void run_shard_unit(shard_manifest_struct *manifest, int unit, char *parts_dir, compete_model_struct *model, int checkpoint_interval);
+
+/* writes one block per region and parameter set, in manifest order, stitched from the partials in parts_dir.
+   returns the number of units without a done partial, listing each on stderr; nothing is written unless that's 0.
+   partials whose columns differ from the track's first are refused.
+*/
+int merge_shards(shard_manifest_struct *manifest, char *parts_dir, posterior_writer_struct *writer);
+
+#endif
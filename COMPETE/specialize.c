@@ -0,0 +1,331 @@
+#include "bc.h"
+#include <dlfcn.h>
+#include <sys/wait.h>
+#include <errno.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+/* model-specialized row kernels: update_normal_row()'s loops over the normal states written out for one model's
+   topology, with every state, parent, child and edge index a constant.  chains of states each fed by the state
+   before it (motifs, nucleosome padding) become plain loops the compiler can vectorize; any other state is one
+   expression.  probabilities are still read at run time from the edge pool and the per-symbol tables, so parameter
+   sets and training change them as before, and one kernel serves every clone of the model.  the sums run in the
+   same order as the generic loops and floating point contraction is off, so the rows come out the same, bit for bit.
+   kernels are compiled with the system compiler and cached by a hash of the topology and, where they're built for
+   it, the host CPU.
+*/
+
+// bumped whenever the generated source changes, so older cached kernels no longer match
+#define SPECIALIZED_KERNEL_VERSION 1
+
+// chains shorter than this are written out state by state
+#define SPECIALIZED_MIN_CHAIN 4
+
+// -march=native only where fingerprint_host_cpu() can tell which CPU it built for
+#if defined(__x86_64__) || defined(__i386__)
+#define SPECIALIZED_CFLAGS "-O3 -march=native -ffp-contract=off -fPIC -shared"
+#else
+#define SPECIALIZED_CFLAGS "-O3 -ffp-contract=off -fPIC -shared"
+#endif
+
+// most words $CC and SPECIALIZED_CFLAGS together split into
+#define SPECIALIZED_MAX_ARGS 64
+
+
+// the states the generic loops cover: every normal state but those of the nucleosome kernel
+static void specialized_skip(model_def_struct *model_def, BOOL forward, int *skip_from, int *skip_to) {
+  nucleosome_kernel_struct *kernel = model_def->nuc_kernel;
+
+  if (!kernel) {
+    *skip_from = *skip_to = model_def->silent_states_begin;
+  } else if (forward) {
+    *skip_from = kernel->first_state + 16;
+    *skip_to = kernel->first_state + 16 * kernel->n_positions;
+  } else {
+    *skip_from = kernel->first_state;
+    *skip_to = kernel->first_state + 16 * (kernel->n_positions - 1);
+  }
+}
+
+
+/* folds in the cpuid leaves -march=native resolves the instruction set and tuning from, so a cache directory shared
+   between machines (a home directory on NFS) never hands one host a kernel built for another.  the APIC ID and
+   logical processor count in leaf 1's EBX differ between cores of one machine and are left out
+*/
+static unsigned long fingerprint_host_cpu(unsigned long hash) {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int leaves[] = {0, 1, 7, 0x80000000, 0x80000001}, regs[4];
+  unsigned int max_leaf = __get_cpuid_max(0, NULL), max_extended = __get_cpuid_max(0x80000000, NULL);
+  int i;
+
+  for (i = 0; i < sizeof(leaves) / sizeof(leaves[0]); i++) {
+    if (leaves[i] > (leaves[i] >= 0x80000000 ? max_extended : max_leaf)) continue;
+    __cpuid_count(leaves[i], 0, regs[0], regs[1], regs[2], regs[3]);
+    if (leaves[i] == 1) regs[1] &= 0xffff;
+    hash = fingerprint_bytes(hash, &leaves[i], sizeof(leaves[i]));
+    hash = fingerprint_bytes(hash, regs, sizeof(regs));
+  }
+#endif
+  return hash;
+}
+
+
+unsigned long model_topology_hash(model_def_struct *model_def) {
+  unsigned long hash = 14695981039346656037UL;
+  int header[8], i;
+
+  header[0] = SPECIALIZED_KERNEL_VERSION;
+  header[1] = model_def->n_states;
+  header[2] = model_def->silent_states_begin;
+  header[3] = model_def->n_edges;
+  specialized_skip(model_def, TRUE, header + 4, header + 5);
+  specialized_skip(model_def, FALSE, header + 6, header + 7);
+  hash = fingerprint_bytes(hash, header, sizeof(header));
+  hash = fingerprint_bytes(hash, SPECIALIZED_CFLAGS, strlen(SPECIALIZED_CFLAGS));
+  hash = fingerprint_host_cpu(hash);
+  hash = fingerprint_bytes(hash, model_def->n_parents, sizeof(int) * model_def->n_states);
+  hash = fingerprint_bytes(hash, model_def->n_children, sizeof(int) * model_def->n_states);
+  for (i = 0; i < model_def->n_edges; i++) {
+    hash = fingerprint_bytes(hash, &model_def->parent_edge_pool[i].state, sizeof(int));
+    hash = fingerprint_bytes(hash, &model_def->child_edge_pool[i].state, sizeof(int));
+  }
+  return hash;
+}
+
+
+// TRUE if state is fed by state - 1 alone (forward) or feeds state + 1 alone (backward)
+static BOOL in_chain(model_def_struct *model_def, int state, BOOL forward) {
+  if (forward) return model_def->n_parents[state] == 1 && model_def->parent_edges[state][0].state == state - 1;
+  return model_def->n_children[state] == 1 && model_def->child_edges[state][0].state == state + 1;
+}
+
+
+static void write_specialized_row(FILE *f, model_def_struct *model_def, BOOL forward) {
+  int skip_from, skip_to, i, j, end;
+
+  specialized_skip(model_def, forward, &skip_from, &skip_to);
+  if (forward) fprintf(f, "void compete_forward_row(const PROBABILITY *restrict prev, PROBABILITY *restrict row, const PROBABILITY *restrict em, const edge_struct *restrict e) {\n");
+  else fprintf(f, "void compete_backward_row(const PROBABILITY *restrict next, PROBABILITY *restrict row, const PROBABILITY *restrict w) {\n");
+  fprintf(f, "  int i;\n\n");
+
+  for (i = 0; i < model_def->silent_states_begin; i = end) {
+    if (i == skip_from) {
+      end = skip_to;
+      continue;
+    }
+
+    for (end = i; end < model_def->silent_states_begin && end != skip_from && in_chain(model_def, end, forward); end++);
+    if (end - i >= SPECIALIZED_MIN_CHAIN) {
+      // one edge per state, so the edge index moves along with the state
+      if (forward) fprintf(f, "  for (i = %d; i < %d; i++) row[i] = (prev[i - 1] * e[i + %ld].prob) * em[i];\n", i, end, (long)(model_def->parent_edges[i] - model_def->parent_edge_pool) - i);
+      else fprintf(f, "  for (i = %d; i < %d; i++) row[i] = next[i + 1] * w[i + %ld];\n", i, end, (long)(model_def->child_edges[i] - model_def->child_edge_pool) - i);
+      continue;
+    }
+
+    end = i + 1;
+    if (forward) {
+      long base = model_def->parent_edges[i] - model_def->parent_edge_pool;
+      if (model_def->n_parents[i] == 0) {
+        fprintf(f, "  row[%d] = 0 * em[%d];\n", i, i);
+        continue;
+      }
+      fprintf(f, "  row[%d] = (", i);
+      for (j = 0; j < model_def->n_parents[i]; j++) fprintf(f, "%sprev[%d] * e[%ld].prob", j ? " + " : "", model_def->parent_edges[i][j].state, base + j);
+      fprintf(f, ") * em[%d];\n", i);
+    } else {
+      long base = model_def->child_edges[i] - model_def->child_edge_pool;
+      if (model_def->n_children[i] == 0) {
+        fprintf(f, "  row[%d] = 0;\n", i);
+        continue;
+      }
+      fprintf(f, "  row[%d] = ", i);
+      for (j = 0; j < model_def->n_children[i]; j++) fprintf(f, "%snext[%d] * w[%ld]", j ? " + " : "", model_def->child_edges[i][j].state, base + j);
+      fprintf(f, ";\n");
+    }
+  }
+  fprintf(f, "}\n\n");
+}
+
+
+void write_specialized_kernel(FILE *f, model_def_struct *model_def, unsigned long topology) {
+  fprintf(f, "// generated by compete for one model topology; see specialize.c\n");
+  fprintf(f, "#define PROBABILITY double\n\n");
+  fprintf(f, "typedef struct {\n  int state;\n  PROBABILITY prob;\n} edge_struct;\n\n");
+  fprintf(f, "unsigned long compete_kernel_topology(void) {\n  return %luUL;\n}\n\n", topology);
+  write_specialized_row(f, model_def, TRUE);
+  write_specialized_row(f, model_def, FALSE);
+}
+
+
+/* $COMPETE_KERNEL_CACHE, or compete/ under $XDG_CACHE_HOME or ~/.cache, created 0700 if need be.  kernels found
+   there are loaded and run, so the directory must be the user's own and writable by nobody else; NULL, having said
+   why, if it isn't or there's no home to put it under.  the caller frees it
+*/
+char *specialized_kernel_cache_dir() {
+  char *env, *dir, *p;
+  struct stat st;
+
+  if ((env = getenv("COMPETE_KERNEL_CACHE")) && *env) {
+    dir = strdup(env);
+  } else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+    dir = ALLOC(strlen(env) + 16);
+    sprintf(dir, "%s/compete", env);
+  } else if ((env = getenv("HOME")) && *env) {
+    dir = ALLOC(strlen(env) + 32);
+    sprintf(dir, "%s/.cache/compete", env);
+  } else {
+    fprintf(stderr, "Neither $COMPETE_KERNEL_CACHE nor $HOME is set, so there's nowhere to keep specialized kernels.\n");
+    return NULL;
+  }
+
+  for (p = dir + 1; *p; p++) {
+    if (*p != '/') continue;
+    *p = '\0';
+    mkdir(dir, 0700);
+    *p = '/';
+  }
+  mkdir(dir, 0700);
+
+  if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    fprintf(stderr, "The kernel cache %s is not a directory.\n", dir);
+    free(dir);
+    return NULL;
+  }
+  if (st.st_uid != getuid() || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+    fprintf(stderr, "The kernel cache %s is not owned by this user alone (it must be theirs, and not group or world writable).\n", dir);
+    free(dir);
+    return NULL;
+  }
+  return dir;
+}
+
+
+// splits str at blanks into argv from *argc on
+static void split_words(char *str, char **argv, int *argc) {
+  char *word, *saveptr = NULL;
+
+  for (word = strtok_r(str, " \t", &saveptr); word && *argc < SPECIALIZED_MAX_ARGS; word = strtok_r(NULL, " \t", &saveptr)) argv[(*argc)++] = word;
+}
+
+
+// runs cc (which may carry flags of its own, as $CC can) on source into object without a shell.  TRUE if it succeeds
+static BOOL compile_kernel(char *cc, char *source, char *object) {
+  char *argv[SPECIALIZED_MAX_ARGS + 4], *words = ALLOC(strlen(cc) + strlen(SPECIALIZED_CFLAGS) + 2);
+  int argc = 0, status;
+  pid_t pid;
+
+  sprintf(words, "%s %s", cc, SPECIALIZED_CFLAGS);
+  split_words(words, argv, &argc);
+  argv[argc++] = "-o";
+  argv[argc++] = object;
+  argv[argc++] = source;
+  argv[argc] = NULL;
+
+  if ((pid = fork()) < 0) {
+    free(words);
+    return FALSE;
+  }
+  if (pid == 0) {
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+  free(words);
+  while (waitpid(pid, &status, 0) < 0) {
+    if (errno != EINTR) return FALSE;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+static BOOL load_specialized_kernel(model_def_struct *model_def, char *filename, unsigned long topology) {
+  specialized_kernel_struct *kernel;
+  unsigned long (*kernel_topology)(void);
+  void *handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+
+  if (!handle) return FALSE;
+  kernel_topology = (unsigned long (*)(void))dlsym(handle, "compete_kernel_topology");
+  if (!kernel_topology || kernel_topology() != topology) {
+    dlclose(handle);
+    return FALSE;
+  }
+
+  kernel = ALLOC(sizeof(specialized_kernel_struct));
+  kernel->handle = handle;
+  kernel->topology = topology;
+  kernel->forward = (void (*)(const PROBABILITY *, PROBABILITY *, const PROBABILITY *, const edge_struct *))dlsym(handle, "compete_forward_row");
+  kernel->backward = (void (*)(const PROBABILITY *, PROBABILITY *, const PROBABILITY *))dlsym(handle, "compete_backward_row");
+  if (!kernel->forward || !kernel->backward) {
+    dlclose(handle);
+    free(kernel);
+    return FALSE;
+  }
+  model_def->specialized = kernel;
+  return TRUE;
+}
+
+
+BOOL specialize_model(model_def_struct *model_def) {
+  unsigned long topology;
+  char *dir, *filename, *source, *temporary, *cc;
+  BOOL ok;
+  FILE *f;
+
+  if (!model_def->emission_by_chr || !model_def->child_emission_weights) {
+    fprintf(stderr, "Only finalized models can be specialized.\n");
+    return FALSE;
+  }
+  free_specialized_kernel(model_def);
+
+  topology = model_topology_hash(model_def);
+  if (!(dir = specialized_kernel_cache_dir())) {
+    fprintf(stderr, "Running the generic kernels.\n");
+    return FALSE;
+  }
+  filename = ALLOC(strlen(dir) + 64);
+  sprintf(filename, "%s/kernel_%016lx.so", dir, topology);
+  if (load_specialized_kernel(model_def, filename, topology)) {
+    free(filename);
+    free(dir);
+    return TRUE;
+  }
+
+  // written and compiled under names of this process's own, then renamed, so concurrent runs never see half a kernel
+  source = ALLOC(strlen(dir) + 64);
+  temporary = ALLOC(strlen(dir) + 64);
+  sprintf(source, "%s/kernel_%016lx.%d.c", dir, topology, (int)getpid());
+  sprintf(temporary, "%s/kernel_%016lx.%d.so", dir, topology, (int)getpid());
+  if (!(f = fopen(source, "wx"))) {
+    fprintf(stderr, "Opening %s for writing failed; running the generic kernels.\n", source);
+    free(source);
+    free(temporary);
+    free(filename);
+    free(dir);
+    return FALSE;
+  }
+  write_specialized_kernel(f, model_def, topology);
+  ok = fclose(f) == 0;
+
+  cc = getenv("CC") && *getenv("CC") ? getenv("CC") : "cc";
+  ok = ok && compile_kernel(cc, source, temporary) && rename(temporary, filename) == 0 && load_specialized_kernel(model_def, filename, topology);
+  if (!ok) {
+    fprintf(stderr, "Compiling the specialized kernel failed (%s %s -o %s %s); running the generic kernels.\n", cc, SPECIALIZED_CFLAGS, temporary, source);
+    unlink(temporary);
+  }
+  unlink(source);
+
+  free(source);
+  free(temporary);
+  free(filename);
+  free(dir);
+  return ok;
+}
+
+
+void free_specialized_kernel(model_def_struct *model_def) {
+  if (!model_def->specialized) return;
+
+  dlclose(model_def->specialized->handle);
+  free(model_def->specialized);
+  model_def->specialized = NULL;
+}
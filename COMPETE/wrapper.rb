@@ -65,6 +65,10 @@ if config['fix_positions'] && config['fix_positions'].length > 0
   run_model << " -f #{fix.join(',')}"
 end
 
+run_model << " -p #{config['threads']}" if config['threads']
+run_model << " -w #{config['window']}" if config['window']
+run_model << " -o #{config['window_overlap']}" if config['window_overlap']
+
 if config['output_start_probs_only']
   run_model << " -s"
 end
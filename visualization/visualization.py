@@ -1,5 +1,9 @@
 
 
+import io
+import socket
+import struct
+from os.path import expanduser
 import numpy as np
 import pandas as pd 
 import matplotlib.pyplot as plt
@@ -126,9 +130,63 @@ def plot_dbf_binding(op, dbf_color_map):
         plt.plot(op.coordinate, op.loc[:, dbf], color = dbf_color_map[dbf], label = dbf)
         plt.fill_between(op.coordinate, op.loc[:, dbf], color = dbf_color_map[dbf])
 
-def read_occupancy_profile(file_name):
+def read_binary_occupancy_profile(file_name):
+    '''read the first block of `compete -O binary` output'''
+
+    with open(file_name, 'rb') as f:
+        data = f.read()
+
+    # magic, then version, number of columns, number of rows and label length, in native byte order
+    version, n_columns, n_rows, label_length = struct.unpack_from('=iiqi', data, 8)
+    offset = 28 + label_length
+    names = []
+    for _ in range(n_columns):
+        end = data.index(b'\0', offset)
+        names.append(data[offset:end].decode())
+        offset = end + 1
+    offset += (4 - offset % 4) % 4
+
+    values = np.frombuffer(data, dtype = np.float32, count = n_rows * n_columns, offset = offset)
+    return pd.DataFrame(values.reshape(n_rows, n_columns).astype(np.float64), columns = names)
 
-    return pd.read_csv(file_name, sep = '\t')
+def read_sparse_occupancy_profile(file_name, n_rows):
+    '''read `compete -O sparse` output back into one column per DBF; positions below the threshold become 0'''
+
+    sparse = pd.read_csv(file_name, sep = '\t', comment = '#')
+    op = sparse.pivot(index = 'position', columns = 'dbf', values = 'occupancy')
+    return op.reindex(range(n_rows)).fillna(0.0).reset_index(drop = True)
+
+def read_occupancy_profile(file_name):
+    '''read `compete` output in any of its -O formats.  for batch or sweep runs, only a single block is supported'''
+
+    file_name = expanduser(file_name)
+    with open(file_name, 'rb') as f:
+        if f.read(8) == b'COMPETEp':
+            return read_binary_occupancy_profile(file_name)
+
+    with open(file_name) as f:
+        for line in f:
+            if not line.startswith('#'):
+                break
+            if line.startswith('# sparse, '):
+                return read_sparse_occupancy_profile(file_name, int(line.split()[2]))
+
+    return pd.read_csv(file_name, sep = '\t', comment = '#')
+
+def query_occupancy_profile(socket_path, sequence, begin, end, options = ''):
+    '''ask a running `competed` for the posteriors of a region, as on a seq_filenames line.  options are any of
+    -n, -u, -t and -m, as for compete'''
+
+    with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as s:
+        s.connect(expanduser(socket_path))
+        s.sendall(('%s %d %d %s -O compact\n' % (sequence, begin, end, options)).encode())
+        with s.makefile('rb') as f:
+            status = f.readline().decode().split(None, 1)
+            if status[0] != 'ok':
+                raise IOError('competed: ' + status[1].strip())
+            data = f.read(int(status[1]))
+
+    return pd.read_csv(io.StringIO(data.decode()), sep = '\t', comment = '#')
 
 def plot_occupancy_profile(op, chromo, coordinate_start, padding = 0, threshold = 0.1, figsize=(18,6), orf_annotation = None, macisaac_annotation = None, file_name = None, dbf_color_map = default_dbf_color_map):
     